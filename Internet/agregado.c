@@ -0,0 +1,257 @@
+/**
+ * @file agregado.c
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Celdas de agregacion en memoria compartida. El histograma de cada
+ *        celda es log-lineal: los valores menores que AGR_SUBCUBETAS tienen
+ *        cubeta propia y cada potencia de dos siguiente se parte en
+ *        AGR_SUBCUBETAS cubetas iguales, de modo que el ancho de una cubeta
+ *        es menor que 1/64 de sus valores y el punto medio queda a menos de
+ *        1/128 de cualquiera de ellos.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "agregado.h"
+
+struct agr_celda
+{
+    uint64_t n;
+    int64_t suma, min, max;
+    uint32_t cubeta[AGR_CUBETAS];
+};
+
+struct agr_memoria
+{
+    int grupos;
+    char nombre[AGR_MAX_GRUPOS][DIR_TEXTO_MAX];
+    struct agr_celda celda[AGR_MAX_GRUPOS][TLM_MAGNITUDES];
+};
+
+static struct agr_memoria *memoria = NULL;
+
+/* Nombre y escala (punto fijo) de cada metrica */
+static const struct
+{
+    const char *nombre;
+    int escala;
+} agr_metricas[TLM_MAGNITUDES] = {
+    [TLM_MAG_ID] = {"id", 1},
+    [TLM_MAG_FIRMWARE] = {"firmware", 1},
+    [TLM_MAG_UPTIME] = {"uptime (s)", 1},
+    [TLM_MAG_ARRANQUE] = {"arranque", 1},
+    [TLM_MAG_MEM_TOTAL] = {"memoria total (MB)", 1},
+    [TLM_MAG_MEM_LIBRE] = {"memoria libre (MB)", 1},
+    [TLM_MAG_CPU] = {"cpu (%)", TLM_CPU_ESCALA},
+};
+
+/**
+ * @brief Reserva las celdas en memoria compartida. Se llama en el padre
+ *        antes de derivar sesiones, que heredan el mapeo.
+ *
+ * @return int 0 o -1 en caso de error
+ */
+int agr_iniciar(void)
+{
+    memoria = mmap(NULL, sizeof(*memoria), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memoria == MAP_FAILED)
+    {
+        perror("mmap agregado");
+        memoria = NULL;
+        return -1;
+    }
+    agr_reiniciar();
+    return 0;
+}
+
+/**
+ * @brief Agrega un grupo de satelites.
+ *
+ * @param nombre
+ * @return int indice del grupo, o -1 si no hay lugar
+ */
+int agr_grupo(const char *nombre)
+{
+    if (memoria == NULL || memoria->grupos == AGR_MAX_GRUPOS)
+        return -1;
+    snprintf(memoria->nombre[memoria->grupos], DIR_TEXTO_MAX, "%s", nombre);
+    return memoria->grupos++;
+}
+
+const char *agr_grupo_nombre(int grupo)
+{
+    return memoria != NULL && grupo >= 0 && grupo < memoria->grupos ? memoria->nombre[grupo] : "flota";
+}
+
+int agr_grupos(void)
+{
+    return memoria != NULL ? memoria->grupos : 0;
+}
+
+const char *agr_metrica_nombre(enum tlm_magnitud metrica)
+{
+    return metrica < TLM_MAGNITUDES ? agr_metricas[metrica].nombre : "?";
+}
+
+/**
+ * @brief Cubeta de un valor.
+ *
+ * @param v
+ * @return int
+ */
+static int agr_cubeta(uint64_t v)
+{
+    int e;
+
+    if (v < AGR_SUBCUBETAS)
+        return (int)v;
+    e = 63 - __builtin_clzll(v) - 6; /* v ocupa 7 + e bits: 64 subcubetas de ancho 2^e */
+    if (e >= AGR_EXPONENTES)
+        return AGR_CUBETAS - 1;
+    return AGR_SUBCUBETAS * (e + 1) + (int)((v >> e) & (AGR_SUBCUBETAS - 1));
+}
+
+/**
+ * @brief Punto medio de una cubeta.
+ *
+ * @param i
+ * @return double
+ */
+static double agr_valor(int i)
+{
+    int e = i / AGR_SUBCUBETAS - 1;
+
+    if (e < 0)
+        return i;
+    return (double)((uint64_t)(AGR_SUBCUBETAS + i % AGR_SUBCUBETAS) << e) + (((uint64_t)1 << e) - 1) / 2.0;
+}
+
+/**
+ * @brief Suma un valor a una celda.
+ *
+ * @param c
+ * @param v
+ */
+static void agr_sumar(struct agr_celda *c, int64_t v)
+{
+    int64_t actual;
+
+    if (v < 0)
+        v = 0;
+    __atomic_fetch_add(&c->n, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->suma, v, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->cubeta[agr_cubeta((uint64_t)v)], 1, __ATOMIC_RELAXED);
+    actual = __atomic_load_n(&c->min, __ATOMIC_RELAXED);
+    while (v < actual && !__atomic_compare_exchange_n(&c->min, &actual, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    actual = __atomic_load_n(&c->max, __ATOMIC_RELAXED);
+    while (v > actual && !__atomic_compare_exchange_n(&c->max, &actual, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/**
+ * @brief Suma a su grupo las metricas agregables de una muestra.
+ *
+ * @param grupo
+ * @param m
+ */
+void agr_muestra(int grupo, const struct tlm_muestra *m)
+{
+    if (memoria == NULL || grupo < 0 || grupo >= memoria->grupos)
+        return;
+    for (int i = 0; i < TLM_MAGNITUDES; i++)
+        if ((AGR_METRICAS & m->presentes) & (1u << i))
+            agr_sumar(&memoria->celda[grupo][i], m->valor[i]);
+}
+
+/**
+ * @brief Resume una metrica de un grupo o de toda la flota. Los cuantiles
+ *        salen de recorrer el histograma combinado: el costo depende de la
+ *        cantidad de grupos y cubetas, no de la de satelites o muestras.
+ *
+ * @param grupo indice, o AGR_FLOTA
+ * @param metrica
+ * @param r
+ * @return int 0, o -1 si no hay muestras
+ */
+int agr_consultar(int grupo, enum tlm_magnitud metrica, struct agr_resumen *r)
+{
+    uint64_t cubeta[AGR_CUBETAS];
+    int desde = grupo, hasta = grupo + 1, escala;
+    uint64_t acumulado = 0, rango50, rango99;
+    int64_t suma = 0, min = INT64_MAX, max = INT64_MIN;
+
+    memset(r, 0, sizeof(*r));
+    if (memoria == NULL || metrica >= TLM_MAGNITUDES)
+        return -1;
+    if (grupo == AGR_FLOTA)
+    {
+        desde = 0;
+        hasta = memoria->grupos;
+    }
+    else if (grupo < 0 || grupo >= memoria->grupos)
+        return -1;
+
+    memset(cubeta, 0, sizeof(cubeta));
+    for (int g = desde; g < hasta; g++)
+    {
+        struct agr_celda *c = &memoria->celda[g][metrica];
+        int64_t v;
+        r->n += __atomic_load_n(&c->n, __ATOMIC_RELAXED);
+        suma += __atomic_load_n(&c->suma, __ATOMIC_RELAXED);
+        if ((v = __atomic_load_n(&c->min, __ATOMIC_RELAXED)) < min)
+            min = v;
+        if ((v = __atomic_load_n(&c->max, __ATOMIC_RELAXED)) > max)
+            max = v;
+        for (int i = 0; i < AGR_CUBETAS; i++)
+            cubeta[i] += __atomic_load_n(&c->cubeta[i], __ATOMIC_RELAXED);
+    }
+    if (r->n == 0)
+        return -1;
+
+    escala = agr_metricas[metrica].escala;
+    r->min = (double)min / escala;
+    r->max = (double)max / escala;
+    r->media = (double)suma / r->n / escala;
+    /* Rango (desde 1) de cada cuantil */
+    rango50 = (r->n + 1) / 2;
+    rango99 = r->n - r->n / 100;
+    for (int i = 0; i < AGR_CUBETAS && acumulado < rango99; i++)
+    {
+        if (cubeta[i] == 0)
+            continue;
+        if (acumulado < rango50 && acumulado + cubeta[i] >= rango50)
+            r->p50 = agr_valor(i) / escala;
+        acumulado += cubeta[i];
+        if (acumulado >= rango99)
+            r->p99 = agr_valor(i) / escala;
+    }
+    /* El punto medio de la cubeta no sale del rango observado */
+    r->p50 = r->p50 < r->min ? r->min : r->p50 > r->max ? r->max : r->p50;
+    r->p99 = r->p99 < r->min ? r->min : r->p99 > r->max ? r->max : r->p99;
+    return 0;
+}
+
+/**
+ * @brief Vacia todas las celdas; los grupos se conservan.
+ */
+void agr_reiniciar(void)
+{
+    if (memoria == NULL)
+        return;
+    for (int g = 0; g < AGR_MAX_GRUPOS; g++)
+        for (int i = 0; i < TLM_MAGNITUDES; i++)
+        {
+            struct agr_celda *c = &memoria->celda[g][i];
+            memset(c->cubeta, 0, sizeof(c->cubeta));
+            __atomic_store_n(&c->n, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&c->suma, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&c->min, INT64_MAX, __ATOMIC_RELAXED);
+            __atomic_store_n(&c->max, INT64_MIN, __ATOMIC_RELAXED);
+        }
+}
@@ -0,0 +1,53 @@
+/**
+ * @file agregado.h
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Vista agregada de la telemetria de toda la flota. Cada sesion hija
+ *        suma las muestras de su satelite, a medida que llegan, en la celda
+ *        de su grupo (la direccion de escucha por la que entro) y de cada
+ *        metrica: cantidad, suma, minimo, maximo y un histograma log-lineal
+ *        del que salen los cuantiles con error relativo acotado. Las celdas
+ *        viven en memoria compartida creada por el padre antes de derivar
+ *        las sesiones y se actualizan con operaciones atomicas, sin
+ *        candados. Los histogramas se combinan sumando cubetas, asi que una
+ *        consulta de toda la flota junta un numero fijo de celdas: su costo
+ *        no depende de cuantos satelites informen.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef AGREGADO_H
+#define AGREGADO_H
+
+#include <stdint.h>
+
+#include "compacta.h"
+
+#define AGR_MAX_GRUPOS DIR_MAX_ESCUCHAS
+#define AGR_FLOTA -1          /* grupo de las consultas de toda la flota */
+#define AGR_SUBCUBETAS 64     /* por potencia de dos: error relativo < 1/128 */
+#define AGR_EXPONENTES 35     /* potencias de dos por encima de AGR_SUBCUBETAS, hasta 2^40 */
+#define AGR_CUBETAS (AGR_SUBCUBETAS * (AGR_EXPONENTES + 1))
+
+/* Metricas que se agregan: las que tiene sentido promediar entre satelites */
+#define AGR_METRICAS ((1u << TLM_MAG_FIRMWARE) | (1u << TLM_MAG_UPTIME) | (1u << TLM_MAG_MEM_TOTAL) | \
+                      (1u << TLM_MAG_MEM_LIBRE) | (1u << TLM_MAG_CPU))
+
+struct agr_resumen
+{
+    uint64_t n;
+    double min, max, media;
+    double p50, p99;
+};
+
+int agr_iniciar(void);
+int agr_grupo(const char *);
+const char *agr_grupo_nombre(int);
+int agr_grupos(void);
+const char *agr_metrica_nombre(enum tlm_magnitud);
+void agr_muestra(int, const struct tlm_muestra *);
+int agr_consultar(int, enum tlm_magnitud, struct agr_resumen *);
+void agr_reiniciar(void);
+
+#endif
@@ -0,0 +1,191 @@
+/**
+ * @file ancho.c
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Prueba de ancho de banda: un mismo bucle envia y recibe a la vez
+ *        sobre el flujo, sin bloquear, hasta completar ambos sentidos.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "ancho.h"
+
+static double anc_segundos(const struct timespec *desde)
+{
+    struct timespec ahora;
+
+    clock_gettime(CLOCK_MONOTONIC, &ahora);
+    return (ahora.tv_sec - desde->tv_sec) + (ahora.tv_nsec - desde->tv_nsec) / 1e9;
+}
+
+static double anc_cpu(const struct timeval *t)
+{
+    return t->tv_sec + t->tv_usec / 1e6;
+}
+
+/**
+ * @brief Estado TCP de la conexion de la sesion.
+ *
+ * @param tcp
+ * @param info
+ * @return int 0 o -1 si el socket no lo informa
+ */
+static int anc_tcp(int tcp, struct tcp_info *info)
+{
+    socklen_t largo = sizeof(*info);
+
+    memset(info, 0, sizeof(*info));
+    return getsockopt(tcp, IPPROTO_TCP, TCP_INFO, info, &largo);
+}
+
+/**
+ * @brief Envia y recibe a la vez los bytes de la prueba.
+ *
+ * @param flujo flujo de la orden
+ * @param tcp socket de la sesion, para TCP_INFO
+ * @param enviar bytes a generar
+ * @param recibir bytes que se esperan del otro extremo
+ * @param m recibe la medida
+ * @return int 0, o -1 si el flujo se corto antes de terminar
+ */
+int anc_mover(int flujo, int tcp, uint64_t enviar, uint64_t recibir, struct anc_medida *m)
+{
+    struct timespec inicio;
+    struct rusage antes, despues;
+    struct tcp_info info;
+    struct pollfd p;
+    unsigned char *datos, *descarte;
+    uint32_t retransmisiones, semilla = 0x9E3779B9;
+    int banderas = fcntl(flujo, F_GETFL), r = 0;
+    ssize_t n;
+
+    memset(m, 0, sizeof(*m));
+    if ((datos = malloc(ANC_BLOQUE)) == NULL || (descarte = malloc(ANC_BLOQUE)) == NULL)
+    {
+        perror("malloc");
+        free(datos);
+        return -1;
+    }
+    /* Datos generados: no se comprimen ni se repiten en cada envio */
+    for (size_t i = 0; i < ANC_BLOQUE; i++)
+    {
+        semilla ^= semilla << 13;
+        semilla ^= semilla >> 17;
+        semilla ^= semilla << 5;
+        datos[i] = (unsigned char)semilla;
+    }
+    anc_tcp(tcp, &info);
+    retransmisiones = info.tcpi_total_retrans;
+    getrusage(RUSAGE_SELF, &antes);
+    clock_gettime(CLOCK_MONOTONIC, &inicio);
+    fcntl(flujo, F_SETFL, banderas | O_NONBLOCK);
+
+    p.fd = flujo;
+    while (m->enviados < enviar || m->recibidos < recibir)
+    {
+        p.events = (m->enviados < enviar ? POLLOUT : 0) | (m->recibidos < recibir ? POLLIN : 0);
+        if (poll(&p, 1, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            r = -1;
+            break;
+        }
+        if ((p.revents & (POLLIN | POLLHUP | POLLERR)) && m->recibidos < recibir)
+        {
+            /* Lo que sigue a los datos ya es la medida del otro extremo */
+            size_t largo = recibir - m->recibidos < ANC_BLOQUE ? recibir - m->recibidos : ANC_BLOQUE;
+            n = recv(flujo, descarte, largo, 0);
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+            {
+                r = -1;
+                break;
+            }
+            if (n > 0 && (m->recibidos += n) >= recibir)
+                m->segundos = anc_segundos(&inicio);
+        }
+        if ((p.revents & POLLOUT) && m->enviados < enviar)
+        {
+            size_t largo = enviar - m->enviados < ANC_BLOQUE ? enviar - m->enviados : ANC_BLOQUE;
+            n = send(flujo, datos, largo, MSG_NOSIGNAL);
+            if (n < 0 && errno != EAGAIN && errno != EINTR)
+            {
+                r = -1;
+                break;
+            }
+            if (n > 0)
+                m->enviados += n;
+        }
+    }
+
+    fcntl(flujo, F_SETFL, banderas);
+    m->total = anc_segundos(&inicio);
+    getrusage(RUSAGE_SELF, &despues);
+    m->usuario = anc_cpu(&despues.ru_utime) - anc_cpu(&antes.ru_utime);
+    m->sistema = anc_cpu(&despues.ru_stime) - anc_cpu(&antes.ru_stime);
+    if (anc_tcp(tcp, &info) == 0)
+    {
+        m->retransmisiones = info.tcpi_total_retrans - retransmisiones;
+        m->rtt = info.tcpi_rtt;
+    }
+    free(datos);
+    free(descarte);
+    return r;
+}
+
+/**
+ * @brief Envia una medida al otro extremo.
+ *
+ * @param fd
+ * @param m
+ * @return int 0 o -1
+ */
+int anc_enviar_medida(int fd, const struct anc_medida *m)
+{
+    char texto[ANC_MENSAJE];
+
+    memset(texto, '\0', sizeof(texto));
+    snprintf(texto, sizeof(texto), "%llu %llu %.6f %.6f %.6f %.6f %u %u",
+             (unsigned long long)m->enviados, (unsigned long long)m->recibidos, m->segundos, m->total,
+             m->usuario, m->sistema, m->retransmisiones, m->rtt);
+    return send(fd, texto, sizeof(texto), MSG_NOSIGNAL) == sizeof(texto) ? 0 : -1;
+}
+
+/**
+ * @brief Recibe la medida del otro extremo.
+ *
+ * @param fd
+ * @param m
+ * @return int 0 o -1
+ */
+int anc_recibir_medida(int fd, struct anc_medida *m)
+{
+    char texto[ANC_MENSAJE];
+    unsigned long long enviados, recibidos;
+
+    memset(m, 0, sizeof(*m));
+    if (recv(fd, texto, sizeof(texto), MSG_WAITALL) != sizeof(texto))
+        return -1;
+    texto[sizeof(texto) - 1] = '\0';
+    if (sscanf(texto, "%llu %llu %lf %lf %lf %lf %u %u", &enviados, &recibidos, &m->segundos, &m->total,
+               &m->usuario, &m->sistema, &m->retransmisiones, &m->rtt) != 8)
+        return -1;
+    m->enviados = enviados;
+    m->recibidos = recibidos;
+    return 0;
+}
@@ -0,0 +1,49 @@
+/**
+ * @file ancho.h
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Prueba de ancho de banda entre estacion y satelite sobre el mismo
+ *        transporte de la sesion: un flujo masivo del multiplexor. Los datos
+ *        se generan en memoria y el receptor los descarta, asi que la prueba
+ *        no toca el disco: si una transferencia real rinde menos que esto, el
+ *        problema no es el enlace. Cada extremo mide lo que recibio, el tiempo
+ *        hasta el ultimo byte, la CPU que uso el proceso (incluido el hilo
+ *        del multiplexor) y las retransmisiones de su lado de la conexion TCP
+ *        segun TCP_INFO.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef ANCHO_H
+#define ANCHO_H
+
+#include <stdint.h>
+
+#define ANC_BLOQUE (64 * 1024) /* bytes por envio y por lectura */
+#define ANC_MENSAJE 128        /* pedido y medida, en texto de largo fijo */
+#define ANC_MB (1024 * 1024)
+
+/*
+ * Secuencia de una prueba, por el flujo de la orden:
+ *   estacion -> pedido: "<bytes de bajada> <bytes de subida>"
+ *   ambos    -> los datos de cada sentido, a la vez
+ *   satelite -> su medida (ver anc_enviar_medida)
+ */
+
+/* Medida de un extremo */
+struct anc_medida
+{
+    uint64_t enviados, recibidos;
+    double segundos;          /* desde el inicio hasta el ultimo byte recibido */
+    double total;             /* duracion de la prueba en este extremo */
+    double usuario, sistema;  /* CPU del proceso, s */
+    uint32_t retransmisiones; /* segmentos que este extremo retransmitio */
+    uint32_t rtt;             /* us, estimado por TCP al final */
+};
+
+int anc_mover(int, int, uint64_t, uint64_t, struct anc_medida *);
+int anc_enviar_medida(int, const struct anc_medida *);
+int anc_recibir_medida(int, struct anc_medida *);
+
+#endif
@@ -0,0 +1,165 @@
+/**
+ * @file bench_agregado.c
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Mide la vista agregada de la flota con muchos satelites: varios
+ *        procesos, como las sesiones de la estacion, suman muestras de CPU
+ *        de sus satelites a la memoria compartida, y luego se mide cuanto
+ *        tarda la consulta de toda la flota y cuanto se alejan sus cuantiles
+ *        de los exactos. Se repite con cantidades crecientes de satelites:
+ *        el tiempo de consulta no deberia cambiar.
+ *        Uso: ./bench_agregado [satelites] [muestras por satelite]
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "agregado.h"
+
+#define SATELITES 50000
+#define MUESTRAS 20
+#define GRUPOS 4
+#define PROCESOS 4
+#define CONSULTAS 1000
+
+void alimentar(int, int, int, int64_t *);
+int64_t valor(unsigned int, int);
+double segundos(struct timespec *);
+int comparar(const void *, const void *);
+
+int main(int argc, char *argv[])
+{
+    struct agr_resumen r;
+    struct timespec inicio;
+    char nombre[16];
+    int satelites = argc > 1 ? atoi(argv[1]) : SATELITES;
+    int muestras = argc > 2 ? atoi(argv[2]) : MUESTRAS;
+
+    if (satelites <= 0 || muestras <= 0 || agr_iniciar() < 0)
+    {
+        fprintf(stderr, "Uso: %s [satelites] [muestras por satelite]\n", argv[0]);
+        exit(1);
+    }
+    for (int g = 0; g < GRUPOS; g++)
+    {
+        snprintf(nombre, sizeof(nombre), "grupo %d", g);
+        agr_grupo(nombre);
+    }
+
+    for (int k = 100; k >= 1; k /= 10)
+    {
+        int n = satelites / k;
+        if (n == 0)
+            continue;
+        int64_t *valores = malloc((size_t)n * muestras * sizeof(int64_t));
+        if (valores == NULL)
+        {
+            perror("malloc");
+            exit(1);
+        }
+        agr_reiniciar();
+
+        clock_gettime(CLOCK_MONOTONIC, &inicio);
+        for (int p = 0; p < PROCESOS; p++)
+        {
+            pid_t pid = fork();
+            if (pid < 0)
+            {
+                perror("fork");
+                exit(1);
+            }
+            if (pid == 0)
+            {
+                alimentar(p, n, muestras, NULL);
+                _exit(0);
+            }
+        }
+        while (wait(NULL) > 0)
+            ;
+        double carga = segundos(&inicio);
+
+        clock_gettime(CLOCK_MONOTONIC, &inicio);
+        for (int c = 0; c < CONSULTAS; c++)
+            agr_consultar(AGR_FLOTA, TLM_MAG_CPU, &r);
+        double consulta = segundos(&inicio) / CONSULTAS;
+
+        /* Cuantiles exactos, con las mismas muestras */
+        for (int p = 0; p < PROCESOS; p++)
+            alimentar(p, n, muestras, valores);
+        qsort(valores, (size_t)n * muestras, sizeof(int64_t), comparar);
+        size_t total = (size_t)n * muestras;
+        double p50 = (double)valores[(total + 1) / 2 - 1] / TLM_CPU_ESCALA;
+        double p99 = (double)valores[total - total / 100 - 1] / TLM_CPU_ESCALA;
+
+        printf("%6d satelites, %8llu muestras: carga %.0f muestras/s, consulta %.1f us, "
+               "p50 %.3f (exacto %.3f, %.2f%%), p99 %.3f (exacto %.3f, %.2f%%)\n",
+               n, (unsigned long long)r.n, r.n / carga, consulta * 1e6,
+               r.p50, p50, 100 * (r.p50 - p50) / p50, r.p99, p99, 100 * (r.p99 - p99) / p99);
+        free(valores);
+    }
+    return 0;
+}
+
+/**
+ * @brief Muestras de los satelites que le tocan a un proceso. Con destino
+ *        las copia en vez de sumarlas, para calcular los cuantiles exactos.
+ *
+ * @param proceso
+ * @param satelites
+ * @param muestras
+ * @param destino NULL para sumarlas a la vista agregada
+ */
+void alimentar(int proceso, int satelites, int muestras, int64_t *destino)
+{
+    struct tlm_muestra m;
+
+    memset(&m, 0, sizeof(m));
+    m.presentes = 1u << TLM_MAG_CPU;
+    for (int s = proceso; s < satelites; s += PROCESOS)
+        for (int i = 0; i < muestras; i++)
+        {
+            m.valor[TLM_MAG_CPU] = valor((unsigned int)s, i);
+            if (destino != NULL)
+                destino[(size_t)s * muestras + i] = m.valor[TLM_MAG_CPU];
+            else
+                agr_muestra(s % GRUPOS, &m);
+        }
+}
+
+/**
+ * @brief CPU de un satelite en una muestra: cada satelite tiene su carga
+ *        base y varia alrededor de ella. Determinista, para repetirla.
+ *
+ * @param satelite
+ * @param muestra
+ * @return int64_t en punto fijo, TLM_CPU_ESCALA por punto porcentual
+ */
+int64_t valor(unsigned int satelite, int muestra)
+{
+    unsigned int semilla = satelite * 2654435761u;
+    int base = (int)(rand_r(&semilla) % 90) + 1;
+
+    semilla += (unsigned int)muestra;
+    return (int64_t)base * TLM_CPU_ESCALA + rand_r(&semilla) % (10 * TLM_CPU_ESCALA);
+}
+
+double segundos(struct timespec *desde)
+{
+    struct timespec ahora;
+
+    clock_gettime(CLOCK_MONOTONIC, &ahora);
+    return (ahora.tv_sec - desde->tv_sec) + (ahora.tv_nsec - desde->tv_nsec) / 1e9;
+}
+
+int comparar(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
@@ -0,0 +1,244 @@
+/**
+ * @file bench_control.c
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Mide la latencia de mensajes de control mientras la conexion esta
+ *        saturada por transferencias masivas. Levanta dos multiplexores sobre
+ *        una conexion TCP local, llena la conexion con flujos masivos y hace
+ *        ida y vuelta de mensajes cortos por otro flujo, primero en la clase
+ *        masiva (sin prioridad) y despues en la clase de control.
+ *        Uso: ./bench_control [MB/s] [mensajes]. Con MB/s se limita el ritmo
+ *        de envio de la conexion (SO_MAX_PACING_RATE) para emular el enlace.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "multiplexor.h"
+
+#define FLUJOS_MASIVOS 2
+#define MENSAJE_LEN 64
+#define MENSAJES 2000
+
+static volatile int corriendo;
+
+void conectar_Local(int *, int *, unsigned int);
+void *hilo_Llenar(void *);
+void *hilo_Drenar(void *);
+void medir(struct mux *, struct mux *, enum mux_clase, int);
+double *ordenar(double *, int);
+int comparar(const void *, const void *);
+
+int main(int argc, char *argv[])
+{
+    unsigned int tasa = 0;
+    int mensajes = MENSAJES;
+    int estacion, satelite;
+
+    if (argc > 1)
+        tasa = (unsigned int)(atof(argv[1]) * 1024 * 1024);
+    if (argc > 2)
+        mensajes = atoi(argv[2]);
+    if (mensajes <= 0)
+    {
+        fprintf(stderr, "Uso: %s [MB/s] [mensajes]\n", argv[0]);
+        exit(1);
+    }
+
+    conectar_Local(&estacion, &satelite, tasa);
+    struct mux *origen = mux_crear(estacion, 1);
+    struct mux *destino = mux_crear(satelite, 0);
+    if (origen == NULL || destino == NULL)
+        exit(1);
+
+    /* Flujos masivos que mantienen la conexion llena durante toda la medicion */
+    pthread_t hilos[2 * FLUJOS_MASIVOS];
+    int extremos[2 * FLUJOS_MASIVOS];
+    char servicio[MUX_SERVICIO];
+    corriendo = 1;
+    for (int i = 0; i < FLUJOS_MASIVOS; i++)
+    {
+        extremos[2 * i] = mux_abrir(origen, "masivo", MUX_MASIVO, 1);
+        extremos[2 * i + 1] = mux_aceptar(destino, servicio, sizeof(servicio));
+        if (extremos[2 * i] < 0 || extremos[2 * i + 1] < 0)
+        {
+            fprintf(stderr, "No se pudo abrir el flujo masivo\n");
+            exit(1);
+        }
+        pthread_create(&hilos[2 * i], NULL, hilo_Llenar, &extremos[2 * i]);
+        pthread_create(&hilos[2 * i + 1], NULL, hilo_Drenar, &extremos[2 * i + 1]);
+    }
+    /* Deja que las colas se llenen antes de medir */
+    usleep(200000);
+
+    printf("Conexion local %s, %d flujos masivos, %d mensajes de %d bytes\n",
+           tasa ? "limitada" : "sin limite", FLUJOS_MASIVOS, mensajes, MENSAJE_LEN);
+    if (tasa)
+        printf("Ritmo de envio: %.1f MB/s\n", tasa / (1024.0 * 1024.0));
+    medir(origen, destino, MUX_MASIVO, mensajes);
+    medir(origen, destino, MUX_CONTROL, mensajes);
+
+    corriendo = 0;
+    for (int i = 0; i < FLUJOS_MASIVOS; i++)
+        shutdown(extremos[2 * i], SHUT_WR);
+    for (int i = 0; i < 2 * FLUJOS_MASIVOS; i++)
+    {
+        pthread_join(hilos[i], NULL);
+        close(extremos[i]);
+    }
+    mux_cerrar(origen);
+    mux_cerrar(destino);
+    return 0;
+}
+
+/**
+ * @brief Crea una conexion TCP por la interfaz local y devuelve sus dos
+ *        extremos.
+ *
+ * @param estacion Extremo que conecta.
+ * @param satelite Extremo aceptado.
+ * @param tasa Ritmo maximo de envio en bytes por segundo (0 sin limite).
+ */
+void conectar_Local(int *estacion, int *satelite, unsigned int tasa)
+{
+    struct sockaddr_in direccion;
+    socklen_t largo = sizeof(direccion);
+    int escucha = socket(AF_INET, SOCK_STREAM, 0);
+
+    memset(&direccion, 0, sizeof(direccion));
+    direccion.sin_family = AF_INET;
+    direccion.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (escucha < 0 || bind(escucha, (struct sockaddr *)&direccion, sizeof(direccion)) < 0 ||
+        listen(escucha, 1) < 0 || getsockname(escucha, (struct sockaddr *)&direccion, &largo) < 0)
+    {
+        perror("escucha");
+        exit(1);
+    }
+    *estacion = socket(AF_INET, SOCK_STREAM, 0);
+    if (*estacion < 0 || connect(*estacion, (struct sockaddr *)&direccion, sizeof(direccion)) < 0)
+    {
+        perror("conexion");
+        exit(1);
+    }
+    *satelite = accept(escucha, NULL, NULL);
+    if (*satelite < 0)
+    {
+        perror("accept");
+        exit(1);
+    }
+    close(escucha);
+
+    /* El ritmo se aplica en los dos sentidos: datos y creditos */
+    if (tasa && (setsockopt(*estacion, SOL_SOCKET, SO_MAX_PACING_RATE, &tasa, sizeof(tasa)) < 0 ||
+                 setsockopt(*satelite, SOL_SOCKET, SO_MAX_PACING_RATE, &tasa, sizeof(tasa)) < 0))
+        perror("SO_MAX_PACING_RATE");
+}
+
+/**
+ * @brief Escribe en un flujo masivo hasta que termine la medicion.
+ *
+ * @param arg Puntero al descriptor del flujo.
+ * @return void* NULL.
+ */
+void *hilo_Llenar(void *arg)
+{
+    static char bloque[64 * 1024];
+    int fd = *(int *)arg;
+
+    while (corriendo)
+        if (write(fd, bloque, sizeof(bloque)) <= 0)
+            break;
+    return NULL;
+}
+
+/**
+ * @brief Lee y descarta lo que llega por un flujo masivo hasta el fin.
+ *
+ * @param arg Puntero al descriptor del flujo.
+ * @return void* NULL.
+ */
+void *hilo_Drenar(void *arg)
+{
+    char bloque[64 * 1024];
+    int fd = *(int *)arg;
+
+    while (read(fd, bloque, sizeof(bloque)) > 0)
+        ;
+    return NULL;
+}
+
+/**
+ * @brief Hace ida y vuelta de mensajes cortos por un flujo nuevo de la clase
+ *        indicada e informa la distribucion de latencias.
+ *
+ * @param origen Multiplexor que abre el flujo.
+ * @param destino Multiplexor que lo acepta y devuelve cada mensaje.
+ * @param clase Clase de prioridad del flujo medido.
+ * @param mensajes Cantidad de idas y vueltas.
+ */
+void medir(struct mux *origen, struct mux *destino, enum mux_clase clase, int mensajes)
+{
+    char mensaje[MENSAJE_LEN], servicio[MUX_SERVICIO];
+    struct timespec inicio, fin;
+    double *muestras = malloc(mensajes * sizeof(double));
+    int ida = mux_abrir(origen, "control", clase, 1);
+    int vuelta = mux_aceptar(destino, servicio, sizeof(servicio));
+
+    if (muestras == NULL || ida < 0 || vuelta < 0)
+    {
+        fprintf(stderr, "No se pudo abrir el flujo medido\n");
+        exit(1);
+    }
+    memset(mensaje, 'c', sizeof(mensaje));
+    for (int i = 0; i < mensajes; i++)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &inicio);
+        if (write(ida, mensaje, sizeof(mensaje)) != sizeof(mensaje) ||
+            recv(vuelta, mensaje, sizeof(mensaje), MSG_WAITALL) != sizeof(mensaje) ||
+            write(vuelta, mensaje, sizeof(mensaje)) != sizeof(mensaje) ||
+            recv(ida, mensaje, sizeof(mensaje), MSG_WAITALL) != sizeof(mensaje))
+        {
+            perror("mensaje");
+            exit(1);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &fin);
+        muestras[i] = (fin.tv_sec - inicio.tv_sec) * 1e3 + (fin.tv_nsec - inicio.tv_nsec) / 1e6;
+    }
+    ordenar(muestras, mensajes);
+    printf("%-8s p50 %8.3f ms  p99 %8.3f ms  max %8.3f ms\n",
+           clase == MUX_CONTROL ? "control" : "masivo",
+           muestras[mensajes / 2], muestras[(mensajes * 99) / 100], muestras[mensajes - 1]);
+
+    close(ida);
+    close(vuelta);
+    free(muestras);
+}
+
+/**
+ * @brief Ordena las muestras de menor a mayor.
+ *
+ * @param muestras Latencias en milisegundos.
+ * @param n Cantidad de muestras.
+ * @return double* Las mismas muestras, ordenadas.
+ */
+double *ordenar(double *muestras, int n)
+{
+    qsort(muestras, n, sizeof(double), comparar);
+    return muestras;
+}
+
+int comparar(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
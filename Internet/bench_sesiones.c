@@ -0,0 +1,247 @@
+/**
+ * @file bench_sesiones.c
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Mide cuanto ocupa una sesion en reposo y cuantos pedidos atiende un
+ *        solo hilo cuando las sesiones son corrutinas del reactor. Crea las
+ *        sesiones sobre pares de sockets locales, cada una suspendida
+ *        esperando su pedido como lo hacen los comandos cortos del satelite,
+ *        y un hilo aparte hace de estacion: escribe pedidos a sesiones al
+ *        azar, de a lotes, y espera cada respuesta.
+ *        Uso: ./bench_sesiones [sesiones] [pedidos]
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#include "reactor.h"
+
+#define SESIONES 5000
+#define PEDIDOS 200000
+#define LOTE 64
+#define RESPUESTA_LEN 32
+
+/* Sesion de prueba: lo unico que conserva entre pedidos */
+struct sesion
+{
+    struct tarea tarea;
+    int fd;
+    uint32_t id;
+    uint32_t atendidos;
+};
+
+struct estacion
+{
+    int *extremos;
+    int sesiones;
+    int pedidos;
+    double segundos;
+    double *latencias;
+};
+
+int atender(struct tarea *);
+void *hilo_Estacion(void *);
+long residente(void);
+int comparar(const void *, const void *);
+
+int main(int argc, char *argv[])
+{
+    struct estacion estacion;
+    struct rlimit limite;
+    struct reactor *reactor = reactor_crear();
+    pthread_t hilo;
+    int sesiones = argc > 1 ? atoi(argv[1]) : SESIONES;
+    int pedidos = argc > 2 ? atoi(argv[2]) : PEDIDOS;
+    long antes, despues;
+    int par[2];
+
+    if (sesiones <= 0 || pedidos <= 0 || reactor == NULL)
+    {
+        fprintf(stderr, "Uso: %s [sesiones] [pedidos]\n", argv[0]);
+        exit(1);
+    }
+    /* Dos descriptores por sesion */
+    getrlimit(RLIMIT_NOFILE, &limite);
+    limite.rlim_cur = limite.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limite);
+
+    estacion.extremos = malloc(sesiones * sizeof(int));
+    estacion.latencias = malloc(pedidos * sizeof(double));
+    int *internos = malloc(sesiones * sizeof(int));
+    if (estacion.extremos == NULL || estacion.latencias == NULL || internos == NULL)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    for (int i = 0; i < sesiones; i++)
+    {
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, par) < 0)
+        {
+            perror("socketpair");
+            exit(1);
+        }
+        estacion.extremos[i] = par[0];
+        internos[i] = par[1];
+    }
+
+    /* Solo se cuenta lo que agregan las sesiones, no los sockets */
+    antes = residente();
+    for (int i = 0; i < sesiones; i++)
+    {
+        struct sesion *s = malloc(sizeof(*s));
+        if (s == NULL)
+        {
+            perror("malloc");
+            exit(1);
+        }
+        s->fd = internos[i];
+        s->id = i;
+        s->atendidos = 0;
+        reactor_iniciar(reactor, &s->tarea, atender);
+    }
+    despues = residente();
+    printf("%d sesiones en reposo en un hilo: %ld bytes residentes por sesion (estructura %zu bytes)\n",
+           reactor_tareas(reactor), (despues - antes) / sesiones, sizeof(struct sesion));
+
+    estacion.sesiones = sesiones;
+    estacion.pedidos = pedidos;
+    if (pthread_create(&hilo, NULL, hilo_Estacion, &estacion) != 0)
+    {
+        perror("pthread_create");
+        exit(1);
+    }
+    reactor_correr(reactor);
+    pthread_join(hilo, NULL);
+
+    qsort(estacion.latencias, pedidos, sizeof(double), comparar);
+    printf("%d pedidos en %.2f s: %.0f pedidos/s, lote %d, p50 %.3f ms, p99 %.3f ms\n",
+           pedidos, estacion.segundos, pedidos / estacion.segundos, LOTE,
+           estacion.latencias[pedidos / 2], estacion.latencias[(pedidos * 99) / 100]);
+
+    reactor_destruir(reactor);
+    free(internos);
+    free(estacion.extremos);
+    free(estacion.latencias);
+    return 0;
+}
+
+/**
+ * @brief Corrutina de cada sesion: espera un pedido y responde, hasta que
+ *        la estacion cierre su extremo.
+ *
+ * @param t struct sesion
+ * @return int enum reactor_paso
+ */
+int atender(struct tarea *t)
+{
+    struct sesion *s = (struct sesion *)t;
+    char pedido[16], respuesta[RESPUESTA_LEN];
+
+    CO_INICIO(t);
+    for (;;)
+    {
+        CO_ESPERAR(t, s->fd, EPOLLIN, 0);
+        if (read(s->fd, pedido, sizeof(pedido)) <= 0)
+            break;
+        memset(respuesta, 0, sizeof(respuesta));
+        snprintf(respuesta, sizeof(respuesta), "ID satelite: %u", s->id);
+        s->atendidos++;
+        if (write(s->fd, respuesta, sizeof(respuesta)) != sizeof(respuesta))
+            break;
+    }
+    close(s->fd);
+    free(s);
+    CO_FIN(t);
+}
+
+/**
+ * @brief Hace de estacion: manda lotes de pedidos a sesiones al azar y lee
+ *        las respuestas. Al terminar cierra todos los extremos, lo que
+ *        termina cada sesion.
+ *
+ * @param arg struct estacion
+ * @return void* NULL
+ */
+void *hilo_Estacion(void *arg)
+{
+    struct estacion *e = arg;
+    struct timespec inicio, fin, enviado[LOTE];
+    char respuesta[RESPUESTA_LEN];
+    int elegidas[LOTE];
+    unsigned int semilla = 1;
+
+    clock_gettime(CLOCK_MONOTONIC, &inicio);
+    for (int hecho = 0; hecho < e->pedidos;)
+    {
+        int lote = e->pedidos - hecho < LOTE ? e->pedidos - hecho : LOTE;
+        if (lote > e->sesiones)
+            lote = e->sesiones;
+        for (int j = 0; j < lote; j++)
+        {
+            /* Sesiones distintas dentro del lote: cada una tiene un pedido a la vez */
+            elegidas[j] = (int)(rand_r(&semilla) % e->sesiones);
+            for (int k = 0; k < j; k++)
+                if (elegidas[k] == elegidas[j])
+                {
+                    elegidas[j] = (elegidas[j] + 1) % e->sesiones;
+                    k = -1;
+                }
+            clock_gettime(CLOCK_MONOTONIC, &enviado[j]);
+            if (write(e->extremos[elegidas[j]], "telemetria", 10) != 10)
+            {
+                perror("pedido");
+                exit(1);
+            }
+        }
+        for (int j = 0; j < lote; j++)
+        {
+            if (recv(e->extremos[elegidas[j]], respuesta, sizeof(respuesta), MSG_WAITALL) != sizeof(respuesta))
+            {
+                perror("respuesta");
+                exit(1);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &fin);
+            e->latencias[hecho + j] = (fin.tv_sec - enviado[j].tv_sec) * 1e3 +
+                                      (fin.tv_nsec - enviado[j].tv_nsec) / 1e6;
+        }
+        hecho += lote;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &fin);
+    e->segundos = (fin.tv_sec - inicio.tv_sec) + (fin.tv_nsec - inicio.tv_nsec) / 1e9;
+
+    for (int i = 0; i < e->sesiones; i++)
+        close(e->extremos[i]);
+    return NULL;
+}
+
+/**
+ * @brief Memoria residente del proceso, en bytes.
+ *
+ * @return long
+ */
+long residente(void)
+{
+    long paginas = 0, residentes = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+
+    if (f == NULL || fscanf(f, "%ld %ld", &paginas, &residentes) != 2)
+        perror("statm");
+    if (f != NULL)
+        fclose(f);
+    return residentes * sysconf(_SC_PAGESIZE);
+}
+
+int comparar(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
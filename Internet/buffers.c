@@ -0,0 +1,288 @@
+/**
+ * @file buffers.c
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Pool de buffers por clases de tamano (potencias de dos desde
+ *        BUF_MINIMO). Cada clase crece de a un slab: una pagina grande de
+ *        BUF_SLAB repartida entre varios buffers, o un slab propio para las
+ *        clases de BUF_SLAB o mas. Los slabs no se devuelven al sistema: los
+ *        buffers sueltos quedan en la cache del hilo que los solto y, cuando
+ *        esta se llena o el hilo termina, en la lista global de su clase.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "buffers.h"
+
+/* Libres que guarda cada hilo, sin candado */
+struct buf_cache
+{
+    struct buffer *libres[BUF_CLASES][BUF_CACHE_HILO];
+    int n[BUF_CLASES];
+};
+
+static struct buffer *libres[BUF_CLASES];
+static pthread_mutex_t buf_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct buf_estadisticas contadores;
+static const char *implementacion = "paginas normales";
+
+static __thread struct buf_cache cache_hilo;
+static __thread int cache_registrada = 0;
+static pthread_key_t clave_cache;
+static pthread_once_t clave_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Devuelve a las listas globales lo que guardaba un hilo que termina.
+ *
+ * @param arg struct buf_cache del hilo
+ */
+static void buf_vaciar_cache(void *arg)
+{
+    struct buf_cache *cache = arg;
+
+    pthread_mutex_lock(&buf_mutex);
+    for (int c = 0; c < BUF_CLASES; c++)
+    {
+        while (cache->n[c] > 0)
+        {
+            struct buffer *b = cache->libres[c][--cache->n[c]];
+            b->siguiente = libres[c];
+            libres[c] = b;
+        }
+    }
+    pthread_mutex_unlock(&buf_mutex);
+}
+
+static void buf_crear_clave(void)
+{
+    pthread_key_create(&clave_cache, buf_vaciar_cache);
+}
+
+/**
+ * @brief Asocia la cache del hilo a la clave cuyo destructor la vacia.
+ */
+static void buf_registrar_hilo(void)
+{
+    if (cache_registrada)
+        return;
+    pthread_once(&clave_once, buf_crear_clave);
+    pthread_setspecific(clave_cache, &cache_hilo);
+    cache_registrada = 1;
+}
+
+/**
+ * @brief Clase de un tamano pedido.
+ *
+ * @param tamano
+ * @return int -1 si supera BUF_MAXIMO
+ */
+static int buf_clase(size_t tamano)
+{
+    size_t capacidad = BUF_MINIMO;
+    int c = 0;
+
+    while (capacidad < tamano && c < BUF_CLASES)
+    {
+        capacidad <<= 1;
+        c++;
+    }
+    return c < BUF_CLASES ? c : -1;
+}
+
+/**
+ * @brief Pide memoria al sistema: huge pages reservadas si las hay; si no,
+ *        una region alineada a BUF_SLAB marcada para paginas grandes
+ *        transparentes. Se llama con el candado tomado.
+ *
+ * @param largo multiplo de BUF_SLAB
+ * @return char* NULL si no hay memoria
+ */
+static char *buf_reservar(size_t largo)
+{
+    char *p = mmap(NULL, largo, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    uintptr_t inicio;
+    size_t antes;
+
+    if (p != MAP_FAILED)
+    {
+        implementacion = "huge pages";
+        contadores.slabs++;
+        contadores.bytes += largo;
+        return p;
+    }
+    p = mmap(NULL, largo + BUF_SLAB, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+    {
+        perror("mmap pool");
+        return NULL;
+    }
+    inicio = ((uintptr_t)p + BUF_SLAB - 1) & ~(uintptr_t)(BUF_SLAB - 1);
+    antes = inicio - (uintptr_t)p;
+    if (antes > 0)
+        munmap(p, antes);
+    munmap((char *)inicio + largo, BUF_SLAB - antes);
+    if (madvise((char *)inicio, largo, MADV_HUGEPAGE) == 0 && implementacion[0] != 'h')
+        implementacion = "paginas grandes transparentes";
+    contadores.slabs++;
+    contadores.bytes += largo;
+    return (char *)inicio;
+}
+
+/**
+ * @brief Agrega un slab a la clase. Se llama con el candado tomado.
+ *
+ * @param c
+ * @return int 0, o -1 si no hay memoria
+ */
+static int buf_crecer(int c)
+{
+    size_t capacidad = (size_t)BUF_MINIMO << c;
+    size_t largo = capacidad < BUF_SLAB ? BUF_SLAB : capacidad;
+    size_t n = largo / capacidad;
+    struct buffer *b = calloc(n, sizeof(*b));
+    char *slab;
+
+    if (b == NULL || (slab = buf_reservar(largo)) == NULL)
+    {
+        free(b);
+        return -1;
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        b[i].datos = slab + i * capacidad;
+        b[i].tamano = capacidad;
+        b[i].clase = c;
+        b[i].siguiente = libres[c];
+        libres[c] = &b[i];
+    }
+    return 0;
+}
+
+/**
+ * @brief Obtiene un buffer de al menos tamano bytes, con una referencia.
+ *        Los mayores que BUF_MAXIMO se piden y devuelven al sistema cada vez.
+ *
+ * @param tamano
+ * @return struct buffer* NULL si no hay memoria
+ */
+struct buffer *buf_obtener(size_t tamano)
+{
+    int c = buf_clase(tamano);
+    struct buffer *b = NULL;
+
+    __atomic_add_fetch(&contadores.pedidos, 1, __ATOMIC_RELAXED);
+    if (c < 0)
+    {
+        size_t largo = (tamano + BUF_SLAB - 1) & ~(size_t)(BUF_SLAB - 1);
+        if ((b = calloc(1, sizeof(*b))) == NULL)
+            return NULL;
+        pthread_mutex_lock(&buf_mutex);
+        b->datos = buf_reservar(largo);
+        contadores.fuera++;
+        pthread_mutex_unlock(&buf_mutex);
+        if (b->datos == NULL)
+        {
+            free(b);
+            return NULL;
+        }
+        b->tamano = largo;
+        b->clase = -1;
+        b->refs = 1;
+        return b;
+    }
+
+    buf_registrar_hilo();
+    if (cache_hilo.n[c] > 0)
+    {
+        b = cache_hilo.libres[c][--cache_hilo.n[c]];
+        __atomic_add_fetch(&contadores.del_hilo, 1, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        pthread_mutex_lock(&buf_mutex);
+        if (libres[c] != NULL || buf_crecer(c) == 0)
+        {
+            b = libres[c];
+            libres[c] = b->siguiente;
+        }
+        pthread_mutex_unlock(&buf_mutex);
+        if (b == NULL)
+            return NULL;
+    }
+    b->siguiente = NULL;
+    b->refs = 1;
+    return b;
+}
+
+/**
+ * @brief Agrega una referencia: el buffer no vuelve al pool hasta que cada
+ *        duenio lo suelte.
+ *
+ * @param b
+ * @return struct buffer* el mismo buffer
+ */
+struct buffer *buf_retener(struct buffer *b)
+{
+    __atomic_add_fetch(&b->refs, 1, __ATOMIC_RELAXED);
+    return b;
+}
+
+/**
+ * @brief Quita una referencia. Con la ultima, el buffer vuelve a la cache
+ *        del hilo que lo suelta, o a la lista global si esta llena.
+ *
+ * @param b puede ser NULL
+ */
+void buf_soltar(struct buffer *b)
+{
+    if (b == NULL || __atomic_sub_fetch(&b->refs, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+    if (b->clase < 0)
+    {
+        munmap(b->datos, b->tamano);
+        free(b);
+        return;
+    }
+    buf_registrar_hilo();
+    if (cache_hilo.n[b->clase] < BUF_CACHE_HILO)
+    {
+        cache_hilo.libres[b->clase][cache_hilo.n[b->clase]++] = b;
+        return;
+    }
+    pthread_mutex_lock(&buf_mutex);
+    b->siguiente = libres[b->clase];
+    libres[b->clase] = b;
+    pthread_mutex_unlock(&buf_mutex);
+}
+
+/**
+ * @brief Copia los contadores del pool.
+ *
+ * @param e
+ */
+void buf_estadisticas(struct buf_estadisticas *e)
+{
+    pthread_mutex_lock(&buf_mutex);
+    *e = contadores;
+    pthread_mutex_unlock(&buf_mutex);
+    e->pedidos = __atomic_load_n(&contadores.pedidos, __ATOMIC_RELAXED);
+    e->del_hilo = __atomic_load_n(&contadores.del_hilo, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Tipo de pagina que respalda los slabs reservados hasta ahora.
+ *
+ * @return const char*
+ */
+const char *buf_implementacion(void)
+{
+    return implementacion;
+}
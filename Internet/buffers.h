@@ -0,0 +1,52 @@
+/**
+ * @file buffers.h
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Pool de buffers grandes compartido por transferencias y flujos.
+ *        Los buffers salen de slabs de paginas grandes (huge pages, o
+ *        paginas transparentes si el sistema no tiene reservadas), estan
+ *        alineados a BUF_ALINEACION, cuentan referencias y vuelven al pool al
+ *        soltar la ultima. Cada hilo guarda algunos libres por clase para no
+ *        tomar el candado global; en regimen no se pide memoria al sistema.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef BUFFERS_H
+#define BUFFERS_H
+
+#include <stddef.h>
+
+#define BUF_MINIMO (64 * 1024)            /* capacidad de la clase mas chica */
+#define BUF_CLASES 7                      /* 64 KB, 128 KB, ... 4 MB */
+#define BUF_MAXIMO (BUF_MINIMO << (BUF_CLASES - 1))
+#define BUF_SLAB (2 * 1024 * 1024)        /* una pagina grande: se reparte entre buffers chicos */
+#define BUF_ALINEACION 4096
+#define BUF_CACHE_HILO 4                  /* libres por clase que guarda cada hilo */
+
+struct buffer
+{
+    char *datos;
+    size_t tamano;             /* capacidad, potencia de dos desde BUF_MINIMO */
+    int clase;                 /* -1: mayor que BUF_MAXIMO, se devuelve al sistema */
+    int refs;
+    struct buffer *siguiente;  /* en las listas de libres */
+};
+
+struct buf_estadisticas
+{
+    unsigned long slabs;       /* reservas al sistema */
+    unsigned long bytes;       /* memoria reservada en slabs */
+    unsigned long pedidos;     /* buf_obtener atendidos */
+    unsigned long del_hilo;    /* atendidos desde la cache del hilo */
+    unsigned long fuera;       /* mayores que BUF_MAXIMO */
+};
+
+struct buffer *buf_obtener(size_t);
+struct buffer *buf_retener(struct buffer *);
+void buf_soltar(struct buffer *);
+void buf_estadisticas(struct buf_estadisticas *);
+const char *buf_implementacion(void);
+
+#endif
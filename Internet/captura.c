@@ -0,0 +1,209 @@
+/**
+ * @file captura.c
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Escritura y lectura de grabaciones de sesion. Quien graba llama a
+ *        cap_registrar desde un unico hilo (el del multiplexor); el archivo
+ *        se escribe con un buffer de CAP_BUFFER bytes, asi que un tramo
+ *        cuesta una copia en memoria y no una llamada al sistema.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "captura.h"
+
+struct cap_archivo
+{
+    FILE *archivo;
+    struct timespec inicio;  /* reloj monotonico al crear la grabacion */
+    uint64_t ultimo;         /* us del registro anterior */
+    int error;               /* grabacion abandonada por un error de escritura */
+    unsigned char *datos;    /* en lectura: bytes del ultimo registro */
+    size_t capacidad;
+};
+
+static void cap_varint_escribir(FILE *f, uint64_t v)
+{
+    do
+    {
+        fputc((int)((v & 0x7F) | (v > 0x7F ? 0x80 : 0)), f);
+        v >>= 7;
+    } while (v != 0);
+}
+
+/**
+ * @brief Lee un varint.
+ *
+ * @param f
+ * @param v
+ * @return int 1, 0 si el archivo termina antes del primer byte o -1 si el
+ *         varint esta cortado
+ */
+static int cap_varint_leer(FILE *f, uint64_t *v)
+{
+    int c;
+
+    *v = 0;
+    for (int corrimiento = 0; corrimiento < 64; corrimiento += 7)
+    {
+        if ((c = fgetc(f)) == EOF)
+            return corrimiento == 0 && feof(f) ? 0 : -1;
+        *v |= (uint64_t)(c & 0x7F) << corrimiento;
+        if (!(c & 0x80))
+            return 1;
+    }
+    return -1;
+}
+
+/**
+ * @brief Crea una grabacion.
+ *
+ * @param ruta
+ * @param satelite ID del satelite de la sesion
+ * @param presentacion bytes que envia el satelite antes del multiplexor
+ * @return struct cap_archivo* NULL en caso de error
+ */
+struct cap_archivo *cap_crear(const char *ruta, uint32_t satelite, uint32_t presentacion)
+{
+    struct cap_archivo *c = calloc(1, sizeof(*c));
+    struct timespec ahora;
+    uint32_t cabecera[CAP_CABECERA_LEN / 4];
+    uint64_t inicio;
+
+    if (c == NULL)
+        return NULL;
+    if ((c->archivo = fopen(ruta, "wbx")) == NULL)
+    {
+        perror(ruta);
+        free(c);
+        return NULL;
+    }
+    setvbuf(c->archivo, NULL, _IOFBF, CAP_BUFFER);
+    clock_gettime(CLOCK_REALTIME, &ahora);
+    clock_gettime(CLOCK_MONOTONIC, &c->inicio);
+    inicio = (uint64_t)ahora.tv_sec * 1000000000ULL + (uint64_t)ahora.tv_nsec;
+    cabecera[0] = htonl(CAP_MAGIA);
+    cabecera[1] = htonl(satelite);
+    cabecera[2] = htonl((uint32_t)(inicio >> 32));
+    cabecera[3] = htonl((uint32_t)inicio);
+    cabecera[4] = htonl(presentacion);
+    fwrite(cabecera, sizeof(cabecera), 1, c->archivo);
+    return c;
+}
+
+/**
+ * @brief Agrega un tramo a la grabacion.
+ *
+ * @param c NULL si no se graba
+ * @param sentido
+ * @param datos
+ * @param largo
+ */
+void cap_registrar(struct cap_archivo *c, enum cap_sentido sentido, const void *datos, size_t largo)
+{
+    struct timespec ahora;
+    uint64_t us;
+
+    if (c == NULL || c->error || largo == 0)
+        return;
+    clock_gettime(CLOCK_MONOTONIC, &ahora);
+    us = (uint64_t)(ahora.tv_sec - c->inicio.tv_sec) * 1000000 + (ahora.tv_nsec - c->inicio.tv_nsec) / 1000;
+    cap_varint_escribir(c->archivo, us - c->ultimo);
+    cap_varint_escribir(c->archivo, (uint64_t)largo << 1 | sentido);
+    if (fwrite(datos, 1, largo, c->archivo) != largo)
+    {
+        perror("captura");
+        c->error = 1;
+    }
+    c->ultimo = us;
+}
+
+/**
+ * @brief Abre una grabacion para leerla.
+ *
+ * @param ruta
+ * @param cab recibe la cabecera
+ * @return struct cap_archivo* NULL si no existe o no es una grabacion
+ */
+struct cap_archivo *cap_abrir(const char *ruta, struct cap_cabecera *cab)
+{
+    struct cap_archivo *c = calloc(1, sizeof(*c));
+    uint32_t cabecera[CAP_CABECERA_LEN / 4];
+
+    if (c == NULL)
+        return NULL;
+    if ((c->archivo = fopen(ruta, "rb")) == NULL)
+    {
+        perror(ruta);
+        free(c);
+        return NULL;
+    }
+    if (fread(cabecera, sizeof(cabecera), 1, c->archivo) != 1 || ntohl(cabecera[0]) != CAP_MAGIA)
+    {
+        fprintf(stderr, "%s: no es una grabacion de sesion\n", ruta);
+        cap_cerrar(c);
+        return NULL;
+    }
+    cab->magia = CAP_MAGIA;
+    cab->satelite = ntohl(cabecera[1]);
+    cab->inicio = (uint64_t)ntohl(cabecera[2]) << 32 | ntohl(cabecera[3]);
+    cab->presentacion = ntohl(cabecera[4]);
+    return c;
+}
+
+/**
+ * @brief Lee el siguiente registro.
+ *
+ * @param c
+ * @param r
+ * @return int 1, 0 al final de la grabacion o -1 si esta cortada
+ */
+int cap_leer(struct cap_archivo *c, struct cap_registro *r)
+{
+    uint64_t delta, largo;
+    unsigned char *datos;
+    int n;
+
+    /* Solo un registro que no empezo marca el final */
+    if ((n = cap_varint_leer(c->archivo, &delta)) <= 0)
+        return n;
+    if (cap_varint_leer(c->archivo, &largo) <= 0)
+        return -1;
+    r->sentido = (enum cap_sentido)(largo & 1);
+    r->largo = (size_t)(largo >> 1);
+    if (r->largo > c->capacidad)
+    {
+        if ((datos = realloc(c->datos, r->largo)) == NULL)
+            return -1;
+        c->datos = datos;
+        c->capacidad = r->largo;
+    }
+    if (fread(c->datos, 1, r->largo, c->archivo) != r->largo)
+        return -1;
+    c->ultimo += delta;
+    r->tiempo = c->ultimo;
+    r->datos = c->datos;
+    return 1;
+}
+
+/**
+ * @brief Cierra una grabacion; al escribir, vacia el buffer en el archivo.
+ *
+ * @param c
+ */
+void cap_cerrar(struct cap_archivo *c)
+{
+    if (c == NULL)
+        return;
+    if (fclose(c->archivo) != 0)
+        perror("captura");
+    free(c->datos);
+    free(c);
+}
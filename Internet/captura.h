@@ -0,0 +1,62 @@
+/**
+ * @file captura.h
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Grabacion de sesiones. La estacion puede guardar todo lo que pasa
+ *        por la conexion de una sesion, en ambos sentidos y con la hora de
+ *        cada lectura o escritura del multiplexor, en un archivo binario
+ *        compacto; la herramienta reproducir vuelve a generar ese trafico
+ *        contra un satelite o una estacion real, al ritmo original o tan
+ *        rapido como responda el otro extremo. Formato: una cabecera de
+ *        CAP_CABECERA_LEN bytes en orden de red (magia, ID del satelite,
+ *        inicio en ns desde 1970 y bytes de la presentacion del satelite,
+ *        que precede a las tramas del multiplexor) y luego un registro por tramo: tiempo
+ *        desde el registro anterior en us (varint), largo << 1 | sentido
+ *        (varint) y los bytes tal como viajaron.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef CAPTURA_H
+#define CAPTURA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CAP_MAGIA 0x43415031   /* "CAP1" */
+#define CAP_CABECERA_LEN 20
+#define CAP_BUFFER (64 * 1024) /* buffer de escritura del archivo */
+
+/* Sentido de un tramo, visto desde quien graba */
+enum cap_sentido
+{
+    CAP_ENTRADA, /* leido de la conexion */
+    CAP_SALIDA   /* escrito en la conexion */
+};
+
+struct cap_cabecera
+{
+    uint32_t magia;
+    uint32_t satelite;
+    uint64_t inicio;       /* ns desde 1970 */
+    uint32_t presentacion; /* bytes del satelite antes de la primera trama */
+};
+
+struct cap_registro
+{
+    uint64_t tiempo;            /* us desde el inicio de la grabacion */
+    enum cap_sentido sentido;
+    size_t largo;
+    const unsigned char *datos; /* valido hasta la siguiente lectura */
+};
+
+struct cap_archivo;
+
+struct cap_archivo *cap_crear(const char *, uint32_t, uint32_t);
+void cap_registrar(struct cap_archivo *, enum cap_sentido, const void *, size_t);
+struct cap_archivo *cap_abrir(const char *, struct cap_cabecera *);
+int cap_leer(struct cap_archivo *, struct cap_registro *);
+void cap_cerrar(struct cap_archivo *);
+
+#endif
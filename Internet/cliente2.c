@@ -7,7 +7,9 @@
  *        ingresar como argumento la direccion del socket destino, la del servidor 
  *        que debe estar creado para poder conectarse. 
  *                  ./<ejecutable> <IPv4>:<Puerto>  
+ *                  ./<ejecutable> [<IPv6>]:<Puerto>  
  *                          ejemplo ./cliente 192.168.1.5:6020 
+ *                          ejemplo ./cliente [2001:db8::5]:6020 
  *        Una vez conectado con servidor queda a la espera de comandos de operacion.
  * @version 0.1
  * @date 2020-01-28
@@ -27,6 +29,12 @@
 #define ANSI_COLOR_GREEN "\x1b[32m"
 #define ANSI_COLOR_CYAN "\x1b[36m"
 #define ANSI_COLOR_RESET "\x1b[0m"
+#define RELEVO_ESPERA 60 /* segundos sin pares tras los que el relevo se cierra */
+#define VIGENCIA_HOSTNAME 10000 /* ms; ademas se invalida cuando cambia */
+#define VIGENCIA_MEMORIA 500    /* ms */
+#define VIGENCIA_CPU 1000       /* ms */
+#define PING_TRAMA_MAX 64       /* bytes de una trama de eco */
+#define PING_ESPERA 5000        /* ms sin ecos UDP tras los que se cierra el socket */
 
 /* Librerias usados por los distintos codigos fuente */
 #include <stdio.h>
@@ -48,14 +56,52 @@
 #include <linux/kernel.h>
 #include <fcntl.h>
 #include <math.h>
+#include <sys/eventfd.h>
+
+#include "telemetria.h"
+#include "compacta.h"
+#include "perfiles.h"
+#include "transferencia.h"
+#include "multiplexor.h"
+#include "reactor.h"
+#include "direcciones.h"
+#include "ancho.h"
+#include "rafaga.h"
+#include "trabajos.h"
+
+struct operacion;
 
 /* Funciones que escribí */
 int conectar(char *, char *);
 void sesionActiva(int, char *, char *);
-void update_Firmware(int, char *, char *);
-int start_Scanning(int);
-int obtener_Telemetria(int, char *);
+int atender_Sesion(struct tarea *);
+int atender_Corta(struct tarea *);
+void *atender_Operacion(void *);
+int update_Firmware(int, char *, char *);
+int instalar_Firmware(int, char *, int, char *, const unsigned char *);
+int servir_Firmware(int, char *, const char *);
+int escuchar_Relevo(struct tarea *);
+void *hilo_Par(void *);
+int relevo_Firmware(int, char *);
+int vigilar_Hostname(struct tarea *);
+int atender_Eco(struct tarea *);
+int abrir_Eco(int);
+void reiniciar(char *, char *);
+int start_Scanning(int, char *);
+int enviar_Rafaga(int, char *, const char *);
+long recibir_Rafaga(int, char *, const char *);
+int prueba_Ancho(int);
+int leer_Pedido(int, char *, size_t *, size_t, int);
+int obtener_Telemetria(struct operacion *);
+void muestrear_Caros(void *);
+void avisar_Caros(void *);
+int enviar_Caros(struct operacion *);
+int reenviar_Telemetria(int);
+int transmitir_Telemetria(struct tarea *);
+void medir_Muestra(struct tlm_muestra *, uint32_t);
 void getfirmware_version(char *);
+void id_Satelite(char *);
+void tiempo_Activo(char *);
 void memoria(char *);
 void bootTime(char *);
 void uptime(char *);
@@ -63,6 +109,141 @@ void CPU(char *);
 void hostname(char *);
 void getValue(char *, char *, char *);
 
+/* Registro de colectores de telemetria, uno por campo. La estacion pide
+   una mascara de campos y solo corren esos colectores; los que cambian poco
+   reusan su ultimo valor mientras siga vigente */
+static const struct tlm_colector colectores[TLM_CAMPOS] = {
+    [TLM_CAMPO_ID] = {TLM_CAMPO_ID, TLM_TIPO_TEXTO, TLM_COSTO_BAJO, id_Satelite, TLM_SIEMPRE},
+    [TLM_CAMPO_FIRMWARE] = {TLM_CAMPO_FIRMWARE, TLM_TIPO_TEXTO, TLM_COSTO_BAJO, getfirmware_version, TLM_SIEMPRE},
+    [TLM_CAMPO_UPTIME] = {TLM_CAMPO_UPTIME, TLM_TIPO_DURACION, TLM_COSTO_BAJO, tiempo_Activo, TLM_SIN_CACHE},
+    [TLM_CAMPO_ARRANQUE] = {TLM_CAMPO_ARRANQUE, TLM_TIPO_FECHA, TLM_COSTO_MEDIO, bootTime, TLM_SIEMPRE},
+    [TLM_CAMPO_HOSTNAME] = {TLM_CAMPO_HOSTNAME, TLM_TIPO_TEXTO, TLM_COSTO_MEDIO, hostname, VIGENCIA_HOSTNAME},
+    [TLM_CAMPO_MEMORIA] = {TLM_CAMPO_MEMORIA, TLM_TIPO_MEMORIA, TLM_COSTO_MEDIO, memoria, VIGENCIA_MEMORIA},
+    [TLM_CAMPO_CPU] = {TLM_CAMPO_CPU, TLM_TIPO_PORCENTAJE, TLM_COSTO_ALTO, CPU, VIGENCIA_CPU},
+};
+
+/* Corrutina que invalida el hostname guardado cuando el kernel lo cambia */
+struct vigia
+{
+    struct tarea tarea;
+    int fd;
+};
+
+/* Perfil de ajuste de sockets elegido por la estacion terrestre */
+static const struct perfil *perfil_activo = NULL;
+
+/* Conexion con la estacion: cada comando llega como un flujo propio */
+static struct mux *conexion = NULL;
+
+/* Bucle de eventos del hilo principal: la sesion y los comandos cortos
+   corren en el como corrutinas */
+static struct reactor *reactor = NULL;
+
+/* Hilos atendiendo flujos; la sesion los espera antes de cerrar la conexion */
+static pthread_mutex_t operaciones_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t operaciones_cond = PTHREAD_COND_INITIALIZER;
+static int operaciones = 0;
+
+/* update_Firmware dejo el nuevo binario verificado en disco */
+static int firmware_listo = 0;
+
+/* Socket de la conexion con la estacion, para consultar TCP_INFO */
+static int socket_estacion = -1;
+
+/* Emisor de las consultas de telemetria: se conserva entre pedidos mientras
+   no cambie el puerto, y con el sus datagramas retenidos; los pedidos y los
+   reenvios pueden llegar en flujos simultaneos */
+static struct tlm_emisor emisor_consultas;
+static int puerto_consultas = 0;
+static unsigned long generacion_consultas = 0; /* cambia al reabrir el emisor */
+static pthread_mutex_t consultas_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Direccion local de la conexion con la estacion: los relevos escuchan en
+   ella, que es la que los demas satelites alcanzan */
+static struct sockaddr_storage direccion_local;
+
+/* Sesion con la estacion: espera flujos nuevos del multiplexor */
+struct sesion
+{
+    struct tarea tarea;
+    int avisos;
+    int logoff;
+    char *nombre;
+    char *server_ip;
+};
+
+/* Relevo de firmware hacia otros satelites, espera pares sin ocupar un hilo */
+struct relevo
+{
+    struct tarea tarea;
+    int escucha;
+    int cantidad;
+    char *nombre;
+};
+
+/* Par atendido por un relevo */
+struct par
+{
+    int sock;
+    char *nombre;
+};
+
+/* Telemetria continua hacia la estacion: muestrea cada periodo y envia
+   tramas compactas, delta contra la ultima muestra acusada */
+struct transmision
+{
+    struct tarea tarea;
+    int flujo;
+    char *server_ip;
+    struct tlm_emisor *emisor;
+    struct tlm_historia historia; /* muestras enviadas, referencias posibles */
+    uint32_t magnitudes;
+    uint32_t muestras, enviadas;
+    int periodo;                  /* ms */
+    int64_t acusada;              /* ultima muestra acusada, -1 ninguna */
+    unsigned char acuse[4];       /* acuse leido a medias */
+    int acuse_n;
+    int nack;                     /* la palabra siguiente es una secuencia a reenviar */
+    unsigned long reenviados;
+    unsigned char paquete[TLM_CARGA_MAX]; /* tramas del proximo datagrama */
+    size_t paquete_n;
+    int paquete_ms;               /* espera de la primera trama del paquete */
+    char pedido[TAM2 + 1];        /* pedido leido hasta ahora */
+    size_t pedido_n;
+    struct timespec proxima;
+    unsigned long bytes, claves;
+};
+
+/* Eco de ping: devuelve cada trama tal como llega, por el flujo de la orden
+   o por un socket UDP propio */
+struct eco
+{
+    struct tarea tarea;
+    int fd;
+    int udp;
+};
+
+/* Operacion pedida por la estacion: corrutina si es un comando corto, hilo
+   propio si transfiere un archivo */
+struct operacion
+{
+    struct tarea tarea;
+    int flujo;
+    char servicio[MUX_SERVICIO];
+    char *nombre;
+    char *server_ip;
+    char pedido[TAM2 + 1];        /* pedido leido hasta ahora */
+    size_t pedido_n;
+    /* Consulta de telemetria: los campos de costo alto se muestrean en el
+       pool de trabajos, con su secuencia ya informada a la estacion */
+    uint32_t caros;
+    uint32_t secuencia[TLM_CAMPOS];
+    char valor[TLM_CAMPOS][TLM_CARGA_MAX];
+    int guardado[TLM_CAMPOS];
+    unsigned long generacion;     /* del emisor de consultas */
+    int listo;                    /* eventfd: el pool termino, o -1 */
+};
+
 /**
  * @brief Llama a la funcion conectar. Si la conexión es posible
  *        activa la sesión con el servidor mediante el socket devuelto
@@ -70,7 +251,7 @@ void getValue(char *, char *, char *);
  * 
  * @param argc 
  * @param argv argv[0] nombre del ejecutable. Empleado en la funcion update_firmware.
- *             argv[1] direccion IPv4 y puerto del servidor.
+ *             argv[1] direccion IPv4 o [IPv6] y puerto del servidor.
  * @return int 
  */
 int main(int argc, char *argv[])
@@ -94,48 +275,58 @@ int main(int argc, char *argv[])
  *        para volver a intentarlo.
  * 
  * @param name_f 
- * @param remote_host direccion IPv4 y puerto de servidor
+ * @param remote_host direccion IPv4 o [IPv6] y puerto de servidor
  * @return int identificador del cliente para identificarse con el servidor
  */
 int conectar(char *name_f, char *remote_host)
 {
     static int sockfd;
     uint8_t conexion = 1;
-    struct sockaddr_in serv_addr, cli_addr;
+    struct addrinfo pistas, *res, *r;
+    struct sockaddr_storage local;
+    socklen_t largo;
     char buffer[50];
     char nombre[50];
+    char texto[DIR_TEXTO_MAX];
     char *direccionIp;
-    int puerto;
-    struct hostent *server;
+    char *puerto;
 
-    direccionIp = strtok(remote_host, ":");
-    puerto = atoi(strtok(NULL, " "));
-    server = gethostbyname(direccionIp);
+    if (dir_separar(remote_host, &direccionIp, &puerto) < 0 || puerto == NULL)
+    {
+        fprintf(stderr, "Uso: <ejecutable> <IPv4>:<Puerto> o [<IPv6>]:<Puerto>\n");
+        exit(1);
+    }
     strtok(name_f, "/");
     strcpy(nombre, strtok(NULL, " "));
     strcpy(name_f, nombre);
 
-    memset((char *)&serv_addr, '0', sizeof(serv_addr));                                  /* Limpia la estructura */
-    serv_addr.sin_family = AF_INET;                                                      /* INET Sock */
-    bcopy((char *)server->h_addr, (char *)&serv_addr.sin_addr.s_addr, server->h_length); /* dirección IP */
-    serv_addr.sin_port = htons(puerto);                                                  /* puerto del servidor */
-
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0)
+    memset(&pistas, 0, sizeof(pistas));
+    pistas.ai_family = AF_UNSPEC; /* IPv6 o IPv4, segun la direccion de la estacion */
+    pistas.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(direccionIp, puerto, &pistas, &res) != 0)
     {
-        perror("creación de socket");
+        fprintf(stderr, "ERROR, no existe el host\n");
         exit(1);
     }
 
-    cli_addr.sin_family = AF_INET;
-    cli_addr.sin_addr.s_addr = inet_addr("192.168.1.4");
-    //cli_addr.sin_port = htons(10010);
-    //bind(sockfd, (struct sockaddr*) &cli_addr, sizeof(cli_addr));
-
     while (conexion)
     {
         printf("\n=====================================");
-        if (connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
+        sockfd = -1;
+        for (r = res; r != NULL && sockfd < 0; r = r->ai_next)
+        {
+            if ((sockfd = socket(r->ai_family, SOCK_STREAM, 0)) < 0)
+            {
+                perror("creación de socket");
+                exit(1);
+            }
+            if (connect(sockfd, r->ai_addr, r->ai_addrlen) < 0)
+            {
+                close(sockfd);
+                sockfd = -1;
+            }
+        }
+        if (sockfd < 0)
         {
             printf("\n  Cliente inicializado - Intento[%d] \n", conexion);
             printf("  Conexion [");
@@ -148,10 +339,12 @@ int conectar(char *name_f, char *remote_host)
         }
         else
         {
-            printf("\n  Cliente inicializado [ID: %d] [%s] \n", getpid(), inet_ntoa(cli_addr.sin_addr));
+            largo = sizeof(local);
+            getsockname(sockfd, (struct sockaddr *)&local, &largo);
+            printf("\n  Cliente inicializado [ID: %d] [%s] \n", getpid(), dir_texto((struct sockaddr *)&local, texto, sizeof(texto)));
             sprintf(buffer, "%d", getpid());
             write(sockfd, buffer, sizeof(buffer));
-            memset(buffer, '\0', TAM);
+            memset(buffer, '\0', sizeof(buffer));
             getfirmware_version(buffer);
             printf("  %s\n", buffer);
             printf("  Conexion [");
@@ -161,6 +354,7 @@ int conectar(char *name_f, char *remote_host)
             conexion = 0;
         }
     }
+    freeaddrinfo(res);
 
     FILE *fd = fopen("cliente2", "r");
     if (fd != NULL)
@@ -174,8 +368,12 @@ int conectar(char *name_f, char *remote_host)
 
 /**
  * @brief Mantiene la sesion hasta que el servidor finalice la sesion empleando
- *        el comando sat_logoff. Se mantiene a la espera de que el servidor
- *        envie un comando, lo comprueba y actua en consecuencia.
+ *        el comando sat_logoff. Cada comando de la estacion llega como un
+ *        flujo del multiplexor. La sesion y los comandos cortos son
+ *        corrutinas del reactor del hilo principal, que se suspenden mientras
+ *        esperan datos; las transferencias de archivos van en un hilo propio,
+ *        de modo que un escaneo en curso no demora la telemetria ni los demas
+ *        comandos.
  * 
  * @param socket socket id
  * @param nombre nombre del codigo ejecutable
@@ -183,295 +381,1267 @@ int conectar(char *name_f, char *remote_host)
  */
 void sesionActiva(int socket, char *nombre, char *server_ip)
 {
-    char buffer[TAM];
-    int n = 0;
-    int sesionActiva = 1;
-    memset(buffer, '\0', sizeof(buffer));
+    static struct sesion sesion;
+
+    socklen_t largo = sizeof(direccion_local);
+    if (getsockname(socket, (struct sockaddr *)&direccion_local, &largo) < 0)
+        perror("getsockname");
 
-    while (sesionActiva)
+    socket_estacion = socket;
+    perfil_activo = perfil_buscar(PERFIL_POR_DEFECTO);
+    if ((conexion = mux_crear(socket, 0)) == NULL)
     {
-        printf("Satelite Activo...\n");
+        exit(1);
+    }
+    mux_ajustar(conexion, &perfil_activo->canal[CANAL_MASIVO]);
+    if ((reactor = reactor_crear()) == NULL)
+    {
+        exit(1);
+    }
+    printf("Satelite Activo...\n");
 
-        memset(buffer, '\0', sizeof(buffer));
-        n = read(socket, buffer, sizeof(buffer)); //Leo el comando enviado por el servidor
-        if (n < 0)
-        { //y lo voy comparando
-            perror("lectura de socket");
-            exit(1);
-        }
-        if (!strcmp(buffer, "update_firmware"))
-        {
-            update_Firmware(socket, nombre, server_ip);
-            sesionActiva = 0;
-        }
-        if (!strcmp(buffer, "start_scanning"))
+    static struct vigia vigia;
+    if ((vigia.fd = open("/proc/sys/kernel/hostname", O_RDONLY | O_CLOEXEC)) >= 0)
+        reactor_iniciar(reactor, &vigia.tarea, vigilar_Hostname);
+    else
+        perror("hostname");
+
+    sesion.avisos = mux_avisos(conexion);
+    sesion.logoff = 0;
+    sesion.nombre = nombre;
+    sesion.server_ip = server_ip;
+    reactor_iniciar(reactor, &sesion.tarea, atender_Sesion);
+    reactor_correr(reactor);
+
+    printf(ANSI_COLOR_RED);
+    printf(sesion.logoff ? "\n Cerrando comunicacion.\n" : "\n Conexion con la estacion perdida.\n");
+    printf(ANSI_COLOR_RESET);
+
+    /* Las operaciones en curso terminan cuando la estacion cierra la conexion */
+    pthread_mutex_lock(&operaciones_mutex);
+    while (operaciones > 0)
+        pthread_cond_wait(&operaciones_cond, &operaciones_mutex);
+    pthread_mutex_unlock(&operaciones_mutex);
+    mux_cerrar(conexion);
+
+    if (firmware_listo)
+    {
+        reiniciar(nombre, server_ip);
+    }
+    exit(0);
+}
+
+/**
+ * @brief Corrutina de la sesion: toma los flujos que abre la estacion. Los
+ *        comandos cortos se inician como corrutinas; los que transfieren un
+ *        archivo son duenios de su flujo hasta terminar y van en un hilo.
+ * 
+ * @param t struct sesion
+ * @return int enum reactor_paso
+ */
+int atender_Sesion(struct tarea *t)
+{
+    struct sesion *s = (struct sesion *)t;
+    struct operacion *op;
+    pthread_t hilo;
+    char servicio[MUX_SERVICIO];
+    uint64_t avisos;
+    int flujo = -1;
+
+    CO_INICIO(t);
+    while (!s->logoff)
+    {
+        CO_ESPERAR(t, s->avisos, EPOLLIN, 0);
+        if (read(s->avisos, &avisos, sizeof(avisos)) < 0 && errno != EAGAIN)
+            perror("eventfd");
+        while (!s->logoff && (flujo = mux_tomar(conexion, servicio, sizeof(servicio))) >= 0)
         {
-            n = start_Scanning(socket);
-            memset(buffer, '\0', sizeof(buffer));
+            if (!strcmp(servicio, "sat_logoff"))
+            {
+                close(flujo);
+                s->logoff = 1;
+                continue;
+            }
+            if ((op = calloc(1, sizeof(*op))) == NULL)
+            {
+                close(flujo);
+                continue;
+            }
+            op->flujo = flujo;
+            strcpy(op->servicio, servicio);
+            op->nombre = s->nombre;
+            op->server_ip = s->server_ip;
+            if (!strcmp(servicio, "transmitir_telemetria"))
+            {
+                struct transmision *tx = calloc(1, sizeof(*tx));
+                if (tx == NULL)
+                {
+                    close(flujo);
+                    free(op);
+                    continue;
+                }
+                tx->flujo = flujo;
+                tx->server_ip = s->server_ip;
+                free(op);
+                reactor_iniciar(t->reactor, &tx->tarea, transmitir_Telemetria);
+                continue;
+            }
+            if (!strcmp(servicio, "ping"))
+            {
+                free(op);
+                if (abrir_Eco(flujo) < 0)
+                    close(flujo);
+                continue;
+            }
+            if (!strcmp(servicio, "obtener_telemetria") || !strcmp(servicio, "perfil") ||
+                !strcmp(servicio, "servir_firmware"))
+            {
+                reactor_iniciar(t->reactor, &op->tarea, atender_Corta);
+                continue;
+            }
+            pthread_mutex_lock(&operaciones_mutex);
+            operaciones++;
+            pthread_mutex_unlock(&operaciones_mutex);
+            if (pthread_create(&hilo, NULL, atender_Operacion, op) != 0)
+            {
+                perror("pthread_create");
+                atender_Operacion(op);
+                continue;
+            }
+            pthread_detach(hilo);
         }
-        if (!strcmp(buffer, "obtener_telemetria"))
+        if (flujo < 0 && errno == EPIPE)
+            break; /* conexion con la estacion caida */
+    } //Fin while sesion activa
+    reactor_detener(t->reactor);
+    CO_FIN(t);
+}
+
+/**
+ * @brief Corrutina de un comando corto: junta el pedido de su flujo sin
+ *        ocupar un hilo ni bloquear el reactor y lo atiende. En una consulta
+ *        de telemetria los campos caros se muestrean en el pool de trabajos
+ *        y la corrutina sigue al terminar; despues reenvia los datagramas
+ *        que la estacion pida, hasta que cierre el flujo o pase TLM_PLAZO
+ *        sin pedidos.
+ * 
+ * @param t struct operacion
+ * @return int enum reactor_paso
+ */
+int atender_Corta(struct tarea *t)
+{
+    struct operacion *op = (struct operacion *)t;
+    int listo;
+
+    CO_INICIO(t);
+    /* La consulta ocupa TAM2 bytes y la siguen los pedidos de reenvio; los
+       demas terminan en '\0' o al cerrarse el flujo */
+    do
+        CO_ESPERAR(t, op->flujo, EPOLLIN, 0);
+    while ((listo = leer_Pedido(op->flujo, op->pedido, &op->pedido_n, TAM2,
+                                !strcmp(op->servicio, "obtener_telemetria"))) == 0);
+    /* Tras una espera se sigue dentro de la consulta: listo no se conserva */
+    if (listo > 0 && !strcmp(op->servicio, "servir_firmware"))
+    {
+        servir_Firmware(op->flujo, op->nombre, op->pedido);
+    }
+    else if (listo > 0 && !strcmp(op->servicio, "perfil"))
+    {
+        const struct perfil *p = perfil_buscar(op->pedido);
+        if (p != NULL)
         {
-            n = obtener_Telemetria(socket, server_ip);
-            memset(buffer, '\0', sizeof(buffer));
+            perfil_activo = p;
+            mux_ajustar(conexion, &perfil_activo->canal[CANAL_MASIVO]);
+            printf("Perfil activo: %s\n", p->nombre);
         }
-        if (!strcmp(buffer, "sat_logoff"))
+    }
+    else if (listo > 0 && !strcmp(op->servicio, "obtener_telemetria") && obtener_Telemetria(op) == 0)
+    {
+        if (op->listo >= 0)
+            CO_ESPERAR(t, op->listo, EPOLLIN, 0);
+        if (enviar_Caros(op) == 0)
         {
-            printf(ANSI_COLOR_RED);
-            printf("\n Cerrando comunicacion.\n");
-            printf(ANSI_COLOR_RESET);
-            close(socket);
-            exit(0);
+            do
+                CO_ESPERAR(t, op->flujo, EPOLLIN, TLM_PLAZO);
+            while (!t->vencida && reenviar_Telemetria(op->flujo) > 0);
         }
-    } //Fin while sesion activa
+    }
+    close(op->flujo);
+    free(op);
+    CO_FIN(t);
+}
+
+/**
+ * @brief Lee sin bloquear lo que haya llegado del pedido de un comando. El
+ *        pedido esta completo al juntar largo bytes, cuando la estacion
+ *        cierra el flujo o, si no es de largo fijo, al llegar su '\0'.
+ * 
+ * @param flujo 
+ * @param pedido al menos largo + 1 bytes, en cero
+ * @param n bytes ya leidos; se actualiza
+ * @param largo 
+ * @param fijo 1 si el pedido ocupa siempre largo bytes
+ * @return int 1 si el pedido esta completo, 0 si falta, -1 si el flujo se
+ *         cerro o fallo antes de llegar algo
+ */
+int leer_Pedido(int flujo, char *pedido, size_t *n, size_t largo, int fijo)
+{
+    ssize_t leidos;
+
+    while (*n < largo)
+    {
+        leidos = recv(flujo, pedido + *n, largo - *n, MSG_DONTWAIT);
+        if (leidos < 0 && errno == EINTR)
+            continue;
+        if (leidos < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        if (leidos <= 0)
+            return *n > 0 ? 1 : -1;
+        *n += (size_t)leidos;
+        if (!fijo && memchr(pedido + *n - leidos, '\0', (size_t)leidos) != NULL)
+            return 1;
+    }
+    return 1;
+}
+
+/**
+ * @brief Atiende en su hilo un comando que transfiere un archivo.
+ * 
+ * @param arg struct operacion
+ * @return void* 
+ */
+void *atender_Operacion(void *arg)
+{
+    struct operacion *op = arg;
+
+    if (!strcmp(op->servicio, "update_firmware"))
+    {
+        if (update_Firmware(op->flujo, op->nombre, NULL))
+            firmware_listo = 1;
+    }
+    if (!strcmp(op->servicio, "update_firmware_udp"))
+    {
+        if (update_Firmware(op->flujo, op->nombre, op->server_ip))
+            firmware_listo = 1;
+    }
+    if (!strcmp(op->servicio, "relevo_firmware"))
+    {
+        if (relevo_Firmware(op->flujo, op->nombre))
+            firmware_listo = 1;
+    }
+    if (!strcmp(op->servicio, "start_scanning"))
+    {
+        start_Scanning(op->flujo, NULL);
+    }
+    if (!strcmp(op->servicio, "start_scanning_udp"))
+    {
+        start_Scanning(op->flujo, op->server_ip);
+    }
+    if (!strcmp(op->servicio, "bandwidth_test"))
+    {
+        prueba_Ancho(op->flujo);
+    }
+    close(op->flujo);
+    free(op);
+
+    pthread_mutex_lock(&operaciones_mutex);
+    operaciones--;
+    pthread_cond_signal(&operaciones_cond);
+    pthread_mutex_unlock(&operaciones_mutex);
+    return NULL;
 }
 
 /**
- * @brief Actualiza la versión del sistema. Recibe la cantidad de bytes del 
- *        nuevo binario y luego comienza a recibirlo y generar el nuevo archivo. 
- *        Una vez completada la descarga del nuevo ejecutable, sobreecribe el 
- *        proceso actual en ejecución y reconecta con el servidor levantando
- *        ya la nueva version.
+ * @brief Actualiza la versión del sistema. Recibe el nuevo binario con
+ *        trf_recibir, que lo verifica por bloques y completo antes de darlo
+ *        por bueno. Si la descarga falla se restaura el binario anterior; si
+ *        no, al cerrar la sesion se reinicia con la nueva version (ver
+ *        reiniciar).
  * 
  * @param sock 
  * @param nombre 
- * @param server 
+ * @param estacion direccion de la estacion para recibirlo en rafaga UDP
+ *        (ver rafaga.h), o NULL para recibirlo por el flujo
+ * @return int 1 si el nuevo binario quedo instalado
  */
-void update_Firmware(int sock, char *nombre, char *server)
+int update_Firmware(int sock, char *nombre, char *estacion)
 {
     printf("=====================================\n\n");
     printf("UPDATE FIRMWARE\n\n");
-    char buffer[TAM];
-    char old_name[10], new_name[10];
-    int new_exe;
-    long byteRead = 0;
-    int npackages = 0;
+    return instalar_Firmware(sock, nombre, 1, estacion, NULL);
+}
+
+/**
+ * @brief Recibe e instala el nuevo binario desde la estacion o desde el
+ *        relevo de otro satelite. La cola de la transferencia solo prueba
+ *        que el archivo llego entero; lo que llega de un relevo ademas debe
+ *        coincidir con el SHA-256 que la estacion indico para el despliegue.
+ * 
+ * @param sock 
+ * @param nombre 
+ * @param avisar confirmar al emisor que se libero el nombre del binario
+ * @param estacion direccion de la estacion si llega en rafaga UDP, o NULL
+ * @param digesto SHA-256 esperado, o NULL si el binario llega de la estacion
+ * @return int 1 si el nuevo binario quedo instalado
+ */
+int instalar_Firmware(int sock, char *nombre, int avisar, char *estacion, const unsigned char *digesto)
+{
+    char old_name[TAM], new_name[TAM + 1];
+    unsigned char recibido[SHA256_LEN];
+    long r;
+    int fd;
 
     /* Renombro al ejecutable actual para receptar el nuevo 
        ejecutable actualizado */
-    strcpy(old_name, nombre);
-
-    strcpy(new_name, old_name);
-    strcat(new_name, "2");
+    snprintf(old_name, sizeof(old_name), "%s", nombre);
+    snprintf(new_name, sizeof(new_name), "%s2", old_name);
 
     rename(old_name, new_name);
 
-    if ((new_exe = open(old_name, O_WRONLY | O_CREAT | O_TRUNC, 0777)) < 0)
+    perfil_aplicar(sock, &perfil_activo->canal[CANAL_MASIVO]);
+    if (avisar)
+        write(sock, "DONE", 4);
+
+    if (estacion != NULL)
+        r = recibir_Rafaga(sock, estacion, old_name);
+    else
+        r = trf_recibir(sock, old_name, TRF_MMAP, TRF_FSYNC_AL_FINAL);
+    if (r >= 0 && digesto != NULL)
     {
-        printf("Error creando el file\n");
-        return;
+        if ((fd = open(old_name, O_RDONLY | O_CLOEXEC)) < 0 || sha256_archivo(fd, recibido) < 0 ||
+            memcmp(recibido, digesto, SHA256_LEN) != 0)
+        {
+            printf("El firmware del relevo no es la imagen del despliegue\n");
+            r = -1;
+        }
+        if (fd >= 0)
+            close(fd);
+    }
+    if (r < 0)
+    {
+        /* El binario recibido no es confiable: se sigue con el actual */
+        printf("Actualizacion fallida, se conserva la version actual\n");
+        remove(old_name);
+        rename(new_name, old_name);
+        return 0;
+    }
+    chmod(old_name, S_IRWXO | S_IRWXU | S_IRWXG);
+    /* La version informada pasa a ser la del binario nuevo */
+    tlm_invalidar(1u << TLM_CAMPO_FIRMWARE);
+    printf("=====================================\n");
+    return 1;
+}
+
+/**
+ * @brief Abre un relevo que sirve el binario propio, ya verificado, a los
+ *        satelites que la estacion le asigne. Escucha en la direccion local
+ *        de la conexion con la estacion, con un puerto libre, y le responde
+ *        "ip:puerto". La escucha es una corrutina del reactor, fuera de las
+ *        operaciones de la sesion.
+ * 
+ * @param sock flujo de la orden
+ * @param nombre nombre del ejecutable
+ * @param pedido cuantos satelites atender, leido del flujo
+ * @return int 1 si el relevo quedo escuchando
+ */
+int servir_Firmware(int sock, char *nombre, const char *pedido)
+{
+    char buffer[TAM];
+    struct sockaddr_storage direccion = direccion_local;
+    socklen_t largo = sizeof(direccion);
+    struct relevo *relevo;
+    int escucha, cantidad;
+
+    cantidad = atoi(pedido);
+
+    /* Puerto libre en la misma direccion */
+    if (direccion.ss_family == AF_INET6)
+        ((struct sockaddr_in6 *)&direccion)->sin6_port = 0;
+    else
+        ((struct sockaddr_in *)&direccion)->sin_port = 0;
+    escucha = socket(direccion.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (cantidad <= 0 || escucha < 0 ||
+        bind(escucha, (struct sockaddr *)&direccion, largo) < 0 ||
+        listen(escucha, cantidad) < 0 ||
+        getsockname(escucha, (struct sockaddr *)&direccion, &largo) < 0 ||
+        (relevo = malloc(sizeof(*relevo))) == NULL)
+    {
+        perror("relevo");
+        if (escucha >= 0)
+            close(escucha);
+        write(sock, "0:0", 4);
+        return 0;
     }
+    relevo->escucha = escucha;
+    relevo->cantidad = cantidad;
+    relevo->nombre = nombre;
 
-    write(sock, "DONE", 4);
     memset(buffer, '\0', sizeof(buffer));
+    dir_texto((struct sockaddr *)&direccion, buffer, sizeof(buffer));
+    write(sock, buffer, strlen(buffer) + 1);
+    printf("Relevo de firmware en %s para %d satelites\n", buffer, cantidad);
+    reactor_iniciar(reactor, &relevo->tarea, escuchar_Relevo);
+    return 1;
+}
+
+/**
+ * @brief Corrutina del relevo: acepta hasta la cantidad de pares, cada uno
+ *        atendido en su propio hilo. Se cierra antes si pasan RELEVO_ESPERA
+ *        segundos sin que llegue ninguno.
+ * 
+ * @param t struct relevo
+ * @return int enum reactor_paso
+ */
+int escuchar_Relevo(struct tarea *t)
+{
+    struct relevo *relevo = (struct relevo *)t;
+    struct par *par;
+    pthread_t hilo;
+    int sock;
 
-    if ((byteRead = read(sock, buffer, sizeof(buffer)) != 0))
+    CO_INICIO(t);
+    while (relevo->cantidad > 0)
     {
-        if (byteRead <= 0)
+        CO_ESPERAR(t, relevo->escucha, EPOLLIN, RELEVO_ESPERA * 1000);
+        if (t->vencida)
+            break;
+        if ((sock = accept(relevo->escucha, NULL, NULL)) < 0)
+            continue;
+        relevo->cantidad--;
+        if ((par = malloc(sizeof(*par))) == NULL)
         {
-            perror("ERROR leyendo del socket");
+            close(sock);
+            continue;
         }
+        par->sock = sock;
+        par->nombre = relevo->nombre;
+        if (pthread_create(&hilo, NULL, hilo_Par, par) != 0)
+        {
+            perror("pthread_create");
+            hilo_Par(par);
+            continue;
+        }
+        pthread_detach(hilo);
     }
+    close(relevo->escucha);
+    free(relevo);
+    CO_FIN(t);
+}
 
-    printf("N° de paquetes a recibir: %s\n", buffer);
-    npackages = atoi(buffer);
+/**
+ * @brief Corrutina que vigila el hostname. /proc/sys no genera eventos de
+ *        inotify, pero el kernel marca con POLLPRI a los lectores de
+ *        kernel/hostname cuando cambia; entonces se descarta el valor
+ *        guardado y la proxima telemetria lo vuelve a leer.
+ * 
+ * @param t struct vigia
+ * @return int enum reactor_paso
+ */
+int vigilar_Hostname(struct tarea *t)
+{
+    struct vigia *vigia = (struct vigia *)t;
+    char nombre[TAM];
 
-    for (int i = 0; i <= npackages; i++)
+    CO_INICIO(t);
+    for (;;)
     {
-        usleep(1000);
-        memset(buffer, '\0', sizeof(buffer));
-        if ((byteRead = read(sock, buffer, sizeof(buffer))) != 0)
+        CO_ESPERAR(t, vigia->fd, EPOLLPRI, 0);
+        /* Se relee para que el proximo aviso sea de un cambio nuevo */
+        lseek(vigia->fd, 0, SEEK_SET);
+        if (read(vigia->fd, nombre, sizeof(nombre)) < 0)
+            break;
+        tlm_invalidar(1u << TLM_CAMPO_HOSTNAME);
+    }
+    close(vigia->fd);
+    CO_FIN(t);
+}
+
+/**
+ * @brief Arranca los ecos de un ping: uno en el flujo de la orden y otro en
+ *        un socket UDP en la direccion local de la conexion, cuyo puerto se
+ *        informa por el flujo ("0" si no se pudo abrir).
+ * 
+ * @param flujo 
+ * @return int 0, o -1 si no hay memoria
+ */
+int abrir_Eco(int flujo)
+{
+    struct sockaddr_storage direccion = direccion_local;
+    socklen_t largo = sizeof(direccion);
+    struct eco *tcp, *udp = NULL;
+    char buffer[TAM];
+    unsigned int puerto = 0;
+    int sock;
+
+    if ((tcp = malloc(sizeof(*tcp))) == NULL)
+        return -1;
+    if (direccion.ss_family == AF_INET6)
+        ((struct sockaddr_in6 *)&direccion)->sin6_port = 0;
+    else
+        ((struct sockaddr_in *)&direccion)->sin_port = 0;
+    if ((sock = socket(direccion.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0 ||
+        bind(sock, (struct sockaddr *)&direccion, largo) < 0 ||
+        getsockname(sock, (struct sockaddr *)&direccion, &largo) < 0 ||
+        (udp = malloc(sizeof(*udp))) == NULL)
+    {
+        perror("eco UDP");
+        if (sock >= 0)
+            close(sock);
+    }
+    else
+    {
+        puerto = ntohs(direccion.ss_family == AF_INET6 ? ((struct sockaddr_in6 *)&direccion)->sin6_port
+                                                       : ((struct sockaddr_in *)&direccion)->sin_port);
+        udp->fd = sock;
+        udp->udp = 1;
+        reactor_iniciar(reactor, &udp->tarea, atender_Eco);
+    }
+
+    memset(buffer, '\0', sizeof(buffer));
+    snprintf(buffer, sizeof(buffer), "%u", puerto);
+    write(flujo, buffer, sizeof(buffer));
+    tcp->fd = flujo;
+    tcp->udp = 0;
+    reactor_iniciar(reactor, &tcp->tarea, atender_Eco);
+    return 0;
+}
+
+/**
+ * @brief Corrutina de eco. La del flujo termina cuando la estacion lo
+ *        cierra; la UDP tras PING_ESPERA ms sin tramas.
+ * 
+ * @param t struct eco
+ * @return int enum reactor_paso
+ */
+int atender_Eco(struct tarea *t)
+{
+    struct eco *e = (struct eco *)t;
+    struct sockaddr_storage origen;
+    socklen_t largo = sizeof(origen);
+    char buffer[PING_TRAMA_MAX];
+    ssize_t n;
+
+    CO_INICIO(t);
+    for (;;)
+    {
+        CO_ESPERAR(t, e->fd, EPOLLIN, e->udp ? PING_ESPERA : 0);
+        if (t->vencida)
+            break;
+        if (!e->udp)
         {
-            if (byteRead <= 0)
-            {
-                perror("ERROR leyendo del socket");
-                continue;
-            }
+            if ((n = read(e->fd, buffer, sizeof(buffer))) <= 0 || write(e->fd, buffer, n) != n)
+                break;
+            continue;
         }
-        if ((write(new_exe, buffer, (size_t)byteRead) < 0))
+        while ((n = recvfrom(e->fd, buffer, sizeof(buffer), 0, (struct sockaddr *)&origen, &largo)) > 0)
         {
-            perror("ERROR escribiendo en el file");
-            exit(EXIT_FAILURE);
+            sendto(e->fd, buffer, n, 0, (struct sockaddr *)&origen, largo);
+            largo = sizeof(origen);
         }
     }
+    close(e->fd);
+    free(e);
+    CO_FIN(t);
+}
+
+/**
+ * @brief Envia el binario propio a un par, con la misma verificacion por
+ *        bloques que usa la estacion.
+ * 
+ * @param arg struct par
+ * @return void* 
+ */
+void *hilo_Par(void *arg)
+{
+    struct par *par = arg;
+
+    perfil_aplicar(par->sock, &perfil_activo->canal[CANAL_MASIVO]);
+    if (trf_enviar(par->sock, par->nombre, &perfil_activo->canal[CANAL_MASIVO]) > 0)
+        printf("Firmware reenviado a otro satelite\n");
+    else
+        printf("El par no pudo verificar el firmware reenviado\n");
+    close(par->sock);
+    free(par);
+    return NULL;
+}
+
+/**
+ * @brief Recibe el firmware del relevo de otro satelite, indicado por la
+ *        estacion como "ip:puerto sha256", y le responde el resultado. Sin
+ *        el resumen de la imagen no se instala nada.
+ * 
+ * @param sock flujo de la orden
+ * @param nombre nombre del ejecutable
+ * @return int 1 si el nuevo binario quedo instalado
+ */
+int relevo_Firmware(int sock, char *nombre)
+{
+    char buffer[TAM + 2 * SHA256_LEN];
+    unsigned char digesto[SHA256_LEN];
+    struct addrinfo pistas, *direccion;
+    char *host, *puerto, *resumen;
+    int par, r = 0, i = 0;
+
+    printf("=====================================\n\n");
+    printf("UPDATE FIRMWARE (relevo)\n\n");
+
     memset(buffer, '\0', sizeof(buffer));
+    read(sock, buffer, sizeof(buffer) - 1);
+    if ((resumen = strchr(buffer, ' ')) != NULL)
+    {
+        *resumen++ = '\0';
+        while (i < SHA256_LEN && sscanf(resumen + 2 * i, "%2hhx", &digesto[i]) == 1)
+            i++;
+    }
+    if (i < SHA256_LEN)
+    {
+        printf("Orden de relevo sin el SHA-256 de la imagen\n");
+        write(sock, "0", 1);
+        return 0;
+    }
+    memset(&pistas, 0, sizeof(pistas));
+    pistas.ai_family = AF_UNSPEC;
+    pistas.ai_socktype = SOCK_STREAM;
+    pistas.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+    if (dir_separar(buffer, &host, &puerto) == 0 && puerto != NULL &&
+        getaddrinfo(host, puerto, &pistas, &direccion) == 0)
+    {
+        par = socket(direccion->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (par >= 0 && connect(par, direccion->ai_addr, direccion->ai_addrlen) == 0)
+            r = instalar_Firmware(par, nombre, 0, NULL, digesto);
+        else
+            perror("conexion con el relevo");
+        if (par >= 0)
+            close(par);
+        freeaddrinfo(direccion);
+    }
+    write(sock, r ? "1" : "0", 1);
+    return r;
+}
+
+/**
+ * @brief Sobreescribe el proceso actual con el binario actualizado, que
+ *        reconecta con el servidor levantando ya la nueva version.
+ * 
+ * @param nombre 
+ * @param server 
+ */
+void reiniciar(char *nombre, char *server)
+{
+    char buffer[TAM];
 
     printf("Reiniciando...\n");
     printf("=====================================\n");
-    close(new_exe);
 
     memset(buffer, '\0', TAM);
     strcpy(buffer, "./");
-    strcat(buffer, old_name);
+    strncat(buffer, nombre, TAM - 3);
 
-    close(sock);
     sleep(5);
-    chmod(old_name, S_IRWXO | S_IRWXU | S_IRWXG);
+    fflush(stdout);
     char *args[] = {buffer, server, NULL};
     execvp(args[0], args);
+    perror("execvp");
 }
 
 /**
- * @brief Envia imagen satelital. Determina la cantidad de bytes de la
- *        imagen y luego obtiene la cantidad paquetes a ser enviados
- *        de tal manera que el protocolo TCP no lo fragmente.
+ * @brief Envia imagen satelital. La cabecera de la transferencia informa
+ *        el tamano exacto y la imagen se envia desde un mapeo en memoria
+ *        (ver trf_enviar), con el ajuste masivo del perfil activo, o en
+ *        rafaga UDP si la estacion lo pide (ver rafaga.h).
  * 
  * @param socket 
+ * @param estacion direccion de la estacion para la rafaga UDP, o NULL
  * @return int 
  */
-int start_Scanning(int socket)
+int start_Scanning(int socket, char *estacion)
 {
     printf("=====================================\n\n");
     printf("START SCANNING\n\n");
 
-    int send_img = 0;
-    int packages = 0;
-    struct stat buf;
-    if ((send_img = open("geoes.jpg", O_RDONLY)) < 0)
+    int r;
+    perfil_aplicar(socket, &perfil_activo->canal[CANAL_MASIVO]);
+    if (estacion != NULL)
+        r = enviar_Rafaga(socket, estacion, "geoes.jpg");
+    else
+        r = trf_enviar(socket, "geoes.jpg", &perfil_activo->canal[CANAL_MASIVO]);
+    if (r == 0)
     {
         printf("No existe la imagen\n");
-        return 0;
     }
-    memset(&packages, '\0', sizeof(packages));
-
-    int count;
-    char sendBuffer[FILE_BUFFER_SIZE];
-    memset(sendBuffer, '\0', sizeof(sendBuffer));
-    fstat(send_img, &buf);
-    off_t fileSize = buf.st_size;
-    printf("Tamaño de Imagen: %li\n", fileSize);
-    packages = fileSize / sizeof(sendBuffer);
-    printf("N° de paquetes a enviar : %i\n", packages);
-    memset(sendBuffer, '\0', sizeof(sendBuffer));
-
-    if (send(socket, &packages, sizeof(int), 0) < 0)
+    if (r > 0)
     {
-        perror("ERROR enviando");
+        printf("Finalizado envio de Imagen\n");
     }
+    printf("\n=====================================\n");
+    return r > 0;
+}
+
+/**
+ * @brief Saluda a la estacion por UDP en el puerto que ofrece por el flujo y
+ *        le envia el archivo en rafaga (ver rafaga.h).
+ * 
+ * @param flujo flujo de la orden
+ * @param estacion direccion de la estacion, "ip" o "ip:puerto"
+ * @param archivo
+ * @return int como raf_enviar_fd
+ */
+int enviar_Rafaga(int flujo, char *estacion, const char *archivo)
+{
+    char remoto[DIR_TEXTO_MAX], *host, *resto;
+    struct raf_ajuste ajuste;
+    int udp, fd, r;
 
-    while ((count = (int)read(send_img, sendBuffer, sizeof(sendBuffer))) > 0)
+    snprintf(remoto, sizeof(remoto), "%s", estacion);
+    dir_separar(remoto, &host, &resto);
+    if ((udp = raf_saludar(flujo, host, &ajuste)) < 0)
+        return -1;
+    fd = open(archivo, O_RDONLY | O_CLOEXEC);
+    r = raf_enviar_fd(flujo, udp, fd, &ajuste);
+    if (fd >= 0)
+        close(fd);
+    close(udp);
+    return r;
+}
+
+/**
+ * @brief Recibe un archivo en rafaga UDP desde la estacion.
+ * 
+ * @param flujo flujo de la orden
+ * @param estacion direccion de la estacion, "ip" o "ip:puerto"
+ * @param ruta
+ * @return long como raf_recibir
+ */
+long recibir_Rafaga(int flujo, char *estacion, const char *ruta)
+{
+    char remoto[DIR_TEXTO_MAX], *host, *resto;
+    struct raf_ajuste ajuste;
+    long r;
+    int udp;
+
+    snprintf(remoto, sizeof(remoto), "%s", estacion);
+    dir_separar(remoto, &host, &resto);
+    if ((udp = raf_saludar(flujo, host, &ajuste)) < 0)
+        return -1;
+    r = raf_recibir(flujo, udp, ruta, TRF_FSYNC_AL_FINAL);
+    close(udp);
+    return r;
+}
+
+/**
+ * @brief Prueba de ancho de banda pedida por la estacion: genera los bytes
+ *        de subida y descarta los de bajada a la vez, por el flujo de la
+ *        orden, y al terminar le devuelve su medida (ver anc_mover).
+ * 
+ * @param flujo 
+ * @return int 1 si la prueba se completo
+ */
+int prueba_Ancho(int flujo)
+{
+    struct anc_medida m;
+    unsigned long long bajada, subida;
+    char buffer[ANC_MENSAJE];
+
+    memset(buffer, '\0', sizeof(buffer));
+    if (recv(flujo, buffer, sizeof(buffer), MSG_WAITALL) != sizeof(buffer) ||
+        sscanf(buffer, "%llu %llu", &bajada, &subida) != 2)
+        return 0;
+    printf("=====================================\n\n");
+    printf("BANDWIDTH TEST\n\n");
+    if (anc_mover(flujo, socket_estacion, subida, bajada, &m) < 0)
     {
-        if (send(socket, sendBuffer, count, 0) < 0)
-        {
-            perror("ERROR enviando");
-        }
-        memset(sendBuffer, '\0', sizeof(sendBuffer));
+        printf("Prueba interrumpida\n");
+        return 0;
     }
-    close(send_img);
-    write(socket, sendBuffer, count);
-    printf("Finalizado envio de Imagen\n");
+    anc_enviar_medida(flujo, &m);
+    printf("Recibidos %.1f MB, enviados %.1f MB en %.2f s, CPU %.0f%%\n", (double)m.recibidos / ANC_MB,
+           (double)m.enviados / ANC_MB, m.total, 100 * (m.usuario + m.sistema) / m.total);
     printf("\n=====================================\n");
-    memset(sendBuffer, '\0', sizeof(sendBuffer));
     return 1;
 }
 
 /**
  * @brief Obtiene información relevante del sistema y lo envía al
- *        servidor mediante socket DATAGRAM.
+ *        servidor mediante socket DATAGRAM. Cada dato viaja con una
+ *        cabecera que identifica al satelite, ya que la estacion recibe
+ *        la telemetria de toda la flota por un mismo socket. Los datos se
+ *        encolan y se envian por lotes (ver tlm_emisor_vaciar).
+ *        La estacion envia el puerto UDP y la mascara de campos que quiere;
+ *        solo corren esos colectores, de menor a mayor costo, y cada clase
+ *        de costo se envia antes de muestrear la siguiente: un campo caro no
+ *        demora a los baratos. Los campos con vigencia salen de la cache
+ *        mientras no venzan (ver tlm_muestrear).
+ *        Antes de los datagramas se informa por el flujo la secuencia del
+ *        primero y cuantos son; los que la estacion no reciba los pide de
+ *        nuevo (ver reenviar_Telemetria).
+ *        Los campos de costo alto lanzan otro proceso: no corren en el
+ *        reactor sino en el pool de trabajos, con su secuencia apartada, y
+ *        avisan por op->listo; los envia enviar_Caros.
  * 
- * @param socketfd 
- * @param remote_host 
- * @return int 
+ * @param op consulta, con el pedido leido
+ * @return int 0, o -1 si el pedido no es valido, no se pudo enviar o la
+ *         estacion cerro el flujo
  */
-int obtener_Telemetria(int socketfd, char *remote_host)
+int obtener_Telemetria(struct operacion *op)
 {
     printf("=====================================\n\n");
     printf("ENVIANDO TELEMETRIA\n\n");
 
-    long minuto = 60;        //Variables usadas para acomodar el formato de
-    long hora = minuto * 60; //salida del uptime
-    long dia = hora * 24;    //probar con "define" desde las cabezeras
-                             //para no desperdiciar memoria.
+    char buffer[TAM2];
+    char remote_host_t[DIR_TEXTO_MAX];
+    snprintf(remote_host_t, sizeof(remote_host_t), "%s", op->server_ip);
+    char *server_ip, *resto;
+    dir_separar(remote_host_t, &server_ip, &resto);
+    /* El socket UDP se conserva entre pedidos mientras no cambie el puerto;
+       los pedidos pueden llegar en flujos simultaneos */
+    uint32_t rango[2], primera;
+    int puerto = 0, campos = 0, n;
+    unsigned int mascara;
 
-    struct sysinfo estructuraInformacion;
-    sysinfo(&estructuraInformacion); //Obtengo datos del sistema
-    long tiempo = estructuraInformacion.uptime;
+    op->listo = -1;
 
-    char buffer[TAM2];
-    char remote_host_t[20];
-    strcpy(remote_host_t, remote_host);
-    char *server_ip = strtok(remote_host_t, ":");
-    struct sockaddr_in dest_addr;
-    int sock_udp, puerto, n;
-    struct hostent *server;
+    /* "puerto mascara"; una estacion sin mascara pide todos los campos */
+    n = sscanf(op->pedido, "%d %x", &puerto, &mascara);
+    if (n < 1 || puerto <= 0 || puerto > 65535)
+    {
+        printf("Pedido de telemetria invalido: %.20s\n", op->pedido);
+        return -1;
+    }
+    if (n < 2)
+        mascara = TLM_TODOS;
+    mascara &= TLM_TODOS;
+    printf("Puerto a usar: %d - campos 0x%02x\n", puerto, mascara);
 
-    memset(buffer, '\0', sizeof(buffer));
+    pthread_mutex_lock(&consultas_mutex);
 
-    read(socketfd, buffer, sizeof(buffer));
-    puerto = atoi(buffer);
-    printf("Puerto a usar: %d\n", puerto);
+    if (puerto != puerto_consultas)
+    {
+        if (puerto_consultas != 0)
+            tlm_emisor_cerrar(&emisor_consultas);
+        generacion_consultas++;
+        //Levanta socket sin conexion como cliente
+        if (tlm_emisor_iniciar(&emisor_consultas, server_ip, puerto, TLM_EMISOR_MAX, TLM_EMISOR_LATENCIA) < 0)
+        {
+            perror("telemetria");
+            puerto_consultas = 0;
+            pthread_mutex_unlock(&consultas_mutex);
+            return -1;
+        }
+        puerto_consultas = puerto;
+    }
+    perfil_aplicar(emisor_consultas.sock, &perfil_activo->canal[CANAL_TELEMETRIA]);
 
-    //Levanta socket sin conexion como cliente
-    server = gethostbyname(server_ip);
-    if (server == NULL)
+    /* Antes de los datagramas, su primera secuencia y cuantos son: la
+       estacion sabe que esperar y que pedir de nuevo. Las secuencias se
+       apartan: otra consulta puede enviar mientras el pool muestrea */
+    for (int i = 0; i < TLM_CAMPOS; i++)
+        campos += (mascara >> i) & 1;
+    primera = tlm_emisor_reservar(&emisor_consultas, (uint32_t)campos);
+    op->generacion = generacion_consultas;
+    rango[0] = htonl(primera);
+    rango[1] = htonl((uint32_t)campos);
+    if (send(op->flujo, rango, sizeof(rango), MSG_NOSIGNAL) < 0)
     {
-        fprintf(stderr, "ERROR, no existe el host\n");
-        exit(0);
+        pthread_mutex_unlock(&consultas_mutex);
+        return -1;
     }
 
-    sock_udp = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sock_udp < 0)
+    for (int costo = 0; costo < TLM_COSTOS; costo++)
     {
-        perror("apertura de socket");
-        exit(1);
+        int encolados = 0;
+        for (int i = 0; i < TLM_CAMPOS; i++)
+        {
+            if (!(mascara & (1u << i)) || colectores[i].costo != (enum tlm_costo)costo)
+                continue;
+            if (costo >= TLM_COSTO_ALTO)
+            {
+                op->secuencia[i] = primera++;
+                op->caros |= 1u << i;
+                continue;
+            }
+            memset(buffer, '\0', sizeof(buffer));
+            int guardado = tlm_muestrear(&colectores[i], buffer);
+            /* Encola el dato; se envia junto con los de su clase de costo */
+            if (tlm_emisor_encolar_en(&emisor_consultas, primera++, (uint16_t)colectores[i].campo, buffer) < 0)
+            {
+                printf("No se pudo enviar la telemetria\n");
+                pthread_mutex_unlock(&consultas_mutex);
+                return -1;
+            }
+            printf("[%d-%d] %s%s\n", i + 1, TLM_CAMPOS, buffer, guardado ? " (cache)" : "");
+            encolados++;
+        }
+        if (encolados > 0 && tlm_emisor_vaciar(&emisor_consultas) < 0)
+        {
+            printf("No se pudo enviar la telemetria\n");
+            pthread_mutex_unlock(&consultas_mutex);
+            return -1;
+        }
+    }
+    pthread_mutex_unlock(&consultas_mutex);
+
+    if (op->caros != 0)
+    {
+        if ((op->listo = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        {
+            perror("eventfd");
+            muestrear_Caros(op);
+        }
+        else
+        {
+            struct trabajo trabajo = {muestrear_Caros, op, avisar_Caros, op};
+            trabajos_enviar(&trabajo);
+        }
     }
+    return 0;
+}
+
+/**
+ * @brief Trabajo del pool: muestrea los campos caros de una consulta.
+ * 
+ * @param arg struct operacion
+ */
+void muestrear_Caros(void *arg)
+{
+    struct operacion *op = arg;
+
+    for (int i = 0; i < TLM_CAMPOS; i++)
+        if (op->caros & (1u << i))
+            op->guardado[i] = tlm_muestrear(&colectores[i], op->valor[i]);
+}
+
+/**
+ * @brief Al terminar muestrear_Caros, en el hilo del pool: despierta a la
+ *        corrutina de la consulta.
+ * 
+ * @param arg struct operacion
+ */
+void avisar_Caros(void *arg)
+{
+    struct operacion *op = arg;
+    uint64_t uno = 1;
 
-    dest_addr.sin_family = AF_INET;
-    dest_addr.sin_port = htons(puerto);
-    dest_addr.sin_addr = *((struct in_addr *)server->h_addr);
+    if (write(op->listo, &uno, sizeof(uno)) < 0)
+        perror("eventfd");
+}
 
-    const int valor = 1;
-    setsockopt(sock_udp, SOL_SOCKET, SO_REUSEADDR, &valor, sizeof(valor));
+/**
+ * @brief Envia los campos caros de una consulta, ya muestreados, con las
+ *        secuencias que se le apartaron. Si el emisor se reabrio entre
+ *        tanto esas secuencias ya no valen y los campos se descartan: la
+ *        estacion los da por perdidos.
+ * 
+ * @param op 
+ * @return int 0, o -1 si no se pudo enviar
+ */
+int enviar_Caros(struct operacion *op)
+{
+    uint64_t avisos;
+    int r = 0;
 
-    memset(&(dest_addr.sin_zero), '\0', 8);
+    if (op->listo >= 0)
+    {
+        if (read(op->listo, &avisos, sizeof(avisos)) < 0)
+            perror("eventfd");
+        close(op->listo);
+        op->listo = -1;
+    }
+    if (op->caros == 0)
+    {
+        printf("\n=====================================\n\n");
+        return 0;
+    }
 
-    //Como son 7 datos a mostrar, cada vez que envio un dato aumento el indice
-    //para ir enviando otro dato
-    for (int i = 0; i < 7; i++)
+    pthread_mutex_lock(&consultas_mutex);
+    if (op->generacion != generacion_consultas || puerto_consultas == 0)
     {
-        memset(buffer, '\0', sizeof(buffer));
-        switch (i)
+        printf("El emisor de consultas cambio: se descartan los campos caros\n");
+        pthread_mutex_unlock(&consultas_mutex);
+        return 0;
+    }
+    for (int i = 0; i < TLM_CAMPOS && r == 0; i++)
+    {
+        if (!(op->caros & (1u << i)))
+            continue;
+        r = tlm_emisor_encolar_en(&emisor_consultas, op->secuencia[i], (uint16_t)colectores[i].campo, op->valor[i]);
+        printf("[%d-%d] %s%s\n", i + 1, TLM_CAMPOS, op->valor[i], op->guardado[i] ? " (cache)" : "");
+    }
+    if (r < 0 || tlm_emisor_vaciar(&emisor_consultas) < 0)
+    {
+        printf("No se pudo enviar la telemetria\n");
+        pthread_mutex_unlock(&consultas_mutex);
+        return -1;
+    }
+    pthread_mutex_unlock(&consultas_mutex);
+    printf("\n=====================================\n\n");
+    return 0;
+}
+
+/**
+ * @brief Reenvia los datagramas de consultas que la estacion pide por el
+ *        flujo: pares TLM_NACK, secuencia. La estacion escribe cada pedido
+ *        de una vez, asi que un par empezado se lee completo.
+ * 
+ * @param flujo 
+ * @return int 0 si la estacion cerro el flujo, 1 si no
+ */
+int reenviar_Telemetria(int flujo)
+{
+    uint32_t par[2];
+    ssize_t n;
+
+    while ((n = recv(flujo, par, sizeof(par), MSG_PEEK | MSG_DONTWAIT)) > 0)
+    {
+        if (recv(flujo, par, sizeof(par), MSG_WAITALL) != sizeof(par))
+            return 0;
+        if (ntohl(par[0]) != TLM_NACK)
+            continue;
+        pthread_mutex_lock(&consultas_mutex);
+        if (puerto_consultas != 0 && tlm_emisor_reenviar(&emisor_consultas, ntohl(par[1])) > 0)
+            printf("Reenviado el datagrama de telemetria %u\n", ntohl(par[1]));
+        pthread_mutex_unlock(&consultas_mutex);
+    }
+    return n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK) ? 0 : 1;
+}
+
+/**
+ * @brief Milisegundos que faltan hasta t, negativo si ya paso.
+ * 
+ * @param t 
+ * @return long 
+ */
+static long faltan(const struct timespec *t)
+{
+    struct timespec ahora;
+
+    clock_gettime(CLOCK_MONOTONIC, &ahora);
+    return (t->tv_sec - ahora.tv_sec) * 1000 + (t->tv_nsec - ahora.tv_nsec) / 1000000;
+}
+
+/**
+ * @brief Lee los acuses pendientes de la estacion (numeros de muestra de
+ *        4 bytes, en orden de red) y se queda con el mas nuevo. Un
+ *        TLM_NACK precede a la secuencia de un datagrama perdido, que se
+ *        reenvia si el emisor todavia lo retiene.
+ * 
+ * @param tx 
+ * @return int 0 si la estacion cerro el flujo, 1 si no
+ */
+static int leer_Acuses(struct transmision *tx)
+{
+    unsigned char buffer[256];
+    uint32_t numero;
+    ssize_t n;
+
+    while ((n = recv(tx->flujo, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0)
+    {
+        for (ssize_t i = 0; i < n; i++)
         {
-        case 0:
-            sprintf(buffer, "ID satelite: %d", getpid()); //Tomo como id del satelite al pid del proceso actual
-            break;
-        case 1:
-            getfirmware_version(buffer);
-            break;
-        case 2:
-            sprintf(buffer, "Uptime : %ld dias, %ld:%02ld:%02ld",
-                    tiempo / dia, (tiempo % dia) / hora,
-                    (tiempo % hora) / minuto, tiempo % minuto);
-            break;
-        case 3:
-            bootTime(buffer);
-            break;
-        case 4:
-            hostname(buffer);
-            break;
-        case 5:
-            memoria(buffer);
-            break;
-        case 6:
-            CPU(buffer);
+            tx->acuse[tx->acuse_n++] = buffer[i];
+            if (tx->acuse_n < 4)
+                continue;
+            memcpy(&numero, tx->acuse, 4);
+            numero = ntohl(numero);
+            tx->acuse_n = 0;
+            if (tx->nack)
+            {
+                tx->nack = 0;
+                if (tx->emisor != NULL && tlm_emisor_reenviar(tx->emisor, numero) > 0)
+                    tx->reenviados++;
+            }
+            else if (numero == TLM_NACK)
+                tx->nack = 1;
+            else if ((int64_t)numero > tx->acusada && numero < tx->enviadas)
+                tx->acusada = numero;
+        }
+    }
+    return n == 0 ? 0 : 1;
+}
+
+/**
+ * @brief Envia las tramas juntadas en un datagrama.
+ * 
+ * @param tx 
+ * @return int 0 o -1 si fallo el envio
+ */
+static int enviar_Paquete(struct transmision *tx)
+{
+    if (tx->paquete_n == 0)
+        return 0;
+    if (tlm_emisor_encolar_datos(tx->emisor, TLM_TRAMA, tx->paquete, tx->paquete_n) < 0)
+        return -1;
+    tx->bytes += TLM_CABECERA_LEN + tx->paquete_n;
+    tx->paquete_n = 0;
+    tx->paquete_ms = 0;
+    return 0;
+}
+
+/**
+ * @brief Corrutina de la telemetria continua. La estacion pide "puerto
+ *        muestras periodo mascara"; cada periodo (ms) se toma una muestra de
+ *        los campos de la mascara y se envia como una trama compacta: clave
+ *        cada TLM_CLAVE_CADA muestras o si la estacion no acuso ninguna que
+ *        siga en la historia, delta contra la ultima acusada si no. Entre
+ *        muestras se leen los acuses. Las tramas se juntan en un datagrama
+ *        mientras la primera no espere mas de TLM_PAQUETE_ESPERA ms. Al
+ *        terminar se informa "tramas bytes claves datagramas" por el flujo
+ *        y se siguen atendiendo los pedidos de reenvio hasta que la
+ *        estacion lo cierre. El emisor es nuevo: sus secuencias empiezan en 0.
+ * 
+ * @param t struct transmision
+ * @return int enum reactor_paso
+ */
+int transmitir_Telemetria(struct tarea *t)
+{
+    struct transmision *tx = (struct transmision *)t;
+    const struct tlm_muestra *ref;
+    struct tlm_muestra m;
+    unsigned char trama[TLM_CARGA_MAX];
+    char buffer[TAM2], remoto[DIR_TEXTO_MAX], *server_ip, *resto;
+    unsigned int muestras = 0, periodo = 0, mascara = 0;
+    int puerto;
+    long resta;
+    size_t largo;
+
+    CO_INICIO(t);
+    /* El pedido ocupa TAM2 bytes; lo que sigue en el flujo son acuses. Se
+       junta sin bloquear el reactor */
+    do
+        CO_ESPERAR(t, tx->flujo, EPOLLIN, 0);
+    while (leer_Pedido(tx->flujo, tx->pedido, &tx->pedido_n, TAM2, 1) == 0);
+    snprintf(remoto, sizeof(remoto), "%s", tx->server_ip);
+    dir_separar(remoto, &server_ip, &resto);
+    if (sscanf(tx->pedido, "%d %u %u %x", &puerto, &muestras, &periodo, &mascara) < 4)
+    {
+        /* Un pedido a medias no deja valores a medias */
+        printf("Pedido de telemetria continua invalido: %.20s\n", tx->pedido);
+        muestras = periodo = mascara = 0;
+    }
+    else if ((tx->emisor = malloc(sizeof(*tx->emisor))) == NULL ||
+             tlm_emisor_iniciar(tx->emisor, server_ip, puerto, 1, 0) < 0)
+    {
+        perror("telemetria continua");
+        free(tx->emisor);
+        tx->emisor = NULL;
+        muestras = 0;
+    }
+    if (tx->emisor != NULL)
+        perfil_aplicar(tx->emisor->sock, &perfil_activo->canal[CANAL_TELEMETRIA]);
+    tx->muestras = muestras;
+    tx->periodo = (int)periodo;
+    tx->magnitudes = tlm_magnitudes(mascara & TLM_TODOS);
+    tx->acusada = -1;
+    tlm_historia_iniciar(&tx->historia);
+    printf("Telemetria continua: %u muestras cada %u ms - campos 0x%02x\n", muestras, periodo, mascara & TLM_TODOS);
+
+    clock_gettime(CLOCK_MONOTONIC, &tx->proxima);
+    while (tx->enviadas < tx->muestras)
+    {
+        medir_Muestra(&m, tx->magnitudes);
+        m.numero = tx->enviadas;
+        ref = NULL;
+        if (m.numero % TLM_CLAVE_CADA != 0 && tx->acusada >= 0)
+            ref = tlm_historia_buscar(&tx->historia, (uint32_t)tx->acusada);
+        largo = tlm_trama_codificar(&m, ref, trama, sizeof(trama) - 1);
+        tlm_historia_guardar(&tx->historia, &m);
+        if (tx->paquete_n + 1 + largo > sizeof(tx->paquete) && enviar_Paquete(tx) < 0)
             break;
-        default:
+        tx->paquete[tx->paquete_n++] = (unsigned char)largo;
+        memcpy(tx->paquete + tx->paquete_n, trama, largo);
+        tx->paquete_n += largo;
+        tx->claves += ref == NULL;
+        tx->enviadas++;
+        /* La siguiente trama haria esperar de mas a la primera */
+        tx->paquete_ms += tx->periodo;
+        if ((tx->paquete_ms > TLM_PAQUETE_ESPERA || tx->enviadas == tx->muestras) && enviar_Paquete(tx) < 0)
             break;
-        }
-        sleep(1);
-        /* Envío de datagrama al servidor */
-        n = sendto(sock_udp, buffer, TAM2, 0, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
-        if (n < 0)
+
+        tx->proxima.tv_nsec += (long)tx->periodo * 1000000;
+        tx->proxima.tv_sec += tx->proxima.tv_nsec / 1000000000;
+        tx->proxima.tv_nsec %= 1000000000;
+        /* Hasta la proxima muestra se atienden los acuses */
+        while (tx->enviadas < tx->muestras && (resta = faltan(&tx->proxima)) > 0)
         {
-            perror("sendto");
-            exit(1);
+            CO_ESPERAR(t, tx->flujo, EPOLLIN, resta);
+            if (!t->vencida && !leer_Acuses(tx))
+                tx->muestras = tx->enviadas; /* la estacion corto */
         }
-        printf("[%d-7] %s\n", i + 1, buffer);
-    } //fin for
-    //finaliza socket sin conexion
+    }
+
     memset(buffer, '\0', sizeof(buffer));
-    printf("\n=====================================\n\n");
-    close(sock_udp);
-    return 0;
+    snprintf(buffer, sizeof(buffer), "%u %lu %lu %u", tx->enviadas, tx->bytes, tx->claves,
+             tx->emisor != NULL ? tx->emisor->secuencia : 0);
+    write(tx->flujo, buffer, strlen(buffer) + 1);
+    /* La estacion pide los datagramas del final que perdio hasta cerrar */
+    do
+        CO_ESPERAR(t, tx->flujo, EPOLLIN, TLM_PLAZO);
+    while (!t->vencida && leer_Acuses(tx));
+    printf("Telemetria continua: %u tramas, %lu bytes, %lu claves, %lu datagramas reenviados\n", tx->enviadas,
+           tx->bytes, tx->claves, tx->reenviados);
+    if (tx->emisor != NULL)
+    {
+        tlm_emisor_cerrar(tx->emisor);
+        free(tx->emisor);
+    }
+    close(tx->flujo);
+    free(tx);
+    CO_FIN(t);
+}
+
+/**
+ * @brief Toma una muestra numerica de los valores pedidos. Los campos que
+ *        cambian poco (firmware, hostname) salen de la cache de la consulta
+ *        de texto; el resto se lee de sysinfo y /proc/stat.
+ * 
+ * @param m 
+ * @param magnitudes bit (1 << magnitud)
+ */
+void medir_Muestra(struct tlm_muestra *m, uint32_t magnitudes)
+{
+    char buffer[TAM2], linea[BUFSIZE], *valor;
+    unsigned long long usuario, prioridad, sistema, ocioso;
+    unsigned long arranque;
+    struct sysinfo info;
+    FILE *fd;
+
+    memset(m, 0, sizeof(*m));
+    m->presentes = magnitudes;
+    m->valor[TLM_MAG_ID] = getpid();
+    if (magnitudes & (1u << TLM_MAG_FIRMWARE))
+    {
+        memset(buffer, '\0', sizeof(buffer));
+        tlm_muestrear(&colectores[TLM_CAMPO_FIRMWARE], buffer);
+        valor = strchr(buffer, ':');
+        m->valor[TLM_MAG_FIRMWARE] = strtol(valor != NULL ? valor + 1 : buffer, NULL, 10);
+    }
+    if (magnitudes & (1u << TLM_MAG_HOSTNAME))
+    {
+        memset(buffer, '\0', sizeof(buffer));
+        tlm_muestrear(&colectores[TLM_CAMPO_HOSTNAME], buffer);
+        valor = strchr(buffer, ':');
+        snprintf(m->hostname, sizeof(m->hostname), "%.*s", TLM_NOMBRE_MAX - 1, valor != NULL ? valor + 2 : buffer);
+    }
+
+    sysinfo(&info);
+    m->valor[TLM_MAG_UPTIME] = info.uptime;
+    m->valor[TLM_MAG_MEM_TOTAL] = (int64_t)info.totalram * info.mem_unit / (1024 * 1024);
+    m->valor[TLM_MAG_MEM_LIBRE] = (int64_t)info.freeram * info.mem_unit / (1024 * 1024);
+
+    if (!(magnitudes & ((1u << TLM_MAG_ARRANQUE) | (1u << TLM_MAG_CPU))) ||
+        (fd = fopen("/proc/stat", "r")) == NULL)
+        return;
+    while (fgets(linea, sizeof(linea), fd) != NULL)
+    {
+        /* Igual que el campo de texto: (user + system) / (user + system + idle) */
+        if (!strncmp(linea, "cpu ", 4) &&
+            sscanf(linea + 4, "%llu %llu %llu %llu", &usuario, &prioridad, &sistema, &ocioso) == 4 &&
+            usuario + sistema + ocioso > 0)
+            m->valor[TLM_MAG_CPU] = (int64_t)((usuario + sistema) * 100ULL * TLM_CPU_ESCALA /
+                                              (usuario + sistema + ocioso));
+        else if (sscanf(linea, "btime %lu", &arranque) == 1)
+            m->valor[TLM_MAG_ARRANQUE] = (int64_t)arranque;
+    }
+    fclose(fd);
 }
 
 /**
@@ -501,6 +1671,36 @@ void getValue(char *file, char *value, char *key)
     return;
 }
 
+/**
+ * @brief ID del satelite: el PID del proceso actual.
+ * 
+ * @param buffer 
+ */
+void id_Satelite(char *buffer)
+{
+    sprintf(buffer, "ID satelite: %d", getpid());
+}
+
+/**
+ * @brief Tiempo desde el arranque del sistema, segun sysinfo.
+ * 
+ * @param buffer 
+ */
+void tiempo_Activo(char *buffer)
+{
+    long minuto = 60;        //Variables usadas para acomodar el formato de
+    long hora = minuto * 60; //salida del uptime
+    long dia = hora * 24;
+
+    struct sysinfo estructuraInformacion;
+    sysinfo(&estructuraInformacion); //Obtengo datos del sistema
+    long tiempo = estructuraInformacion.uptime;
+
+    sprintf(buffer, "Uptime : %ld dias, %ld:%02ld:%02ld",
+            tiempo / dia, (tiempo % dia) / hora,
+            (tiempo % hora) / minuto, tiempo % minuto);
+}
+
 /**
  * @brief Get the firmware version object
  * 
@@ -545,7 +1745,7 @@ void CPU(char *buffer)
     strcat(buffer, "CPU: ");
     strcat(buffer, cpu);
     strcat(buffer, "%");
-    fclose(fp);
+    pclose(fp);
 }
 
 /**
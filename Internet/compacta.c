@@ -0,0 +1,285 @@
+/**
+ * @file compacta.c
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Codificacion de las tramas compactas de telemetria. Formato:
+ *        tipo (u8), numero de muestra (varint) y, en las delta, la distancia
+ *        a la referencia (varint); luego la mascara de valores presentes
+ *        (varint) y cada valor en orden de bit: los numericos en varint
+ *        zigzag (el valor en las clave, la diferencia en las delta) y el
+ *        hostname como largo (varint) y bytes.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "compacta.h"
+
+/* Campo de la consulta de texto del que sale cada valor */
+static const enum tlm_campo tlm_origen[TLM_MAGNITUDES + 1] = {
+    [TLM_MAG_ID] = TLM_CAMPO_ID,
+    [TLM_MAG_FIRMWARE] = TLM_CAMPO_FIRMWARE,
+    [TLM_MAG_UPTIME] = TLM_CAMPO_UPTIME,
+    [TLM_MAG_ARRANQUE] = TLM_CAMPO_ARRANQUE,
+    [TLM_MAG_MEM_TOTAL] = TLM_CAMPO_MEMORIA,
+    [TLM_MAG_MEM_LIBRE] = TLM_CAMPO_MEMORIA,
+    [TLM_MAG_CPU] = TLM_CAMPO_CPU,
+    [TLM_MAG_HOSTNAME] = TLM_CAMPO_HOSTNAME,
+};
+
+/**
+ * @brief Valores que corresponden a una mascara de campos.
+ *
+ * @param campos bit (1 << campo)
+ * @return uint32_t bit (1 << magnitud), incluido TLM_MAG_HOSTNAME
+ */
+uint32_t tlm_magnitudes(uint32_t campos)
+{
+    uint32_t mascara = 0;
+
+    for (int i = 0; i <= TLM_MAGNITUDES; i++)
+        if (campos & (1u << tlm_origen[i]))
+            mascara |= 1u << i;
+    return mascara;
+}
+
+void tlm_historia_iniciar(struct tlm_historia *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+void tlm_historia_guardar(struct tlm_historia *h, const struct tlm_muestra *m)
+{
+    h->muestra[m->numero % TLM_HISTORIA] = *m;
+}
+
+/**
+ * @brief Busca una muestra por numero.
+ *
+ * @param h
+ * @param numero
+ * @return const struct tlm_muestra* NULL si ya fue reemplazada o no llego
+ */
+const struct tlm_muestra *tlm_historia_buscar(const struct tlm_historia *h, uint32_t numero)
+{
+    const struct tlm_muestra *m = &h->muestra[numero % TLM_HISTORIA];
+
+    return m->presentes != 0 && m->numero == numero ? m : NULL;
+}
+
+/**
+ * @brief Escribe un entero sin signo en varint: 7 bits por byte, el bit
+ *        alto indica que sigue otro byte.
+ *
+ * @param p
+ * @param fin
+ * @param v
+ * @return unsigned char* posicion siguiente, o NULL si no entra
+ */
+static unsigned char *tlm_varint_escribir(unsigned char *p, const unsigned char *fin, uint64_t v)
+{
+    do
+    {
+        if (p == fin)
+            return NULL;
+        *p++ = (unsigned char)((v & 0x7F) | (v > 0x7F ? 0x80 : 0));
+        v >>= 7;
+    } while (v != 0);
+    return p;
+}
+
+/**
+ * @brief Lee un varint.
+ *
+ * @param p
+ * @param fin
+ * @param v
+ * @return const unsigned char* posicion siguiente, o NULL si esta cortado
+ */
+static const unsigned char *tlm_varint_leer(const unsigned char *p, const unsigned char *fin, uint64_t *v)
+{
+    *v = 0;
+    for (int corrimiento = 0; corrimiento < 64; corrimiento += 7)
+    {
+        if (p == fin)
+            return NULL;
+        *v |= (uint64_t)(*p & 0x7F) << corrimiento;
+        if (!(*p++ & 0x80))
+            return p;
+    }
+    return NULL;
+}
+
+/* Zigzag: los enteros chicos, positivos o negativos, ocupan pocos bytes */
+static uint64_t tlm_zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t tlm_dezigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/**
+ * @brief Codifica una muestra como trama clave, o como delta si hay
+ *        referencia. En una delta solo van los valores que cambiaron.
+ *
+ * @param m
+ * @param ref muestra que el receptor ya tiene, o NULL para una clave
+ * @param dst
+ * @param max
+ * @return size_t bytes escritos, 0 si no entra en max
+ */
+size_t tlm_trama_codificar(const struct tlm_muestra *m, const struct tlm_muestra *ref,
+                           unsigned char *dst, size_t max)
+{
+    const unsigned char *fin = dst + max;
+    unsigned char *p = dst;
+    uint32_t cambios = m->presentes;
+    size_t largo;
+
+    if (ref != NULL)
+    {
+        for (int i = 0; i < TLM_MAGNITUDES; i++)
+            if ((cambios & (1u << i)) && (ref->presentes & (1u << i)) && m->valor[i] == ref->valor[i])
+                cambios &= ~(1u << i);
+        if ((cambios & (1u << TLM_MAG_HOSTNAME)) && (ref->presentes & (1u << TLM_MAG_HOSTNAME)) &&
+            !strcmp(m->hostname, ref->hostname))
+            cambios &= ~(1u << TLM_MAG_HOSTNAME);
+    }
+
+    if (p == fin)
+        return 0;
+    *p++ = ref != NULL ? TLM_DELTA : TLM_CLAVE;
+    if ((p = tlm_varint_escribir(p, fin, m->numero)) == NULL)
+        return 0;
+    if (ref != NULL && (p = tlm_varint_escribir(p, fin, m->numero - ref->numero)) == NULL)
+        return 0;
+    if ((p = tlm_varint_escribir(p, fin, cambios)) == NULL)
+        return 0;
+    for (int i = 0; i < TLM_MAGNITUDES; i++)
+    {
+        if (!(cambios & (1u << i)))
+            continue;
+        int64_t v = m->valor[i] - (ref != NULL && (ref->presentes & (1u << i)) ? ref->valor[i] : 0);
+        if ((p = tlm_varint_escribir(p, fin, tlm_zigzag(v))) == NULL)
+            return 0;
+    }
+    if (cambios & (1u << TLM_MAG_HOSTNAME))
+    {
+        largo = strnlen(m->hostname, TLM_NOMBRE_MAX - 1);
+        if ((p = tlm_varint_escribir(p, fin, largo)) == NULL || (size_t)(fin - p) < largo)
+            return 0;
+        memcpy(p, m->hostname, largo);
+        p += largo;
+    }
+    return (size_t)(p - dst);
+}
+
+/**
+ * @brief Decodifica una trama. Los valores que una delta no trae se toman
+ *        de la referencia.
+ *
+ * @param src
+ * @param n
+ * @param h historia del receptor, donde se busca la referencia
+ * @param m recibe la muestra
+ * @return int TLM_CLAVE o TLM_DELTA, -1 si la trama es invalida o
+ *         TLM_SIN_REFERENCIA
+ */
+int tlm_trama_decodificar(const unsigned char *src, size_t n, const struct tlm_historia *h,
+                          struct tlm_muestra *m)
+{
+    const unsigned char *fin = src + n, *p = src;
+    const struct tlm_muestra *ref = NULL;
+    uint64_t numero, distancia = 0, cambios, v;
+    int tipo;
+
+    if (n == 0 || (*p != TLM_CLAVE && *p != TLM_DELTA))
+        return -1;
+    tipo = *p++;
+    if ((p = tlm_varint_leer(p, fin, &numero)) == NULL)
+        return -1;
+    if (tipo == TLM_DELTA && (p = tlm_varint_leer(p, fin, &distancia)) == NULL)
+        return -1;
+    if ((p = tlm_varint_leer(p, fin, &cambios)) == NULL || cambios >> (TLM_MAGNITUDES + 1))
+        return -1;
+
+    if (tipo == TLM_DELTA)
+    {
+        if ((ref = tlm_historia_buscar(h, (uint32_t)(numero - distancia))) == NULL)
+            return TLM_SIN_REFERENCIA;
+        *m = *ref;
+    }
+    else
+        memset(m, 0, sizeof(*m));
+    m->numero = (uint32_t)numero;
+    m->presentes |= (uint32_t)cambios;
+
+    for (int i = 0; i < TLM_MAGNITUDES; i++)
+    {
+        if (!(cambios & (1u << i)))
+            continue;
+        if ((p = tlm_varint_leer(p, fin, &v)) == NULL)
+            return -1;
+        m->valor[i] = (ref != NULL && (ref->presentes & (1u << i)) ? ref->valor[i] : 0) + tlm_dezigzag(v);
+    }
+    if (cambios & (1u << TLM_MAG_HOSTNAME))
+    {
+        if ((p = tlm_varint_leer(p, fin, &v)) == NULL || v >= TLM_NOMBRE_MAX || v > (uint64_t)(fin - p))
+            return -1;
+        memcpy(m->hostname, p, v);
+        m->hostname[v] = '\0';
+    }
+    return tipo;
+}
+
+/**
+ * @brief Escribe un campo de la muestra con el texto de la consulta
+ *        comun, para mostrarlo y para comparar con lo que ocuparia ese
+ *        formato.
+ *
+ * @param m
+ * @param campo
+ * @param texto
+ * @param largo
+ * @return int caracteres escritos, 0 si la muestra no trae el campo
+ */
+int tlm_muestra_texto(const struct tlm_muestra *m, enum tlm_campo campo, char *texto, size_t largo)
+{
+    long t;
+    time_t arranque;
+    char fecha[40];
+
+    if (!(m->presentes & tlm_magnitudes(1u << campo)))
+        return 0;
+    switch (campo)
+    {
+    case TLM_CAMPO_ID:
+        return snprintf(texto, largo, "ID satelite: %lld", (long long)m->valor[TLM_MAG_ID]);
+    case TLM_CAMPO_FIRMWARE:
+        return snprintf(texto, largo, "Version Firmware: %lld", (long long)m->valor[TLM_MAG_FIRMWARE]);
+    case TLM_CAMPO_UPTIME:
+        t = (long)m->valor[TLM_MAG_UPTIME];
+        return snprintf(texto, largo, "Uptime : %ld dias, %ld:%02ld:%02ld",
+                        t / 86400, (t % 86400) / 3600, (t % 3600) / 60, t % 60);
+    case TLM_CAMPO_ARRANQUE:
+        arranque = (time_t)m->valor[TLM_MAG_ARRANQUE];
+        strftime(fecha, sizeof(fecha), "%c", localtime(&arranque));
+        return snprintf(texto, largo, "Boot Time: %s", fecha);
+    case TLM_CAMPO_HOSTNAME:
+        return snprintf(texto, largo, "Hostname: %s", m->hostname);
+    case TLM_CAMPO_MEMORIA:
+        return snprintf(texto, largo, "MemTotal: %lld - MemFree: %lld",
+                        (long long)m->valor[TLM_MAG_MEM_TOTAL], (long long)m->valor[TLM_MAG_MEM_LIBRE]);
+    case TLM_CAMPO_CPU:
+        return snprintf(texto, largo, "CPU: %g%%", (double)m->valor[TLM_MAG_CPU] / TLM_CPU_ESCALA);
+    default:
+        return 0;
+    }
+}
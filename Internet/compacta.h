@@ -0,0 +1,82 @@
+/**
+ * @file compacta.h
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Formato compacto para la telemetria continua. En lugar de un
+ *        datagrama de texto por campo, cada muestra viaja en una sola trama
+ *        binaria con los valores como enteros (o punto fijo) codificados en
+ *        varint. Una trama clave lleva todos los valores; una trama delta
+ *        solo las diferencias con una muestra de referencia, la ultima que
+ *        la estacion acuso recibir, y omite los valores que no cambiaron.
+ *        Cada TLM_CLAVE_CADA muestras se envia una clave, de modo que una
+ *        estacion que perdio la referencia se recupera sin pedir nada.
+ *        Las tramas de varias muestras seguidas viajan juntas en un
+ *        datagrama con la cabecera de telemetria y campo TLM_TRAMA, cada una
+ *        precedida por su largo (u8), hasta TLM_PAQUETE_ESPERA ms.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef COMPACTA_H
+#define COMPACTA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "telemetria.h"
+
+#define TLM_TRAMA 0x8000      /* campo de la cabecera de un datagrama de tramas */
+#define TLM_CLAVE_CADA 32     /* muestras entre tramas clave */
+#define TLM_HISTORIA 64       /* muestras que recuerdan emisor y receptor */
+#define TLM_ACUSE_CADA 8      /* muestras entre acuses de la estacion */
+#define TLM_NOMBRE_MAX 64     /* hostname en una trama */
+#define TLM_PAQUETE_ESPERA 20 /* ms que una trama espera a las siguientes en su datagrama */
+
+/* Valores numericos de una muestra. Un campo de texto de la consulta puede
+   dar mas de un valor (memoria: total y libre) */
+enum tlm_magnitud
+{
+    TLM_MAG_ID,
+    TLM_MAG_FIRMWARE,
+    TLM_MAG_UPTIME,    /* s */
+    TLM_MAG_ARRANQUE,  /* s desde 1970 */
+    TLM_MAG_MEM_TOTAL, /* MB */
+    TLM_MAG_MEM_LIBRE, /* MB */
+    TLM_MAG_CPU,       /* %, con TLM_CPU_ESCALA */
+    TLM_MAGNITUDES
+};
+#define TLM_MAG_HOSTNAME TLM_MAGNITUDES /* bit del unico valor de texto */
+#define TLM_CPU_ESCALA 10000            /* cuatro decimales, como el texto */
+
+/* Tipos de trama */
+enum tlm_trama_tipo
+{
+    TLM_CLAVE,
+    TLM_DELTA
+};
+#define TLM_SIN_REFERENCIA -2 /* delta cuya referencia no esta en la historia */
+
+struct tlm_muestra
+{
+    uint32_t numero;
+    uint32_t presentes; /* bit (1 << magnitud); 0 si el lugar esta libre */
+    int64_t valor[TLM_MAGNITUDES];
+    char hostname[TLM_NOMBRE_MAX];
+};
+
+/* Ultimas muestras, indexadas por numero */
+struct tlm_historia
+{
+    struct tlm_muestra muestra[TLM_HISTORIA];
+};
+
+uint32_t tlm_magnitudes(uint32_t);
+void tlm_historia_iniciar(struct tlm_historia *);
+void tlm_historia_guardar(struct tlm_historia *, const struct tlm_muestra *);
+const struct tlm_muestra *tlm_historia_buscar(const struct tlm_historia *, uint32_t);
+size_t tlm_trama_codificar(const struct tlm_muestra *, const struct tlm_muestra *, unsigned char *, size_t);
+int tlm_trama_decodificar(const unsigned char *, size_t, const struct tlm_historia *, struct tlm_muestra *);
+int tlm_muestra_texto(const struct tlm_muestra *, enum tlm_campo, char *, size_t);
+
+#endif
@@ -0,0 +1,202 @@
+/**
+ * @file correccion.c
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Reed-Solomon sistematico sobre GF(256), polinomio 0x11d. Las
+ *        operaciones sobre trozos usan la tabla completa de productos
+ *        (64 KB): cada byte cuesta una lectura y un XOR por coeficiente.
+ *        Para reconstruir, los trozos de datos presentes se descuentan de
+ *        la paridad y queda un sistema de Cauchy de e x e con las e
+ *        columnas faltantes, siempre invertible, que se resuelve por
+ *        Gauss-Jordan.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <string.h>
+#include <pthread.h>
+
+#include "correccion.h"
+
+#define COR_POLI 0x11d
+
+static uint8_t cor_exp[2 * 255];
+static uint8_t cor_log[256];
+static uint8_t cor_mul[256][256];
+static pthread_once_t cor_una_vez = PTHREAD_ONCE_INIT;
+
+static void cor_iniciar(void)
+{
+    unsigned int x = 1;
+
+    for (int i = 0; i < 255; i++)
+    {
+        cor_exp[i] = cor_exp[i + 255] = (uint8_t)x;
+        cor_log[x] = (uint8_t)i;
+        x <<= 1;
+        if (x & 0x100)
+            x ^= COR_POLI;
+    }
+    for (int a = 1; a < 256; a++)
+        for (int b = 1; b < 256; b++)
+            cor_mul[a][b] = cor_exp[cor_log[a] + cor_log[b]];
+}
+
+static uint8_t cor_inverso(uint8_t a)
+{
+    return cor_exp[255 - cor_log[a]];
+}
+
+/**
+ * @brief Coeficiente de la fila de paridad sobre la columna de datos.
+ *
+ * @param k trozos de datos del grupo
+ * @param fila
+ * @param columna
+ * @return uint8_t
+ */
+static uint8_t cor_coeficiente(int k, int fila, int columna)
+{
+    return cor_inverso((uint8_t)((k + fila) ^ columna));
+}
+
+/**
+ * @brief destino += coeficiente * origen, byte a byte.
+ *
+ * @param destino
+ * @param origen
+ * @param coeficiente
+ * @param largo
+ */
+static void cor_sumar(unsigned char *destino, const unsigned char *origen, uint8_t coeficiente, size_t largo)
+{
+    const uint8_t *tabla = cor_mul[coeficiente];
+
+    if (coeficiente == 0)
+        return;
+    if (coeficiente == 1)
+    {
+        for (size_t i = 0; i < largo; i++)
+            destino[i] ^= origen[i];
+        return;
+    }
+    for (size_t i = 0; i < largo; i++)
+        destino[i] ^= tabla[origen[i]];
+}
+
+/**
+ * @brief Filas de paridad distintas de un grupo de k trozos.
+ *
+ * @param k
+ * @return int
+ */
+int cor_filas(int k)
+{
+    return COR_FILAS - k;
+}
+
+/**
+ * @brief Calcula una fila de paridad.
+ *
+ * @param datos k trozos de largo bytes
+ * @param k
+ * @param fila 0 .. cor_filas(k) - 1
+ * @param paridad recibe largo bytes
+ * @param largo
+ */
+void cor_codificar(const unsigned char *const *datos, int k, int fila, unsigned char *paridad, size_t largo)
+{
+    pthread_once(&cor_una_vez, cor_iniciar);
+    memset(paridad, 0, largo);
+    for (int c = 0; c < k; c++)
+        cor_sumar(paridad, datos[c], cor_coeficiente(k, fila, c), largo);
+}
+
+/**
+ * @brief Reconstruye los trozos de datos faltantes de un grupo a partir de
+ *        tantas filas de paridad como faltantes.
+ *
+ * @param datos k trozos; los faltantes reciben el resultado
+ * @param k
+ * @param faltan indices de los e trozos faltantes
+ * @param e
+ * @param paridad e trozos de paridad; se modifican
+ * @param filas fila de cada trozo de paridad, distintas
+ * @param largo
+ * @return int 0, o -1 si los parametros no son validos
+ */
+int cor_decodificar(unsigned char **datos, int k, const int *faltan, int e, unsigned char **paridad,
+                    const int *filas, size_t largo)
+{
+    uint8_t a[COR_FILAS][COR_FILAS], inv[COR_FILAS][COR_FILAS];
+    char falta[COR_FILAS];
+
+    pthread_once(&cor_una_vez, cor_iniciar);
+    if (k <= 0 || k >= COR_FILAS || e < 0 || e > k)
+        return -1;
+    memset(falta, 0, sizeof(falta));
+    for (int m = 0; m < e; m++)
+        falta[faltan[m]] = 1;
+
+    /* Se descuentan los datos presentes: queda paridad = A * faltantes */
+    for (int j = 0; j < e; j++)
+    {
+        if (filas[j] < 0 || filas[j] >= cor_filas(k))
+            return -1;
+        for (int c = 0; c < k; c++)
+            if (!falta[c])
+                cor_sumar(paridad[j], datos[c], cor_coeficiente(k, filas[j], c), largo);
+        for (int m = 0; m < e; m++)
+        {
+            a[j][m] = cor_coeficiente(k, filas[j], faltan[m]);
+            inv[j][m] = j == m;
+        }
+    }
+
+    /* Gauss-Jordan: toda submatriz de Cauchy es invertible, pero se
+       verifica el pivote por si las filas vinieran repetidas */
+    for (int col = 0; col < e; col++)
+    {
+        int piv = col;
+        while (piv < e && a[piv][col] == 0)
+            piv++;
+        if (piv == e)
+            return -1;
+        if (piv != col)
+            for (int m = 0; m < e; m++)
+            {
+                uint8_t t = a[col][m];
+                a[col][m] = a[piv][m];
+                a[piv][m] = t;
+                t = inv[col][m];
+                inv[col][m] = inv[piv][m];
+                inv[piv][m] = t;
+            }
+        uint8_t f = cor_inverso(a[col][col]);
+        for (int m = 0; m < e; m++)
+        {
+            a[col][m] = cor_mul[f][a[col][m]];
+            inv[col][m] = cor_mul[f][inv[col][m]];
+        }
+        for (int j = 0; j < e; j++)
+        {
+            uint8_t g = a[j][col];
+            if (j == col || g == 0)
+                continue;
+            for (int m = 0; m < e; m++)
+            {
+                a[j][m] ^= cor_mul[g][a[col][m]];
+                inv[j][m] ^= cor_mul[g][inv[col][m]];
+            }
+        }
+    }
+
+    for (int m = 0; m < e; m++)
+    {
+        memset(datos[faltan[m]], 0, largo);
+        for (int j = 0; j < e; j++)
+            cor_sumar(datos[faltan[m]], paridad[j], inv[m][j], largo);
+    }
+    return 0;
+}
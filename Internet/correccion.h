@@ -0,0 +1,30 @@
+/**
+ * @file correccion.h
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Codigo de borrado Reed-Solomon sobre GF(256) para la correccion de
+ *        errores hacia adelante de las rafagas UDP. Un grupo de k trozos de
+ *        datos del mismo largo se protege con filas de paridad: la fila j es
+ *        la combinacion de los datos con los coeficientes de una matriz de
+ *        Cauchy, 1 / (x_j + y_c) con x_j = k + j e y_c = c. Cualquier
+ *        subconjunto de k trozos, de datos o de paridad, reconstruye el
+ *        grupo, y hay COR_FILAS - k filas distintas: el emisor puede seguir
+ *        generando paridad nueva para reparar sin saber que trozos faltan.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef CORRECCION_H
+#define CORRECCION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define COR_FILAS 256 /* trozos distintos de un grupo, datos y paridad */
+
+int cor_filas(int);
+void cor_codificar(const unsigned char *const *, int, int, unsigned char *, size_t);
+int cor_decodificar(unsigned char **, int, const int *, int, unsigned char **, const int *, size_t);
+
+#endif
@@ -0,0 +1,276 @@
+/**
+ * @file direcciones.c
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Lectura y escritura de direcciones "host:puerto" en IPv4 e IPv6, y
+ *        apertura de los sockets en los que escucha la estacion. Un socket
+ *        en [::] se abre con doble pila (IPV6_V6ONLY en 0) y atiende tambien
+ *        a los satelites IPv4, que se ven como ::ffff:a.b.c.d; al escribirlas
+ *        se muestran como IPv4.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "direcciones.h"
+
+/**
+ * @brief Separa "host:puerto" en el lugar. El host IPv6 va entre corchetes;
+ *        una IPv6 sin corchetes se toma como host sin puerto.
+ *
+ * @param texto se modifica
+ * @param host recibe el host, "" si no hay
+ * @param puerto recibe el puerto, NULL si no hay
+ * @return int 0, o -1 si faltan el corchete de cierre o el puerto tras ':'
+ */
+int dir_separar(char *texto, char **host, char **puerto)
+{
+    char *fin, *dos_puntos;
+
+    *puerto = NULL;
+    if (texto[0] == '[')
+    {
+        if ((fin = strchr(texto, ']')) == NULL)
+            return -1;
+        *fin = '\0';
+        *host = texto + 1;
+        if (fin[1] == '\0')
+            return 0;
+        if (fin[1] != ':' || fin[2] == '\0')
+            return -1;
+        *puerto = fin + 2;
+        return 0;
+    }
+    *host = texto;
+    dos_puntos = strchr(texto, ':');
+    if (dos_puntos == NULL || strchr(dos_puntos + 1, ':') != NULL)
+        return 0;
+    *dos_puntos = '\0';
+    if (dos_puntos[1] == '\0')
+        return -1;
+    *puerto = dos_puntos + 1;
+    return 0;
+}
+
+/**
+ * @brief Escribe una direccion como "a.b.c.d:puerto" o "[ipv6]:puerto". Las
+ *        IPv4 vistas por un socket de doble pila se escriben como IPv4.
+ *
+ * @param sa
+ * @param texto
+ * @param largo al menos DIR_TEXTO_MAX
+ * @return const char* texto
+ */
+const char *dir_texto(const struct sockaddr *sa, char *texto, size_t largo)
+{
+    char ip[INET6_ADDRSTRLEN], interfaz[IF_NAMESIZE];
+
+    if (sa->sa_family == AF_INET)
+    {
+        const struct sockaddr_in *v4 = (const struct sockaddr_in *)sa;
+        inet_ntop(AF_INET, &v4->sin_addr, ip, sizeof(ip));
+        snprintf(texto, largo, "%s:%u", ip, ntohs(v4->sin_port));
+    }
+    else if (sa->sa_family == AF_INET6)
+    {
+        const struct sockaddr_in6 *v6 = (const struct sockaddr_in6 *)sa;
+        if (IN6_IS_ADDR_V4MAPPED(&v6->sin6_addr))
+        {
+            inet_ntop(AF_INET, &v6->sin6_addr.s6_addr[12], ip, sizeof(ip));
+            snprintf(texto, largo, "%s:%u", ip, ntohs(v6->sin6_port));
+        }
+        else
+        {
+            inet_ntop(AF_INET6, &v6->sin6_addr, ip, sizeof(ip));
+            if (v6->sin6_scope_id != 0 && if_indextoname(v6->sin6_scope_id, interfaz) != NULL)
+                snprintf(texto, largo, "[%s%%%s]:%u", ip, interfaz, ntohs(v6->sin6_port));
+            else
+                snprintf(texto, largo, "[%s]:%u", ip, ntohs(v6->sin6_port));
+        }
+    }
+    else
+        snprintf(texto, largo, "(familia %d)", sa->sa_family);
+    return texto;
+}
+
+/**
+ * @brief Agrega una direccion a la lista con el puerto indicado.
+ *
+ * @param sa
+ * @param puerto en orden de host
+ * @param escuchas
+ * @param n cantidad ya cargada
+ * @param max
+ * @return int nueva cantidad
+ */
+static int dir_agregar(const struct sockaddr *sa, unsigned int puerto,
+                       struct dir_escucha *escuchas, int n, int max)
+{
+    struct dir_escucha *d;
+
+    if (n >= max)
+    {
+        fprintf(stderr, "Mas de %d direcciones de escucha, se ignoran las demas\n", max);
+        return n;
+    }
+    d = &escuchas[n];
+    memset(d, 0, sizeof(*d));
+    if (sa->sa_family == AF_INET)
+    {
+        d->largo = sizeof(struct sockaddr_in);
+        memcpy(&d->direccion, sa, d->largo);
+        ((struct sockaddr_in *)&d->direccion)->sin_port = htons(puerto);
+    }
+    else
+    {
+        d->largo = sizeof(struct sockaddr_in6);
+        memcpy(&d->direccion, sa, d->largo);
+        ((struct sockaddr_in6 *)&d->direccion)->sin6_port = htons(puerto);
+    }
+    return n + 1;
+}
+
+/**
+ * @brief Convierte una especificacion de escucha en direcciones locales:
+ *        "*[:puerto]" (todas, doble pila), "interfaz[:puerto]" (todas las
+ *        direcciones de la interfaz), o una IP o nombre de host, IPv6 entre
+ *        corchetes si lleva puerto. Sin puerto se usa DIR_PUERTO.
+ *
+ * @param especificacion
+ * @param escuchas recibe las direcciones
+ * @param max lugares en escuchas
+ * @return int cantidad de direcciones, o -1 si no se pudo resolver
+ */
+int dir_resolver(const char *especificacion, struct dir_escucha *escuchas, int max)
+{
+    char texto[256], *host, *puerto, *fin;
+    unsigned long numero;
+    struct addrinfo pistas, *res, *r;
+    struct ifaddrs *interfaces, *i;
+    int n = 0, prueba, error;
+
+    snprintf(texto, sizeof(texto), "%s", especificacion);
+    if (dir_separar(texto, &host, &puerto) < 0)
+    {
+        fprintf(stderr, "Direccion de escucha invalida: %s\n", especificacion);
+        return -1;
+    }
+    if (puerto == NULL)
+        puerto = DIR_PUERTO;
+    numero = strtoul(puerto, &fin, 10);
+    if (*fin != '\0' || numero > 65535)
+    {
+        fprintf(stderr, "Puerto invalido: %s\n", puerto);
+        return -1;
+    }
+
+    if (host[0] == '\0' || !strcmp(host, "*"))
+    {
+        struct sockaddr_in6 v6 = {0};
+        struct sockaddr_in v4 = {0};
+
+        /* Doble pila si el equipo tiene IPv6 */
+        if ((prueba = socket(AF_INET6, SOCK_STREAM, 0)) >= 0)
+        {
+            close(prueba);
+            v6.sin6_family = AF_INET6;
+            v6.sin6_addr = in6addr_any;
+            return dir_agregar((struct sockaddr *)&v6, numero, escuchas, 0, max);
+        }
+        v4.sin_family = AF_INET;
+        v4.sin_addr.s_addr = htonl(INADDR_ANY);
+        return dir_agregar((struct sockaddr *)&v4, numero, escuchas, 0, max);
+    }
+
+    if (if_nametoindex(host) != 0)
+    {
+        if (getifaddrs(&interfaces) < 0)
+        {
+            perror("getifaddrs");
+            return -1;
+        }
+        for (i = interfaces; i != NULL; i = i->ifa_next)
+        {
+            if (i->ifa_addr == NULL || strcmp(i->ifa_name, host) ||
+                (i->ifa_addr->sa_family != AF_INET && i->ifa_addr->sa_family != AF_INET6))
+                continue;
+            if (dir_agregar(i->ifa_addr, numero, escuchas, n, max) == n)
+                break;
+            n++;
+            /* Las de enlace local solo existen dentro de su interfaz */
+            if (i->ifa_addr->sa_family == AF_INET6 &&
+                IN6_IS_ADDR_LINKLOCAL(&((struct sockaddr_in6 *)i->ifa_addr)->sin6_addr))
+                ((struct sockaddr_in6 *)&escuchas[n - 1].direccion)->sin6_scope_id = if_nametoindex(host);
+        }
+        freeifaddrs(interfaces);
+        if (n == 0)
+            fprintf(stderr, "La interfaz %s no tiene direcciones IP\n", host);
+        return n > 0 ? n : -1;
+    }
+
+    memset(&pistas, 0, sizeof(pistas));
+    pistas.ai_family = AF_UNSPEC;
+    pistas.ai_socktype = SOCK_STREAM;
+    pistas.ai_flags = AI_PASSIVE;
+    if ((error = getaddrinfo(host, NULL, &pistas, &res)) != 0)
+    {
+        fprintf(stderr, "%s: %s\n", host, gai_strerror(error));
+        return -1;
+    }
+    for (r = res; r != NULL; r = r->ai_next)
+        n = dir_agregar(r->ai_addr, numero, escuchas, n, max);
+    freeaddrinfo(res);
+    return n;
+}
+
+/**
+ * @brief Abre un socket ligado a la direccion. Si es de flujo queda
+ *        escuchando con la cola maxima del sistema.
+ *
+ * @param d
+ * @param tipo SOCK_STREAM o SOCK_DGRAM, admite SOCK_NONBLOCK
+ * @return int descriptor, o -1 en caso de error
+ */
+int dir_abrir(const struct dir_escucha *d, int tipo)
+{
+    const struct sockaddr_in6 *v6 = (const struct sockaddr_in6 *)&d->direccion;
+    char texto[DIR_TEXTO_MAX];
+    int fd, si = 1, solo_v6;
+
+    if ((fd = socket(d->direccion.ss_family, tipo, 0)) < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+    if (d->direccion.ss_family == AF_INET6)
+    {
+        /* Solo [::] atiende tambien IPv4 */
+        solo_v6 = !IN6_IS_ADDR_UNSPECIFIED(&v6->sin6_addr);
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &solo_v6, sizeof(solo_v6));
+    }
+    if ((tipo & ~(SOCK_NONBLOCK | SOCK_CLOEXEC)) == SOCK_STREAM)
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &si, sizeof(si));
+
+    if (bind(fd, (const struct sockaddr *)&d->direccion, d->largo) < 0 ||
+        ((tipo & ~(SOCK_NONBLOCK | SOCK_CLOEXEC)) == SOCK_STREAM && listen(fd, SOMAXCONN) < 0))
+    {
+        int error = errno;
+        fprintf(stderr, "ligadura %s: %s\n", dir_texto((const struct sockaddr *)&d->direccion, texto, sizeof(texto)),
+                strerror(error));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
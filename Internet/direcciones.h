@@ -0,0 +1,38 @@
+/**
+ * @file direcciones.h
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Direcciones IPv4/IPv6 compartidas por satelite y estacion. Las
+ *        direcciones se escriben "host:puerto", con el host IPv6 entre
+ *        corchetes ("[::1]:6020"). La estacion escucha en una lista de
+ *        direcciones: cada una puede ser una IP, un nombre de host, el nombre
+ *        de una interfaz (todas sus direcciones) o "*", que es [::] con doble
+ *        pila, o 0.0.0.0 si el equipo no tiene IPv6.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef DIRECCIONES_H
+#define DIRECCIONES_H
+
+#include <stddef.h>
+#include <sys/socket.h>
+
+#define DIR_PUERTO "6020"       /* puerto de la estacion si no se indica */
+#define DIR_TEXTO_MAX 64        /* "[ipv6%interfaz]:puerto" */
+#define DIR_MAX_ESCUCHAS 16     /* direcciones en las que escucha la estacion */
+
+/* Direccion local en la que escucha la estacion */
+struct dir_escucha
+{
+    struct sockaddr_storage direccion;
+    socklen_t largo;
+};
+
+int dir_separar(char *, char **, char **);
+const char *dir_texto(const struct sockaddr *, char *, size_t);
+int dir_resolver(const char *, struct dir_escucha *, int);
+int dir_abrir(const struct dir_escucha *, int);
+
+#endif
@@ -0,0 +1,918 @@
+/**
+ * @file enlace.c
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Emulador de enlace satelital. Se ubica entre los satelites y la
+ *        estacion: acepta sus conexiones TCP y sus datagramas UDP en la
+ *        direccion de escucha y los reenvia a la estacion, y las respuestas
+ *        al satelite, haciendolos pasar por un enlace con demora, variacion,
+ *        perdidas, reordenamiento y tasa limitada, con valores propios para
+ *        la bajada (estacion -> satelite) y la subida.
+ *        El enlace transmite de a un paquete: un segmento TCP de hasta
+ *        ENL_SEGMENTO bytes o un datagrama. Cada sentido tiene una cola de
+ *        hasta -q KB delante de la tasa; los datagramas que no entran se
+ *        descartan y los segmentos esperan, lo que frena al emisor TCP. Como
+ *        el enlace termina las conexiones TCP, un segmento perdido no se
+ *        pierde: llega una ida y vuelta despues, como con una retransmision
+ *        rapida, vuelve a ocupar el enlace y demora a los que le siguen; por
+ *        lo mismo los segmentos no se reordenan. Un datagrama reordenado se
+ *        retiene ENL_REORDEN ms para que lo adelanten los siguientes.
+ *        La telemetria UDP se envia al puerto de la estacion en la direccion
+ *        del enlace, asi que el enlace debe escuchar en el mismo puerto que
+ *        la estacion (por ejemplo la estacion en 127.0.0.2:6020 y el enlace
+ *        en 127.0.0.1:6020). El eco UDP del ping lo inicia la estacion hacia
+ *        la direccion del satelite que ve, la del enlace, y no lo atraviesa.
+ *        Las rafagas UDP de escaneos y firmware (ver rafaga.h) usan otro
+ *        puerto de la estacion: con un puerto fijo (canal udp ... <puerto>)
+ *        y -u con ese puerto, tambien pasan por el enlace.
+ *        Uso: ./enlace [opciones] <escucha> <estacion host:puerto>
+ *          -d <ms>      demora de un sentido
+ *          -j <ms>      variacion de la demora, uniforme entre 0 y el valor
+ *          -p <%>       paquetes perdidos
+ *          -o <%>       datagramas reordenados
+ *          -b <kbit/s>  tasa, 0 sin limite
+ *          -q <KB>      cola delante de la tasa
+ *          -s <semilla> del azar, para repetir una corrida
+ *          -u <puerto>  otro puerto UDP a reenviar, repetible
+ *        Cada valor puede darse como <bajada>/<subida>.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "direcciones.h"
+
+#define ENL_SEGMENTO 1448              /* bytes de un segmento TCP en el enlace */
+#define ENL_DATAGRAMA 65536
+#define ENL_COLA 256                   /* KB de cola por sentido si no se indica */
+#define ENL_MEMORIA (32 * 1024 * 1024) /* bytes en vuelo por sentido de una conexion */
+#define ENL_REORDEN 10                 /* ms que se retiene un datagrama reordenado */
+#define ENL_MAX_CONEXIONES 64
+#define ENL_MAX_ORIGENES 256           /* satelites que envian UDP a la vez */
+#define ENL_UDP_ESPERA 60000           /* ms sin datagramas tras los que se olvida un origen */
+#define ENL_LOTE 64                    /* lecturas por descriptor y vuelta */
+#define ENL_MAX_PUERTOS 8              /* puertos UDP reenviados, con el de la estacion */
+#define ENL_POLL_MAX (1 + ENL_MAX_PUERTOS + 2 * ENL_MAX_CONEXIONES + ENL_MAX_ORIGENES)
+
+/* Sentidos del enlace */
+enum
+{
+    BAJADA, /* estacion -> satelite */
+    SUBIDA  /* satelite -> estacion */
+};
+
+static const char *nombres[2] = {"bajada", "subida"};
+
+/* Condiciones de un sentido del enlace */
+struct parametros
+{
+    uint64_t demora, variacion;   /* ns */
+    double perdida, reorden;      /* probabilidades */
+    double tasa;                  /* bit/s, 0 sin limite */
+    size_t cola;                  /* bytes */
+};
+
+struct paquete
+{
+    struct paquete *sig;
+    uint64_t llegada, entrega;    /* ns */
+    size_t largo, enviado;
+    unsigned char datos[];
+};
+
+/* Un sentido de una conexion o de un origen UDP */
+struct sentido
+{
+    const struct parametros *p;
+    struct paquete *primero, *ultimo; /* por hora de entrega */
+    uint64_t libre;               /* ns en que la tasa termina con lo encolado */
+    uint64_t ultima;              /* entrega del ultimo segmento TCP */
+    size_t en_vuelo;              /* bytes encolados aun no entregados */
+    int bloqueado;                /* el destino no admitio mas */
+    struct estadistica
+    {
+        uint64_t paquetes, bytes, perdidos, descartados, reordenados;
+        uint64_t entregados, demora; /* demora: suma en ns */
+    } e;
+};
+
+struct conexion
+{
+    int fd[2];                    /* [BAJADA] lado del satelite, [SUBIDA] lado de la estacion */
+    struct sentido sentido[2];
+    int fin[2];                   /* el origen del sentido cerro */
+    int cerrado[2];               /* se cerro la escritura del destino */
+    uint64_t inicio;
+    unsigned int numero;
+};
+
+/* Puerto UDP reenviado: escucha en la direccion del enlace y entrega en
+   el mismo puerto de la estacion */
+struct puerto_udp
+{
+    int fd;
+    struct sockaddr_storage estacion;
+};
+
+/* Satelite que envia datagramas a un puerto: su socket conectado a la
+   estacion recibe las respuestas */
+struct origen
+{
+    struct sockaddr_storage satelite;
+    socklen_t largo;
+    int puerto;                   /* indice en puertos */
+    int fd;
+    uint64_t ultimo;              /* ns del ultimo datagrama */
+    struct sentido sentido[2];
+};
+
+static struct parametros parametros[2];
+static struct sockaddr_storage estacion;
+static socklen_t estacion_largo;
+static unsigned short azar[3];
+static struct conexion *conexiones[ENL_MAX_CONEXIONES];
+static struct origen *origenes[ENL_MAX_ORIGENES];
+static struct puerto_udp puertos[ENL_MAX_PUERTOS];
+static int n_puertos = 0;
+static struct estadistica totales[2][2]; /* [tcp][sentido] */
+static volatile sig_atomic_t terminar = 0;
+
+int leer_Valor(const char *, double, double[2]);
+int resolver_Estacion(char *);
+int abrir_Puerto(struct dir_escucha *, unsigned int);
+void aceptar(int, uint64_t);
+void recibir_Udp(int, uint64_t);
+void atender_Conexion(struct conexion *, struct pollfd *, uint64_t);
+void atender_Origen(struct origen *, uint64_t);
+int encolar(struct sentido *, const unsigned char *, size_t, int, uint64_t);
+int entregar(struct sentido *, int, int, const struct sockaddr_storage *, socklen_t, uint64_t);
+void cerrar_Conexion(struct conexion *, uint64_t);
+void vaciar(struct sentido *, struct estadistica *);
+void informar(const char *, const struct estadistica *);
+uint64_t despertar(const struct sentido *, uint64_t);
+uint64_t admite(const struct sentido *, uint64_t);
+uint64_t ahora_ns(void);
+void al_terminar(int);
+
+int main(int argc, char *argv[])
+{
+    struct dir_escucha escucha;
+    struct pollfd pf[ENL_POLL_MAX];
+    struct sigaction sa;
+    char texto[DIR_TEXTO_MAX], texto2[DIR_TEXTO_MAX];
+    double v[2];
+    unsigned int extra[ENL_MAX_PUERTOS];
+    int opcion, fd_tcp, n, n_extra = 0, semilla = 1;
+
+    memset(parametros, 0, sizeof(parametros));
+    parametros[BAJADA].cola = parametros[SUBIDA].cola = ENL_COLA * 1024;
+    while ((opcion = getopt(argc, argv, "d:j:p:o:b:q:s:u:")) != -1)
+    {
+        if (opcion == 's')
+        {
+            semilla = atoi(optarg);
+            continue;
+        }
+        if (opcion == 'u')
+        {
+            int puerto = atoi(optarg);
+            if (n_extra == ENL_MAX_PUERTOS - 1 || puerto <= 0 || puerto > 65535)
+            {
+                opcion = '?';
+                break;
+            }
+            extra[n_extra++] = (unsigned int)puerto;
+            continue;
+        }
+        if (leer_Valor(optarg, opcion == 'p' || opcion == 'o' ? 100 : 1, v) < 0)
+            opcion = '?';
+        for (int s = 0; s < 2; s++)
+            switch (opcion)
+            {
+            case 'd':
+                parametros[s].demora = (uint64_t)(v[s] * 1e6);
+                break;
+            case 'j':
+                parametros[s].variacion = (uint64_t)(v[s] * 1e6);
+                break;
+            case 'p':
+                parametros[s].perdida = v[s] / 100;
+                break;
+            case 'o':
+                parametros[s].reorden = v[s] / 100;
+                break;
+            case 'b':
+                parametros[s].tasa = v[s] * 1000;
+                break;
+            case 'q':
+                parametros[s].cola = (size_t)(v[s] * 1024);
+                break;
+            }
+        if (opcion == '?')
+            break;
+    }
+    if (opcion == '?' || argc - optind != 2)
+    {
+        fprintf(stderr, "Uso: %s [-d ms] [-j ms] [-p %%] [-o %%] [-b kbit/s] [-q KB] [-s semilla] [-u puerto] "
+                        "<escucha> <estacion host:puerto>\n"
+                        "     cada valor puede darse como <bajada>/<subida>\n",
+                argv[0]);
+        exit(1);
+    }
+    azar[0] = 0x330e;
+    azar[1] = (unsigned short)semilla;
+    azar[2] = (unsigned short)(semilla >> 16);
+
+    if (resolver_Estacion(argv[optind + 1]) < 0 || dir_resolver(argv[optind], &escucha, 1) < 1 ||
+        (fd_tcp = dir_abrir(&escucha, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0 ||
+        abrir_Puerto(&escucha, 0) < 0)
+        exit(1);
+    for (int i = 0; i < n_extra; i++)
+        if (abrir_Puerto(&escucha, extra[i]) < 0)
+            exit(1);
+
+    dir_texto((struct sockaddr *)&escucha.direccion, texto, sizeof(texto));
+    dir_texto((struct sockaddr *)&estacion, texto2, sizeof(texto2));
+    printf("Enlace %s -> estacion %s\n", texto, texto2);
+    if (strcmp(strrchr(texto, ':'), strrchr(texto2, ':')))
+        printf("Aviso: la telemetria UDP va al puerto de la estacion; con otro puerto no pasa por el enlace\n");
+    for (int i = 0; i < n_extra; i++)
+        printf("  UDP tambien en el puerto %u\n", extra[i]);
+    for (int s = 0; s < 2; s++)
+    {
+        const struct parametros *p = &parametros[s];
+        printf("  %s: demora %.1f ms + 0..%.1f ms, %.2f%% perdidas, %.2f%% reordenados, ", nombres[s],
+               p->demora / 1e6, p->variacion / 1e6, 100 * p->perdida, 100 * p->reorden);
+        if (p->tasa > 0)
+            printf("%.0f kbit/s, cola %zu KB\n", p->tasa / 1000, p->cola / 1024);
+        else
+            printf("sin limite de tasa\n");
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = al_terminar;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    while (!terminar)
+    {
+        uint64_t ahora = ahora_ns(), proximo = ahora + 1000000000ULL;
+
+        n = 0;
+        pf[n++] = (struct pollfd){fd_tcp, POLLIN, 0};
+        for (int i = 0; i < n_puertos; i++)
+            pf[n++] = (struct pollfd){puertos[i].fd, POLLIN, 0};
+        for (int i = 0; i < ENL_MAX_CONEXIONES; i++)
+        {
+            struct conexion *c = conexiones[i];
+            if (c == NULL)
+                continue;
+            for (int lado = 0; lado < 2; lado++)
+            {
+                /* El lado del satelite es origen de la subida y destino de la bajada */
+                struct sentido *sale = &c->sentido[lado == BAJADA ? SUBIDA : BAJADA], *entra = &c->sentido[lado];
+                short eventos = 0;
+                if (!c->fin[lado == BAJADA ? SUBIDA : BAJADA] && admite(sale, ahora) <= ahora)
+                    eventos |= POLLIN;
+                if (entra->bloqueado)
+                    eventos |= POLLOUT;
+                pf[n++] = (struct pollfd){c->fd[lado], eventos, 0};
+            }
+            for (int s = 0; s < 2; s++)
+            {
+                uint64_t t = despertar(&c->sentido[s], ahora);
+                uint64_t a = c->fin[s] ? UINT64_MAX : admite(&c->sentido[s], ahora);
+                t = a > ahora && a < t ? a : t;
+                proximo = t < proximo ? t : proximo;
+            }
+        }
+        for (int i = 0; i < ENL_MAX_ORIGENES; i++)
+        {
+            struct origen *o = origenes[i];
+            if (o == NULL)
+                continue;
+            pf[n++] = (struct pollfd){o->fd, POLLIN, 0};
+            for (int s = 0; s < 2; s++)
+            {
+                uint64_t t = despertar(&o->sentido[s], ahora);
+                proximo = t < proximo ? t : proximo;
+            }
+        }
+
+        if (poll(pf, n, (int)((proximo - ahora + 999999) / 1000000)) < 0 && errno != EINTR)
+        {
+            perror("poll");
+            break;
+        }
+        ahora = ahora_ns();
+        if (pf[0].revents & POLLIN)
+            aceptar(fd_tcp, ahora);
+        for (int i = 0; i < n_puertos; i++)
+            if (pf[1 + i].revents & POLLIN)
+                recibir_Udp(i, ahora);
+        n = 1 + n_puertos;
+        for (int i = 0; i < ENL_MAX_CONEXIONES; i++)
+            if (conexiones[i] != NULL)
+            {
+                /* Una conexion aceptada en esta vuelta no tiene entradas en pf */
+                if (pf[n].fd == conexiones[i]->fd[BAJADA])
+                {
+                    atender_Conexion(conexiones[i], &pf[n], ahora);
+                    n += 2;
+                }
+            }
+        for (int i = 0; i < ENL_MAX_ORIGENES; i++)
+            if (origenes[i] != NULL)
+            {
+                if (pf[n].fd == origenes[i]->fd)
+                    n++;
+                atender_Origen(origenes[i], ahora);
+                if (origenes[i]->sentido[BAJADA].primero == NULL && origenes[i]->sentido[SUBIDA].primero == NULL &&
+                    ahora - origenes[i]->ultimo > ENL_UDP_ESPERA * 1000000ULL)
+                {
+                    vaciar(&origenes[i]->sentido[BAJADA], &totales[0][BAJADA]);
+                    vaciar(&origenes[i]->sentido[SUBIDA], &totales[0][SUBIDA]);
+                    close(origenes[i]->fd);
+                    free(origenes[i]);
+                    origenes[i] = NULL;
+                }
+            }
+    }
+
+    for (int i = 0; i < ENL_MAX_CONEXIONES; i++)
+        if (conexiones[i] != NULL)
+            cerrar_Conexion(conexiones[i], ahora_ns());
+    for (int i = 0; i < ENL_MAX_ORIGENES; i++)
+        if (origenes[i] != NULL)
+        {
+            vaciar(&origenes[i]->sentido[BAJADA], &totales[0][BAJADA]);
+            vaciar(&origenes[i]->sentido[SUBIDA], &totales[0][SUBIDA]);
+        }
+    printf("Totales\n");
+    informar("TCP bajada", &totales[1][BAJADA]);
+    informar("TCP subida", &totales[1][SUBIDA]);
+    informar("UDP bajada", &totales[0][BAJADA]);
+    informar("UDP subida", &totales[0][SUBIDA]);
+    return 0;
+}
+
+/**
+ * @brief Lee "<valor>" o "<bajada>/<subida>".
+ *
+ * @param texto
+ * @param maximo mayor valor admitido, 0 sin limite
+ * @param v recibe el valor de cada sentido
+ * @return int 0, o -1 si no es valido
+ */
+int leer_Valor(const char *texto, double maximo, double v[2])
+{
+    char *fin;
+
+    v[BAJADA] = strtod(texto, &fin);
+    v[SUBIDA] = v[BAJADA];
+    if (*fin == '/')
+        v[SUBIDA] = strtod(fin + 1, &fin);
+    if (fin == texto || *fin != '\0' || v[BAJADA] < 0 || v[SUBIDA] < 0 ||
+        (maximo > 1 && (v[BAJADA] > maximo || v[SUBIDA] > maximo)))
+        return -1;
+    return 0;
+}
+
+/**
+ * @brief Resuelve la direccion de la estacion, la misma para TCP y UDP.
+ *
+ * @param direccion "host:puerto", se modifica
+ * @return int 0 o -1
+ */
+int resolver_Estacion(char *direccion)
+{
+    struct addrinfo pistas, *res;
+    char *host, *puerto;
+
+    if (dir_separar(direccion, &host, &puerto) < 0 || puerto == NULL)
+    {
+        fprintf(stderr, "Direccion de la estacion: <IPv4>:<Puerto> o [<IPv6>]:<Puerto>\n");
+        return -1;
+    }
+    memset(&pistas, 0, sizeof(pistas));
+    pistas.ai_family = AF_UNSPEC;
+    pistas.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, puerto, &pistas, &res) != 0)
+    {
+        fprintf(stderr, "ERROR, no existe el host\n");
+        return -1;
+    }
+    memcpy(&estacion, res->ai_addr, res->ai_addrlen);
+    estacion_largo = res->ai_addrlen;
+    freeaddrinfo(res);
+    return 0;
+}
+
+/**
+ * @brief Abre un puerto UDP reenviado, en la direccion de escucha y con su
+ *        destino en la estacion.
+ *
+ * @param escucha direccion del enlace
+ * @param puerto 0 para el de la escucha y el de la estacion
+ * @return int 0 o -1
+ */
+int abrir_Puerto(struct dir_escucha *escucha, unsigned int puerto)
+{
+    struct puerto_udp *p = &puertos[n_puertos];
+    struct dir_escucha d = *escucha;
+
+    p->estacion = estacion;
+    if (puerto != 0)
+    {
+        uint16_t red = htons((uint16_t)puerto);
+        if (d.direccion.ss_family == AF_INET6)
+        {
+            ((struct sockaddr_in6 *)&d.direccion)->sin6_port = red;
+            ((struct sockaddr_in6 *)&p->estacion)->sin6_port = red;
+        }
+        else
+        {
+            ((struct sockaddr_in *)&d.direccion)->sin_port = red;
+            ((struct sockaddr_in *)&p->estacion)->sin_port = red;
+        }
+    }
+    if ((p->fd = dir_abrir(&d, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0)
+        return -1;
+    n_puertos++;
+    return 0;
+}
+
+/**
+ * @brief Acepta las conexiones de los satelites y abre la de cada uno con la
+ *        estacion.
+ *
+ * @param escucha
+ * @param ahora
+ */
+void aceptar(int escucha, uint64_t ahora)
+{
+    static unsigned int numero = 0;
+    struct sockaddr_storage satelite;
+    socklen_t largo = sizeof(satelite);
+    char texto[DIR_TEXTO_MAX];
+    struct conexion *c;
+    int fd, sube, i, si = 1;
+
+    while ((fd = accept4(escucha, (struct sockaddr *)&satelite, &largo, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        for (i = 0; i < ENL_MAX_CONEXIONES && conexiones[i] != NULL; i++)
+            ;
+        if (i == ENL_MAX_CONEXIONES || (c = calloc(1, sizeof(*c))) == NULL)
+        {
+            fprintf(stderr, "Sin lugar para otra conexion\n");
+            close(fd);
+            continue;
+        }
+        /* La conexion con la estacion se abre bloqueante: el satelite espera,
+           como esperaria su propio connect */
+        if ((sube = socket(estacion.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0 ||
+            connect(sube, (struct sockaddr *)&estacion, estacion_largo) < 0 ||
+            fcntl(sube, F_SETFL, O_NONBLOCK) < 0)
+        {
+            perror("conexion con la estacion");
+            if (sube >= 0)
+                close(sube);
+            close(fd);
+            free(c);
+            continue;
+        }
+        /* El enlace decide cuando sale cada segmento */
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &si, sizeof(si));
+        setsockopt(sube, IPPROTO_TCP, TCP_NODELAY, &si, sizeof(si));
+        c->fd[BAJADA] = fd;
+        c->fd[SUBIDA] = sube;
+        c->sentido[BAJADA].p = &parametros[BAJADA];
+        c->sentido[SUBIDA].p = &parametros[SUBIDA];
+        c->inicio = ahora;
+        c->numero = ++numero;
+        conexiones[i] = c;
+        printf("Conexion %u desde %s\n", c->numero, dir_texto((struct sockaddr *)&satelite, texto, sizeof(texto)));
+        largo = sizeof(satelite);
+    }
+}
+
+/**
+ * @brief Datagramas de los satelites a un puerto. Cada satelite tiene, por
+ *        puerto, su propio socket hacia la estacion, por el que vuelven las
+ *        respuestas.
+ *
+ * @param puerto indice en puertos
+ * @param ahora
+ */
+void recibir_Udp(int puerto, uint64_t ahora)
+{
+    static unsigned char datos[ENL_DATAGRAMA];
+    struct sockaddr_storage satelite;
+    socklen_t largo = sizeof(satelite);
+    struct origen *o;
+    ssize_t n;
+    int i, libre;
+
+    for (int k = 0; k < ENL_LOTE; k++)
+    {
+        if ((n = recvfrom(puertos[puerto].fd, datos, sizeof(datos), 0, (struct sockaddr *)&satelite, &largo)) < 0)
+            return;
+        libre = -1;
+        for (i = 0; i < ENL_MAX_ORIGENES; i++)
+        {
+            if (origenes[i] == NULL)
+                libre = libre < 0 ? i : libre;
+            else if (origenes[i]->puerto == puerto && origenes[i]->largo == largo &&
+                     !memcmp(&origenes[i]->satelite, &satelite, largo))
+                break;
+        }
+        if (i == ENL_MAX_ORIGENES)
+        {
+            if (libre < 0 || (o = calloc(1, sizeof(*o))) == NULL)
+                continue;
+            if ((o->fd = socket(estacion.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0 ||
+                connect(o->fd, (struct sockaddr *)&puertos[puerto].estacion, estacion_largo) < 0)
+            {
+                perror("socket UDP hacia la estacion");
+                if (o->fd >= 0)
+                    close(o->fd);
+                free(o);
+                continue;
+            }
+            memcpy(&o->satelite, &satelite, largo);
+            o->largo = largo;
+            o->puerto = puerto;
+            o->sentido[BAJADA].p = &parametros[BAJADA];
+            o->sentido[SUBIDA].p = &parametros[SUBIDA];
+            origenes[i = libre] = o;
+        }
+        origenes[i]->ultimo = ahora;
+        encolar(&origenes[i]->sentido[SUBIDA], datos, (size_t)n, 0, ahora);
+        largo = sizeof(satelite);
+    }
+}
+
+/**
+ * @brief Lee de cada lado de una conexion lo que el enlace admite y entrega
+ *        los segmentos cuya hora llego. Cierra la escritura de un destino
+ *        cuando su origen cerro y no queda nada en camino.
+ *
+ * @param c
+ * @param pf entradas de poll de los lados [BAJADA] y [SUBIDA]
+ * @param ahora
+ */
+void atender_Conexion(struct conexion *c, struct pollfd *pf, uint64_t ahora)
+{
+    unsigned char datos[ENL_SEGMENTO];
+    ssize_t n;
+
+    for (int s = 0; s < 2; s++)
+    {
+        /* La subida se lee del lado del satelite, la bajada del de la estacion */
+        int origen = s == SUBIDA ? BAJADA : SUBIDA;
+        struct sentido *sen = &c->sentido[s];
+
+        if (pf[origen].revents & (POLLIN | POLLHUP | POLLERR))
+            for (int k = 0; k < ENL_LOTE && !c->fin[s] && admite(sen, ahora) <= ahora; k++)
+            {
+                n = recv(c->fd[origen], datos, sizeof(datos), 0);
+                if (n == 0)
+                    c->fin[s] = 1;
+                else if (n < 0 && errno != EAGAIN && errno != EINTR)
+                {
+                    cerrar_Conexion(c, ahora);
+                    return;
+                }
+                else if (n < 0)
+                    break;
+                else
+                    encolar(sen, datos, (size_t)n, 1, ahora);
+            }
+        if (entregar(sen, c->fd[s], 1, NULL, 0, ahora) < 0)
+        {
+            cerrar_Conexion(c, ahora);
+            return;
+        }
+        if (c->fin[s] && sen->primero == NULL && !c->cerrado[s])
+        {
+            shutdown(c->fd[s], SHUT_WR);
+            c->cerrado[s] = 1;
+        }
+    }
+    if (c->cerrado[BAJADA] && c->cerrado[SUBIDA])
+        cerrar_Conexion(c, ahora);
+}
+
+/**
+ * @brief Respuestas de la estacion a un satelite y entrega de los datagramas
+ *        de ambos sentidos cuya hora llego.
+ *
+ * @param o
+ * @param ahora
+ */
+void atender_Origen(struct origen *o, uint64_t ahora)
+{
+    static unsigned char datos[ENL_DATAGRAMA];
+    ssize_t n;
+
+    for (int k = 0; k < ENL_LOTE && (n = recv(o->fd, datos, sizeof(datos), 0)) >= 0; k++)
+    {
+        o->ultimo = ahora;
+        encolar(&o->sentido[BAJADA], datos, (size_t)n, 0, ahora);
+    }
+    entregar(&o->sentido[SUBIDA], o->fd, 0, NULL, 0, ahora);
+    entregar(&o->sentido[BAJADA], puertos[o->puerto].fd, 0, &o->satelite, o->largo, ahora);
+}
+
+/**
+ * @brief Bytes que esperan la tasa del enlace.
+ *
+ * @param s
+ * @param ahora
+ * @return size_t
+ */
+static size_t en_cola(const struct sentido *s, uint64_t ahora)
+{
+    if (s->p->tasa <= 0 || s->libre <= ahora)
+        return 0;
+    return (size_t)((s->libre - ahora) * s->p->tasa / 8e9);
+}
+
+/**
+ * @brief Ns que tarda un paquete en salir a la tasa del enlace.
+ *
+ * @param s
+ * @param largo
+ * @return uint64_t
+ */
+static uint64_t serializar(const struct sentido *s, size_t largo)
+{
+    return s->p->tasa > 0 ? (uint64_t)(largo * 8e9 / s->p->tasa) : 0;
+}
+
+/**
+ * @brief Ocupa la tasa del enlace con un paquete.
+ *
+ * @param s
+ * @param largo
+ * @param desde ns a partir de los que puede salir
+ * @return uint64_t ns en que termina de salir
+ */
+static uint64_t ocupar(struct sentido *s, size_t largo, uint64_t desde)
+{
+    if (s->libre < desde)
+        s->libre = desde;
+    s->libre += serializar(s, largo);
+    return s->libre;
+}
+
+/**
+ * @brief Hace pasar un paquete por el enlace: decide si se pierde y a que
+ *        hora llega, y lo encola en orden de entrega.
+ *
+ * @param s
+ * @param datos
+ * @param largo
+ * @param tcp 1 para un segmento, 0 para un datagrama
+ * @param ahora
+ * @return int 0, o -1 si no hay memoria
+ */
+int encolar(struct sentido *s, const unsigned char *datos, size_t largo, int tcp, uint64_t ahora)
+{
+    const struct parametros *p = s->p;
+    struct paquete *q, **lugar;
+    uint64_t entrega;
+
+    s->e.paquetes++;
+    s->e.bytes += largo;
+    if (!tcp && p->perdida > 0 && erand48(azar) < p->perdida)
+    {
+        s->e.perdidos++;
+        return 0;
+    }
+    if (!tcp && p->tasa > 0 && en_cola(s, ahora) + largo > p->cola)
+    {
+        s->e.descartados++;
+        return 0;
+    }
+    if ((q = malloc(sizeof(*q) + largo)) == NULL)
+    {
+        perror("malloc");
+        s->e.descartados++;
+        return -1;
+    }
+    memcpy(q->datos, datos, largo);
+    q->largo = largo;
+    q->enviado = 0;
+    q->llegada = ahora;
+
+    entrega = ocupar(s, largo, ahora) + p->demora;
+    if (p->variacion > 0)
+        entrega += (uint64_t)(erand48(azar) * p->variacion);
+    if (tcp)
+    {
+        /* Retransmision: una ida y vuelta mas y otra vez por la tasa */
+        while (p->perdida > 0 && erand48(azar) < p->perdida)
+        {
+            s->e.perdidos++;
+            ocupar(s, largo, ahora);
+            entrega += parametros[BAJADA].demora + parametros[SUBIDA].demora + serializar(s, largo);
+        }
+        /* El flujo llega en orden */
+        if (entrega < s->ultima)
+            entrega = s->ultima;
+        s->ultima = entrega;
+    }
+    else if (p->reorden > 0 && erand48(azar) < p->reorden)
+    {
+        entrega += ENL_REORDEN * 1000000ULL;
+        s->e.reordenados++;
+    }
+    q->entrega = entrega;
+
+    if (s->ultimo == NULL || s->ultimo->entrega <= entrega)
+        lugar = s->ultimo == NULL ? &s->primero : &s->ultimo->sig;
+    else
+        for (lugar = &s->primero; (*lugar)->entrega <= entrega; lugar = &(*lugar)->sig)
+            ;
+    q->sig = *lugar;
+    *lugar = q;
+    if (q->sig == NULL)
+        s->ultimo = q;
+    s->en_vuelo += largo;
+    return 0;
+}
+
+/**
+ * @brief Entrega los paquetes cuya hora llego. Un segmento que el destino no
+ *        admite entero queda primero, con lo ya enviado descontado, hasta
+ *        que el destino admita mas; un datagrama que no se pudo enviar se
+ *        descarta.
+ *
+ * @param s
+ * @param fd
+ * @param tcp
+ * @param destino de los datagramas en un socket sin conectar, o NULL
+ * @param largo
+ * @param ahora
+ * @return int 0, o -1 si el destino de un segmento cerro la conexion
+ */
+int entregar(struct sentido *s, int fd, int tcp, const struct sockaddr_storage *destino, socklen_t largo,
+             uint64_t ahora)
+{
+    struct paquete *q;
+    ssize_t n;
+
+    s->bloqueado = 0;
+    while ((q = s->primero) != NULL && q->entrega <= ahora)
+    {
+        n = sendto(fd, q->datos + q->enviado, q->largo - q->enviado, MSG_NOSIGNAL | MSG_DONTWAIT,
+                   (const struct sockaddr *)destino, destino != NULL ? largo : 0);
+        if (n < 0 && tcp && errno != EAGAIN && errno != EINTR)
+            return -1;
+        if (n >= 0)
+            q->enviado += (size_t)n;
+        if (tcp && q->enviado < q->largo)
+        {
+            s->bloqueado = 1;
+            return 0;
+        }
+        if (n < 0)
+            s->e.descartados++;
+        else
+        {
+            s->e.entregados++;
+            s->e.demora += ahora - q->llegada;
+        }
+        s->primero = q->sig;
+        if (s->primero == NULL)
+            s->ultimo = NULL;
+        s->en_vuelo -= q->largo;
+        free(q);
+    }
+    return 0;
+}
+
+/**
+ * @brief Cierra los dos lados de una conexion e informa lo que paso por el
+ *        enlace.
+ *
+ * @param c
+ * @param ahora
+ */
+void cerrar_Conexion(struct conexion *c, uint64_t ahora)
+{
+    printf("Conexion %u cerrada tras %.1f s\n", c->numero, (ahora - c->inicio) / 1e9);
+    for (int s = 0; s < 2; s++)
+    {
+        informar(nombres[s], &c->sentido[s].e);
+        vaciar(&c->sentido[s], &totales[1][s]);
+        close(c->fd[s]);
+    }
+    for (int i = 0; i < ENL_MAX_CONEXIONES; i++)
+        if (conexiones[i] == c)
+            conexiones[i] = NULL;
+    free(c);
+}
+
+/**
+ * @brief Suma la estadistica de un sentido a los totales y libera lo que
+ *        quedaba en camino.
+ *
+ * @param s
+ * @param total
+ */
+void vaciar(struct sentido *s, struct estadistica *total)
+{
+    struct paquete *q;
+
+    total->paquetes += s->e.paquetes;
+    total->bytes += s->e.bytes;
+    total->perdidos += s->e.perdidos;
+    total->descartados += s->e.descartados;
+    total->reordenados += s->e.reordenados;
+    total->entregados += s->e.entregados;
+    total->demora += s->e.demora;
+    while ((q = s->primero) != NULL)
+    {
+        s->primero = q->sig;
+        free(q);
+    }
+    s->ultimo = NULL;
+}
+
+void informar(const char *titulo, const struct estadistica *e)
+{
+    printf("  %-10s %8llu paquetes, %9.2f MB, %6llu perdidos, %6llu descartados, %6llu reordenados, "
+           "demora media %.1f ms\n",
+           titulo, (unsigned long long)e->paquetes, e->bytes / 1048576.0, (unsigned long long)e->perdidos,
+           (unsigned long long)e->descartados, (unsigned long long)e->reordenados,
+           e->entregados > 0 ? e->demora / 1e6 / e->entregados : 0.0);
+}
+
+/**
+ * @brief Hora a la que un sentido tiene un paquete para entregar. Con el
+ *        destino bloqueado se espera a que poll avise.
+ *
+ * @param s
+ * @param ahora
+ * @return uint64_t ns, UINT64_MAX si no hay nada que entregar
+ */
+uint64_t despertar(const struct sentido *s, uint64_t ahora)
+{
+    if (s->primero == NULL || s->bloqueado)
+        return UINT64_MAX;
+    return s->primero->entrega < ahora ? ahora : s->primero->entrega;
+}
+
+/**
+ * @brief Hora a la que la cola de un sentido TCP vuelve a admitir un
+ *        segmento. Una cola vacia admite uno aunque sea menor que el.
+ *
+ * @param s
+ * @param ahora
+ * @return uint64_t ns, ahora si ya puede leerse; UINT64_MAX si la memoria
+ *         del sentido se lleno y hay que esperar entregas
+ */
+uint64_t admite(const struct sentido *s, uint64_t ahora)
+{
+    uint64_t vaciar;
+
+    if (s->en_vuelo + ENL_SEGMENTO > ENL_MEMORIA)
+        return UINT64_MAX;
+    if (en_cola(s, ahora) == 0 || en_cola(s, ahora) + ENL_SEGMENTO <= s->p->cola)
+        return ahora;
+    /* Tiempo que tarda en salir lo que puede quedar en cola junto al segmento */
+    vaciar = s->p->cola > ENL_SEGMENTO ? serializar(s, s->p->cola - ENL_SEGMENTO) : 0;
+    return s->libre - vaciar > ahora ? s->libre - vaciar : ahora;
+}
+
+uint64_t ahora_ns(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ULL + (uint64_t)t.tv_nsec;
+}
+
+void al_terminar(int senal)
+{
+    (void)senal;
+    terminar = 1;
+}
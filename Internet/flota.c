@@ -0,0 +1,680 @@
+/**
+ * @file flota.c
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Coordinador del despliegue de firmware en el proceso padre. Cada
+ *        sesion hija queda registrada con un canal SOCK_SEQPACKET; el hilo
+ *        coordinador espera con poll en todos los canales. Al recibir un
+ *        plan copia el firmware a un memfd sellado (una sola lectura del
+ *        archivo, una sola copia en memoria), lo adjunta a la orden de cada
+ *        sesion y estas lo envian a su satelite mapeando esas mismas paginas.
+ *        Los satelites se actualizan por olas: dentro de una ola hay a lo
+ *        sumo "concurrencia" envios en curso, y la ola siguiente empieza solo
+ *        si la anterior no supero las fallas permitidas. Con relevos, cuando
+ *        un satelite actualizado se reconecta se le pide que sirva el
+ *        firmware a "ramas" pares; cada satelite pendiente se asigna a un
+ *        relevo con lugar y, si no hay, a la estacion mientras no supere su
+ *        concurrencia.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <arpa/inet.h>
+
+#include "flota.h"
+
+struct flota_satelite
+{
+    uint32_t satelite;
+    int fd;                   /* canal con la sesion; -1 si la sesion termino */
+    enum flota_estado estado;
+    int porcentaje;
+    struct timespec desde;    /* inicio del envio */
+    int por_relevo;           /* el envio en curso viene de otro satelite */
+    int relevo;               /* ya se le pidio servir el firmware */
+};
+
+/* Satelite actualizado que sirve el firmware a otros */
+struct flota_fuente
+{
+    uint32_t satelite;
+    uint32_t ip, puerto;
+    int libres;               /* pares que todavia puede atender */
+    struct timespec desde;
+};
+
+/* Despliegue en curso */
+struct flota_despliegue
+{
+    int activo;
+    struct flota_mensaje plan;
+    int orden[FLOTA_MAX_SATELITES];  /* posiciones en la tabla, en orden de envio */
+    int n;
+    int siguiente;                   /* proximo de orden[] a lanzar */
+    int fin_ola;                     /* fin (exclusivo) de la ola actual en orden[] */
+    int numero_ola, olas;
+    int en_curso, fallas_ola;
+    int desde_estacion;              /* envios en curso desde la estacion */
+    int verificados, fallidos, omitidos, relevados;
+    struct flota_fuente fuentes[FLOTA_MAX_SATELITES];
+    int n_fuentes;
+    struct timespec inicio;
+};
+
+static struct flota_satelite tabla[FLOTA_MAX_SATELITES];
+static struct flota_despliegue despliegue;
+static pthread_mutex_t tabla_mutex = PTHREAD_MUTEX_INITIALIZER;
+static const char *ruta_imagen = NULL;
+static int imagen = -1; /* memfd con el firmware mientras dura el despliegue */
+static unsigned char digesto[SHA256_LEN]; /* SHA-256 de la imagen, lo verifica quien la recibe de un relevo */
+
+/**
+ * @brief Segundos transcurridos desde t.
+ *
+ * @param t
+ * @return double
+ */
+static double flota_segundos(const struct timespec *t)
+{
+    struct timespec ahora;
+    clock_gettime(CLOCK_MONOTONIC, &ahora);
+    return (ahora.tv_sec - t->tv_sec) + (ahora.tv_nsec - t->tv_nsec) / 1e9;
+}
+
+/**
+ * @brief Crea el canal de ordenes entre el padre (canal[0]) y una sesion
+ *        (canal[1]).
+ *
+ * @param canal
+ * @return int 0 o -1
+ */
+int flota_canal_crear(int canal[2])
+{
+    return socketpair(AF_UNIX, SOCK_SEQPACKET, 0, canal);
+}
+
+/**
+ * @brief Envia un mensaje por el canal, opcionalmente con un descriptor.
+ *
+ * @param canal
+ * @param msg
+ * @param fd descriptor a adjuntar, o -1
+ * @return int 0 o -1
+ */
+int flota_enviar(int canal, const struct flota_mensaje *msg, int fd)
+{
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = {(void *)msg, sizeof(*msg)};
+    struct msghdr mh;
+    struct cmsghdr *cm;
+    ssize_t n;
+
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    if (fd >= 0)
+    {
+        memset(control, 0, sizeof(control));
+        mh.msg_control = control;
+        mh.msg_controllen = sizeof(control);
+        cm = CMSG_FIRSTHDR(&mh);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+    }
+    do
+    {
+        n = sendmsg(canal, &mh, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    return n == (ssize_t)sizeof(*msg) ? 0 : -1;
+}
+
+/**
+ * @brief Recibe un mensaje del canal y el descriptor adjunto, si lo hay.
+ *
+ * @param canal
+ * @param msg
+ * @param fd recibe el descriptor adjunto, o -1
+ * @return int 0, o -1 si el otro extremo cerro o el mensaje es invalido
+ */
+int flota_recibir(int canal, struct flota_mensaje *msg, int *fd)
+{
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = {msg, sizeof(*msg)};
+    struct msghdr mh;
+    struct cmsghdr *cm;
+    ssize_t n;
+
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control;
+    mh.msg_controllen = sizeof(control);
+    do
+    {
+        n = recvmsg(canal, &mh, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+
+    *fd = -1;
+    for (cm = CMSG_FIRSTHDR(&mh); n > 0 && cm != NULL; cm = CMSG_NXTHDR(&mh, cm))
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS)
+            memcpy(fd, CMSG_DATA(cm), sizeof(int));
+    if (n != (ssize_t)sizeof(*msg))
+    {
+        if (*fd >= 0)
+            close(*fd);
+        *fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Copia el firmware a un memfd sellado: es la unica lectura del
+ *        archivo y la unica copia en memoria durante el despliegue. El
+ *        SHA-256 de la copia acompana cada orden de relevo, para que un
+ *        satelite no instale otra cosa que la imagen del despliegue.
+ *
+ * @param ruta
+ * @param tamano recibe el tamano de la imagen
+ * @param resumen recibe el SHA-256 de la imagen
+ * @return int descriptor del memfd, o -1
+ */
+static int flota_imagen(const char *ruta, off_t *tamano, unsigned char resumen[SHA256_LEN])
+{
+    struct stat st;
+    off_t desplazamiento = 0;
+    ssize_t n;
+    int fd, mem;
+
+    if ((fd = open(ruta, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+    {
+        perror(ruta);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    if ((mem = memfd_create("firmware", MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0)
+    {
+        perror("memfd_create");
+        close(fd);
+        return -1;
+    }
+    while (desplazamiento < st.st_size)
+    {
+        n = sendfile(mem, fd, &desplazamiento, st.st_size - desplazamiento);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            perror("copia del firmware");
+            close(fd);
+            close(mem);
+            return -1;
+        }
+    }
+    close(fd);
+    /* Ninguna sesion puede alterar la imagen mientras se envia */
+    if (fcntl(mem, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0)
+        perror("sellos del firmware");
+    if (sha256_archivo(mem, resumen) < 0)
+    {
+        perror("SHA-256 del firmware");
+        close(mem);
+        return -1;
+    }
+    *tamano = st.st_size;
+    return mem;
+}
+
+/**
+ * @brief Cierra el despliegue e informa el resultado. Con tabla_mutex.
+ */
+static void flota_fin(void)
+{
+    printf("[flota] despliegue terminado en %.1f s: %d verificados (%d por relevo), %d fallidos, "
+           "%d omitidos\n",
+           flota_segundos(&despliegue.inicio), despliegue.verificados, despliegue.relevados,
+           despliegue.fallidos, despliegue.omitidos);
+    close(imagen);
+    imagen = -1;
+    despliegue.activo = 0;
+    for (int i = 0; i < FLOTA_MAX_SATELITES; i++)
+    {
+        tabla[i].estado = FLOTA_LIBRE;
+        tabla[i].relevo = 0;
+    }
+}
+
+/**
+ * @brief Registra el final del envio a un satelite. Con tabla_mutex.
+ *
+ * @param i posicion en la tabla
+ * @param ok
+ * @param motivo descripcion de la falla
+ */
+static void flota_terminar(int i, int ok, const char *motivo)
+{
+    struct flota_satelite *s = &tabla[i];
+
+    if (s->estado == FLOTA_ENVIANDO)
+    {
+        despliegue.en_curso--;
+        if (!s->por_relevo)
+            despliegue.desde_estacion--;
+    }
+    s->estado = ok ? FLOTA_VERIFICADO : FLOTA_FALLIDO;
+    if (ok)
+    {
+        despliegue.verificados++;
+        despliegue.relevados += s->por_relevo;
+        printf("[flota] satelite %u: verificado en %.1f s\n", s->satelite, flota_segundos(&s->desde));
+    }
+    else
+    {
+        despliegue.fallidos++;
+        despliegue.fallas_ola++;
+        printf("[flota] satelite %u: fallo (%s)\n", s->satelite, motivo);
+    }
+}
+
+/**
+ * @brief Relevo con lugar para un par mas, vigente todavia.
+ *
+ * @return struct flota_fuente* NULL si no hay
+ */
+static struct flota_fuente *flota_fuente_libre(void)
+{
+    for (int k = 0; k < despliegue.n_fuentes; k++)
+    {
+        struct flota_fuente *f = &despliegue.fuentes[k];
+        if (f->libres > 0 && flota_segundos(&f->desde) < FLOTA_VIGENCIA)
+            return f;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Pide a los satelites ya actualizados que se reconectaron que
+ *        sirvan el firmware a otros. Con tabla_mutex.
+ */
+static void flota_pedir_relevos(void)
+{
+    struct flota_mensaje msg;
+
+    for (int i = 0; despliegue.plan.ramas > 0 && i < FLOTA_MAX_SATELITES; i++)
+    {
+        struct flota_satelite *s = &tabla[i];
+        int actualizado = 0;
+
+        if (s->fd < 0 || s->estado != FLOTA_LIBRE || s->relevo)
+            continue;
+        for (int k = 0; k < despliegue.n && !actualizado; k++)
+            actualizado = tabla[despliegue.orden[k]].estado == FLOTA_VERIFICADO &&
+                          tabla[despliegue.orden[k]].satelite == s->satelite;
+        if (!actualizado)
+            continue;
+        memset(&msg, 0, sizeof(msg));
+        msg.tipo = FLOTA_SERVIR;
+        msg.cantidad = despliegue.plan.ramas;
+        if (flota_enviar(s->fd, &msg, -1) == 0)
+            s->relevo = 1;
+    }
+}
+
+/**
+ * @brief Lanza envios hasta agotar los relevos con lugar y la concurrencia
+ *        de la estacion, y pasa a la ola siguiente cuando la actual termina.
+ *        Con tabla_mutex.
+ */
+static void flota_avanzar(void)
+{
+    struct flota_mensaje msg;
+    struct flota_fuente *f;
+
+    while (despliegue.activo)
+    {
+        while (despliegue.siguiente < despliegue.fin_ola &&
+               despliegue.fallas_ola <= (int)despliegue.plan.fallas &&
+               ((f = flota_fuente_libre()) != NULL ||
+                despliegue.desde_estacion < (int)despliegue.plan.concurrencia))
+        {
+            int i = despliegue.orden[despliegue.siguiente++];
+            struct flota_satelite *s = &tabla[i];
+
+            /* Un relevo libre evita usar el enlace de la estacion */
+            memset(&msg, 0, sizeof(msg));
+            msg.tipo = f != NULL ? FLOTA_RELEVO : FLOTA_ACTUALIZAR;
+            if (f != NULL)
+            {
+                msg.ip = f->ip;
+                msg.puerto = f->puerto;
+                memcpy(msg.digesto, digesto, sizeof(msg.digesto));
+            }
+            clock_gettime(CLOCK_MONOTONIC, &s->desde);
+            s->porcentaje = 0;
+            if (s->fd < 0 || flota_enviar(s->fd, &msg, f != NULL ? -1 : imagen) < 0)
+            {
+                flota_terminar(i, 0, "sesion terminada");
+                continue;
+            }
+            s->estado = FLOTA_ENVIANDO;
+            s->por_relevo = f != NULL;
+            despliegue.en_curso++;
+            if (f != NULL)
+            {
+                f->libres--;
+                printf("[flota] satelite %u: recibiendo del satelite %u\n", s->satelite, f->satelite);
+            }
+            else
+            {
+                despliegue.desde_estacion++;
+                printf("[flota] satelite %u: enviando\n", s->satelite);
+            }
+        }
+
+        /* La ola sigue en curso */
+        if (despliegue.en_curso > 0 ||
+            (despliegue.siguiente < despliegue.fin_ola && despliegue.fallas_ola <= (int)despliegue.plan.fallas))
+            return;
+
+        printf("[flota] ola %d/%d terminada con %d fallas\n", despliegue.numero_ola, despliegue.olas,
+               despliegue.fallas_ola);
+        if (despliegue.fallas_ola > (int)despliegue.plan.fallas)
+        {
+            for (int k = despliegue.siguiente; k < despliegue.n; k++)
+            {
+                tabla[despliegue.orden[k]].estado = FLOTA_OMITIDO;
+                despliegue.omitidos++;
+            }
+            printf("[flota] despliegue detenido: la ola %d supero %u fallas\n", despliegue.numero_ola,
+                   despliegue.plan.fallas);
+            flota_fin();
+            return;
+        }
+        if (despliegue.siguiente == despliegue.n)
+        {
+            flota_fin();
+            return;
+        }
+        despliegue.numero_ola++;
+        despliegue.fallas_ola = 0;
+        despliegue.fin_ola += despliegue.plan.ola;
+        if (despliegue.fin_ola > despliegue.n)
+            despliegue.fin_ola = despliegue.n;
+        printf("[flota] ola %d/%d: %d satelites\n", despliegue.numero_ola, despliegue.olas,
+               despliegue.fin_ola - despliegue.siguiente);
+    }
+}
+
+/**
+ * @brief Inicia un despliegue a todos los satelites conectados. Con
+ *        tabla_mutex.
+ *
+ * @param plan
+ */
+static void flota_comenzar(const struct flota_mensaje *plan)
+{
+    off_t tamano;
+
+    if (despliegue.activo)
+    {
+        printf("[flota] ya hay un despliegue en curso\n");
+        return;
+    }
+    memset(&despliegue, 0, sizeof(despliegue));
+    despliegue.plan = *plan;
+    if (despliegue.plan.concurrencia == 0)
+        despliegue.plan.concurrencia = 1;
+    if (despliegue.plan.ola == 0)
+        despliegue.plan.ola = FLOTA_MAX_SATELITES;
+
+    for (int i = 0; i < FLOTA_MAX_SATELITES; i++)
+    {
+        if (tabla[i].fd < 0)
+            continue;
+        tabla[i].estado = FLOTA_PENDIENTE;
+        despliegue.orden[despliegue.n++] = i;
+    }
+    if (despliegue.n == 0)
+    {
+        printf("[flota] no hay satelites conectados\n");
+        return;
+    }
+    if ((imagen = flota_imagen(ruta_imagen, &tamano, digesto)) < 0)
+    {
+        for (int i = 0; i < FLOTA_MAX_SATELITES; i++)
+            tabla[i].estado = FLOTA_LIBRE;
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &despliegue.inicio);
+    despliegue.activo = 1;
+    despliegue.olas = (despliegue.n + despliegue.plan.ola - 1) / despliegue.plan.ola;
+    despliegue.fin_ola = despliegue.n < (int)despliegue.plan.ola ? despliegue.n : (int)despliegue.plan.ola;
+    despliegue.numero_ola = 1;
+    printf("[flota] firmware %s: %ld bytes en memoria, %d satelites, %d olas, concurrencia %u, "
+           "fallas por ola %u, relevos de %u pares\n",
+           ruta_imagen, (long)tamano, despliegue.n, despliegue.olas, despliegue.plan.concurrencia,
+           despliegue.plan.fallas, despliegue.plan.ramas);
+    printf("[flota] ola 1/%d: %d satelites\n", despliegue.olas, despliegue.fin_ola);
+}
+
+/**
+ * @brief Atiende un mensaje de una sesion. Con tabla_mutex.
+ *
+ * @param i posicion en la tabla
+ * @param msg
+ */
+static void flota_atender(int i, const struct flota_mensaje *msg)
+{
+    struct flota_satelite *s = &tabla[i];
+    struct flota_fuente *f;
+    int porcentaje;
+
+    switch (msg->tipo)
+    {
+    case FLOTA_PLAN:
+        flota_comenzar(msg);
+        break;
+    case FLOTA_AVANCE:
+        if (s->estado != FLOTA_ENVIANDO || msg->total == 0)
+            break;
+        porcentaje = (int)(msg->hecho * 100 / msg->total);
+        if (porcentaje != s->porcentaje)
+        {
+            s->porcentaje = porcentaje;
+            printf("[flota] satelite %u: %d%%\n", s->satelite, porcentaje);
+        }
+        break;
+    case FLOTA_RESULTADO:
+        if (s->estado == FLOTA_ENVIANDO)
+            flota_terminar(i, msg->resultado > 0, msg->resultado == 0 ? "sin firmware" : "no verificado");
+        break;
+    case FLOTA_PUERTO:
+        if (!despliegue.activo || msg->puerto == 0 || despliegue.n_fuentes == FLOTA_MAX_SATELITES)
+            break;
+        f = &despliegue.fuentes[despliegue.n_fuentes++];
+        f->satelite = s->satelite;
+        f->ip = msg->ip;
+        f->puerto = msg->puerto;
+        f->libres = (int)despliegue.plan.ramas;
+        clock_gettime(CLOCK_MONOTONIC, &f->desde);
+        printf("[flota] satelite %u: relevo en %s:%u para %d pares\n", s->satelite,
+               inet_ntoa(*(struct in_addr *)&f->ip), f->puerto, f->libres);
+        break;
+    }
+}
+
+/**
+ * @brief Hilo coordinador: atiende los canales de todas las sesiones y
+ *        vence los envios que superan FLOTA_PLAZO.
+ *
+ * @param arg no usado
+ * @return void*
+ */
+static void *flota_coordinador(void *arg)
+{
+    struct pollfd pfd[FLOTA_MAX_SATELITES];
+    int indice[FLOTA_MAX_SATELITES];
+    struct flota_mensaje msg;
+    int n, adjunto;
+
+    (void)arg;
+    for (;;)
+    {
+        /* La tabla se relee en cada vuelta: el timeout recoge los registros nuevos */
+        pthread_mutex_lock(&tabla_mutex);
+        n = 0;
+        for (int i = 0; i < FLOTA_MAX_SATELITES; i++)
+        {
+            if (tabla[i].fd < 0)
+                continue;
+            pfd[n].fd = tabla[i].fd;
+            pfd[n].events = POLLIN;
+            indice[n++] = i;
+        }
+        pthread_mutex_unlock(&tabla_mutex);
+
+        if (poll(pfd, n, 200) < 0 && errno != EINTR)
+        {
+            perror("poll flota");
+            sleep(1);
+            continue;
+        }
+
+        pthread_mutex_lock(&tabla_mutex);
+        for (int j = 0; j < n; j++)
+        {
+            struct flota_satelite *s = &tabla[indice[j]];
+            if (pfd[j].revents == 0 || s->fd != pfd[j].fd)
+                continue;
+            if (flota_recibir(s->fd, &msg, &adjunto) < 0)
+            {
+                /* La sesion termino: tras un firmware verificado es lo esperado */
+                close(s->fd);
+                s->fd = -1;
+                if (s->estado == FLOTA_ENVIANDO)
+                    flota_terminar(indice[j], 0, "sesion terminada");
+                continue;
+            }
+            if (adjunto >= 0)
+                close(adjunto);
+            flota_atender(indice[j], &msg);
+        }
+        for (int i = 0; despliegue.activo && i < FLOTA_MAX_SATELITES; i++)
+            if (tabla[i].estado == FLOTA_ENVIANDO && flota_segundos(&tabla[i].desde) > FLOTA_PLAZO)
+                flota_terminar(i, 0, "plazo vencido");
+        if (despliegue.activo)
+            flota_pedir_relevos();
+        flota_avanzar();
+        pthread_mutex_unlock(&tabla_mutex);
+        fflush(stdout);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Toma la tabla antes de fork(): una sesion nueva no hereda un
+ *        canal cerrado por el coordinador que aun figura en la tabla.
+ */
+static void flota_fork_tomar(void)
+{
+    pthread_mutex_lock(&tabla_mutex);
+}
+
+/**
+ * @brief Suelta la tabla despues de fork(), en el padre y en el hijo.
+ */
+static void flota_fork_soltar(void)
+{
+    pthread_mutex_unlock(&tabla_mutex);
+}
+
+/**
+ * @brief Inicia el hilo coordinador del padre.
+ *
+ * @param ruta firmware a desplegar; se lee al iniciar cada despliegue
+ * @return int 0 o -1
+ */
+int flota_coordinador_iniciar(const char *ruta)
+{
+    pthread_t hilo;
+
+    ruta_imagen = ruta;
+    for (int i = 0; i < FLOTA_MAX_SATELITES; i++)
+    {
+        tabla[i].fd = -1;
+        tabla[i].estado = FLOTA_LIBRE;
+    }
+    pthread_atfork(flota_fork_tomar, flota_fork_soltar, flota_fork_soltar);
+    if (pthread_create(&hilo, NULL, flota_coordinador, NULL) != 0)
+    {
+        perror("coordinador de flota");
+        return -1;
+    }
+    pthread_detach(hilo);
+    return 0;
+}
+
+/**
+ * @brief Agrega la sesion de un satelite a la tabla del coordinador.
+ *
+ * @param satelite ID del satelite
+ * @param fd canal[0] devuelto por flota_canal_crear
+ * @return int 0, o -1 si la tabla esta llena
+ */
+int flota_registrar(uint32_t satelite, int fd)
+{
+    int r = -1;
+
+    pthread_mutex_lock(&tabla_mutex);
+    for (int i = 0; i < FLOTA_MAX_SATELITES; i++)
+    {
+        /* Una posicion que sigue en el despliegue no se reusa hasta que termine */
+        if (tabla[i].fd < 0 && tabla[i].estado == FLOTA_LIBRE)
+        {
+            tabla[i].satelite = satelite;
+            tabla[i].fd = fd;
+            r = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&tabla_mutex);
+    return r;
+}
+
+/**
+ * @brief En una sesion recien creada: cierra los canales de las demas
+ *        sesiones y la imagen heredados del padre. La tabla esta completa:
+ *        el fork se hizo con tabla_mutex tomado (ver flota_fork_tomar).
+ */
+void flota_hijo(void)
+{
+    for (int i = 0; i < FLOTA_MAX_SATELITES; i++)
+    {
+        if (tabla[i].fd >= 0)
+            close(tabla[i].fd);
+        tabla[i].fd = -1;
+    }
+    if (imagen >= 0)
+        close(imagen);
+    imagen = -1;
+}
@@ -0,0 +1,80 @@
+/**
+ * @file flota.h
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Despliegue de firmware a toda la flota. El proceso padre de la
+ *        estacion conoce a todos los satelites conectados: un hilo
+ *        coordinador guarda un canal de ordenes con cada sesion hija, copia
+ *        el firmware una sola vez a memoria y reparte ese mismo descriptor a
+ *        las sesiones, por olas y con un maximo de envios simultaneos. Si una
+ *        ola tiene mas fallas que las permitidas, el despliegue se detiene.
+ *        Con relevos, cada satelite que ya verifico la imagen nueva la
+ *        reenvia a otros satelites que le asigna el coordinador, de modo que
+ *        la imagen se reparte como un arbol y el enlace de la estacion deja
+ *        de ser el cuello de botella.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef FLOTA_H
+#define FLOTA_H
+
+#include <stdint.h>
+
+#include "integridad.h"
+
+#define FLOTA_MAX_SATELITES 256   /* sesiones que sigue el coordinador */
+#define FLOTA_PLAZO 120           /* segundos que puede tardar un satelite */
+#define FLOTA_PASO 10             /* cada cuantos puntos porcentuales se informa el avance */
+#define FLOTA_VIGENCIA 45         /* segundos en que se usa un relevo; el satelite espera pares 60 */
+
+/* Mensajes entre la sesion y el coordinador */
+enum flota_tipo
+{
+    FLOTA_PLAN,        /* sesion -> padre: iniciar un despliegue con estos limites */
+    FLOTA_ACTUALIZAR,  /* padre -> sesion: enviar el firmware adjunto (SCM_RIGHTS) */
+    FLOTA_AVANCE,      /* sesion -> padre: bytes enviados */
+    FLOTA_RESULTADO,   /* sesion -> padre: 1 verificado, 0 sin firmware, -1 fallo */
+    FLOTA_SERVIR,      /* padre -> sesion: el satelite abre un relevo para "cantidad" pares */
+    FLOTA_PUERTO,      /* sesion -> padre: direccion del relevo (puerto 0 si no se pudo) */
+    FLOTA_RELEVO       /* padre -> sesion: el satelite recibe el firmware del relevo indicado */
+};
+
+/* Estado de cada satelite en el despliegue */
+enum flota_estado
+{
+    FLOTA_LIBRE,
+    FLOTA_PENDIENTE,
+    FLOTA_ENVIANDO,
+    FLOTA_VERIFICADO,
+    FLOTA_FALLIDO,
+    FLOTA_OMITIDO
+};
+
+struct flota_mensaje
+{
+    uint32_t tipo;
+    uint32_t concurrencia;  /* FLOTA_PLAN: envios simultaneos */
+    uint32_t ola;           /* FLOTA_PLAN: satelites por ola */
+    uint32_t fallas;        /* FLOTA_PLAN: fallas toleradas por ola */
+    uint64_t hecho, total;  /* FLOTA_AVANCE */
+    int32_t resultado;      /* FLOTA_RESULTADO */
+    uint32_t ramas;         /* FLOTA_PLAN: pares que atiende cada satelite actualizado, 0 sin relevos */
+    uint32_t cantidad;      /* FLOTA_SERVIR */
+    uint32_t ip;            /* FLOTA_PUERTO y FLOTA_RELEVO, en orden de red */
+    uint32_t puerto;
+    unsigned char digesto[SHA256_LEN]; /* FLOTA_RELEVO: SHA-256 de la imagen del despliegue */
+};
+
+/* Proceso padre */
+int flota_canal_crear(int[2]);
+int flota_coordinador_iniciar(const char *);
+int flota_registrar(uint32_t, int);
+void flota_hijo(void);
+
+/* Sesion */
+int flota_enviar(int, const struct flota_mensaje *, int);
+int flota_recibir(int, struct flota_mensaje *, int *);
+
+#endif
@@ -0,0 +1,544 @@
+/**
+ * @file integridad.c
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief CRC32C (Castagnoli) y SHA-256. En x86-64 se elige en tiempo de
+ *        ejecucion la version por hardware: crc32 de SSE4.2 sobre tres
+ *        flujos intercalados, combinados con tablas de desplazamiento, y
+ *        las instrucciones SHA para SHA-256. En otros procesadores se usan
+ *        CRC por tablas de 8 bytes (slicing-by-8) y SHA-256 en C.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "integridad.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define INTEGRIDAD_X86 1
+#endif
+
+#define CRC32C_POLI 0x82f63b78 /* polinomio reflejado */
+#define CRC32C_LARGO 8192      /* tramos de los tres flujos intercalados */
+#define CRC32C_CORTO 256
+
+static uint32_t crc32c_tabla[8][256];
+static uint32_t crc32c_largo[4][256];
+static uint32_t crc32c_corto[4][256];
+static int usar_sse42 = 0;
+static int usar_sha = 0;
+static pthread_once_t integridad_una_vez = PTHREAD_ONCE_INIT;
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+/**
+ * @brief Multiplica un vector por una matriz sobre GF(2).
+ *
+ * @param mat 32 columnas
+ * @param vec
+ * @return uint32_t
+ */
+static uint32_t gf2_por_matriz(const uint32_t *mat, uint32_t vec)
+{
+    uint32_t suma = 0;
+
+    while (vec)
+    {
+        if (vec & 1)
+            suma ^= *mat;
+        vec >>= 1;
+        mat++;
+    }
+    return suma;
+}
+
+/**
+ * @brief cuadrado = mat * mat sobre GF(2).
+ *
+ * @param cuadrado
+ * @param mat
+ */
+static void gf2_cuadrado(uint32_t *cuadrado, const uint32_t *mat)
+{
+    for (int n = 0; n < 32; n++)
+        cuadrado[n] = gf2_por_matriz(mat, mat[n]);
+}
+
+/**
+ * @brief Arma las tablas que desplazan un CRC sobre len bytes en cero, para
+ *        combinar los flujos calculados en paralelo. len debe ser potencia
+ *        de dos.
+ *
+ * @param ceros tablas por byte del operando
+ * @param len
+ */
+static void crc32c_tablas_ceros(uint32_t ceros[4][256], size_t len)
+{
+    uint32_t par[32], impar[32], fila = 1;
+
+    impar[0] = CRC32C_POLI; /* operador para un bit en cero */
+    for (int n = 1; n < 32; n++)
+    {
+        impar[n] = fila;
+        fila <<= 1;
+    }
+    gf2_cuadrado(par, impar);  /* dos bits */
+    gf2_cuadrado(impar, par);  /* cuatro bits */
+
+    /* Cada cuadrado duplica la cantidad de ceros: el primero deja un byte */
+    do
+    {
+        gf2_cuadrado(par, impar);
+        len >>= 1;
+        if (len == 0)
+            break;
+        gf2_cuadrado(impar, par);
+        len >>= 1;
+        if (len == 0)
+        {
+            memcpy(par, impar, sizeof(par));
+            break;
+        }
+    } while (1);
+
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        ceros[0][n] = gf2_por_matriz(par, n);
+        ceros[1][n] = gf2_por_matriz(par, n << 8);
+        ceros[2][n] = gf2_por_matriz(par, n << 16);
+        ceros[3][n] = gf2_por_matriz(par, n << 24);
+    }
+}
+
+/**
+ * @brief Inicializa las tablas y detecta las instrucciones disponibles.
+ */
+static void integridad_iniciar(void)
+{
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? (c >> 1) ^ CRC32C_POLI : c >> 1;
+        crc32c_tabla[0][n] = c;
+    }
+    for (int n = 0; n < 256; n++)
+        for (int k = 1; k < 8; k++)
+            crc32c_tabla[k][n] = crc32c_tabla[0][crc32c_tabla[k - 1][n] & 0xff] ^ (crc32c_tabla[k - 1][n] >> 8);
+
+    crc32c_tablas_ceros(crc32c_largo, CRC32C_LARGO);
+    crc32c_tablas_ceros(crc32c_corto, CRC32C_CORTO);
+
+#ifdef INTEGRIDAD_X86
+    usar_sse42 = __builtin_cpu_supports("sse4.2");
+    /* gcc no ofrece "sha" en __builtin_cpu_supports: CPUID hoja 7, EBX bit 29 */
+    {
+        unsigned int a = 7, b, c = 0, d;
+        __asm__("cpuid" : "+a"(a), "=b"(b), "+c"(c), "=d"(d));
+        usar_sha = (b >> 29) & 1 && __builtin_cpu_supports("sse4.1");
+    }
+#endif
+}
+
+/**
+ * @brief CRC32C por tablas, procesando 8 bytes por iteracion.
+ *
+ * @param crc
+ * @param buf
+ * @param len
+ * @return uint32_t
+ */
+static uint32_t crc32c_sw(uint32_t crc, const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+
+    crc = ~crc;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (len >= 8)
+    {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        w ^= crc;
+        crc = crc32c_tabla[7][w & 0xff] ^ crc32c_tabla[6][(w >> 8) & 0xff] ^
+              crc32c_tabla[5][(w >> 16) & 0xff] ^ crc32c_tabla[4][(w >> 24) & 0xff] ^
+              crc32c_tabla[3][(w >> 32) & 0xff] ^ crc32c_tabla[2][(w >> 40) & 0xff] ^
+              crc32c_tabla[1][(w >> 48) & 0xff] ^ crc32c_tabla[0][w >> 56];
+        p += 8;
+        len -= 8;
+    }
+#endif
+    while (len--)
+        crc = crc32c_tabla[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+/**
+ * @brief Aplica a crc el desplazamiento precalculado en ceros.
+ *
+ * @param ceros
+ * @param crc
+ * @return uint32_t
+ */
+static uint32_t crc32c_desplazar(uint32_t ceros[4][256], uint32_t crc)
+{
+    return ceros[0][crc & 0xff] ^ ceros[1][(crc >> 8) & 0xff] ^
+           ceros[2][(crc >> 16) & 0xff] ^ ceros[3][crc >> 24];
+}
+
+#ifdef INTEGRIDAD_X86
+/**
+ * @brief CRC32C con la instruccion crc32 de SSE4.2. La instruccion tiene
+ *        latencia 3 y rendimiento 1, asi que se calculan tres tramos
+ *        consecutivos a la vez y luego se combinan.
+ *
+ * @param crc
+ * @param buf
+ * @param len
+ * @return uint32_t
+ */
+__attribute__((target("sse4.2"))) static uint32_t crc32c_hw(uint32_t crc, const void *buf, size_t len)
+{
+    const unsigned char *p = buf, *fin;
+    uint64_t c0 = ~crc & 0xffffffff, c1, c2, w0, w1, w2;
+
+    while (len > 0 && ((uintptr_t)p & 7) != 0)
+    {
+        c0 = _mm_crc32_u8((uint32_t)c0, *p++);
+        len--;
+    }
+
+    while (len >= 3 * CRC32C_LARGO)
+    {
+        c1 = c2 = 0;
+        fin = p + CRC32C_LARGO;
+        do
+        {
+            memcpy(&w0, p, 8);
+            memcpy(&w1, p + CRC32C_LARGO, 8);
+            memcpy(&w2, p + 2 * CRC32C_LARGO, 8);
+            c0 = _mm_crc32_u64(c0, w0);
+            c1 = _mm_crc32_u64(c1, w1);
+            c2 = _mm_crc32_u64(c2, w2);
+            p += 8;
+        } while (p < fin);
+        c0 = crc32c_desplazar(crc32c_largo, (uint32_t)c0) ^ c1;
+        c0 = crc32c_desplazar(crc32c_largo, (uint32_t)c0) ^ c2;
+        p += 2 * CRC32C_LARGO;
+        len -= 3 * CRC32C_LARGO;
+    }
+
+    while (len >= 3 * CRC32C_CORTO)
+    {
+        c1 = c2 = 0;
+        fin = p + CRC32C_CORTO;
+        do
+        {
+            memcpy(&w0, p, 8);
+            memcpy(&w1, p + CRC32C_CORTO, 8);
+            memcpy(&w2, p + 2 * CRC32C_CORTO, 8);
+            c0 = _mm_crc32_u64(c0, w0);
+            c1 = _mm_crc32_u64(c1, w1);
+            c2 = _mm_crc32_u64(c2, w2);
+            p += 8;
+        } while (p < fin);
+        c0 = crc32c_desplazar(crc32c_corto, (uint32_t)c0) ^ c1;
+        c0 = crc32c_desplazar(crc32c_corto, (uint32_t)c0) ^ c2;
+        p += 2 * CRC32C_CORTO;
+        len -= 3 * CRC32C_CORTO;
+    }
+
+    while (len >= 8)
+    {
+        memcpy(&w0, p, 8);
+        c0 = _mm_crc32_u64(c0, w0);
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0)
+        c0 = _mm_crc32_u8((uint32_t)c0, *p++);
+    return ~(uint32_t)c0;
+}
+#endif
+
+/**
+ * @brief CRC32C de buf, continuando un CRC previo (0 para empezar).
+ *
+ * @param crc
+ * @param buf
+ * @param len
+ * @return uint32_t
+ */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+    pthread_once(&integridad_una_vez, integridad_iniciar);
+#ifdef INTEGRIDAD_X86
+    if (usar_sse42)
+        return crc32c_hw(crc, buf, len);
+#endif
+    return crc32c_sw(crc, buf, len);
+}
+
+/**
+ * @brief Nombre de la implementacion de CRC32C en uso.
+ *
+ * @return const char*
+ */
+const char *crc32c_implementacion(void)
+{
+    pthread_once(&integridad_una_vez, integridad_iniciar);
+    return usar_sse42 ? "SSE4.2" : "portable";
+}
+
+#define ROTD(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/**
+ * @brief Procesa bloques completos de 64 bytes en C.
+ *
+ * @param estado
+ * @param p
+ * @param bloques
+ */
+static void sha256_bloques_sw(uint32_t estado[8], const unsigned char *p, size_t bloques)
+{
+    uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+
+    while (bloques--)
+    {
+        for (int i = 0; i < 16; i++)
+            w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 |
+                   (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+        for (int i = 16; i < 64; i++)
+        {
+            uint32_t s0 = ROTD(w[i - 15], 7) ^ ROTD(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = ROTD(w[i - 2], 17) ^ ROTD(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        a = estado[0], b = estado[1], c = estado[2], d = estado[3];
+        e = estado[4], f = estado[5], g = estado[6], h = estado[7];
+        for (int i = 0; i < 64; i++)
+        {
+            t1 = h + (ROTD(e, 6) ^ ROTD(e, 11) ^ ROTD(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+            t2 = (ROTD(a, 2) ^ ROTD(a, 13) ^ ROTD(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g, g = f, f = e, e = d + t1;
+            d = c, c = b, b = a, a = t1 + t2;
+        }
+        estado[0] += a, estado[1] += b, estado[2] += c, estado[3] += d;
+        estado[4] += e, estado[5] += f, estado[6] += g, estado[7] += h;
+        p += 64;
+    }
+}
+
+#ifdef INTEGRIDAD_X86
+/**
+ * @brief Procesa bloques completos de 64 bytes con las instrucciones SHA.
+ *        El estado se reordena como ABEF/CDGH, que es lo que esperan
+ *        sha256rnds2; cada grupo de cuatro rondas usa un registro de la
+ *        planificacion de mensajes, que se extiende con sha256msg1/msg2.
+ *
+ * @param estado
+ * @param p
+ * @param bloques
+ */
+__attribute__((target("sha,sse4.1"))) static void sha256_bloques_hw(uint32_t estado[8], const unsigned char *p, size_t bloques)
+{
+    const __m128i orden = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i e0, e1, msg, tmp, w[4], abef, cdgh;
+
+    tmp = _mm_loadu_si128((const __m128i *)&estado[0]);
+    e1 = _mm_loadu_si128((const __m128i *)&estado[4]);
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);     /* CDAB */
+    e1 = _mm_shuffle_epi32(e1, 0x1B);       /* EFGH */
+    e0 = _mm_alignr_epi8(tmp, e1, 8);       /* ABEF */
+    e1 = _mm_blend_epi16(e1, tmp, 0xF0);    /* CDGH */
+
+    while (bloques--)
+    {
+        abef = e0;
+        cdgh = e1;
+#pragma GCC unroll 16
+        for (int i = 0; i < 16; i++)
+        {
+            if (i < 4)
+                w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 16 * i)), orden);
+            msg = _mm_add_epi32(w[i & 3], _mm_loadu_si128((const __m128i *)&sha256_k[4 * i]));
+            e1 = _mm_sha256rnds2_epu32(e1, e0, msg);
+            if (i >= 3 && i <= 14)
+            {
+                tmp = _mm_alignr_epi8(w[i & 3], w[(i - 1) & 3], 4);
+                w[(i + 1) & 3] = _mm_add_epi32(w[(i + 1) & 3], tmp);
+                w[(i + 1) & 3] = _mm_sha256msg2_epu32(w[(i + 1) & 3], w[i & 3]);
+            }
+            msg = _mm_shuffle_epi32(msg, 0x0E);
+            e0 = _mm_sha256rnds2_epu32(e0, e1, msg);
+            if (i >= 1 && i <= 12)
+                w[(i - 1) & 3] = _mm_sha256msg1_epu32(w[(i - 1) & 3], w[i & 3]);
+        }
+        e0 = _mm_add_epi32(e0, abef);
+        e1 = _mm_add_epi32(e1, cdgh);
+        p += 64;
+    }
+
+    tmp = _mm_shuffle_epi32(e0, 0x1B);      /* FEBA */
+    e1 = _mm_shuffle_epi32(e1, 0xB1);       /* DCHG */
+    e0 = _mm_blend_epi16(tmp, e1, 0xF0);    /* DCBA */
+    e1 = _mm_alignr_epi8(e1, tmp, 8);       /* HGFE */
+    _mm_storeu_si128((__m128i *)&estado[0], e0);
+    _mm_storeu_si128((__m128i *)&estado[4], e1);
+}
+#endif
+
+/**
+ * @brief Procesa bloques completos con la implementacion disponible.
+ *
+ * @param estado
+ * @param p
+ * @param bloques
+ */
+static void sha256_bloques(uint32_t estado[8], const unsigned char *p, size_t bloques)
+{
+#ifdef INTEGRIDAD_X86
+    if (usar_sha)
+    {
+        sha256_bloques_hw(estado, p, bloques);
+        return;
+    }
+#endif
+    sha256_bloques_sw(estado, p, bloques);
+}
+
+/**
+ * @brief Comienza un nuevo calculo de SHA-256.
+ *
+ * @param s
+ */
+void sha256_iniciar(struct sha256 *s)
+{
+    static const uint32_t inicial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+    pthread_once(&integridad_una_vez, integridad_iniciar);
+    memcpy(s->estado, inicial, sizeof(inicial));
+    s->total = 0;
+    s->usados = 0;
+}
+
+/**
+ * @brief Agrega datos al calculo.
+ *
+ * @param s
+ * @param datos
+ * @param len
+ */
+void sha256_agregar(struct sha256 *s, const void *datos, size_t len)
+{
+    const unsigned char *p = datos;
+
+    s->total += len;
+    if (s->usados > 0)
+    {
+        size_t falta = 64 - s->usados;
+        size_t n = len < falta ? len : falta;
+        memcpy(s->resto + s->usados, p, n);
+        s->usados += n;
+        p += n;
+        len -= n;
+        if (s->usados < 64)
+            return;
+        sha256_bloques(s->estado, s->resto, 1);
+        s->usados = 0;
+    }
+    if (len >= 64)
+    {
+        sha256_bloques(s->estado, p, len / 64);
+        p += len & ~(size_t)63;
+        len &= 63;
+    }
+    memcpy(s->resto, p, len);
+    s->usados = len;
+}
+
+/**
+ * @brief Agrega el relleno y obtiene el resumen.
+ *
+ * @param s
+ * @param resumen
+ */
+void sha256_finalizar(struct sha256 *s, unsigned char resumen[SHA256_LEN])
+{
+    uint64_t bits = s->total * 8;
+
+    s->resto[s->usados++] = 0x80;
+    if (s->usados > 56)
+    {
+        memset(s->resto + s->usados, 0, 64 - s->usados);
+        sha256_bloques(s->estado, s->resto, 1);
+        s->usados = 0;
+    }
+    memset(s->resto + s->usados, 0, 56 - s->usados);
+    for (int i = 0; i < 8; i++)
+        s->resto[63 - i] = (unsigned char)(bits >> (8 * i));
+    sha256_bloques(s->estado, s->resto, 1);
+
+    for (int i = 0; i < 8; i++)
+    {
+        resumen[4 * i] = (unsigned char)(s->estado[i] >> 24);
+        resumen[4 * i + 1] = (unsigned char)(s->estado[i] >> 16);
+        resumen[4 * i + 2] = (unsigned char)(s->estado[i] >> 8);
+        resumen[4 * i + 3] = (unsigned char)s->estado[i];
+    }
+}
+
+/**
+ * @brief SHA-256 de todo el contenido de un archivo abierto, leido desde el
+ *        principio sin mover su posicion.
+ *
+ * @param fd
+ * @param resumen
+ * @return int 0, o -1 si no pudo leerse
+ */
+int sha256_archivo(int fd, unsigned char resumen[SHA256_LEN])
+{
+    struct sha256 s;
+    unsigned char bloque[65536];
+    off_t desplazamiento = 0;
+    ssize_t n;
+
+    sha256_iniciar(&s);
+    while ((n = pread(fd, bloque, sizeof(bloque), desplazamiento)) != 0)
+    {
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        sha256_agregar(&s, bloque, (size_t)n);
+        desplazamiento += n;
+    }
+    sha256_finalizar(&s, resumen);
+    return 0;
+}
+
+/**
+ * @brief Nombre de la implementacion de SHA-256 en uso.
+ *
+ * @return const char*
+ */
+const char *sha256_implementacion(void)
+{
+    pthread_once(&integridad_una_vez, integridad_iniciar);
+    return usar_sha ? "SHA-NI" : "portable";
+}
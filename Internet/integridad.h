@@ -0,0 +1,39 @@
+/**
+ * @file integridad.h
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Sumas de verificacion de las transferencias: CRC32C por bloque y
+ *        SHA-256 del archivo completo. Ambas usan instrucciones del
+ *        procesador (SSE4.2 y SHA) cuando estan disponibles y una version
+ *        portable en caso contrario.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef INTEGRIDAD_H
+#define INTEGRIDAD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA256_LEN 32
+
+struct sha256
+{
+    uint32_t estado[8];
+    uint64_t total;          /* bytes procesados */
+    unsigned char resto[64]; /* bloque incompleto pendiente */
+    size_t usados;
+};
+
+uint32_t crc32c(uint32_t, const void *, size_t);
+const char *crc32c_implementacion(void);
+
+void sha256_iniciar(struct sha256 *);
+void sha256_agregar(struct sha256 *, const void *, size_t);
+void sha256_finalizar(struct sha256 *, unsigned char[SHA256_LEN]);
+int sha256_archivo(int, unsigned char[SHA256_LEN]);
+const char *sha256_implementacion(void);
+
+#endif
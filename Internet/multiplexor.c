@@ -0,0 +1,895 @@
+/**
+ * @file multiplexor.c
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Multiplexor de flujos sobre una conexion TCP. Un unico hilo por
+ *        conexion espera con poll sobre la conexion y sobre el extremo interno
+ *        de cada flujo: elige con el planificador de que flujo leer la
+ *        proxima trama, separa las tramas que llegan y las entrega a cada
+ *        flujo sin bloquearse. Los datos que la aplicacion aun no leyo quedan
+ *        en el buffer de entrada del flujo, que nunca se desborda porque el
+ *        otro extremo solo envia lo que le habilita el credito.
+ *        Planificador: el control pasa siempre; el resto sale en rafagas de
+ *        MUX_RAFAGA cuando el kernel avisa (TCP_NOTSENT_LOWAT) que su cola sin
+ *        enviar es corta, de modo que un comando nunca queda detras de megas
+ *        de imagen. Dentro de cada clase se atiende al flujo de menor tiempo
+ *        virtual de inicio, que avanza bytes/peso con cada trama (WFQ).
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "multiplexor.h"
+#include "buffers.h"
+
+/* Cuando lo entregado a la aplicacion alcanza esta cantidad se devuelve el
+   credito al otro extremo */
+#define MUX_UMBRAL_CREDITO (MUX_VENTANA / 4)
+
+/* Lo que pueden ocupar las tramas de control de un flujo en una vuelta:
+   ABRIR con el nombre, CREDITO, FIN y RESET */
+#define MUX_CONTROL_MAX (4 * MUX_CABECERA_LEN + MUX_SERVICIO + 6)
+
+/* Unidad del tiempo virtual: bytes * MUX_ESCALA / peso */
+#define MUX_ESCALA 256
+
+struct mux_flujo
+{
+    uint32_t id;                  /* 0: entrada libre */
+    int fd;                       /* extremo del multiplexor; la aplicacion usa el otro */
+    char servicio[MUX_SERVICIO];
+    int clase;                    /* enum mux_clase de los datos que envia */
+    uint32_t peso;                /* parte de la clase que le corresponde */
+    uint64_t virtual;             /* tiempo virtual en que termina su ultima trama */
+    uint32_t credito;             /* bytes que el otro extremo acepta todavia */
+    uint32_t consumido;           /* entregado a la aplicacion y aun no informado */
+    char *entrada;                /* anillo de MUX_VENTANA bytes para la aplicacion */
+    struct buffer *anillo;        /* buffer del pool que respalda la entrada */
+    size_t ent_ini, ent_len;
+    int legible;                  /* poll informo datos de la aplicacion */
+    int anunciar;                 /* falta enviar MUX_ABRIR */
+    int fin_local;                /* 1: la aplicacion cerro su escritura, 2: FIN enviado */
+    int fin_remoto;               /* 1: llego FIN, 2: ya se cerro la escritura hacia la aplicacion */
+    int reset;                    /* falta enviar MUX_RESET y liberar */
+};
+
+struct mux
+{
+    int sock;
+    int despertar;                /* eventfd para interrumpir el poll del hilo */
+    int avisos;                   /* eventfd legible con flujos sin aceptar o la conexion caida */
+    pthread_t hilo;
+    pthread_mutex_t mutex;
+    pthread_cond_t hay_nuevos;
+    uint32_t siguiente;           /* proximo identificador propio */
+    uint64_t reloj[MUX_CLASES];   /* tiempo virtual de la ultima trama de cada clase */
+    int escribible;               /* el kernel admite otra rafaga no urgente */
+    int terminar, caido;
+    struct mux_flujo flujos[MUX_MAX_FLUJOS];
+    int nuevos[MUX_MAX_FLUJOS];   /* flujos abiertos por el otro extremo, sin aceptar */
+    char nuevos_servicio[MUX_MAX_FLUJOS][MUX_SERVICIO];
+    int n_nuevos;
+    uint32_t rechazados[MUX_MAX_FLUJOS]; /* flujos del otro extremo sin lugar: falta el MUX_RESET */
+    int n_rechazados;
+    size_t sal_ini, sal_len;
+    size_t lec_len;
+    char *salida;                 /* MUX_SALIDA bytes */
+    char *lectura;                /* MUX_LECTURA bytes */
+    struct buffer *buf_salida, *buf_lectura;
+    struct cap_archivo *captura;  /* grabacion de la sesion, o NULL */
+};
+
+void *mux_bucle(void *);
+
+/**
+ * @brief Despierta al hilo del multiplexor para que revise los flujos.
+ *
+ * @param m
+ */
+static void mux_despertar(struct mux *m)
+{
+    uint64_t uno = 1;
+    if (write(m->despertar, &uno, sizeof(uno)) < 0)
+        perror("eventfd");
+}
+
+/**
+ * @brief Avisa a quien espera flujos nuevos sin bloquearse (mux_avisos).
+ *
+ * @param m
+ */
+static void mux_avisar(struct mux *m)
+{
+    uint64_t uno = 1;
+    if (write(m->avisos, &uno, sizeof(uno)) < 0)
+        perror("eventfd");
+}
+
+/**
+ * @brief Espacio libre al final del buffer de salida, compactandolo si hace
+ *        falta.
+ *
+ * @param m
+ * @return size_t
+ */
+static size_t mux_espacio(struct mux *m)
+{
+    if (m->sal_ini > 0 && m->sal_ini + m->sal_len > MUX_SALIDA / 2)
+    {
+        memmove(m->salida, m->salida + m->sal_ini, m->sal_len);
+        m->sal_ini = 0;
+    }
+    return MUX_SALIDA - m->sal_ini - m->sal_len;
+}
+
+/**
+ * @brief Agrega una trama al buffer de salida. La carga ya puede estar en su
+ *        lugar (carga == NULL), como cuando se lee directo del flujo.
+ *
+ * @param m
+ * @param flujo
+ * @param tipo
+ * @param carga
+ * @param largo
+ */
+static void mux_trama(struct mux *m, uint32_t flujo, uint16_t tipo, const void *carga, uint16_t largo)
+{
+    char *p = m->salida + m->sal_ini + m->sal_len;
+    uint32_t u32 = htonl(flujo);
+    uint16_t u16 = htons(tipo);
+
+    memcpy(p, &u32, 4);
+    memcpy(p + 4, &u16, 2);
+    u16 = htons(largo);
+    memcpy(p + 6, &u16, 2);
+    if (carga != NULL)
+        memcpy(p + MUX_CABECERA_LEN, carga, largo);
+    m->sal_len += MUX_CABECERA_LEN + largo;
+}
+
+/**
+ * @brief Busca un flujo por identificador.
+ *
+ * @param m
+ * @param id
+ * @return struct mux_flujo* NULL si no existe
+ */
+static struct mux_flujo *mux_buscar(struct mux *m, uint32_t id)
+{
+    for (int i = 0; i < MUX_MAX_FLUJOS; i++)
+        if (m->flujos[i].id == id)
+            return &m->flujos[i];
+    return NULL;
+}
+
+/**
+ * @brief Crea un flujo en una entrada libre de la tabla.
+ *
+ * @param m
+ * @param id
+ * @param servicio
+ * @param clase
+ * @param peso
+ * @return int extremo de la aplicacion, o -1
+ */
+static int mux_nuevo(struct mux *m, uint32_t id, const char *servicio, int clase, uint32_t peso)
+{
+    struct mux_flujo *f = mux_buscar(m, 0);
+    int par[2];
+
+    if (f == NULL || m->caido)
+        return -1;
+    /* El anillo sale del pool: un flujo nuevo reusa el de uno cerrado */
+    if ((f->anillo = buf_obtener(MUX_VENTANA)) == NULL)
+        return -1;
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, par) < 0)
+    {
+        perror("socketpair");
+        buf_soltar(f->anillo);
+        f->anillo = NULL;
+        return -1;
+    }
+    f->entrada = f->anillo->datos;
+    fcntl(par[0], F_SETFL, O_NONBLOCK);
+
+    f->id = id;
+    f->fd = par[0];
+    snprintf(f->servicio, sizeof(f->servicio), "%s", servicio);
+    f->clase = clase;
+    f->peso = peso > 0 ? peso : 1;
+    f->virtual = m->reloj[f->clase];
+    f->credito = MUX_VENTANA;
+    f->consumido = 0;
+    f->ent_ini = f->ent_len = 0;
+    f->legible = 1;
+    f->anunciar = f->fin_local = f->fin_remoto = f->reset = 0;
+    return par[1];
+}
+
+/**
+ * @brief Libera un flujo. La aplicacion ve el cierre en su extremo.
+ *
+ * @param f
+ */
+static void mux_liberar(struct mux_flujo *f)
+{
+    close(f->fd);
+    buf_soltar(f->anillo);
+    f->anillo = NULL;
+    f->entrada = NULL;
+    f->id = 0;
+}
+
+/**
+ * @brief Entrega a la aplicacion lo que pueda del buffer de entrada sin
+ *        bloquearse.
+ *
+ * @param f
+ */
+static void mux_entregar(struct mux_flujo *f)
+{
+    ssize_t n;
+
+    while (f->ent_len > 0 && !f->reset)
+    {
+        size_t tramo = MUX_VENTANA - f->ent_ini < f->ent_len ? MUX_VENTANA - f->ent_ini : f->ent_len;
+        n = send(f->fd, f->entrada + f->ent_ini, tramo, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN)
+            {
+                /* La aplicacion cerro el flujo con datos en camino */
+                f->reset = 1;
+                f->ent_len = 0;
+            }
+            break;
+        }
+        f->ent_ini = (f->ent_ini + (size_t)n) % MUX_VENTANA;
+        f->ent_len -= (size_t)n;
+        f->consumido += (uint32_t)n;
+    }
+    if (f->ent_len == 0 && f->fin_remoto == 1 && !f->reset)
+    {
+        shutdown(f->fd, SHUT_WR);
+        f->fin_remoto = 2;
+    }
+}
+
+/**
+ * @brief Procesa una trama recibida de la conexion.
+ *
+ * @param m
+ * @param cab
+ * @param carga
+ * @return int 0, o -1 si el otro extremo violo el protocolo
+ */
+static int mux_procesar(struct mux *m, const struct mux_cabecera *cab, const char *carga)
+{
+    struct mux_flujo *f = cab->flujo != 0 ? mux_buscar(m, cab->flujo) : NULL;
+    char servicio[MUX_SERVICIO];
+    uint32_t u32;
+    size_t pos, tramo;
+    int fd;
+
+    switch (cab->tipo)
+    {
+    case MUX_DATOS:
+        if (f == NULL || f->reset)
+            return 0; /* flujo ya descartado: los datos en camino se ignoran */
+        if (cab->largo > MUX_VENTANA - f->ent_len)
+        {
+            printf("Flujo %u excedio su credito\n", cab->flujo);
+            return -1;
+        }
+        pos = (f->ent_ini + f->ent_len) % MUX_VENTANA;
+        tramo = MUX_VENTANA - pos < cab->largo ? MUX_VENTANA - pos : cab->largo;
+        memcpy(f->entrada + pos, carga, tramo);
+        memcpy(f->entrada, carga + tramo, cab->largo - tramo);
+        f->ent_len += cab->largo;
+        mux_entregar(f);
+        break;
+    case MUX_ABRIR:
+        if (f != NULL)
+            return -1;
+        if (cab->largo < 2 || (unsigned char)carga[0] >= MUX_CLASES)
+            return -1;
+        snprintf(servicio, sizeof(servicio), "%.*s", (int)cab->largo - 2, carga + 2);
+        if (m->n_nuevos == MUX_MAX_FLUJOS ||
+            (fd = mux_nuevo(m, cab->flujo, servicio, (unsigned char)carga[0], (unsigned char)carga[1])) < 0)
+        {
+            /* Sin lugar: el otro extremo ve el flujo cerrado. El MUX_RESET
+               sale con las demas tramas de control; no tiene mas flujos
+               abiertos que los que caben en su tabla */
+            if (m->n_rechazados == MUX_MAX_FLUJOS)
+                return -1;
+            m->rechazados[m->n_rechazados++] = cab->flujo;
+            break;
+        }
+        m->nuevos[m->n_nuevos] = fd;
+        memcpy(m->nuevos_servicio[m->n_nuevos], servicio, sizeof(servicio));
+        m->n_nuevos++;
+        pthread_cond_signal(&m->hay_nuevos);
+        mux_avisar(m);
+        break;
+    case MUX_FIN:
+        if (f != NULL && !f->fin_remoto)
+        {
+            f->fin_remoto = 1;
+            mux_entregar(f);
+        }
+        break;
+    case MUX_CREDITO:
+        if (f != NULL && cab->largo == sizeof(u32))
+        {
+            memcpy(&u32, carga, sizeof(u32));
+            f->credito += ntohl(u32);
+        }
+        break;
+    case MUX_RESET:
+        if (f != NULL)
+            mux_liberar(f);
+        break;
+    default:
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Lee de la conexion y procesa todas las tramas completas.
+ *
+ * @param m
+ */
+static void mux_leer_conexion(struct mux *m)
+{
+    struct mux_cabecera cab;
+    size_t pos = 0;
+    uint32_t u32;
+    uint16_t u16;
+    ssize_t n;
+
+    n = recv(m->sock, m->lectura + m->lec_len, MUX_LECTURA - m->lec_len, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (n <= 0)
+    {
+        m->caido = 1;
+        return;
+    }
+    cap_registrar(m->captura, CAP_ENTRADA, m->lectura + m->lec_len, (size_t)n);
+    m->lec_len += (size_t)n;
+
+    while (m->lec_len - pos >= MUX_CABECERA_LEN)
+    {
+        memcpy(&u32, m->lectura + pos, 4);
+        cab.flujo = ntohl(u32);
+        memcpy(&u16, m->lectura + pos + 4, 2);
+        cab.tipo = ntohs(u16);
+        memcpy(&u16, m->lectura + pos + 6, 2);
+        cab.largo = ntohs(u16);
+        if (cab.largo > MUX_TRAMA_MAX)
+        {
+            m->caido = 1;
+            return;
+        }
+        if (m->lec_len - pos < MUX_CABECERA_LEN + (size_t)cab.largo)
+            break;
+        if (mux_procesar(m, &cab, m->lectura + pos + MUX_CABECERA_LEN) < 0)
+        {
+            m->caido = 1;
+            return;
+        }
+        pos += MUX_CABECERA_LEN + cab.largo;
+    }
+    memmove(m->lectura, m->lectura + pos, m->lec_len - pos);
+    m->lec_len -= pos;
+}
+
+/**
+ * @brief Escribe en la conexion lo que admita sin bloquearse.
+ *
+ * @param m
+ */
+static void mux_escribir_conexion(struct mux *m)
+{
+    ssize_t n;
+
+    while (m->sal_len > 0)
+    {
+        n = send(m->sock, m->salida + m->sal_ini, m->sal_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN)
+                m->caido = 1;
+            m->escribible = 0;
+            return;
+        }
+        cap_registrar(m->captura, CAP_SALIDA, m->salida + m->sal_ini, (size_t)n);
+        m->sal_ini += (size_t)n;
+        m->sal_len -= (size_t)n;
+    }
+    m->sal_ini = 0;
+}
+
+/**
+ * @brief Indica si conviene leer del flujo: tiene credito, la aplicacion
+ *        no cerro su escritura y entra una trama completa en la salida.
+ *
+ * @param m
+ * @param f
+ * @return int
+ */
+static int mux_puede_leer(struct mux *m, struct mux_flujo *f)
+{
+    return f->id != 0 && !f->reset && !f->anunciar && !f->fin_local && f->credito > 0 &&
+           MUX_SALIDA - m->sal_ini - m->sal_len >= MUX_CABECERA_LEN + MUX_TRAMA_MAX;
+}
+
+/**
+ * @brief Elige el flujo del que sale la proxima trama de datos: el de mayor
+ *        clase con datos y, dentro de ella, el de menor tiempo virtual de
+ *        inicio. Un flujo que estuvo inactivo arranca desde el reloj de su
+ *        clase, sin acumular turnos.
+ *
+ * @param m
+ * @param no_urgentes tambien se consideran las clases que no son de control
+ * @param inicio recibe el tiempo virtual de inicio del elegido
+ * @return struct mux_flujo* NULL si no hay datos para enviar
+ */
+static struct mux_flujo *mux_elegir(struct mux *m, int no_urgentes, uint64_t *inicio)
+{
+    struct mux_flujo *elegido = NULL;
+
+    for (int clase = 0; clase < MUX_CLASES && elegido == NULL; clase++)
+    {
+        if (clase != MUX_CONTROL && !no_urgentes)
+            break;
+        for (int i = 0; i < MUX_MAX_FLUJOS; i++)
+        {
+            struct mux_flujo *f = &m->flujos[i];
+            if (f->clase != clase || !f->legible || !mux_puede_leer(m, f))
+                continue;
+            uint64_t v = f->virtual > m->reloj[clase] ? f->virtual : m->reloj[clase];
+            if (elegido == NULL || v < *inicio)
+            {
+                elegido = f;
+                *inicio = v;
+            }
+        }
+    }
+    return elegido;
+}
+
+/**
+ * @brief Arma las tramas pendientes. Primero las de control del protocolo,
+ *        que no consumen credito; despues las de datos en el orden que decide
+ *        mux_elegir. Los flujos de control pasan siempre; los demas solo
+ *        mientras dure la rafaga habilitada por el kernel.
+ *
+ * @param m
+ */
+static void mux_generar(struct mux *m)
+{
+    struct mux_flujo *f;
+    char abrir[2 + MUX_SERVICIO];
+    uint32_t u32;
+    uint64_t inicio = 0;
+    size_t rafaga = 0;
+    ssize_t n;
+
+    while (m->n_rechazados > 0 && mux_espacio(m) >= MUX_CABECERA_LEN)
+        mux_trama(m, m->rechazados[--m->n_rechazados], MUX_RESET, NULL, 0);
+
+    for (int i = 0; i < MUX_MAX_FLUJOS; i++)
+    {
+        f = &m->flujos[i];
+        if (f->id == 0 || mux_espacio(m) < MUX_CONTROL_MAX)
+            continue;
+        if (f->anunciar)
+        {
+            abrir[0] = (char)f->clase;
+            abrir[1] = (char)f->peso;
+            memcpy(abrir + 2, f->servicio, strlen(f->servicio));
+            mux_trama(m, f->id, MUX_ABRIR, abrir, (uint16_t)(2 + strlen(f->servicio)));
+            f->anunciar = 0;
+        }
+        if (f->reset)
+        {
+            mux_trama(m, f->id, MUX_RESET, NULL, 0);
+            mux_liberar(f);
+            continue;
+        }
+        if (f->consumido >= MUX_UMBRAL_CREDITO || (f->consumido > 0 && f->fin_remoto))
+        {
+            u32 = htonl(f->consumido);
+            mux_trama(m, f->id, MUX_CREDITO, &u32, sizeof(u32));
+            f->consumido = 0;
+        }
+        if (f->fin_local == 1)
+        {
+            mux_trama(m, f->id, MUX_FIN, NULL, 0);
+            f->fin_local = 2;
+        }
+        if (f->fin_local == 2 && f->fin_remoto == 2)
+            mux_liberar(f);
+    }
+
+    while (mux_espacio(m) >= MUX_CABECERA_LEN + MUX_TRAMA_MAX &&
+           (f = mux_elegir(m, m->escribible && rafaga < MUX_RAFAGA, &inicio)) != NULL)
+    {
+        size_t max = f->credito < MUX_TRAMA_MAX ? f->credito : MUX_TRAMA_MAX;
+        char *destino = m->salida + m->sal_ini + m->sal_len + MUX_CABECERA_LEN;
+        n = recv(f->fd, destino, max, MSG_DONTWAIT);
+        if (n > 0)
+        {
+            mux_trama(m, f->id, MUX_DATOS, NULL, (uint16_t)n);
+            f->credito -= (uint32_t)n;
+            m->reloj[f->clase] = inicio;
+            f->virtual = inicio + (uint64_t)n * MUX_ESCALA / f->peso;
+            if (f->clase != MUX_CONTROL)
+                rafaga += (size_t)n;
+        }
+        else if (n == 0)
+        {
+            mux_trama(m, f->id, MUX_FIN, NULL, 0);
+            f->fin_local = 2;
+            if (f->fin_remoto == 2)
+                mux_liberar(f);
+        }
+        else if (errno == EAGAIN)
+            f->legible = 0;
+        else if (errno != EINTR)
+        {
+            f->legible = 0;
+            f->reset = 1;
+        }
+    }
+    /* Rafaga completa: la proxima espera el aviso de escritura del kernel */
+    if (rafaga >= MUX_RAFAGA)
+        m->escribible = 0;
+}
+
+/**
+ * @brief Hilo del multiplexor. Mantiene el candado salvo mientras espera en
+ *        poll, de modo que mux_abrir y mux_aceptar ven la tabla consistente.
+ *
+ * @param arg struct mux
+ * @return void*
+ */
+void *mux_bucle(void *arg)
+{
+    struct mux *m = arg;
+    struct pollfd pfd[MUX_MAX_FLUJOS + 2];
+    int indice[MUX_MAX_FLUJOS + 2];
+    uint64_t eventos;
+    nfds_t n;
+    int pendientes;
+
+    pthread_mutex_lock(&m->mutex);
+    while (!m->caido)
+    {
+        mux_generar(m);
+        mux_escribir_conexion(m);
+        if (m->terminar && m->sal_len == 0)
+            break;
+
+        n = 0;
+        pendientes = 0;
+        pfd[n].fd = m->despertar;
+        pfd[n++].events = POLLIN;
+        pfd[n++].fd = m->sock;
+        for (int i = 0; i < MUX_MAX_FLUJOS; i++)
+        {
+            struct mux_flujo *f = &m->flujos[i];
+            short ev = 0;
+            if (f->id == 0)
+                continue;
+            if (f->ent_len > 0)
+                ev |= POLLOUT;
+            if (mux_puede_leer(m, f))
+            {
+                /* Se anota que el flujo tiene datos aunque no haya rafaga:
+                   asi compite en mux_elegir apenas el kernel la habilite */
+                if (!f->legible)
+                    ev |= POLLIN;
+                if (f->clase != MUX_CONTROL)
+                    pendientes = 1;
+            }
+            if (ev == 0)
+                continue;
+            indice[n] = i;
+            pfd[n].fd = f->fd;
+            pfd[n++].events = ev;
+        }
+        pfd[1].events = (m->lec_len < MUX_LECTURA ? POLLIN : 0) |
+                        (m->sal_len > 0 || (pendientes && !m->escribible) ? POLLOUT : 0);
+
+        pthread_mutex_unlock(&m->mutex);
+        if (poll(pfd, n, -1) < 0 && errno != EINTR)
+        {
+            perror("poll");
+            pthread_mutex_lock(&m->mutex);
+            break;
+        }
+        pthread_mutex_lock(&m->mutex);
+
+        if (pfd[0].revents & POLLIN)
+            if (read(m->despertar, &eventos, sizeof(eventos)) < 0 && errno != EAGAIN)
+                perror("eventfd");
+        if (pfd[1].revents & (POLLIN | POLLERR | POLLHUP))
+            mux_leer_conexion(m);
+        if (pfd[1].revents & POLLOUT)
+            m->escribible = 1; /* la cola sin enviar bajo de MUX_NO_ENVIADO */
+        for (nfds_t j = 2; j < n; j++)
+        {
+            struct mux_flujo *f = &m->flujos[indice[j]];
+            if (f->fd != pfd[j].fd || f->id == 0)
+                continue; /* liberado mientras tanto */
+            if (pfd[j].revents & (POLLIN | POLLHUP | POLLERR))
+                f->legible = 1;
+            if (pfd[j].revents & (POLLOUT | POLLERR | POLLHUP))
+                mux_entregar(f);
+        }
+    }
+
+    /* Conexion caida o cierre: las aplicaciones ven sus flujos cerrados */
+    m->caido = 1;
+    for (int i = 0; i < MUX_MAX_FLUJOS; i++)
+        if (m->flujos[i].id != 0)
+            mux_liberar(&m->flujos[i]);
+    pthread_cond_broadcast(&m->hay_nuevos);
+    mux_avisar(m);
+    pthread_mutex_unlock(&m->mutex);
+    return NULL;
+}
+
+/**
+ * @brief Pone la conexion bajo el control de un multiplexor. A partir de
+ *        aqui todo el trafico de la sesion debe pasar por flujos.
+ *
+ * @param sock conexion TCP ya establecida; pasa a ser del multiplexor
+ * @param impar 1 en la estacion (flujos impares), 0 en el satelite (pares)
+ * @return struct mux* NULL en caso de error
+ */
+struct mux *mux_crear(int sock, int impar)
+{
+    struct mux *m = calloc(1, sizeof(*m));
+    int uno = 1, no_enviado = MUX_NO_ENVIADO;
+
+    if (m == NULL)
+        return NULL;
+    m->buf_salida = buf_obtener(MUX_SALIDA);
+    m->buf_lectura = buf_obtener(MUX_LECTURA);
+    if (m->buf_salida == NULL || m->buf_lectura == NULL)
+    {
+        buf_soltar(m->buf_salida);
+        buf_soltar(m->buf_lectura);
+        free(m);
+        return NULL;
+    }
+    m->salida = m->buf_salida->datos;
+    m->lectura = m->buf_lectura->datos;
+    m->sock = sock;
+    m->siguiente = impar ? 1 : 2;
+    m->escribible = 1;
+    if ((m->despertar = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 ||
+        (m->avisos = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+    {
+        perror("eventfd");
+        if (m->despertar >= 0)
+            close(m->despertar);
+        buf_soltar(m->buf_salida);
+        buf_soltar(m->buf_lectura);
+        free(m);
+        return NULL;
+    }
+    pthread_mutex_init(&m->mutex, NULL);
+    pthread_cond_init(&m->hay_nuevos, NULL);
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+    /* El multiplexor ya agrupa las tramas: cada escritura debe salir */
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &uno, sizeof(uno));
+    /* Con poca cola en el kernel el orden lo decide el planificador */
+    setsockopt(sock, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &no_enviado, sizeof(no_enviado));
+    /* Las aplicaciones escriben en sus flujos con write; un flujo cerrado
+       por la caida de la conexion no debe terminar el proceso */
+    signal(SIGPIPE, SIG_IGN);
+
+    if (pthread_create(&m->hilo, NULL, mux_bucle, m) != 0)
+    {
+        perror("pthread_create");
+        close(m->despertar);
+        close(m->avisos);
+        buf_soltar(m->buf_salida);
+        buf_soltar(m->buf_lectura);
+        free(m);
+        return NULL;
+    }
+    return m;
+}
+
+/**
+ * @brief Abre un flujo hacia el otro extremo, que lo recibe con mux_aceptar.
+ *        La clase y el peso rigen los datos que envian ambos extremos.
+ *
+ * @param m
+ * @param servicio nombre de la operacion
+ * @param clase prioridad del flujo
+ * @param peso parte de la clase frente a otros flujos de la misma clase
+ * @return int socket del flujo para la aplicacion, o -1 con errno EPIPE si
+ *         la conexion cayo o EAGAIN si no hay flujos libres
+ */
+int mux_abrir(struct mux *m, const char *servicio, enum mux_clase clase, uint8_t peso)
+{
+    int fd;
+
+    pthread_mutex_lock(&m->mutex);
+    if ((fd = mux_nuevo(m, m->siguiente, servicio, clase, peso)) >= 0)
+    {
+        mux_buscar(m, m->siguiente)->anunciar = 1;
+        m->siguiente += 2;
+    }
+    else
+        errno = m->caido ? EPIPE : EAGAIN; /* sin flujos, anillos o descriptores libres */
+    pthread_mutex_unlock(&m->mutex);
+    if (fd >= 0)
+        mux_despertar(m);
+    return fd;
+}
+
+/**
+ * @brief Saca el primer flujo abierto por el otro extremo. Con el candado.
+ *
+ * @param m
+ * @param servicio recibe el nombre de la operacion
+ * @param len
+ * @return int socket del flujo, o -1 si no hay
+ */
+static int mux_sacar(struct mux *m, char *servicio, size_t len)
+{
+    int fd;
+
+    if (m->n_nuevos == 0)
+        return -1;
+    fd = m->nuevos[0];
+    snprintf(servicio, len, "%s", m->nuevos_servicio[0]);
+    m->n_nuevos--;
+    memmove(m->nuevos, m->nuevos + 1, m->n_nuevos * sizeof(m->nuevos[0]));
+    memmove(m->nuevos_servicio, m->nuevos_servicio + 1, m->n_nuevos * sizeof(m->nuevos_servicio[0]));
+    return fd;
+}
+
+/**
+ * @brief Espera un flujo abierto por el otro extremo.
+ *
+ * @param m
+ * @param servicio recibe el nombre de la operacion
+ * @param len
+ * @return int socket del flujo, o -1 si la conexion cayo
+ */
+int mux_aceptar(struct mux *m, char *servicio, size_t len)
+{
+    int fd;
+
+    pthread_mutex_lock(&m->mutex);
+    while (m->n_nuevos == 0 && !m->caido)
+        pthread_cond_wait(&m->hay_nuevos, &m->mutex);
+    fd = mux_sacar(m, servicio, len);
+    pthread_mutex_unlock(&m->mutex);
+    return fd;
+}
+
+/**
+ * @brief Como mux_aceptar, pero sin esperar: para atender la conexion desde
+ *        un bucle de eventos que vigila mux_avisos.
+ *
+ * @param m
+ * @param servicio recibe el nombre de la operacion
+ * @param len
+ * @return int socket del flujo, o -1 con errno EAGAIN si no hay flujos
+ *         nuevos o EPIPE si la conexion cayo
+ */
+int mux_tomar(struct mux *m, char *servicio, size_t len)
+{
+    int fd;
+
+    pthread_mutex_lock(&m->mutex);
+    fd = mux_sacar(m, servicio, len);
+    if (fd < 0)
+        errno = m->caido ? EPIPE : EAGAIN;
+    pthread_mutex_unlock(&m->mutex);
+    return fd;
+}
+
+/**
+ * @brief Descriptor que se vuelve legible cuando hay flujos para
+ *        mux_tomar o la conexion cayo. Quien lo vigila lo vacia con read
+ *        antes de tomar los flujos.
+ *
+ * @param m
+ * @return int
+ */
+int mux_avisos(struct mux *m)
+{
+    return m->avisos;
+}
+
+/**
+ * @brief Aplica a la conexion los buffers y la prioridad de un ajuste. Las
+ *        opciones de agrupamiento no se aplican: el multiplexor arma sus
+ *        propias escrituras y cualquier retencion demoraria a todos los flujos.
+ *
+ * @param m
+ * @param aj
+ * @return int
+ */
+int mux_ajustar(struct mux *m, const struct ajuste_socket *aj)
+{
+    struct ajuste_socket conexion = *aj;
+
+    conexion.nodelay = 1;
+    conexion.cork = 0;
+    conexion.zerocopy = 0;
+    return perfil_aplicar(m->sock, &conexion);
+}
+
+/**
+ * @brief Graba desde ahora todo lo que se lee y escribe en la conexion. El
+ *        hilo del multiplexor es el unico que escribe en la grabacion; quien
+ *        la pidio la cierra despues de mux_cerrar.
+ *
+ * @param m
+ * @param captura NULL para dejar de grabar
+ */
+void mux_grabar(struct mux *m, struct cap_archivo *captura)
+{
+    pthread_mutex_lock(&m->mutex);
+    m->captura = captura;
+    pthread_mutex_unlock(&m->mutex);
+}
+
+/**
+ * @brief Envia lo pendiente, detiene el hilo y cierra la conexion y los
+ *        flujos que queden.
+ *
+ * @param m
+ */
+void mux_cerrar(struct mux *m)
+{
+    pthread_mutex_lock(&m->mutex);
+    m->terminar = 1;
+    pthread_mutex_unlock(&m->mutex);
+    mux_despertar(m);
+    pthread_join(m->hilo, NULL);
+
+    for (int i = 0; i < m->n_nuevos; i++)
+        close(m->nuevos[i]);
+    close(m->sock);
+    close(m->despertar);
+    close(m->avisos);
+    pthread_mutex_destroy(&m->mutex);
+    pthread_cond_destroy(&m->hay_nuevos);
+    buf_soltar(m->buf_salida);
+    buf_soltar(m->buf_lectura);
+    free(m);
+}
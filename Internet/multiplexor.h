@@ -0,0 +1,76 @@
+/**
+ * @file multiplexor.h
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Flujos logicos sobre la conexion TCP entre estacion y satelite. Cada
+ *        operacion (escaneo, telemetria, firmware, perfil) abre su propio
+ *        flujo y lo usa como un socket comun: la aplicacion recibe un extremo
+ *        de un socketpair y el hilo del multiplexor lleva los datos entre ese
+ *        extremo y la conexion, en tramas cortas y con una ventana de credito
+ *        por flujo, de modo que un flujo lento o detenido no frena al resto.
+ *        Cada flujo pertenece a una clase de prioridad: el control sale antes
+ *        que la telemetria y esta antes que las transferencias masivas; dentro
+ *        de una clase los flujos se reparten la conexion segun su peso.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef MULTIPLEXOR_H
+#define MULTIPLEXOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "perfiles.h"
+#include "captura.h"
+
+#define MUX_CABECERA_LEN 8
+#define MUX_TRAMA_MAX (16 * 1024)   /* datos por trama: lo que un flujo puede demorar a otro */
+#define MUX_VENTANA (512 * 1024)    /* credito inicial de cada flujo y su buffer de entrada */
+#define MUX_MAX_FLUJOS 32           /* flujos abiertos a la vez por conexion */
+#define MUX_SERVICIO 32             /* largo maximo del nombre de servicio */
+#define MUX_SALIDA (256 * 1024)     /* tramas listas para escribir en la conexion */
+#define MUX_LECTURA (256 * 1024)    /* lectura de la conexion pendiente de separar */
+#define MUX_RAFAGA (64 * 1024)      /* datos no urgentes agregados por cada aviso de escritura */
+#define MUX_NO_ENVIADO (64 * 1024)  /* TCP_NOTSENT_LOWAT: cola sin enviar que admite el kernel */
+
+/* Clases de prioridad, de mayor a menor */
+enum mux_clase
+{
+    MUX_CONTROL,    /* comandos cortos: siempre pasan primero */
+    MUX_TELEMETRIA, /* pedidos y respuestas de estado */
+    MUX_MASIVO,     /* imagenes y firmware: usan lo que queda de la conexion */
+    MUX_CLASES
+};
+
+/* Tipos de trama */
+enum mux_tipo
+{
+    MUX_DATOS,   /* bytes del flujo */
+    MUX_ABRIR,   /* nuevo flujo; la carga es clase (u8), peso (u8) y nombre del servicio */
+    MUX_FIN,     /* el emisor no enviara mas datos en el flujo */
+    MUX_CREDITO, /* el receptor entrego a la aplicacion la cantidad indicada (u32) */
+    MUX_RESET    /* el flujo se descarta en ambos extremos */
+};
+
+/* Cabecera de cada trama, en orden de red */
+struct mux_cabecera
+{
+    uint32_t flujo; /* identificador: impar si lo abrio la estacion, par si el satelite */
+    uint16_t tipo;
+    uint16_t largo; /* bytes de carga, hasta MUX_TRAMA_MAX */
+};
+
+struct mux;
+
+struct mux *mux_crear(int, int);
+int mux_abrir(struct mux *, const char *, enum mux_clase, uint8_t);
+int mux_aceptar(struct mux *, char *, size_t);
+int mux_tomar(struct mux *, char *, size_t);
+int mux_avisos(struct mux *);
+int mux_ajustar(struct mux *, const struct ajuste_socket *);
+void mux_grabar(struct mux *, struct cap_archivo *);
+void mux_cerrar(struct mux *);
+
+#endif
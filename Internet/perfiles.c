@@ -0,0 +1,234 @@
+/**
+ * @file perfiles.c
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Tabla de perfiles de ajuste de sockets y funciones para aplicarlos.
+ *        El canal de comandos y las transferencias masivas comparten el mismo
+ *        socket TCP, por eso las transferencias aplican el ajuste masivo al
+ *        comenzar y restauran el de comandos al terminar.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/errqueue.h>
+
+#include "perfiles.h"
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+/* {nodelay, cork, zerocopy, sndbuf, rcvbuf, prioridad} */
+const struct perfil perfiles[] = {
+    {"sistema", "valores por defecto del kernel",
+     {{0, 0, 0, 0, 0, -1}, {0, 0, 0, 0, 0, -1}, {0, 0, 0, 0, 0, -1}}},
+    {"equilibrado", "comandos sin Nagle, transferencias agrupadas",
+     {{1, 0, 0, 0, 0, -1}, {0, 1, 0, 1 << 20, 1 << 20, -1}, {0, 0, 0, 0, 0, 4}}},
+    {"latencia", "todo sin Nagle ni agrupamiento, telemetria prioritaria",
+     {{1, 0, 0, 0, 0, 6}, {1, 0, 0, 256 << 10, 256 << 10, -1}, {0, 0, 0, 0, 0, 6}}},
+    {"rendimiento", "transferencias con MSG_ZEROCOPY y buffers grandes",
+     {{1, 0, 0, 0, 0, -1}, {0, 1, 1, 4 << 20, 4 << 20, -1}, {0, 0, 0, 0, 0, 2}}},
+    {NULL, NULL, {{0, 0, 0, 0, 0, -1}, {0, 0, 0, 0, 0, -1}, {0, 0, 0, 0, 0, -1}}}};
+
+/**
+ * @brief Busca un perfil por nombre.
+ *
+ * @param nombre
+ * @return const struct perfil* NULL si no existe
+ */
+const struct perfil *perfil_buscar(const char *nombre)
+{
+    for (int i = 0; perfiles[i].nombre != NULL; i++)
+        if (!strcmp(perfiles[i].nombre, nombre))
+            return &perfiles[i];
+    return NULL;
+}
+
+/**
+ * @brief Indica si el socket es una conexion TCP (y no, por ejemplo, un
+ *        flujo del multiplexor sobre un socketpair).
+ *
+ * @param fd
+ * @return int
+ */
+static int perfil_es_tcp(int fd)
+{
+    int tipo = 0, dominio = 0;
+    socklen_t len = sizeof(tipo);
+
+    getsockopt(fd, SOL_SOCKET, SO_TYPE, &tipo, &len);
+    len = sizeof(dominio);
+    getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &dominio, &len);
+    return tipo == SOCK_STREAM && (dominio == AF_INET || dominio == AF_INET6);
+}
+
+/**
+ * @brief Aplica un ajuste a un socket. Las opciones TCP solo se aplican a
+ *        conexiones TCP; las de buffer y prioridad a cualquiera. Quitar el
+ *        TCP_CORK envia de inmediato lo que quedara retenido.
+ *
+ * @param fd
+ * @param aj
+ * @return int 0, o -1 si alguna opcion no pudo aplicarse
+ */
+int perfil_aplicar(int fd, const struct ajuste_socket *aj)
+{
+    int r = 0;
+
+    if (perfil_es_tcp(fd))
+    {
+        r |= setsockopt(fd, IPPROTO_TCP, TCP_CORK, &aj->cork, sizeof(aj->cork));
+        r |= setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &aj->nodelay, sizeof(aj->nodelay));
+        if (aj->zerocopy)
+            r |= setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &aj->zerocopy, sizeof(aj->zerocopy));
+    }
+    if (aj->sndbuf > 0)
+        r |= setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &aj->sndbuf, sizeof(aj->sndbuf));
+    if (aj->rcvbuf > 0)
+        r |= setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &aj->rcvbuf, sizeof(aj->rcvbuf));
+    if (aj->prioridad >= 0)
+        r |= setsockopt(fd, SOL_SOCKET, SO_PRIORITY, &aj->prioridad, sizeof(aj->prioridad));
+
+    if (r < 0)
+        perror("ajuste de socket");
+    return r < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Envia len bytes completos. Con zerocopy activo, en conexiones TCP y
+ *        con envios de al menos PERFIL_ZEROCOPY_MIN bytes usa MSG_ZEROCOPY:
+ *        el kernel envia desde las paginas del llamador, que no deben
+ *        modificarse hasta que perfil_esperar_zerocopy confirme la
+ *        finalizacion.
+ *
+ * @param fd
+ * @param buf
+ * @param len
+ * @param aj ajuste del canal masivo
+ * @param pendientes envios zerocopy aun sin confirmar (se incrementa)
+ * @return ssize_t len, o -1 en caso de error
+ */
+ssize_t perfil_enviar(int fd, const void *buf, size_t len, const struct ajuste_socket *aj, int *pendientes)
+{
+    const char *p = buf;
+    size_t enviado = 0;
+    ssize_t n;
+    int zerocopy = aj->zerocopy && perfil_es_tcp(fd);
+
+    while (enviado < len)
+    {
+        if (zerocopy && len - enviado >= PERFIL_ZEROCOPY_MIN)
+        {
+            n = send(fd, p + enviado, len - enviado, MSG_ZEROCOPY | MSG_NOSIGNAL);
+            if (n >= 0)
+            {
+                (*pendientes)++;
+                enviado += (size_t)n;
+                continue;
+            }
+            if (errno != ENOBUFS && errno != EINVAL && errno != EOPNOTSUPP)
+            {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+            /* Sin memoria para fijar paginas o sin soporte: copia normal */
+        }
+        n = send(fd, p + enviado, len - enviado, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        enviado += (size_t)n;
+    }
+    return (ssize_t)len;
+}
+
+/**
+ * @brief Envia de inmediato lo que TCP_CORK o Nagle esten reteniendo, sin
+ *        cambiar el ajuste del socket. Se usa antes de esperar una respuesta
+ *        del otro extremo, que de otro modo llegaria recien al vencer el
+ *        corcho o el ACK demorado.
+ *
+ * @param fd
+ * @return int 0, o -1 si no pudo aplicarse
+ */
+int perfil_empujar(int fd)
+{
+    int cork = 0, nodelay = 0, si = 1, no = 0, r = 0;
+    socklen_t len = sizeof(cork);
+
+    if (!perfil_es_tcp(fd) || getsockopt(fd, IPPROTO_TCP, TCP_CORK, &cork, &len) < 0)
+        return 0;
+    len = sizeof(nodelay);
+    getsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, &len);
+    if (!cork && nodelay)
+        return 0;
+
+    /* Activar TCP_NODELAY fuerza el envio de lo pendiente */
+    r |= setsockopt(fd, IPPROTO_TCP, TCP_CORK, &no, sizeof(no));
+    r |= setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &si, sizeof(si));
+    r |= setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    r |= setsockopt(fd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork));
+    if (r < 0)
+        perror("ajuste de socket");
+    return r < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Espera las notificaciones de finalizacion de los envios zerocopy.
+ *        Cada notificacion de la cola de errores confirma un rango de envios.
+ *
+ * @param fd
+ * @param pendientes cantidad de envios a confirmar
+ * @return int 0, o -1 si el socket fallo antes de confirmarlos
+ */
+int perfil_esperar_zerocopy(int fd, int pendientes)
+{
+    char control[128];
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    struct sock_extended_err *err;
+    struct pollfd pfd;
+
+    while (pendientes > 0)
+    {
+        pfd.fd = fd;
+        pfd.events = 0; /* POLLERR se informa siempre */
+        if (poll(&pfd, 1, 1000) < 0 && errno != EINTR)
+            return -1;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+        {
+            if (errno == EAGAIN || errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm))
+        {
+            err = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (err->ee_errno == 0 && err->ee_origin == SO_EE_ORIGIN_ZEROCOPY)
+                pendientes -= (int)(err->ee_data - err->ee_info + 1);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,60 @@
+/**
+ * @file perfiles.h
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Perfiles de ajuste de sockets por tipo de canal. Un perfil define
+ *        las opciones para el canal de comandos, para las transferencias
+ *        masivas (imagen y firmware) y para la telemetria. La estacion
+ *        terrestre elige el perfil y se lo comunica al satelite.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef PERFILES_H
+#define PERFILES_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define PERFIL_POR_DEFECTO "equilibrado"
+#define PERFIL_ZEROCOPY_MIN (16 * 1024) /* por debajo, MSG_ZEROCOPY no compensa */
+
+enum canal
+{
+    CANAL_COMANDOS,
+    CANAL_MASIVO,
+    CANAL_TELEMETRIA,
+    CANALES
+};
+
+/**
+ * @brief Opciones de un socket. Un valor 0 (o -1 en prioridad) deja el
+ *        valor por defecto del kernel.
+ */
+struct ajuste_socket
+{
+    int nodelay;   /* TCP_NODELAY */
+    int cork;      /* TCP_CORK mientras dura la transferencia */
+    int zerocopy;  /* SO_ZEROCOPY y MSG_ZEROCOPY en envios grandes */
+    int sndbuf;    /* SO_SNDBUF en bytes */
+    int rcvbuf;    /* SO_RCVBUF en bytes */
+    int prioridad; /* SO_PRIORITY (0..6 sin privilegios) */
+};
+
+struct perfil
+{
+    const char *nombre;
+    const char *descripcion;
+    struct ajuste_socket canal[CANALES];
+};
+
+extern const struct perfil perfiles[];
+
+const struct perfil *perfil_buscar(const char *);
+int perfil_aplicar(int, const struct ajuste_socket *);
+ssize_t perfil_enviar(int, const void *, size_t, const struct ajuste_socket *, int *);
+int perfil_esperar_zerocopy(int, int);
+int perfil_empujar(int);
+
+#endif
@@ -0,0 +1,126 @@
+/**
+ * @file prueba_telemetria.c
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Prueba que la estacion recibe entero un datagrama de tramas
+ *        compactas lleno hasta TLM_CARGA_MAX bytes. Se empaquetan tramas con
+ *        la misma regla que el satelite hasta completar exactamente
+ *        TLM_CARGA_MAX bytes, se pasan por un canal de sesion como los del
+ *        despachador y se decodifican como en la estacion: todas las tramas
+ *        deben ser validas.
+ *        Uso: ./prueba_telemetria
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "telemetria.h"
+#include "compacta.h"
+
+size_t codificar(uint32_t, size_t, unsigned char *);
+
+int main(void)
+{
+    struct tlm_cabecera cab;
+    struct tlm_historia historia;
+    struct tlm_muestra m;
+    unsigned char datagrama[TLM_DATAGRAMA_MAX], trama[TLM_CARGA_MAX], *paquete = datagrama + TLM_CABECERA_LEN;
+    char carga[TLM_CARGA_MAX + 1];
+    size_t paquete_n = 0, largo, resta;
+    uint32_t numero = 0;
+    ssize_t n;
+    int canal[2], tramas = 0, validas = 0, tipo;
+
+    /* Tramas comunes mientras quede lugar para otra y una ultima a medida */
+    while (paquete_n + 2 * (1 + (largo = codificar(numero, 0, trama))) <= TLM_CARGA_MAX)
+    {
+        paquete[paquete_n++] = (unsigned char)largo;
+        memcpy(paquete + paquete_n, trama, largo);
+        paquete_n += largo;
+        numero++;
+    }
+    /* La ultima completa el datagrama alargando el hostname */
+    resta = TLM_CARGA_MAX - paquete_n;
+    for (size_t h = 0; h < TLM_NOMBRE_MAX && 1 + (largo = codificar(numero, h, trama)) != resta; h++)
+        ;
+    if (1 + largo != resta)
+    {
+        fprintf(stderr, "No se pudo completar el datagrama: faltan %zu bytes\n", resta);
+        exit(1);
+    }
+    paquete[paquete_n++] = (unsigned char)largo;
+    memcpy(paquete + paquete_n, trama, largo);
+    paquete_n += largo;
+    numero++;
+
+    cab = (struct tlm_cabecera){TLM_MAGIA, 1, 0, TLM_TRAMA, (uint16_t)paquete_n};
+    tlm_cabecera_escribir(datagrama, &cab);
+    if (tlm_canal_crear(canal) < 0 || send(canal[0], datagrama, TLM_CABECERA_LEN + paquete_n, 0) < 0)
+    {
+        perror("canal");
+        exit(1);
+    }
+    if ((n = tlm_canal_recibir(canal[1], &cab, carga, sizeof(carga))) < 0)
+    {
+        perror("recepción");
+        exit(1);
+    }
+
+    /* Como la estacion: cada trama precedida por su largo */
+    tlm_historia_iniciar(&historia);
+    for (ssize_t p = 0; p < n; p += 1 + (unsigned char)carga[p])
+    {
+        tramas++;
+        tipo = (unsigned char)carga[p] > n - p - 1
+                   ? -1
+                   : tlm_trama_decodificar((unsigned char *)carga + p + 1, (unsigned char)carga[p], &historia, &m);
+        if (tipo < 0)
+            break;
+        tlm_historia_guardar(&historia, &m);
+        validas++;
+    }
+    printf("Datagrama de %zu bytes de carga: %zd recibidos, %d de %u tramas validas\n", paquete_n, n, validas,
+           numero);
+    close(canal[0]);
+    close(canal[1]);
+    if (paquete_n != TLM_CARGA_MAX || n != TLM_CARGA_MAX || tramas != (int)numero || validas != tramas)
+    {
+        printf("FALLA\n");
+        exit(1);
+    }
+    printf("OK\n");
+    return 0;
+}
+
+/**
+ * @brief Codifica una trama clave con todas las magnitudes.
+ *
+ * @param numero de muestra
+ * @param hostname largo del hostname
+ * @param trama al menos TLM_CARGA_MAX bytes
+ * @return size_t bytes de la trama
+ */
+size_t codificar(uint32_t numero, size_t hostname, unsigned char *trama)
+{
+    struct tlm_muestra m;
+
+    memset(&m, 0, sizeof(m));
+    m.numero = numero;
+    m.presentes = tlm_magnitudes(TLM_TODOS);
+    m.valor[TLM_MAG_ID] = 4242;
+    m.valor[TLM_MAG_FIRMWARE] = 2;
+    m.valor[TLM_MAG_UPTIME] = 86400 + numero;
+    m.valor[TLM_MAG_ARRANQUE] = 1580169600;
+    m.valor[TLM_MAG_MEM_TOTAL] = 16000;
+    m.valor[TLM_MAG_MEM_LIBRE] = 9000 - numero;
+    m.valor[TLM_MAG_CPU] = 12345;
+    memset(m.hostname, 's', hostname < TLM_NOMBRE_MAX - 1 ? hostname : TLM_NOMBRE_MAX - 1);
+    /* Como el satelite: un byte menos que el buffer de la trama */
+    return tlm_trama_codificar(&m, NULL, trama, TLM_CARGA_MAX - 1);
+}
@@ -0,0 +1,923 @@
+/**
+ * @file rafaga.c
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Transferencia de archivos en rafagas UDP con correccion de errores
+ *        hacia adelante. El emisor envia desde un mapeo del archivo y marca
+ *        el ritmo con la tasa pedida; el receptor procesa los datagramas a
+ *        medida que llegan: los de datos van directo al archivo y los de
+ *        paridad solo se guardan mientras a su grupo le falten datos.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+
+#include "rafaga.h"
+#include "correccion.h"
+#include "integridad.h"
+
+#define RAF_RCVBUF (4 * 1024 * 1024)
+#define RAF_RAFAGA 1000000ULL     /* ns que el emisor puede adelantarse a la tasa */
+#define RAF_SOBRECARGA 28         /* bytes de las cabeceras IPv4 y UDP */
+#define RAF_MAX_PERDIDA 0.5       /* tope de la perdida usada para el margen */
+#define RAF_SIN_AVANCE 3          /* rondas seguidas sin recibir nada */
+
+/* Grupo en el receptor */
+struct raf_grupo
+{
+    uint64_t tengo[COR_FILAS / 64]; /* indices recibidos */
+    uint16_t datos;                 /* trozos de datos recibidos */
+    uint16_t n_paridad;
+    uint8_t listo;
+    int *filas;                     /* fila de cada trozo de paridad guardado */
+    unsigned char *paridad;         /* n_paridad trozos de RAF_TROZO */
+};
+
+/* Estado del receptor */
+struct raf_recepcion
+{
+    int fd;
+    uint32_t id;
+    uint64_t tamano;
+    uint32_t n_trozos, n_grupos, pendientes;
+    struct raf_grupo *grupos;
+    unsigned char *trabajo;         /* RAF_GRUPO trozos para reconstruir */
+    uint64_t validos, sobrantes, invalidos, recuperados;
+    int error;
+};
+
+/* Ritmo del emisor */
+struct raf_ritmo
+{
+    uint64_t proximo;               /* ns a partir del cual sale el proximo datagrama */
+    double ns_por_byte;
+};
+
+static uint64_t raf_ahora(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ULL + (uint64_t)t.tv_nsec;
+}
+
+/**
+ * @brief Lee exactamente len bytes del flujo.
+ *
+ * @param flujo
+ * @param buf
+ * @param len
+ * @return int 0, o -1 si el flujo se cerro o fallo
+ */
+static int raf_leer(int flujo, void *buf, size_t len)
+{
+    char *p = buf;
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = recv(flujo, p, len, MSG_WAITALL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int raf_escribir(int flujo, const void *buf, size_t len)
+{
+    const char *p = buf;
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = send(flujo, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Escribe dos u32 en orden de red: fin de ronda, cabecera de pedido.
+ *
+ * @param flujo
+ * @param a
+ * @param b
+ * @return int 0 o -1
+ */
+static int raf_par(int flujo, uint32_t a, uint32_t b)
+{
+    uint32_t par[2] = {htonl(a), htonl(b)};
+
+    return raf_escribir(flujo, par, sizeof(par));
+}
+
+/**
+ * @brief Arma la cabecera de un datagrama. El CRC32C cubre la cabecera, sin
+ *        el, y la carga: un datagrama alterado cuenta como perdido.
+ *
+ * @param c RAF_CABECERA_LEN bytes
+ * @param id
+ * @param grupo
+ * @param indice
+ * @param tipo
+ * @param carga
+ * @param largo
+ */
+static void raf_cabecera(unsigned char *c, uint32_t id, uint32_t grupo, uint16_t indice, uint16_t tipo,
+                         const unsigned char *carga, size_t largo)
+{
+    uint32_t u32;
+    uint16_t u16;
+
+    u32 = htonl(RAF_MAGIA);
+    memcpy(c, &u32, 4);
+    u32 = htonl(id);
+    memcpy(c + 4, &u32, 4);
+    u32 = htonl(grupo);
+    memcpy(c + 8, &u32, 4);
+    u16 = htons(indice);
+    memcpy(c + 12, &u16, 2);
+    u16 = htons(tipo);
+    memcpy(c + 14, &u16, 2);
+    u32 = htonl(crc32c(crc32c(0, c, 16), carga, largo));
+    memcpy(c + 16, &u32, 4);
+}
+
+/**
+ * @brief Trozos de datos de un grupo.
+ *
+ * @param n_trozos del archivo
+ * @param grupo
+ * @return int
+ */
+static int raf_datos(uint32_t n_trozos, uint32_t grupo)
+{
+    uint32_t desde = grupo * RAF_GRUPO;
+    return n_trozos - desde < RAF_GRUPO ? (int)(n_trozos - desde) : RAF_GRUPO;
+}
+
+/**
+ * @brief Largo de un trozo de datos (el ultimo puede ser incompleto).
+ *
+ * @param tamano
+ * @param trozo indice en el archivo
+ * @return size_t
+ */
+static size_t raf_largo(uint64_t tamano, uint64_t trozo)
+{
+    uint64_t desde = trozo * RAF_TROZO;
+    return tamano - desde < RAF_TROZO ? (size_t)(tamano - desde) : RAF_TROZO;
+}
+
+/**
+ * @brief Abre el socket UDP de la estacion en la direccion de la sesion, lo
+ *        ofrece al satelite y espera su saludo para conectarlo a el.
+ *
+ * @param sesion socket de la sesion con el satelite
+ * @param flujo flujo de la orden
+ * @param a tasa, paridad y puerto
+ * @return int socket conectado al satelite, o -1
+ */
+int raf_abrir(int sesion, int flujo, const struct raf_ajuste *a)
+{
+    struct sockaddr_storage direccion, origen;
+    socklen_t largo = sizeof(direccion), largo_origen;
+    unsigned char hola[RAF_CABECERA_LEN + 1];
+    char oferta[RAF_MENSAJE];
+    struct pollfd p[2];
+    uint32_t u32, listo = 0;
+    unsigned int puerto = 0;
+    uint64_t limite;
+    int udp = -1, rcvbuf = RAF_RCVBUF;
+    ssize_t n;
+
+    if (getsockname(sesion, (struct sockaddr *)&direccion, &largo) == 0 &&
+        (udp = socket(direccion.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0)) >= 0)
+    {
+        /* Sin privilegios el kernel lo recorta a rmem_max, no es un error */
+        setsockopt(udp, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        for (int intento = a->puerto != 0 ? 0 : 1; intento < 2; intento++)
+        {
+            uint16_t pedido = htons(intento == 0 ? a->puerto : 0);
+            if (direccion.ss_family == AF_INET6)
+                ((struct sockaddr_in6 *)&direccion)->sin6_port = pedido;
+            else
+                ((struct sockaddr_in *)&direccion)->sin_port = pedido;
+            if (bind(udp, (struct sockaddr *)&direccion, largo) == 0)
+                break;
+            if (intento == 0)
+                printf("Puerto UDP %u ocupado, se usa otro\n", a->puerto);
+            else
+            {
+                perror("rafaga UDP");
+                close(udp);
+                udp = -1;
+            }
+        }
+    }
+    if (udp >= 0 && getsockname(udp, (struct sockaddr *)&direccion, &largo) == 0)
+        puerto = ntohs(direccion.ss_family == AF_INET6 ? ((struct sockaddr_in6 *)&direccion)->sin6_port
+                                                       : ((struct sockaddr_in *)&direccion)->sin_port);
+
+    memset(oferta, '\0', sizeof(oferta));
+    snprintf(oferta, sizeof(oferta), "%u %u %u", puerto, a->tasa, a->paridad);
+    if (raf_escribir(flujo, oferta, sizeof(oferta)) < 0 || puerto == 0)
+    {
+        if (udp >= 0)
+            close(udp);
+        return -1;
+    }
+
+    p[0] = (struct pollfd){udp, POLLIN, 0};
+    p[1] = (struct pollfd){flujo, POLLIN, 0};
+    limite = raf_ahora() + RAF_ESPERA * 1000000ULL;
+    while (!listo && raf_ahora() < limite)
+    {
+        if (poll(p, 2, (int)((limite - raf_ahora()) / 1000000) + 1) < 0 && errno != EINTR)
+            break;
+        if (p[1].revents)
+            break; /* el satelite no deberia escribir: se corto el flujo */
+        if (!(p[0].revents & POLLIN))
+            continue;
+        largo_origen = sizeof(origen);
+        n = recvfrom(udp, hola, sizeof(hola), 0, (struct sockaddr *)&origen, &largo_origen);
+        memcpy(&u32, hola, 4);
+        if (n == RAF_CABECERA_LEN && ntohl(u32) == RAF_MAGIA && hola[15] == RAF_HOLA &&
+            connect(udp, (struct sockaddr *)&origen, largo_origen) == 0)
+            listo = 1;
+    }
+    u32 = htonl(listo);
+    if (raf_escribir(flujo, &u32, sizeof(u32)) < 0 || !listo)
+    {
+        if (!listo)
+            printf("El satelite no saludo por UDP\n");
+        close(udp);
+        return -1;
+    }
+    return udp;
+}
+
+/**
+ * @brief Lado del satelite: lee el ofrecimiento de la estacion, conecta un
+ *        socket UDP a su puerto y la saluda hasta que confirme.
+ *
+ * @param flujo flujo de la orden
+ * @param host direccion de la estacion
+ * @param a recibe tasa y paridad pedidas por la estacion
+ * @return int socket conectado a la estacion, o -1
+ */
+int raf_saludar(int flujo, const char *host, struct raf_ajuste *a)
+{
+    struct addrinfo pistas, *res;
+    unsigned char hola[RAF_CABECERA_LEN];
+    char oferta[RAF_MENSAJE], servicio[8];
+    struct pollfd p;
+    unsigned int puerto = 0, tasa = 0, paridad = 0;
+    uint32_t listo = 0;
+    int udp, rcvbuf = RAF_RCVBUF;
+
+    if (raf_leer(flujo, oferta, sizeof(oferta)) < 0)
+        return -1;
+    oferta[sizeof(oferta) - 1] = '\0';
+    if (sscanf(oferta, "%u %u %u", &puerto, &tasa, &paridad) != 3 || puerto == 0 || puerto > 65535)
+    {
+        printf("La estacion no pudo abrir la rafaga UDP\n");
+        return -1;
+    }
+    memset(a, 0, sizeof(*a));
+    a->tasa = tasa;
+    a->paridad = paridad;
+    a->puerto = (uint16_t)puerto;
+
+    memset(&pistas, 0, sizeof(pistas));
+    pistas.ai_family = AF_UNSPEC;
+    pistas.ai_socktype = SOCK_DGRAM;
+    snprintf(servicio, sizeof(servicio), "%u", puerto);
+    if (getaddrinfo(host, servicio, &pistas, &res) != 0)
+    {
+        fprintf(stderr, "ERROR, no existe el host\n");
+        return -1;
+    }
+    if ((udp = socket(res->ai_family, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0 ||
+        connect(udp, res->ai_addr, res->ai_addrlen) < 0)
+    {
+        perror("rafaga UDP");
+        if (udp >= 0)
+            close(udp);
+        freeaddrinfo(res);
+        return -1;
+    }
+    freeaddrinfo(res);
+    setsockopt(udp, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    /* La estacion responde siempre, con 0 si vencio su espera */
+    raf_cabecera(hola, 0, 0, 0, RAF_HOLA, NULL, 0);
+    p = (struct pollfd){flujo, POLLIN, 0};
+    do
+        send(udp, hola, sizeof(hola), 0);
+    while (poll(&p, 1, RAF_SALUDO) == 0 || (p.revents == 0 && errno == EINTR));
+    if (raf_leer(flujo, &listo, sizeof(listo)) < 0 || ntohl(listo) != 1)
+    {
+        printf("La estacion no recibio el saludo UDP\n");
+        close(udp);
+        return -1;
+    }
+    return udp;
+}
+
+/**
+ * @brief Espera lo necesario para respetar la tasa. Tras un silencio no
+ *        acumula credito: como mucho sale RAF_RAFAGA ns adelantado.
+ *
+ * @param r
+ * @param bytes del datagrama
+ */
+static void raf_pausar(struct raf_ritmo *r, size_t bytes)
+{
+    uint64_t ahora = raf_ahora();
+    struct timespec t;
+
+    if (r->proximo + RAF_RAFAGA < ahora)
+        r->proximo = ahora;
+    if (r->proximo > ahora + RAF_RAFAGA)
+    {
+        t.tv_sec = (time_t)(r->proximo / 1000000000ULL);
+        t.tv_nsec = (long)(r->proximo % 1000000000ULL);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR)
+            ;
+    }
+    r->proximo += (uint64_t)((bytes + RAF_SOBRECARGA) * r->ns_por_byte);
+}
+
+/**
+ * @brief Envia un trozo de un grupo. Los errores de envio (por ejemplo un
+ *        ICMP de un datagrama anterior) no cortan la rafaga: el trozo se
+ *        pierde y se repara como cualquier otro.
+ *
+ * @param udp
+ * @param r
+ * @param id
+ * @param grupo
+ * @param indice
+ * @param carga
+ * @param largo
+ */
+static void raf_trozo(int udp, struct raf_ritmo *r, uint32_t id, uint32_t grupo, int indice,
+                      const unsigned char *carga, size_t largo)
+{
+    unsigned char cabecera[RAF_CABECERA_LEN];
+    struct iovec iov[2] = {{cabecera, sizeof(cabecera)}, {(void *)carga, largo}};
+    struct msghdr msg;
+
+    raf_cabecera(cabecera, id, grupo, (uint16_t)indice, RAF_DATOS, carga, largo);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    raf_pausar(r, sizeof(cabecera) + largo);
+    sendmsg(udp, &msg, 0);
+}
+
+/**
+ * @brief Punteros a los trozos de datos de un grupo. El ultimo trozo del
+ *        archivo se completa con ceros en relleno para codificar.
+ *
+ * @param mapa
+ * @param tamano
+ * @param n_trozos
+ * @param grupo
+ * @param datos recibe RAF_GRUPO punteros
+ * @param relleno RAF_TROZO bytes
+ * @return int trozos de datos del grupo
+ */
+static int raf_punteros(const char *mapa, uint64_t tamano, uint32_t n_trozos, uint32_t grupo,
+                        const unsigned char **datos, unsigned char *relleno)
+{
+    int k = raf_datos(n_trozos, grupo);
+
+    for (int c = 0; c < k; c++)
+    {
+        uint64_t t = (uint64_t)grupo * RAF_GRUPO + c;
+        size_t largo = raf_largo(tamano, t);
+        datos[c] = (const unsigned char *)mapa + t * RAF_TROZO;
+        if (largo < RAF_TROZO)
+        {
+            memset(relleno, 0, RAF_TROZO);
+            memcpy(relleno, datos[c], largo);
+            datos[c] = relleno;
+        }
+    }
+    return k;
+}
+
+/**
+ * @brief Envia un archivo ya abierto por la rafaga y atiende los pedidos de
+ *        reparacion del receptor.
+ *
+ * @param flujo flujo de la orden
+ * @param udp socket conectado al receptor
+ * @param fd archivo a enviar, o -1 para avisar que no existe
+ * @param a tasa y paridad
+ * @return int 1 si el receptor verifico el archivo, 0 si no hay archivo, -1
+ *         si fallo el flujo o el receptor cancelo
+ */
+int raf_enviar_fd(int flujo, int udp, int fd, const struct raf_ajuste *a)
+{
+    unsigned char anuncio[RAF_ANUNCIO_LEN], relleno[RAF_TROZO], paridad[RAF_TROZO];
+    const unsigned char *datos[RAF_GRUPO];
+    struct raf_ritmo ritmo;
+    struct sha256 sha;
+    struct stat st;
+    uint32_t u32, id, n_trozos = 0, n_grupos = 0, pedido[2], *entradas = NULL, ronda = 0, enviados = 0;
+    uint64_t u64, tamano = RAF_SIN_ARCHIVO, inicio, total = 0, reparacion = 0;
+    uint16_t *siguiente = NULL;
+    char *mapa = NULL;
+    int m, r = -1;
+
+    if (fd >= 0 && fstat(fd, &st) == 0)
+    {
+        tamano = (uint64_t)st.st_size;
+        if (tamano > 0 && (mapa = mmap(NULL, tamano, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+        {
+            perror("mmap");
+            mapa = NULL;
+            tamano = RAF_SIN_ARCHIVO;
+        }
+    }
+    if (tamano != RAF_SIN_ARCHIVO)
+    {
+        n_trozos = (uint32_t)((tamano + RAF_TROZO - 1) / RAF_TROZO);
+        n_grupos = (n_trozos + RAF_GRUPO - 1) / RAF_GRUPO;
+        if ((siguiente = calloc(n_grupos + 1, sizeof(*siguiente))) == NULL)
+        {
+            perror("calloc");
+            tamano = RAF_SIN_ARCHIVO;
+        }
+    }
+
+    id = (uint32_t)(raf_ahora() ^ ((uint64_t)getpid() << 16));
+    memset(anuncio, 0, sizeof(anuncio));
+    u32 = htonl(RAF_MAGIA);
+    memcpy(anuncio, &u32, 4);
+    u32 = htonl(id);
+    memcpy(anuncio + 4, &u32, 4);
+    u64 = htobe64(tamano);
+    memcpy(anuncio + 8, &u64, 8);
+    u32 = htonl(RAF_TROZO);
+    memcpy(anuncio + 16, &u32, 4);
+    u32 = htonl(RAF_GRUPO);
+    memcpy(anuncio + 20, &u32, 4);
+    if (tamano != RAF_SIN_ARCHIVO)
+    {
+        sha256_iniciar(&sha);
+        sha256_agregar(&sha, mapa, tamano);
+        sha256_finalizar(&sha, anuncio + 24);
+    }
+    if (raf_escribir(flujo, anuncio, sizeof(anuncio)) < 0 || tamano == RAF_SIN_ARCHIVO)
+    {
+        r = tamano == RAF_SIN_ARCHIVO ? 0 : -1;
+        goto fin;
+    }
+    printf("Tamaño: %lu - rafaga UDP a %u kbit/s, %u%% de paridad\n", (unsigned long)tamano, a->tasa, a->paridad);
+
+    ritmo.proximo = 0;
+    ritmo.ns_por_byte = 8e6 / (a->tasa > 0 ? a->tasa : RAF_TASA);
+    m = (int)((RAF_GRUPO * a->paridad + 99) / 100);
+    inicio = raf_ahora();
+
+    /* Primera ronda: cada grupo con su paridad */
+    for (uint32_t g = 0; g < n_grupos; g++)
+    {
+        int k = raf_punteros(mapa, tamano, n_trozos, g, datos, relleno);
+        int filas = m < cor_filas(k) ? m : cor_filas(k);
+        for (int c = 0; c < k; c++)
+        {
+            uint64_t t = (uint64_t)g * RAF_GRUPO + c;
+            raf_trozo(udp, &ritmo, id, g, c, (const unsigned char *)mapa + t * RAF_TROZO, raf_largo(tamano, t));
+        }
+        for (int j = 0; j < filas; j++)
+        {
+            cor_codificar(datos, k, j, paridad, RAF_TROZO);
+            raf_trozo(udp, &ritmo, id, g, k + j, paridad, RAF_TROZO);
+        }
+        siguiente[g] = (uint16_t)filas;
+        enviados += (uint32_t)(k + filas);
+    }
+    total = enviados;
+
+    for (;;)
+    {
+        if (raf_par(flujo, ronda, enviados) < 0 || raf_leer(flujo, pedido, sizeof(pedido)) < 0)
+            break;
+        uint32_t cantidad = ntohl(pedido[0]);
+        double perdida = ntohl(pedido[1]) / 1e6;
+        if (cantidad == 0)
+        {
+            if (raf_leer(flujo, &u32, sizeof(u32)) == 0 && ntohl(u32) == 0)
+                r = 1;
+            break;
+        }
+        if (cantidad == RAF_ABORTAR || cantidad > n_grupos ||
+            (entradas = realloc(entradas, (size_t)cantidad * 2 * sizeof(uint32_t))) == NULL ||
+            raf_leer(flujo, entradas, (size_t)cantidad * 2 * sizeof(uint32_t)) < 0)
+        {
+            printf("El receptor cancelo la transferencia\n");
+            break;
+        }
+        /* Margen segun la perdida medida: faltan / (1 - p) trozos, mas uno */
+        if (perdida > RAF_MAX_PERDIDA)
+            perdida = RAF_MAX_PERDIDA;
+        ronda++;
+        enviados = 0;
+        for (uint32_t e = 0; e < cantidad; e++)
+        {
+            uint32_t g = ntohl(entradas[2 * e]), faltan = ntohl(entradas[2 * e + 1]);
+            if (g >= n_grupos || faltan > RAF_GRUPO)
+                continue;
+            int k = raf_punteros(mapa, tamano, n_trozos, g, datos, relleno);
+            uint32_t extra = faltan + (uint32_t)(faltan * perdida / (1 - perdida) + 0.999) + (perdida > 0);
+            for (uint32_t x = 0; x < extra; x++)
+            {
+                /* Filas nuevas mientras haya; despues se repiten */
+                int fila = siguiente[g]++ % cor_filas(k);
+                cor_codificar(datos, k, fila, paridad, RAF_TROZO);
+                raf_trozo(udp, &ritmo, id, g, k + fila, paridad, RAF_TROZO);
+            }
+            enviados += extra;
+        }
+        reparacion += enviados;
+        total += enviados;
+    }
+
+    double s = (raf_ahora() - inicio) / 1e9;
+    printf("Rafaga UDP: %lu datagramas (%lu de reparacion) en %u rondas, %.2f s, %.2f MB/s\n",
+           (unsigned long)total, (unsigned long)reparacion, ronda + 1, s, s > 0 ? tamano / s / 1e6 : 0.0);
+fin:
+    if (mapa != NULL)
+        munmap(mapa, tamano);
+    free(siguiente);
+    free(entradas);
+    return r;
+}
+
+/**
+ * @brief Reconstruye los datos faltantes de un grupo con la paridad
+ *        guardada; los presentes se leen del archivo.
+ *
+ * @param rx
+ * @param grupo
+ * @return int 0 o -1
+ */
+static int raf_reconstruir(struct raf_recepcion *rx, uint32_t grupo)
+{
+    struct raf_grupo *g = &rx->grupos[grupo];
+    unsigned char *datos[RAF_GRUPO], *paridad[RAF_GRUPO];
+    int faltan[RAF_GRUPO], e = 0, k = raf_datos(rx->n_trozos, grupo);
+
+    for (int c = 0; c < k; c++)
+    {
+        uint64_t t = (uint64_t)grupo * RAF_GRUPO + c;
+        size_t largo = raf_largo(rx->tamano, t);
+        datos[c] = rx->trabajo + (size_t)c * RAF_TROZO;
+        memset(datos[c], 0, RAF_TROZO);
+        if (!(g->tengo[c / 64] & (1ULL << (c % 64))))
+            faltan[e++] = c;
+        else if (pread(rx->fd, datos[c], largo, (off_t)(t * RAF_TROZO)) != (ssize_t)largo)
+            return -1;
+    }
+    for (int j = 0; j < e; j++)
+        paridad[j] = g->paridad + (size_t)j * RAF_TROZO;
+    if (cor_decodificar(datos, k, faltan, e, paridad, g->filas, RAF_TROZO) < 0)
+        return -1;
+    for (int m = 0; m < e; m++)
+    {
+        uint64_t t = (uint64_t)grupo * RAF_GRUPO + faltan[m];
+        size_t largo = raf_largo(rx->tamano, t);
+        if (pwrite(rx->fd, datos[faltan[m]], largo, (off_t)(t * RAF_TROZO)) != (ssize_t)largo)
+            return -1;
+    }
+    rx->recuperados += (uint64_t)e;
+    return 0;
+}
+
+/**
+ * @brief Procesa un datagrama: los datos van a su lugar en el archivo, la
+ *        paridad se guarda mientras al grupo le falten datos, y el grupo
+ *        queda listo al juntar tantos trozos como datos tiene.
+ *
+ * @param rx
+ * @param d
+ * @param n
+ */
+static void raf_procesar(struct raf_recepcion *rx, const unsigned char *d, size_t n)
+{
+    uint32_t u32, grupo, crc;
+    uint16_t u16, indice, tipo;
+    struct raf_grupo *g;
+    int k;
+
+    if (n < RAF_CABECERA_LEN)
+        goto invalido;
+    memcpy(&u32, d, 4);
+    if (ntohl(u32) != RAF_MAGIA)
+        goto invalido;
+    memcpy(&u32, d + 4, 4);
+    memcpy(&u16, d + 14, 2);
+    tipo = ntohs(u16);
+    if (ntohl(u32) != rx->id || tipo != RAF_DATOS)
+        goto invalido;
+    memcpy(&u32, d + 16, 4);
+    crc = crc32c(crc32c(0, d, 16), d + RAF_CABECERA_LEN, n - RAF_CABECERA_LEN);
+    if (ntohl(u32) != crc)
+        goto invalido;
+    memcpy(&u32, d + 8, 4);
+    grupo = ntohl(u32);
+    memcpy(&u16, d + 12, 2);
+    indice = ntohs(u16);
+    if (grupo >= rx->n_grupos || indice >= COR_FILAS)
+        goto invalido;
+    g = &rx->grupos[grupo];
+    k = raf_datos(rx->n_trozos, grupo);
+    n -= RAF_CABECERA_LEN;
+    d += RAF_CABECERA_LEN;
+    if (indice < k ? n != raf_largo(rx->tamano, (uint64_t)grupo * RAF_GRUPO + indice) : n != RAF_TROZO)
+        goto invalido;
+
+    rx->validos++;
+    if (g->listo || (g->tengo[indice / 64] & (1ULL << (indice % 64))))
+    {
+        rx->sobrantes++;
+        return;
+    }
+    g->tengo[indice / 64] |= 1ULL << (indice % 64);
+    if (indice < k)
+    {
+        uint64_t t = (uint64_t)grupo * RAF_GRUPO + indice;
+        if (pwrite(rx->fd, d, n, (off_t)(t * RAF_TROZO)) != (ssize_t)n)
+            rx->error = 1;
+        g->datos++;
+    }
+    else if (g->datos + g->n_paridad < k)
+    {
+        unsigned char *p = realloc(g->paridad, (size_t)(g->n_paridad + 1) * RAF_TROZO);
+        int *f = realloc(g->filas, (size_t)(g->n_paridad + 1) * sizeof(int));
+        if (p != NULL)
+            g->paridad = p;
+        if (f != NULL)
+            g->filas = f;
+        if (p == NULL || f == NULL)
+        {
+            rx->error = 1;
+            return;
+        }
+        memcpy(g->paridad + (size_t)g->n_paridad * RAF_TROZO, d, RAF_TROZO);
+        g->filas[g->n_paridad++] = indice - k;
+    }
+
+    if (g->datos < k && g->datos + g->n_paridad >= k && raf_reconstruir(rx, grupo) < 0)
+        rx->error = 1;
+    if (g->datos + g->n_paridad >= k)
+    {
+        g->listo = 1;
+        rx->pendientes--;
+        free(g->paridad);
+        free(g->filas);
+        g->paridad = NULL;
+        g->filas = NULL;
+    }
+    return;
+
+invalido:
+    rx->invalidos++;
+}
+
+/**
+ * @brief Recibe los datagramas de una ronda hasta el fin de ronda del
+ *        emisor y, despues, hasta completar lo enviado o RAF_SILENCIO ms
+ *        sin datagramas: el fin viaja por el flujo y puede adelantarse a
+ *        los ultimos datagramas.
+ *
+ * @param rx
+ * @param flujo
+ * @param udp
+ * @param enviados recibe los datagramas que envio el emisor en la ronda
+ * @return int 0, o -1 si se corto el flujo
+ */
+static int raf_ronda(struct raf_recepcion *rx, int flujo, int udp, uint32_t *enviados)
+{
+    static __thread unsigned char d[RAF_CABECERA_LEN + RAF_TROZO + 1];
+    struct pollfd p[2] = {{udp, POLLIN, 0}, {flujo, POLLIN, 0}};
+    uint64_t validos = rx->validos, ultimo = raf_ahora();
+    uint32_t fin[2];
+    int fin_visto = 0, espera;
+    ssize_t n;
+
+    for (;;)
+    {
+        if (fin_visto && (rx->pendientes == 0 || rx->validos - validos >= *enviados))
+            return 0;
+        espera = -1;
+        if (fin_visto)
+        {
+            uint64_t pasado = (raf_ahora() - ultimo) / 1000000;
+            if (pasado >= RAF_SILENCIO)
+                return 0;
+            espera = (int)(RAF_SILENCIO - pasado);
+        }
+        p[1].fd = fin_visto ? -1 : flujo;
+        if (poll(p, 2, espera) < 0 && errno != EINTR)
+            return -1;
+        if (p[1].revents)
+        {
+            if (raf_leer(flujo, fin, sizeof(fin)) < 0)
+                return -1;
+            *enviados = ntohl(fin[1]);
+            fin_visto = 1;
+        }
+        if (p[0].revents & POLLIN)
+        {
+            while ((n = recv(udp, d, sizeof(d), MSG_DONTWAIT)) >= 0)
+                raf_procesar(rx, d, (size_t)n);
+            ultimo = raf_ahora();
+        }
+    }
+}
+
+/**
+ * @brief Recibe un archivo enviado con raf_enviar_fd y lo guarda en ruta.
+ *
+ * @param flujo flujo de la orden
+ * @param udp socket conectado al emisor
+ * @param ruta
+ * @param politica TRF_FSYNC_NUNCA o TRF_FSYNC_AL_FINAL
+ * @return long bytes recibidos, o -1 en caso de error o si no se pudo verificar
+ */
+long raf_recibir(int flujo, int udp, const char *ruta, enum trf_fsync politica)
+{
+    unsigned char anuncio[RAF_ANUNCIO_LEN], resumen[SHA256_LEN];
+    struct raf_recepcion rx;
+    struct sha256 sha;
+    uint32_t u32, *pedido = NULL, enviados = 0, perdida = 0, perdida_inicial = 0;
+    uint64_t u64, validos;
+    int ronda = 0, sin_avance = 0, r = -1;
+    char *mapa;
+
+    memset(&rx, 0, sizeof(rx));
+    rx.fd = -1;
+    if (raf_leer(flujo, anuncio, sizeof(anuncio)) < 0)
+    {
+        perror("ERROR leyendo del socket");
+        return -1;
+    }
+    memcpy(&u32, anuncio, 4);
+    memcpy(&u64, anuncio + 8, 8);
+    rx.tamano = be64toh(u64);
+    if (ntohl(u32) != RAF_MAGIA)
+    {
+        printf("Anuncio de rafaga invalido\n");
+        return -1;
+    }
+    if (rx.tamano == RAF_SIN_ARCHIVO)
+    {
+        printf("El archivo no existe en el emisor\n");
+        return -1;
+    }
+    memcpy(&u32, anuncio + 16, 4);
+    if (ntohl(u32) != RAF_TROZO)
+    {
+        printf("Anuncio de rafaga invalido\n");
+        return -1;
+    }
+    memcpy(&u32, anuncio + 4, 4);
+    rx.id = ntohl(u32);
+    rx.n_trozos = (uint32_t)((rx.tamano + RAF_TROZO - 1) / RAF_TROZO);
+    rx.n_grupos = (rx.n_trozos + RAF_GRUPO - 1) / RAF_GRUPO;
+    rx.pendientes = rx.n_grupos;
+    printf("Tamaño a recibir: %lu\n", (unsigned long)rx.tamano);
+
+    if ((rx.fd = open(ruta, O_RDWR | O_CREAT | O_TRUNC, 0666)) < 0)
+    {
+        printf("Error creando el file\n");
+        goto fin;
+    }
+    if (rx.tamano > 0 && fallocate(rx.fd, 0, 0, rx.tamano) < 0 && (errno != EOPNOTSUPP || ftruncate(rx.fd, rx.tamano) < 0))
+    {
+        perror("fallocate");
+        goto fin;
+    }
+    if ((rx.grupos = calloc(rx.n_grupos + 1, sizeof(*rx.grupos))) == NULL ||
+        (rx.trabajo = malloc((size_t)RAF_GRUPO * RAF_TROZO)) == NULL ||
+        (pedido = malloc(((size_t)rx.n_grupos * 2 + 2) * sizeof(uint32_t))) == NULL)
+    {
+        perror("malloc");
+        goto fin;
+    }
+
+    for (;;)
+    {
+        validos = rx.validos;
+        if (raf_ronda(&rx, flujo, udp, &enviados) < 0)
+            goto fin;
+        if (rx.error)
+        {
+            perror("ERROR escribiendo el archivo");
+            raf_par(flujo, RAF_ABORTAR, 0);
+            goto fin;
+        }
+        /* Perdida de la ronda, para el margen de la siguiente */
+        validos = rx.validos - validos;
+        perdida = enviados > validos ? (uint32_t)((enviados - validos) * 1000000ULL / enviados) : 0;
+        if (ronda == 0)
+            perdida_inicial = perdida;
+        sin_avance = validos == 0 ? sin_avance + 1 : 0;
+
+        uint32_t cantidad = 0;
+        for (uint32_t g = 0; g < rx.n_grupos; g++)
+            if (!rx.grupos[g].listo)
+            {
+                int k = raf_datos(rx.n_trozos, g);
+                pedido[2 + 2 * cantidad] = htonl(g);
+                pedido[3 + 2 * cantidad] = htonl((uint32_t)(k - rx.grupos[g].datos - rx.grupos[g].n_paridad));
+                cantidad++;
+            }
+        if (cantidad == 0)
+            break;
+        if (++ronda > RAF_RONDAS || sin_avance >= RAF_SIN_AVANCE)
+        {
+            printf("Rafaga abandonada: %u grupos incompletos tras %d rondas\n", cantidad, ronda - 1);
+            raf_par(flujo, RAF_ABORTAR, 0);
+            goto fin;
+        }
+        pedido[0] = htonl(cantidad);
+        pedido[1] = htonl(perdida);
+        if (raf_escribir(flujo, pedido, ((size_t)cantidad * 2 + 2) * sizeof(uint32_t)) < 0)
+            goto fin;
+    }
+
+    /* Todos los grupos listos: se verifica el archivo completo */
+    sha256_iniciar(&sha);
+    if (rx.tamano > 0)
+    {
+        if ((mapa = mmap(NULL, rx.tamano, PROT_READ, MAP_SHARED, rx.fd, 0)) == MAP_FAILED)
+        {
+            perror("mmap");
+            raf_par(flujo, RAF_ABORTAR, 0);
+            goto fin;
+        }
+        sha256_agregar(&sha, mapa, rx.tamano);
+        munmap(mapa, rx.tamano);
+    }
+    sha256_finalizar(&sha, resumen);
+    r = memcmp(resumen, anuncio + 24, SHA256_LEN) ? -1 : 0;
+    u32 = htonl(r == 0 ? 0 : RAF_ABORTAR);
+    if (raf_par(flujo, 0, perdida) < 0 || raf_escribir(flujo, &u32, sizeof(u32)) < 0)
+        r = -1;
+    if (r < 0)
+        printf("El SHA-256 del archivo no coincide\n");
+    else
+        printf("Rafaga UDP: %u trozos en %u grupos, %lu datagramas validos (%lu sobrantes, %lu invalidos), "
+               "perdida inicial %.2f%%, %lu trozos reconstruidos por FEC, %d rondas de reparacion\n",
+               rx.n_trozos, rx.n_grupos, (unsigned long)rx.validos, (unsigned long)rx.sobrantes,
+               (unsigned long)rx.invalidos, perdida_inicial / 1e4, (unsigned long)rx.recuperados, ronda);
+    if (r == 0 && politica == TRF_FSYNC_AL_FINAL && fsync(rx.fd) < 0)
+        perror("fsync");
+
+fin:
+    if (rx.grupos != NULL)
+        for (uint32_t g = 0; g < rx.n_grupos; g++)
+        {
+            free(rx.grupos[g].paridad);
+            free(rx.grupos[g].filas);
+        }
+    free(rx.grupos);
+    free(rx.trabajo);
+    free(pedido);
+    if (rx.fd >= 0)
+        close(rx.fd);
+    return r < 0 ? -1 : (long)rx.tamano;
+}
@@ -0,0 +1,83 @@
+/**
+ * @file rafaga.h
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Canal masivo alternativo por UDP para escaneos y firmware, pensado
+ *        para enlaces largos con perdidas, donde TCP reduce su ventana con
+ *        cada perdida. El emisor envia a una tasa fija, sin esperar acuses,
+ *        trozos de RAF_TROZO bytes en grupos de RAF_GRUPO protegidos con
+ *        paridad Reed-Solomon (ver correccion.h); el receptor escribe cada
+ *        trozo con pwrite en su lugar del archivo y reconstruye los que
+ *        faltan en cuanto un grupo junta tantos trozos como datos tiene. Al
+ *        final de cada ronda pide, por el flujo de la orden, cuantos trozos
+ *        le faltan a cada grupo incompleto, y el emisor responde con filas de
+ *        paridad nuevas, cualquiera sirve, agregando margen segun la perdida
+ *        medida. El control (anuncio, fin de ronda, pedidos y veredicto)
+ *        viaja por el flujo, que es confiable.
+ *        El socket UDP lo abre la estacion, en la direccion de la sesion, y
+ *        el satelite lo saluda primero: asi, como la telemetria, atraviesa
+ *        NAT y el emulador de enlace (con un puerto fijo, ver enlace.c).
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef RAFAGA_H
+#define RAFAGA_H
+
+#include <stdint.h>
+
+#include "transferencia.h"
+
+#define RAF_MAGIA 0x52414631      /* "RAF1" */
+#define RAF_CABECERA_LEN 20       /* de cada datagrama */
+#define RAF_TROZO 1200            /* carga: cabe en la MTU minima de IPv6 */
+#define RAF_GRUPO 32              /* trozos de datos por grupo */
+#define RAF_ANUNCIO_LEN (24 + SHA256_LEN)
+#define RAF_MENSAJE 64            /* ofrecimiento de la estacion, en texto */
+#define RAF_TASA 20000            /* kbit/s si no se indica */
+#define RAF_PARIDAD 10            /* % de paridad en la primera ronda si no se indica */
+#define RAF_RONDAS 30             /* rondas de reparacion antes de abandonar */
+#define RAF_SILENCIO 250          /* ms sin datagramas que cierran una ronda */
+#define RAF_ESPERA 5000           /* ms que la estacion espera el saludo */
+#define RAF_SALUDO 200            /* ms entre saludos del satelite */
+#define RAF_SIN_ARCHIVO UINT64_MAX
+#define RAF_ABORTAR UINT32_MAX
+
+/* Tipo de datagrama */
+enum raf_tipo
+{
+    RAF_HOLA,  /* saludo del satelite, sin carga */
+    RAF_DATOS  /* trozo: indice < datos del grupo, o paridad */
+};
+
+/* Canal masivo elegido en la estacion */
+struct raf_ajuste
+{
+    uint32_t tasa;    /* kbit/s; 0 usa el canal TCP */
+    uint32_t paridad; /* % de trozos de paridad por grupo en la primera ronda */
+    uint16_t puerto;  /* puerto UDP fijo de la estacion, 0 cualquiera */
+};
+
+/*
+ * Secuencia, por el flujo de la orden salvo los datagramas:
+ *   estacion -> ofrecimiento: "<puerto> <tasa> <paridad>"
+ *   satelite -> UDP: RAF_HOLA cada RAF_SALUDO ms
+ *   estacion -> u32 1 si recibio el saludo (su socket queda conectado), 0 si no
+ *   emisor   -> anuncio: magia, id, tamano (u64), trozo, grupo, SHA-256
+ *   emisor   -> UDP: de cada grupo, sus datos y su paridad
+ *   emisor   -> fin de ronda: u32 ronda, u32 datagramas enviados
+ *   receptor -> pedido: u32 grupos incompletos, u32 perdida de la ronda (ppm),
+ *               y por grupo: u32 grupo, u32 trozos que le faltan
+ *   emisor   -> UDP: paridad nueva de los grupos pedidos; fin de ronda
+ * hasta que el receptor pide 0 grupos y envia el veredicto: u32 0 si el
+ * SHA-256 coincide, RAF_ABORTAR si no. Un pedido de RAF_ABORTAR grupos
+ * cancela la transferencia.
+ */
+
+int raf_abrir(int, int, const struct raf_ajuste *);
+int raf_saludar(int, const char *, struct raf_ajuste *);
+int raf_enviar_fd(int, int, int, const struct raf_ajuste *);
+long raf_recibir(int, int, const char *, enum trf_fsync);
+
+#endif
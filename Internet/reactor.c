@@ -0,0 +1,285 @@
+/**
+ * @file reactor.c
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Bucle de eventos de las corrutinas. Una tarea suspendida tiene su
+ *        descriptor en epoll (EPOLLONESHOT, apuntando a la tarea) y, si
+ *        espera con plazo, un lugar en un monticulo ordenado por vencimiento.
+ *        Al reanudarla se quita de ambos antes de llamar a su funcion, asi
+ *        la tarea puede cerrar o cambiar sus descriptores libremente y el
+ *        reactor no guarda nada de ella mientras corre.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "reactor.h"
+
+struct reactor
+{
+    int epoll;
+    int detener;
+    int tareas;              /* iniciadas y sin terminar */
+    struct tarea **plazos;   /* monticulo: el primero vence antes */
+    int n_plazos, capacidad;
+};
+
+/**
+ * @brief Milisegundos de CLOCK_MONOTONIC.
+ *
+ * @return int64_t
+ */
+static int64_t reactor_ahora(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (int64_t)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+static void reactor_intercambiar(struct reactor *r, int a, int b)
+{
+    struct tarea *t = r->plazos[a];
+    r->plazos[a] = r->plazos[b];
+    r->plazos[b] = t;
+    r->plazos[a]->indice = a;
+    r->plazos[b]->indice = b;
+}
+
+/**
+ * @brief Reubica el elemento i del monticulo hacia arriba o hacia abajo.
+ *
+ * @param r
+ * @param i
+ */
+static void reactor_acomodar(struct reactor *r, int i)
+{
+    while (i > 0 && r->plazos[(i - 1) / 2]->plazo > r->plazos[i]->plazo)
+    {
+        reactor_intercambiar(r, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    for (;;)
+    {
+        int menor = i, h = 2 * i + 1;
+        if (h < r->n_plazos && r->plazos[h]->plazo < r->plazos[menor]->plazo)
+            menor = h;
+        if (h + 1 < r->n_plazos && r->plazos[h + 1]->plazo < r->plazos[menor]->plazo)
+            menor = h + 1;
+        if (menor == i)
+            return;
+        reactor_intercambiar(r, i, menor);
+        i = menor;
+    }
+}
+
+/**
+ * @brief Quita la tarea del monticulo de plazos, si estaba.
+ *
+ * @param r
+ * @param t
+ */
+static void reactor_sin_plazo(struct reactor *r, struct tarea *t)
+{
+    int i = t->indice;
+
+    if (i < 0)
+        return;
+    t->indice = -1;
+    if (i == --r->n_plazos)
+        return;
+    r->plazos[i] = r->plazos[r->n_plazos];
+    r->plazos[i]->indice = i;
+    reactor_acomodar(r, i);
+}
+
+/**
+ * @brief Reanuda una tarea suspendida: la saca de epoll y de los plazos y
+ *        corre su funcion hasta la proxima espera o el fin.
+ *
+ * @param r
+ * @param t
+ * @param listos eventos de epoll, 0 si vencio el plazo
+ */
+static void reactor_reanudar(struct reactor *r, struct tarea *t, uint32_t listos)
+{
+    if (t->fd >= 0 && epoll_ctl(r->epoll, EPOLL_CTL_DEL, t->fd, NULL) < 0)
+        perror("epoll_ctl");
+    reactor_sin_plazo(r, t);
+    t->fd = -1;
+    t->listos = listos;
+    t->vencida = listos == 0;
+    if (t->funcion(t) == REACTOR_FIN)
+        r->tareas--;
+}
+
+/**
+ * @brief Crea un reactor vacio.
+ *
+ * @return struct reactor* NULL en caso de error
+ */
+struct reactor *reactor_crear(void)
+{
+    struct reactor *r = calloc(1, sizeof(*r));
+
+    if (r == NULL)
+        return NULL;
+    if ((r->epoll = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    {
+        perror("epoll_create1");
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+/**
+ * @brief Inicia una corrutina: corre su funcion desde el principio hasta la
+ *        primera espera. Solo desde el hilo del reactor (o antes de
+ *        reactor_correr).
+ *
+ * @param r
+ * @param t tarea incluida en la estructura de la corrutina
+ * @param funcion
+ */
+void reactor_iniciar(struct reactor *r, struct tarea *t, reactor_funcion funcion)
+{
+    t->funcion = funcion;
+    t->reactor = r;
+    t->linea = 0;
+    t->fd = -1;
+    t->plazo = 0;
+    t->indice = -1;
+    t->listos = 0;
+    t->vencida = 0;
+    r->tareas++;
+    if (t->funcion(t) == REACTOR_FIN)
+        r->tareas--;
+}
+
+/**
+ * @brief Suspende la tarea hasta que el descriptor tenga alguno de los
+ *        eventos o pasen ms milisegundos. Se usa a traves de CO_ESPERAR.
+ *        Cada descriptor puede tener una sola tarea esperandolo.
+ *
+ * @param t
+ * @param fd descriptor, o -1 para esperar solo el plazo
+ * @param eventos EPOLLIN, EPOLLOUT...
+ * @param ms plazo; 0 sin plazo
+ */
+void reactor_esperar(struct tarea *t, int fd, uint32_t eventos, int ms)
+{
+    struct reactor *r = t->reactor;
+    struct epoll_event ev;
+
+    if (fd >= 0)
+    {
+        ev.events = eventos | EPOLLONESHOT;
+        ev.data.ptr = t;
+        if (epoll_ctl(r->epoll, EPOLL_CTL_ADD, fd, &ev) < 0)
+        {
+            /* Sin epoll la tarea se reanuda enseguida y ve el error al usar
+               el descriptor */
+            perror("epoll_ctl");
+            fd = -1;
+            ms = 1;
+        }
+    }
+    t->fd = fd;
+    if (ms <= 0)
+        return;
+    if (r->n_plazos == r->capacidad)
+    {
+        int capacidad = r->capacidad ? 2 * r->capacidad : 64;
+        struct tarea **plazos = realloc(r->plazos, capacidad * sizeof(*plazos));
+        if (plazos == NULL)
+        {
+            perror("realloc");
+            return;
+        }
+        r->plazos = plazos;
+        r->capacidad = capacidad;
+    }
+    t->plazo = reactor_ahora() + ms;
+    t->indice = r->n_plazos;
+    r->plazos[r->n_plazos++] = t;
+    reactor_acomodar(r, t->indice);
+}
+
+/**
+ * @brief Atiende eventos y plazos hasta que no queden tareas o alguna llame
+ *        a reactor_detener.
+ *
+ * @param r
+ * @return int 0, o -1 si fallo epoll_wait
+ */
+int reactor_correr(struct reactor *r)
+{
+    struct epoll_event ev[REACTOR_LOTE];
+    int n, espera;
+    int64_t ahora;
+
+    r->detener = 0;
+    while (!r->detener && r->tareas > 0)
+    {
+        espera = -1;
+        if (r->n_plazos > 0)
+        {
+            int64_t falta = r->plazos[0]->plazo - reactor_ahora();
+            espera = falta < 0 ? 0 : (int)falta;
+        }
+        if ((n = epoll_wait(r->epoll, ev, REACTOR_LOTE, espera)) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            return -1;
+        }
+        for (int i = 0; i < n && !r->detener; i++)
+            reactor_reanudar(r, ev[i].data.ptr, ev[i].events);
+
+        ahora = reactor_ahora();
+        while (!r->detener && r->n_plazos > 0 && r->plazos[0]->plazo <= ahora)
+            reactor_reanudar(r, r->plazos[0], 0);
+    }
+    return 0;
+}
+
+/**
+ * @brief Hace que reactor_correr vuelva despues del paso actual. Las tareas
+ *        suspendidas quedan como estaban.
+ *
+ * @param r
+ */
+void reactor_detener(struct reactor *r)
+{
+    r->detener = 1;
+}
+
+/**
+ * @brief Tareas iniciadas que todavia no terminaron.
+ *
+ * @param r
+ * @return int
+ */
+int reactor_tareas(struct reactor *r)
+{
+    return r->tareas;
+}
+
+/**
+ * @brief Libera el reactor. Las tareas que queden son de quien las creo.
+ *
+ * @param r
+ */
+void reactor_destruir(struct reactor *r)
+{
+    close(r->epoll);
+    free(r->plazos);
+    free(r);
+}
@@ -0,0 +1,78 @@
+/**
+ * @file reactor.h
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Bucle de eventos de un solo hilo para corrutinas sin pila. Cada
+ *        tarea es una funcion que se reanuda donde quedo: CO_ESPERAR la
+ *        suspende hasta que su descriptor este listo o venza el plazo, y
+ *        vuelve a entrar a la funcion justo despues de la espera. Como no hay
+ *        pila propia, lo que deba sobrevivir a una espera vive en la
+ *        estructura de la tarea; una sesion en reposo ocupa solo eso.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+#define REACTOR_LOTE 64 /* eventos por llamada a epoll_wait */
+
+/* Lo que devuelve la funcion de una tarea */
+enum reactor_paso
+{
+    REACTOR_SIGUE, /* suspendida en CO_ESPERAR */
+    REACTOR_FIN    /* termino; el reactor no vuelve a tocar la tarea */
+};
+
+struct reactor;
+struct tarea;
+
+typedef int (*reactor_funcion)(struct tarea *);
+
+/* Se incluye como primer miembro de la estructura de cada corrutina */
+struct tarea
+{
+    reactor_funcion funcion;
+    struct reactor *reactor;
+    int linea;          /* punto de reanudacion; 0 al empezar */
+    int fd;             /* descriptor que espera, -1 ninguno */
+    uint32_t listos;    /* eventos con los que se reanudo */
+    int vencida;        /* se reanudo porque vencio el plazo */
+    int64_t plazo;      /* ms de CLOCK_MONOTONIC; 0 sin plazo */
+    int indice;         /* posicion en el monticulo de plazos, -1 fuera */
+};
+
+/* Corrutinas sin pila: el switch salta a la linea de la ultima espera. Las
+   variables locales no se conservan entre esperas y no puede haber dos
+   CO_ESPERAR en la misma linea. */
+#define CO_INICIO(t)         \
+    switch ((t)->linea)      \
+    {                        \
+    case 0:
+
+#define CO_ESPERAR(t, descriptor, eventos, ms)                  \
+    do                                                          \
+    {                                                           \
+        reactor_esperar((t), (descriptor), (eventos), (ms));    \
+        (t)->linea = __LINE__;                                  \
+        return REACTOR_SIGUE;                                   \
+    case __LINE__:;                                             \
+    } while (0)
+
+#define CO_FIN(t) \
+    }             \
+    return REACTOR_FIN
+
+struct reactor *reactor_crear(void);
+void reactor_iniciar(struct reactor *, struct tarea *, reactor_funcion);
+void reactor_esperar(struct tarea *, int, uint32_t, int);
+int reactor_correr(struct reactor *);
+void reactor_detener(struct reactor *);
+int reactor_tareas(struct reactor *);
+void reactor_destruir(struct reactor *);
+
+#endif
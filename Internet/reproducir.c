@@ -0,0 +1,537 @@
+/**
+ * @file reproducir.c
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Reproduce una sesion grabada por la estacion (ver captura.h) contra
+ *        un extremo real, para repetir fuera de linea el trafico de una
+ *        sesion de produccion y comparar versiones con la misma carga.
+ *          satelite: hace de estacion. Espera la conexion de un satelite y le
+ *                    envia lo que le envio la estacion grabada.
+ *          estacion: hace de satelite. Se conecta a la estacion, se presenta
+ *                    y le envia lo que le envio el satelite grabado. Las
+ *                    ordenes salen de la consola de la estacion, que debe
+ *                    recibir los mismos comandos que en la sesion grabada.
+ *        Cada tramo sale a su hora original, o con -r tan rapido como
+ *        responda el otro extremo. En ambos casos un tramo espera a que el
+ *        otro extremo avance, en cada flujo del multiplexor que el tramo
+ *        toca, lo que habia avanzado en la grabacion (datos y tramas de
+ *        control), y a tener credito para los datos que lleva: asi se
+ *        respetan los pedidos y respuestas y la ventana de cada flujo. Si un
+ *        flujo ya abierto no avanza lo esperado en REP_ESPERA ms, el tramo
+ *        sale igual y se cuenta como desvio.
+ *        Uso: ./reproducir [-r] <grabacion> satelite [<direccion de escucha>]
+ *             ./reproducir [-r] <grabacion> estacion <IPv4>:<Puerto>
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "captura.h"
+#include "direcciones.h"
+#include "multiplexor.h"
+
+#define REP_ESPERA 2000         /* ms sin avance tras los que un tramo sale igual */
+#define REP_LECTURA (64 * 1024)
+#define REP_TOCADOS 64          /* flujos distintos en un tramo */
+
+/* Separa en tramas los bytes de un sentido de la conexion */
+struct lector
+{
+    size_t saltar;                /* bytes previos al multiplexor */
+    unsigned char cabecera[MUX_CABECERA_LEN];
+    size_t n;                     /* bytes de la trama actual ya leidos */
+    uint32_t flujo;
+    uint16_t tipo, largo;
+    unsigned char credito[4];
+};
+
+/* Un flujo de la conexion */
+struct flujo
+{
+    uint64_t grabado, vivo;       /* avance del otro extremo, grabado y real */
+    uint64_t faltante;            /* lo que no llego y ya no se espera */
+    uint64_t credito;             /* otorgado por el otro extremo, ademas de MUX_VENTANA */
+    uint64_t enviado;             /* datos enviados */
+};
+
+/* Flujo tocado por el tramo a enviar */
+struct tocado
+{
+    uint32_t flujo;
+    uint64_t datos;               /* carga de las tramas de datos que empiezan en el tramo */
+};
+
+/* Estado de una reproduccion */
+struct reproduccion
+{
+    int sock;
+    int rapido;
+    struct timespec inicio;
+    uint64_t actividad;           /* us de la ultima lectura o escritura */
+    uint64_t enviados, recibidos;
+    uint64_t esperando;           /* us esperando al otro extremo */
+    unsigned int tramos, desvios;
+    int cerrado;
+    struct lector grabado, vivo, propio;
+    struct flujo *flujos;         /* por identificador */
+    uint32_t n_flujos;
+    struct tocado tocados[REP_TOCADOS];
+    int n_tocados;
+};
+
+int abrir_Satelite(const char *);
+int abrir_Estacion(char *);
+void separar(struct reproduccion *, struct lector *, const unsigned char *, size_t);
+int esperar(struct reproduccion *, uint64_t);
+int enviar(struct reproduccion *, const unsigned char *, size_t);
+void drenar(struct reproduccion *);
+uint64_t transcurrido(struct reproduccion *);
+
+int main(int argc, char *argv[])
+{
+    struct reproduccion r;
+    struct cap_cabecera cab;
+    struct cap_registro reg;
+    struct cap_archivo *c;
+    enum cap_sentido propio;
+    uint64_t otro = 0, grabado = 0, duracion = 0, antes;
+    char fecha[64];
+    time_t inicio;
+    int estado, a = 1;
+
+    memset(&r, 0, sizeof(r));
+    if (argc > a && !strcmp(argv[a], "-r"))
+    {
+        r.rapido = 1;
+        a++;
+    }
+    if (argc < a + 2 || (strcmp(argv[a + 1], "satelite") && strcmp(argv[a + 1], "estacion")) ||
+        (!strcmp(argv[a + 1], "estacion") && argc < a + 3))
+    {
+        fprintf(stderr, "Uso: %s [-r] <grabacion> satelite [<direccion de escucha>]\n"
+                        "     %s [-r] <grabacion> estacion <IPv4>:<Puerto>\n",
+                argv[0], argv[0]);
+        exit(1);
+    }
+    if ((c = cap_abrir(argv[a], &cab)) == NULL)
+        exit(1);
+
+    /* Frente a un satelite se envia lo que escribio la estacion grabada */
+    if (!strcmp(argv[a + 1], "satelite"))
+    {
+        propio = CAP_SALIDA;
+        r.grabado.saltar = r.vivo.saltar = cab.presentacion;
+        r.sock = abrir_Satelite(argc > a + 2 ? argv[a + 2] : "*");
+    }
+    else
+    {
+        propio = CAP_ENTRADA;
+        r.propio.saltar = cab.presentacion;
+        r.sock = abrir_Estacion(argv[a + 2]);
+    }
+    if (r.sock < 0)
+        exit(1);
+    fcntl(r.sock, F_SETFL, fcntl(r.sock, F_GETFL) | O_NONBLOCK);
+    clock_gettime(CLOCK_MONOTONIC, &r.inicio);
+
+    while ((estado = cap_leer(c, &reg)) > 0)
+    {
+        duracion = reg.tiempo;
+        if (reg.sentido != propio)
+        {
+            otro += reg.largo;
+            separar(&r, &r.grabado, reg.datos, reg.largo);
+            continue;
+        }
+        grabado += reg.largo;
+        if (r.cerrado)
+            continue; /* solo se cuenta el resto de la grabacion */
+        r.n_tocados = 0;
+        separar(&r, &r.propio, reg.datos, reg.largo);
+        antes = transcurrido(&r);
+        if (esperar(&r, r.rapido ? 0 : reg.tiempo) < 0)
+            continue;
+        r.esperando += transcurrido(&r) - antes;
+        if (enviar(&r, reg.datos, reg.largo) == 0)
+            r.tramos++;
+    }
+    if (estado < 0)
+        fprintf(stderr, "%s: grabacion cortada\n", argv[a]);
+    drenar(&r);
+    cap_cerrar(c);
+    close(r.sock);
+
+    inicio = (time_t)(cab.inicio / 1000000000ULL);
+    strftime(fecha, sizeof(fecha), "%c", localtime(&inicio));
+    const char *otro_extremo = propio == CAP_SALIDA ? "el satelite" : "la estacion";
+    printf("Grabacion: satelite %u, %s, %.2f s, %.1f MB hacia %s y %.1f MB desde alli\n", cab.satelite, fecha,
+           duracion / 1e6, grabado / 1048576.0, otro_extremo, otro / 1048576.0);
+    double s = r.actividad / 1e6; /* hasta el ultimo byte, sin la espera final */
+    printf("Reproduccion %s: %.2f s (%.0f%% de la original), %u tramos, %.1f MB enviados, %.1f MB recibidos "
+           "(%.1f MB/s)\n",
+           r.rapido ? "rapida" : "al ritmo original", s, duracion > 0 ? 100 * s * 1e6 / duracion : 100.0, r.tramos,
+           r.enviados / 1048576.0, r.recibidos / 1048576.0, s > 0 ? (r.enviados + r.recibidos) / 1048576.0 / s : 0.0);
+    printf("Esperando a %s: %.2f s; tramos sin la respuesta grabada: %u%s\n", otro_extremo, r.esperando / 1e6,
+           r.desvios, r.cerrado && grabado > r.enviados ? "; el otro extremo cerro la conexion antes del final" : "");
+    free(r.flujos);
+    return 0;
+}
+
+/**
+ * @brief Escucha como la estacion y espera un satelite.
+ *
+ * @param especificacion direccion de escucha (ver dir_resolver)
+ * @return int conexion con el satelite, o -1
+ */
+int abrir_Satelite(const char *especificacion)
+{
+    struct dir_escucha d;
+    char texto[DIR_TEXTO_MAX];
+    int escucha, sock;
+
+    if (dir_resolver(especificacion, &d, 1) < 1 || (escucha = dir_abrir(&d, SOCK_STREAM)) < 0)
+        return -1;
+    printf("Esperando un satelite en %s\n", dir_texto((struct sockaddr *)&d.direccion, texto, sizeof(texto)));
+    sock = accept(escucha, NULL, NULL);
+    if (sock < 0)
+        perror("accept");
+    close(escucha);
+    return sock;
+}
+
+/**
+ * @brief Se conecta como satelite a la estacion.
+ *
+ * @param direccion "host:puerto", se modifica
+ * @return int conexion con la estacion, o -1
+ */
+int abrir_Estacion(char *direccion)
+{
+    struct addrinfo pistas, *res, *p;
+    char *host, *puerto;
+    int sock = -1;
+
+    if (dir_separar(direccion, &host, &puerto) < 0 || puerto == NULL)
+    {
+        fprintf(stderr, "Direccion de la estacion: <IPv4>:<Puerto> o [<IPv6>]:<Puerto>\n");
+        return -1;
+    }
+    memset(&pistas, 0, sizeof(pistas));
+    pistas.ai_family = AF_UNSPEC;
+    pistas.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, puerto, &pistas, &res) != 0)
+    {
+        fprintf(stderr, "ERROR, no existe el host\n");
+        return -1;
+    }
+    for (p = res; p != NULL && sock < 0; p = p->ai_next)
+    {
+        if ((sock = socket(p->ai_family, SOCK_STREAM, 0)) < 0)
+            continue;
+        if (connect(sock, p->ai_addr, p->ai_addrlen) < 0)
+        {
+            close(sock);
+            sock = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (sock < 0)
+        perror("connect");
+    return sock;
+}
+
+uint64_t transcurrido(struct reproduccion *r)
+{
+    struct timespec ahora;
+
+    clock_gettime(CLOCK_MONOTONIC, &ahora);
+    return (uint64_t)(ahora.tv_sec - r->inicio.tv_sec) * 1000000 + (ahora.tv_nsec - r->inicio.tv_nsec) / 1000;
+}
+
+/**
+ * @brief Avance de un flujo del otro extremo, creandolo si hace falta.
+ *
+ * @param r
+ * @param id
+ * @return struct flujo*
+ */
+static struct flujo *buscar(struct reproduccion *r, uint32_t id)
+{
+    struct flujo *f;
+    uint32_t n;
+
+    if (id >= r->n_flujos)
+    {
+        n = id + 64;
+        if ((f = realloc(r->flujos, n * sizeof(*f))) == NULL)
+        {
+            perror("realloc");
+            exit(1);
+        }
+        memset(f + r->n_flujos, 0, (n - r->n_flujos) * sizeof(*f));
+        r->flujos = f;
+        r->n_flujos = n;
+    }
+    return &r->flujos[id];
+}
+
+/**
+ * @brief Anota que el tramo a enviar toca un flujo.
+ *
+ * @param r
+ * @param l cabecera de una trama propia
+ */
+static void tocar(struct reproduccion *r, struct lector *l)
+{
+    int i;
+
+    for (i = 0; i < r->n_tocados && r->tocados[i].flujo != l->flujo; i++)
+        ;
+    if (i == REP_TOCADOS)
+        return;
+    if (i == r->n_tocados)
+    {
+        r->tocados[i].flujo = l->flujo;
+        r->tocados[i].datos = 0;
+        r->n_tocados++;
+    }
+    if (l->tipo == MUX_DATOS)
+        r->tocados[i].datos += l->largo;
+}
+
+/**
+ * @brief Una trama completa del otro extremo. El avance de su flujo es la
+ *        carga de datos o 1 para las de control; el credito no cuenta como
+ *        avance, porque su reparto en tramas depende del ritmo de lectura,
+ *        y se acumula aparte.
+ *
+ * @param r
+ * @param l
+ */
+static void trama(struct reproduccion *r, struct lector *l)
+{
+    struct flujo *f = buscar(r, l->flujo);
+    uint32_t credito;
+    uint64_t avance = 1;
+
+    if (l->tipo == MUX_CREDITO)
+    {
+        if (l == &r->vivo && l->largo == sizeof(credito))
+        {
+            memcpy(&credito, l->credito, sizeof(credito));
+            f->credito += ntohl(credito);
+        }
+        return;
+    }
+    if (l->tipo == MUX_DATOS)
+        avance = l->largo;
+    if (l == &r->grabado)
+        f->grabado += avance;
+    else
+        f->vivo += avance;
+}
+
+/**
+ * @brief Separa en tramas los bytes de un sentido. Las tramas pueden quedar
+ *        partidas entre tramos.
+ *
+ * @param r
+ * @param l
+ * @param p
+ * @param n
+ */
+void separar(struct reproduccion *r, struct lector *l, const unsigned char *p, size_t n)
+{
+    uint32_t u32;
+    uint16_t u16;
+    size_t k;
+
+    k = l->saltar < n ? l->saltar : n;
+    l->saltar -= k;
+    p += k;
+    n -= k;
+    for (;;)
+    {
+        if (l->n < MUX_CABECERA_LEN)
+        {
+            if (n == 0)
+                break;
+            k = MUX_CABECERA_LEN - l->n < n ? MUX_CABECERA_LEN - l->n : n;
+            memcpy(l->cabecera + l->n, p, k);
+            l->n += k;
+            p += k;
+            n -= k;
+            if (l->n < MUX_CABECERA_LEN)
+                break;
+            memcpy(&u32, l->cabecera, 4);
+            l->flujo = ntohl(u32);
+            memcpy(&u16, l->cabecera + 4, 2);
+            l->tipo = ntohs(u16);
+            memcpy(&u16, l->cabecera + 6, 2);
+            l->largo = ntohs(u16);
+            if (l == &r->propio)
+                tocar(r, l);
+        }
+        k = MUX_CABECERA_LEN + l->largo - l->n < n ? MUX_CABECERA_LEN + l->largo - l->n : n;
+        for (size_t i = 0; i < k && l->n - MUX_CABECERA_LEN + i < sizeof(l->credito); i++)
+            l->credito[l->n - MUX_CABECERA_LEN + i] = p[i];
+        l->n += k;
+        p += k;
+        n -= k;
+        if (l->n < MUX_CABECERA_LEN + l->largo)
+            break; /* sigue en el proximo tramo */
+        if (l != &r->propio)
+            trama(r, l);
+        l->n = 0;
+    }
+}
+
+/**
+ * @brief Lee y separa lo que haya enviado el otro extremo.
+ *
+ * @param r
+ */
+static void leer(struct reproduccion *r)
+{
+    static unsigned char buffer[REP_LECTURA];
+    ssize_t n;
+
+    while ((n = recv(r->sock, buffer, sizeof(buffer), 0)) > 0)
+    {
+        r->recibidos += (uint64_t)n;
+        r->actividad = transcurrido(r);
+        separar(r, &r->vivo, buffer, (size_t)n);
+    }
+    if (n == 0 || (errno != EAGAIN && errno != EINTR))
+        r->cerrado = 1;
+}
+
+/**
+ * @brief Indica si el otro extremo avanzo lo grabado en los flujos del tramo
+ *        y si estos tienen credito para sus datos. Un flujo ya abierto que
+ *        lleva REP_ESPERA ms sin avance no se espera mas; uno que el otro
+ *        extremo aun no abrio se espera siempre.
+ *
+ * @param r
+ * @param ahora
+ * @return int
+ */
+static int listo(struct reproduccion *r, uint64_t ahora)
+{
+    int listo = 1;
+
+    for (int i = 0; i < r->n_tocados; i++)
+    {
+        struct flujo *f = buscar(r, r->tocados[i].flujo);
+        if (f->enviado + r->tocados[i].datos > MUX_VENTANA + f->credito)
+        {
+            listo = 0;
+            continue;
+        }
+        if (f->vivo + f->faltante >= f->grabado)
+            continue;
+        if (f->vivo > 0 && ahora - r->actividad >= REP_ESPERA * 1000ULL)
+        {
+            r->desvios++;
+            f->faltante = f->grabado - f->vivo;
+            continue;
+        }
+        listo = 0;
+    }
+    return listo;
+}
+
+/**
+ * @brief Espera la hora de un tramo y el avance del otro extremo en sus
+ *        flujos, leyendo mientras tanto.
+ *
+ * @param r
+ * @param hora us desde el inicio, 0 para no esperar la hora
+ * @return int 0, o -1 si el otro extremo cerro la conexion
+ */
+int esperar(struct reproduccion *r, uint64_t hora)
+{
+    struct pollfd p = {r->sock, POLLIN, 0};
+    uint64_t ahora, plazo;
+
+    for (;;)
+    {
+        ahora = transcurrido(r);
+        if (listo(r, ahora) && ahora >= hora)
+            return 0;
+        plazo = hora > ahora ? hora - ahora : REP_ESPERA * 1000ULL;
+        if (poll(&p, 1, (int)(plazo / 1000) + 1) > 0)
+            leer(r);
+        if (r->cerrado)
+            return -1;
+    }
+}
+
+/**
+ * @brief Envia un tramo, leyendo lo que llegue mientras la conexion no
+ *        admita mas, y descuenta sus datos del credito de cada flujo.
+ *
+ * @param r
+ * @param datos
+ * @param largo
+ * @return int 0, o -1 si el otro extremo cerro la conexion
+ */
+int enviar(struct reproduccion *r, const unsigned char *datos, size_t largo)
+{
+    struct pollfd p = {r->sock, POLLIN | POLLOUT, 0};
+    ssize_t n;
+
+    while (largo > 0)
+    {
+        if (poll(&p, 1, -1) < 0 && errno != EINTR)
+            return -1;
+        if (p.revents & (POLLIN | POLLHUP | POLLERR))
+            leer(r);
+        if (r->cerrado)
+            return -1;
+        if (!(p.revents & POLLOUT))
+            continue;
+        n = send(r->sock, datos, largo, MSG_NOSIGNAL);
+        if (n < 0 && errno != EAGAIN && errno != EINTR)
+        {
+            r->cerrado = 1;
+            return -1;
+        }
+        if (n > 0)
+        {
+            datos += n;
+            largo -= (size_t)n;
+            r->enviados += (uint64_t)n;
+            r->actividad = transcurrido(r);
+        }
+    }
+    for (int i = 0; i < r->n_tocados; i++)
+        buscar(r, r->tocados[i].flujo)->enviado += r->tocados[i].datos;
+    return 0;
+}
+
+/**
+ * @brief Al final de la grabacion lee hasta que el otro extremo cierra o
+ *        deja de enviar REP_ESPERA ms.
+ *
+ * @param r
+ */
+void drenar(struct reproduccion *r)
+{
+    struct pollfd p = {r->sock, POLLIN, 0};
+
+    while (!r->cerrado && poll(&p, 1, REP_ESPERA) > 0)
+        leer(r);
+}
@@ -5,8 +5,13 @@
  * @brief Implemetacion de socket INET. El servidor funciona como estacion terrestre
  *        solicitando datos a satelite.  
  *        Comienza creando un socket INET orientado a la conexión. El usuario debe ingresar
- *        por linea de comandos solo su nombre (login <usuario>), la direccion y el puerto
- *        del servidor es fijo,192.168.1.5:6020.  
+ *        por linea de comandos solo su nombre (login <usuario>). La estacion escucha en
+ *        las direcciones dadas como argumentos (IPv4, [IPv6], nombre de interfaz o "*",
+ *        con ":puerto" opcional), cada una con su propio hilo; sin argumentos escucha
+ *        en todas, IPv4 e IPv6, puerto 6020.
+ *                  ./servidor [-g <directorio>] [<direccion>[:<puerto>] ...]
+ *                          ejemplo ./servidor 192.168.1.5:6020 [fd00::5]:6020 eth1
+ *        Con -g cada sesion se graba en el directorio indicado (ver captura.h).
  *        Una vez realizada la validacion de credenciales se crea el socket y queda a la
  *        espera de una conexion entrante por parte de un satelite. Cuando conecta, deriva
  *        la conexion original a una conexion secundaria, proceso hijo, para mantener al
@@ -19,6 +24,7 @@
  */
 
 /* Librerias usados por los distintos codigos fuente */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -27,6 +33,7 @@
 #include <time.h>
 #include <fcntl.h>
 #include <termios.h>
+#include <pthread.h>
 #include <netdb.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -36,30 +43,189 @@
 #include <sys/file.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <poll.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
 
+#include "telemetria.h"
+#include "compacta.h"
+#include "agregado.h"
+#include "perfiles.h"
+#include "transferencia.h"
+#include "multiplexor.h"
+#include "buffers.h"
+#include "flota.h"
+#include "reactor.h"
+#include "direcciones.h"
+#include "ancho.h"
+#include "captura.h"
+#include "rafaga.h"
+
 #define TAM 80
 #define TAM2 150
 #define BUFSIZE 1024
 #define DIRECTORIO_IMAGEN "/imagen"
+#define DIRECTORIO_ESCANEOS "escaneos"
+#define INDICE_ESCANEOS DIRECTORIO_ESCANEOS "/indice.txt"
+#define FIRMWARE "cliente2"
 #define BYTES_STREAM 1500
 #define BUFF_SIZE 1024
 #define FILE_BUFFER_SIZE 1500
+#define POLITICA_FSYNC TRF_FSYNC_AL_FINAL
+#define PRESENTACION_LEN 50      /* bytes con que se presenta el satelite: su ID */
+#define PRESENTACION_PLAZO 5000  /* ms para presentarse despues de conectar */
+#define ACEPTAR_LOTE 64          /* conexiones aceptadas por turno del reactor */
+#define ACEPTAR_PAUSA 100        /* ms sin aceptar cuando faltan descriptores */
+#define IP_UDP_CABECERAS 28      /* bytes de IPv4 y UDP por datagrama */
+#define PING_ESPERA 1000         /* ms que se esperan los ecos despues de la ultima trama */
 #define ANSI_COLOR_RED "\x1b[31m"
 #define ANSI_COLOR_GREEN "\x1b[32m"
 #define ANSI_COLOR_CYAN "\x1b[36m"
 #define ANSI_COLOR_BLUE "\x1b[34m"
 #define ANSI_COLOR_RESET "\x1b[0m"
 
+/* Socket de escucha del padre. Cada direccion tiene su hilo con su propio
+   reactor, asi las conexiones de distintas interfaces se atienden en
+   paralelo */
+struct escucha
+{
+    struct tarea tarea;
+    int fd;
+    int sin_descriptores; /* pausar antes de volver a aceptar */
+    struct reactor *reactor;
+    pthread_t hilo;
+};
+
+/* Conexion aceptada que todavia no envio su ID. El padre no espera a
+   ningun satelite: cada presentacion es una corrutina con plazo */
+struct presentacion
+{
+    struct tarea tarea;
+    int fd;
+    size_t recibido;
+    char buffer[PRESENTACION_LEN + 1];
+    struct sockaddr_storage direccion;
+    struct timespec inicio;
+    struct presentacion *ant, *sig;
+};
+
 /* Funciones que escribí */
 int validacion(char *, char *);
 void sesion(int, char *, char *, char *);
-int update_Firmware(int);
-int start_Scanning(int);
-int obtener_Telemetria(int, char *, char *);
-int Servidor_UP(char *, char *);
+int update_Firmware(int, int, const struct raf_ajuste *);
+int start_Scanning(int, const struct raf_ajuste *);
+int obtener_Telemetria(int, char *, char *, uint32_t);
+int transmitir_Telemetria(int, char *, unsigned int, unsigned int, uint32_t);
+void mostrar_Agregado(int);
+int ping_Satelite(int, unsigned int, unsigned int);
+int prueba_Ancho(int, uint64_t, uint64_t);
+void informar_Sentido(const char *, const struct anc_medida *, const struct anc_medida *);
+void Servidor_UP(int, char **, char *);
+int cambiar_Perfil(char *);
+int elegir_Canal(char *);
+int abrir_Flujo(const char *, enum mux_clase, uint8_t);
+void *hilo_Scanning(void *);
+int abortar_Escaneos(void);
+int ruta_Escaneo(char *, size_t, struct timespec *);
+void indexar_Escaneo(const char *, long, struct timespec *);
+void *hilo_Flota(void *);
+int servir_Firmware(uint32_t, struct flota_mensaje *);
+int relevo_Firmware(uint32_t, uint32_t, const unsigned char *);
+void informar_Avance(uint64_t, uint64_t, void *);
+void cerrar_Sesion(void);
+double milisegundos(struct timespec *);
+void *hilo_Escucha(void *);
+int aceptar_Conexiones(struct tarea *);
+int atender_Presentacion(struct tarea *);
+void iniciar_Sesion(struct presentacion *);
+struct cap_archivo *grabar_Sesion(struct presentacion *);
+
+/* Canal por el que el receptor de telemetria del padre entrega a esta sesion
+   los datagramas de su satelite */
+static int canal_telemetria = -1;
+
+/* Perfil de ajuste de sockets vigente en la sesion */
+static const struct perfil *perfil_activo = NULL;
+
+/* Forma de volcar en disco la imagen recibida */
+static enum trf_modo modo_recepcion = TRF_ESCRITOR;
+
+/* Canal de los escaneos y del firmware: tasa 0 usa el flujo TCP; si no,
+   rafaga UDP con correccion de errores (ver rafaga.h) */
+static struct raf_ajuste canal_masivo = {0, RAF_PARIDAD, 0};
+
+/* ID del satelite de esta sesion: nombra sus escaneos en el archivo */
+static uint32_t satelite_id = 0;
+
+/* Canal de ordenes con el coordinador de flota del padre */
+static int canal_flota = -1;
+
+/* Pares a los que reenvia el firmware cada satelite ya actualizado en los
+   despliegues que se pidan desde esta sesion (0: solo la estacion) */
+static unsigned int ramas_relevo = 0;
+
+/* Grupo de la vista agregada al que suma esta sesion: la direccion de
+   escucha por la que llego el satelite */
+static int grupo_sesion = -1;
+
+/* Directorio de las grabaciones de sesion (-g), o NULL si no se graba */
+static const char *directorio_capturas = NULL;
+
+/* En el hijo: grabacion de su sesion */
+static struct cap_archivo *captura = NULL;
+
+/* Direcciones en las que escucha el padre */
+static struct escucha escuchas[DIR_MAX_ESCUCHAS];
+static int n_escuchas = 0;
+
+/* Presentaciones en curso en el padre, de todos los hilos de escucha; el
+   hijo cierra las que hereda */
+static struct presentacion *presentaciones = NULL;
+static pthread_mutex_t presentaciones_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Usuario de la estacion, para las sesiones que se deriven */
+static char *usuario_estacion = NULL;
+
+/* En el hijo: conexion con su satelite, ya presentado */
+static int socket_sesion = -1;
+
+/* Conexion con el satelite: cada comando abre un flujo propio */
+static struct mux *conexion = NULL;
+
+/* Pesos dentro de la clase masiva: una actualizacion de firmware avanza
+   mas rapido que los escaneos que compartan la conexion */
+#define PESO_ESCANEO 1
+#define PESO_FIRMWARE 4
+
+/* Escaneo en curso: su flujo y el canal elegido al pedirlo */
+struct escaneo
+{
+    int flujo;
+    struct raf_ajuste canal;
+};
+
+/* Trama de ping: el satelite la devuelve sin mirarla */
+struct ping_trama
+{
+    uint32_t numero;
+    uint32_t camino;
+    uint64_t enviada; /* ns, reloj monotonico de la estacion */
+};
+
+/* Camino medido por un ping */
+struct ping_camino
+{
+    const char *nombre;
+    int fd;
+    double *rtt; /* ms por trama, negativo si no volvio */
+    unsigned int recibidas;
+};
+
+/* Flujos de escaneo en curso, para poder abortarlos */
+static int escaneos[MUX_MAX_FLUJOS];
+static int n_escaneos = 0;
+static pthread_mutex_t escaneos_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /**
  * @brief Estado inicial de conexion al servidor. Realiza la validacion de las
@@ -68,14 +234,22 @@ int Servidor_UP(char *, char *);
  *        mediante la funcion Servidor_UP. 
  * 
  * @param argc 
- * @param argv 
+ * @param argv -g <directorio> para grabar las sesiones y direcciones de
+ *        escucha, opcionales
  * @return int 
  */
 int main(int argc, char *argv[])
 {
     int conexion = 0;
     char bufferConexion[30];
-    char usuario[20], ip[INET_ADDRSTRLEN], port[5];
+    char usuario[20];
+
+    if (argc > 2 && !strcmp(argv[1], "-g"))
+    {
+        directorio_capturas = argv[2];
+        argc -= 2;
+        argv += 2;
+    }
 
     printf("\nInicio del programa Servidor");
     printf("\n===========================\n");
@@ -85,7 +259,7 @@ int main(int argc, char *argv[])
         memset(&bufferConexion[0], 0, sizeof(bufferConexion));
         printf("desconectado");
         printf("~$ ");
-        fgets(bufferConexion, TAM - 1, stdin);
+        fgets(bufferConexion, sizeof(bufferConexion), stdin);
         conexion = validacion(bufferConexion, usuario);
     } while (conexion == 0);
 
@@ -96,88 +270,344 @@ int main(int argc, char *argv[])
     printf(ANSI_COLOR_GREEN);
     printf("Esperando por conexión entrante\n");
     printf(ANSI_COLOR_RESET);
-    int socket = Servidor_UP(ip, port);
-    sesion(socket, usuario, ip, port);
+    Servidor_UP(argc - 1, argv + 1, usuario);
 
     return 0;
 }
 
 /**
- * @brief Crea el socket para atender las peticiones entrantes.
- *        Cuando se conecta un cliente, deriva dicha conexion a un proceso
- *        hijo para mantenerse a le espera de nuevas conexiones entrantes.
+ * @brief Crea los sockets para atender las peticiones entrantes, uno por
+ *        direccion de escucha, y con cada uno un receptor de telemetria UDP
+ *        en la misma direccion, que vive en este proceso mientras dure la
+ *        estacion. Cada socket se atiende en su propio hilo: las conexiones
+ *        se aceptan de a lotes y cada una espera su presentacion en una
+ *        corrutina con plazo, asi un satelite que conecta y no envia nada no
+ *        demora a los demas. Cuando un satelite se presenta, deriva la
+ *        conexion a un proceso hijo, que sigue en el hilo de esa direccion
+ *        con la sesion; el padre sigue aceptando. Cada hijo recibe un canal
+ *        propio con la telemetria de su satelite.
  * 
- * @param ip 
- * @param port 
- * @return int 
+ * @param n cantidad de direcciones; 0 para escuchar en todas
+ * @param especificaciones direcciones de escucha (ver dir_resolver)
+ * @param usuario
  */
-int Servidor_UP(char *ip, char *port)
+void Servidor_UP(int n, char **especificaciones, char *usuario)
 {
-    int sockfd, newsockfd, pid;
-    socklen_t clilen;
-    struct sockaddr_in cli_addr, serv_addr;
-    char str2[INET_ADDRSTRLEN];
+    static char *todas[] = {"*"};
+    struct dir_escucha direcciones[DIR_MAX_ESCUCHAS];
+    char texto[DIR_TEXTO_MAX];
+    int n_direcciones = 0, r, fd;
+
+    if (n <= 0)
+    {
+        n = 1;
+        especificaciones = todas;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        r = dir_resolver(especificaciones[i], direcciones + n_direcciones, DIR_MAX_ESCUCHAS - n_direcciones);
+        if (r < 0)
+            exit(1);
+        n_direcciones += r;
+    }
 
-    if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    usuario_estacion = usuario;
+    if (agr_iniciar() < 0)
+        printf("Sin vista agregada de la flota\n");
+    for (int i = 0; i < n_direcciones; i++)
+    {
+        dir_texto((struct sockaddr *)&direcciones[i].direccion, texto, sizeof(texto));
+        if ((fd = dir_abrir(&direcciones[i], SOCK_STREAM | SOCK_NONBLOCK)) < 0)
+            continue;
+        if (tlm_receptor_iniciar(&direcciones[i]) < 0)
+        {
+            printf("Sin telemetria en %s, direccion descartada\n", texto);
+            close(fd);
+            continue;
+        }
+        escuchas[n_escuchas].fd = fd;
+        escuchas[n_escuchas].sin_descriptores = 0;
+        if ((escuchas[n_escuchas].reactor = reactor_crear()) == NULL)
+            exit(1);
+        printf("Proceso: %d - socket disponible: %s\n", getpid(), texto);
+        agr_grupo(texto);
+        n_escuchas++;
+    }
+    if (n_escuchas == 0)
+    {
+        fprintf(stderr, "Ninguna direccion de escucha disponible\n");
+        exit(1);
+    }
+    if (flota_coordinador_iniciar(FIRMWARE) < 0)
     {
-        perror("creación de  socket");
         exit(1);
     }
 
-    memset(&serv_addr, 0, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_addr.s_addr = inet_addr("192.168.1.5");
-    //serv_addr.sin_addr.s_addr = inet_addr("192.168.0.10");
-    serv_addr.sin_port = htons(6020);
-    inet_ntop(AF_INET, &(serv_addr.sin_addr.s_addr), str2, INET_ADDRSTRLEN);
+    for (int i = 0; i < n_escuchas; i++)
+        if (pthread_create(&escuchas[i].hilo, NULL, hilo_Escucha, &escuchas[i]) != 0)
+        {
+            perror("pthread_create");
+            exit(1);
+        }
+    /* Los hilos de escucha solo terminan por un error */
+    for (int i = 0; i < n_escuchas; i++)
+        pthread_join(escuchas[i].hilo, NULL);
+    exit(1);
+}
+
+/**
+ * @brief Hilo de una direccion de escucha: corre su reactor. En el padre no
+ *        vuelve; en un hijo el reactor se detiene con la conexion del
+ *        satelite que se presento, y el hilo, unico del hijo, libera lo
+ *        heredado del padre y atiende la sesion.
+ * 
+ * @param arg struct escucha
+ * @return void* NULL si fallo el reactor
+ */
+void *hilo_Escucha(void *arg)
+{
+    struct escucha *e = arg;
+    struct sockaddr_storage local;
+    socklen_t largo = sizeof(local);
+    char texto[DIR_TEXTO_MAX], *ip, *port;
 
-    strcpy(ip, str2);
-    sprintf(port, "%d", ntohs(serv_addr.sin_port));
+    reactor_iniciar(e->reactor, &e->tarea, aceptar_Conexiones);
+    reactor_correr(e->reactor);
+    if (socket_sesion < 0)
+        return NULL;
 
-    if (bind(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
+    /* Hijo: no atiende mas conexiones que la de su satelite */
+    grupo_sesion = (int)(e - escuchas);
+    for (int i = 0; i < n_escuchas; i++)
     {
-        perror("ligadura");
-        exit(1);
+        reactor_destruir(escuchas[i].reactor);
+        close(escuchas[i].fd);
     }
+    for (struct presentacion *p = presentaciones; p != NULL; p = p->sig)
+        close(p->fd);
 
-    printf("Proceso: %d - socket disponible: %s:%d\n", getpid(), str2, ntohs(serv_addr.sin_port));
+    /* La sesion muestra y anuncia la direccion por la que llego el satelite */
+    getsockname(socket_sesion, (struct sockaddr *)&local, &largo);
+    dir_texto((struct sockaddr *)&local, texto, sizeof(texto));
+    ip = texto;
+    port = strrchr(texto, ':');
+    *port++ = '\0';
+    sesion(socket_sesion, usuario_estacion, ip, port);
+    exit(0);
+}
 
-    listen(sockfd, 5);
-    clilen = sizeof(cli_addr);
+/**
+ * @brief Corrutina del socket de escucha: acepta de a ACEPTAR_LOTE
+ *        conexiones por turno y arranca la presentacion de cada una. Sin
+ *        descriptores libres deja de aceptar ACEPTAR_PAUSA ms.
+ * 
+ * @param t struct escucha
+ * @return int enum reactor_paso
+ */
+int aceptar_Conexiones(struct tarea *t)
+{
+    struct escucha *e = (struct escucha *)t;
+    struct presentacion *p;
+    socklen_t largo;
+    int error;
 
-    while (1)
+    CO_INICIO(t);
+    for (;;)
     {
-        newsockfd = accept(sockfd, (struct sockaddr *)&cli_addr, &clilen);
-        if (newsockfd < 0)
+        if (e->sin_descriptores)
         {
-            perror("accept");
-            exit(1);
+            e->sin_descriptores = 0;
+            CO_ESPERAR(t, -1, 0, ACEPTAR_PAUSA);
         }
-
-        pid = fork();
-        if (pid < 0)
+        CO_ESPERAR(t, e->fd, EPOLLIN, 0);
+        for (int n = 0; n < ACEPTAR_LOTE; n++)
         {
-            perror("fork");
-            exit(1);
+            if ((p = calloc(1, sizeof(*p))) == NULL)
+            {
+                perror("calloc");
+                e->sin_descriptores = 1;
+                break;
+            }
+            largo = sizeof(p->direccion);
+            if ((p->fd = accept4(e->fd, (struct sockaddr *)&p->direccion, &largo, SOCK_NONBLOCK)) < 0)
+            {
+                error = errno;
+                free(p);
+                if (error == EINTR || error == ECONNABORTED)
+                    continue;
+                if (error == EAGAIN || error == EWOULDBLOCK)
+                    break;
+                perror("accept");
+                if (error != EMFILE && error != ENFILE && error != ENOBUFS && error != ENOMEM)
+                    exit(1);
+                e->sin_descriptores = 1;
+                break;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &p->inicio);
+            pthread_mutex_lock(&presentaciones_mutex);
+            p->sig = presentaciones;
+            if (presentaciones != NULL)
+                presentaciones->ant = p;
+            presentaciones = p;
+            pthread_mutex_unlock(&presentaciones_mutex);
+            reactor_iniciar(t->reactor, &p->tarea, atender_Presentacion);
         }
+    }
+    CO_FIN(t);
+}
 
-        if (pid == 0)
-        { //proceso hijo
-            //close( sockfd );
-            return (newsockfd);
-        }
-        else
+/**
+ * @brief Corrutina de una conexion recien aceptada: junta los
+ *        PRESENTACION_LEN bytes con el ID del satelite y entonces le abre una
+ *        sesion. Si no llegan dentro de PRESENTACION_PLAZO cierra la conexion.
+ * 
+ * @param t struct presentacion
+ * @return int enum reactor_paso
+ */
+int atender_Presentacion(struct tarea *t)
+{
+    struct presentacion *p = (struct presentacion *)t;
+    char texto[DIR_TEXTO_MAX];
+    ssize_t n;
+    int resta;
+
+    CO_INICIO(t);
+    while (p->recibido < PRESENTACION_LEN)
+    {
+        /* El plazo cuenta desde que conecto, no desde la ultima lectura */
+        resta = PRESENTACION_PLAZO - (int)milisegundos(&p->inicio);
+        CO_ESPERAR(t, p->fd, EPOLLIN, resta > 1 ? resta : 1);
+        if (t->vencida)
         {
-            char buffer[TAM];
-            memset(buffer, '\0', sizeof(buffer));
-            read(newsockfd, buffer, sizeof(buffer) - 1);
-            printf(ANSI_COLOR_GREEN);
-            printf("\nSERVIDOR: Nuevo cliente (PID: %s) conectado desde %s:%d\n", buffer, inet_ntoa(cli_addr.sin_addr), htons(cli_addr.sin_port));
-            printf(ANSI_COLOR_RESET);
+            printf("Conexion desde %s sin presentacion en %d ms, cerrada\n",
+                   dir_texto((struct sockaddr *)&p->direccion, texto, sizeof(texto)), PRESENTACION_PLAZO);
+            break;
         }
-    } //Fin while(1)
-    close(sockfd);
-    return 0;
+        n = read(p->fd, p->buffer + p->recibido, PRESENTACION_LEN - p->recibido);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+            break;
+        if (n > 0)
+            p->recibido += n;
+    }
+    pthread_mutex_lock(&presentaciones_mutex);
+    if (p->ant != NULL)
+        p->ant->sig = p->sig;
+    else
+        presentaciones = p->sig;
+    if (p->sig != NULL)
+        p->sig->ant = p->ant;
+    pthread_mutex_unlock(&presentaciones_mutex);
+    if (p->recibido == PRESENTACION_LEN)
+        iniciar_Sesion(p);
+    if (socket_sesion < 0)
+        close(p->fd);
+    free(p);
+    CO_FIN(t);
+}
+
+/**
+ * @brief Deriva a un proceso hijo la conexion de un satelite que ya se
+ *        presento. En el hijo deja la conexion, de nuevo bloqueante, en
+ *        socket_sesion y detiene el reactor; en el padre registra el
+ *        satelite en la flota y en el receptor de telemetria.
+ * 
+ * @param p
+ */
+void iniciar_Sesion(struct presentacion *p)
+{
+    int canal[2], orden[2];
+    uint32_t id = (uint32_t)atoi(p->buffer);
+    char texto[DIR_TEXTO_MAX];
+    int pid;
+
+    if (tlm_canal_crear(canal) < 0)
+    {
+        perror("canal de telemetria");
+        return;
+    }
+    if (flota_canal_crear(orden) < 0)
+    {
+        perror("canal de flota");
+        close(canal[0]);
+        close(canal[1]);
+        return;
+    }
+
+    /* Con la lista tomada el hijo la hereda consistente */
+    pthread_mutex_lock(&presentaciones_mutex);
+    pid = fork();
+    pthread_mutex_unlock(&presentaciones_mutex);
+    if (pid < 0)
+    {
+        perror("fork");
+        exit(1);
+    }
+
+    if (pid == 0)
+    { //proceso hijo
+        tlm_receptor_hijo();
+        flota_hijo();
+        close(canal[0]);
+        close(orden[0]);
+        canal_telemetria = canal[1];
+        canal_flota = orden[1];
+        /* El satelite se presenta con su ID; la sesion lo necesita para
+           archivar sus escaneos */
+        satelite_id = id;
+        fcntl(p->fd, F_SETFL, fcntl(p->fd, F_GETFL) & ~O_NONBLOCK);
+        socket_sesion = p->fd;
+        if (directorio_capturas != NULL)
+            captura = grabar_Sesion(p);
+        reactor_detener(p->tarea.reactor);
+        return;
+    }
+
+    close(canal[1]);
+    close(orden[1]);
+    if (flota_registrar(id, orden[0]) < 0)
+    {
+        printf("Tabla de flota completa, satelite %s fuera de los despliegues\n", p->buffer);
+        close(orden[0]);
+    }
+    if (tlm_receptor_registrar(id, canal[0]) < 0)
+    {
+        printf("Tabla de telemetria completa, satelite %s sin telemetria\n", p->buffer);
+        close(canal[0]);
+    }
+    printf(ANSI_COLOR_GREEN);
+    printf("\nSERVIDOR: Nuevo cliente (PID: %s) conectado desde %s\n", p->buffer, dir_texto((struct sockaddr *)&p->direccion, texto, sizeof(texto)));
+    printf(ANSI_COLOR_RESET);
+}
+
+/**
+ * @brief Crea la grabacion de la sesion que empieza:
+ *        <directorio>/sat<ID>-<fecha UTC>-<pid>.cap. El primer tramo es la
+ *        presentacion del satelite, que ya se leyo fuera del multiplexor.
+ * 
+ * @param p
+ * @return struct cap_archivo* NULL si no se pudo crear
+ */
+struct cap_archivo *grabar_Sesion(struct presentacion *p)
+{
+    struct cap_archivo *c;
+    char ruta[TAM2], fecha[TAM];
+    struct timespec ahora;
+    struct tm tm;
+
+    clock_gettime(CLOCK_REALTIME, &ahora);
+    gmtime_r(&ahora.tv_sec, &tm);
+    strftime(fecha, sizeof(fecha), "%Y%m%dT%H%M%SZ", &tm);
+    snprintf(ruta, sizeof(ruta), "%s/sat%u-%s-%d.cap", directorio_capturas, satelite_id, fecha, getpid());
+    if (mkdir(directorio_capturas, 0775) < 0 && errno != EEXIST)
+    {
+        perror("grabacion de sesion");
+        return NULL;
+    }
+    if ((c = cap_crear(ruta, satelite_id, PRESENTACION_LEN)) == NULL)
+        return NULL;
+    cap_registrar(c, CAP_ENTRADA, p->buffer, PRESENTACION_LEN);
+    printf("Grabando la sesion en %s\n", ruta);
+    return c;
 }
 
 /**
@@ -200,7 +630,7 @@ int validacion(char *buffer, char *usuario)
     term.c_lflag &= ~ECHO;
     tcsetattr(STDIN_FILENO, TCSANOW, &term);
 
-    char *contras = (char *)malloc(10);
+    char *contras = (char *)malloc(TAM);
     char *token, *command, *pass;
     char line[256];
     buffer[strlen(buffer) - 1] = 0;
@@ -294,12 +724,32 @@ int validacion(char *buffer, char *usuario)
  */
 void sesion(int socket, char *usuario, char *ip, char *port)
 {
-    int n = 0;
+    int n = 0, flujo;
     char comando[50];
     int sesionActiva = 1;
+    pthread_t hilo;
     printf(ANSI_COLOR_RESET);
     printf("\nEscriba 'opciones' para listar los comandos disponibles.\n");
 
+    /* El satelite arranca con el mismo perfil por defecto */
+    perfil_activo = perfil_buscar(PERFIL_POR_DEFECTO);
+    if ((conexion = mux_crear(socket, 1)) == NULL)
+    {
+        exit(1);
+    }
+    mux_grabar(conexion, captura);
+    mux_ajustar(conexion, &perfil_activo->canal[CANAL_MASIVO]);
+
+    /* Ordenes del coordinador de flota, atendidas junto con la consola */
+    if (pthread_create(&hilo, NULL, hilo_Flota, NULL) != 0)
+    {
+        perror("pthread_create");
+    }
+    else
+    {
+        pthread_detach(hilo);
+    }
+
     while (sesionActiva)
     {
         printf(ANSI_COLOR_CYAN "%s", usuario);
@@ -312,30 +762,234 @@ void sesion(int socket, char *usuario, char *ip, char *port)
         if (!strcmp(comando, "update_firmware"))
         {
             printf("Enviando orden UPDATE FIRMWARE\n");
-            n = update_Firmware(socket);
-            strcpy(comando, "sat_logoff");
-            n = n;
+            flujo = abrir_Flujo(canal_masivo.tasa ? "update_firmware_udp" : comando, MUX_MASIVO, PESO_FIRMWARE);
+            if (flujo >= 0)
+            {
+                n = update_Firmware(flujo, -1, &canal_masivo);
+                close(flujo);
+                strcpy(comando, "sat_logoff");
+                n = n;
+            }
         }
 
         if (!strcmp(comando, "start_scanning"))
         {
+            /* El escaneo sigue en su flujo mientras se atienden otros comandos */
+            struct escaneo *escaneo = malloc(sizeof(*escaneo));
             printf("Enviando orden START SCANNING\n");
-            n = start_Scanning(socket);
+            if (escaneo == NULL)
+            {
+                perror("malloc");
+                continue;
+            }
+            escaneo->canal = canal_masivo;
+            escaneo->flujo = abrir_Flujo(canal_masivo.tasa ? "start_scanning_udp" : comando, MUX_MASIVO, PESO_ESCANEO);
+            if (escaneo->flujo < 0)
+            {
+                free(escaneo);
+                continue;
+            }
+            pthread_mutex_lock(&escaneos_mutex);
+            escaneos[n_escaneos++] = escaneo->flujo;
+            pthread_mutex_unlock(&escaneos_mutex);
+            if (pthread_create(&hilo, NULL, hilo_Scanning, escaneo) != 0)
+            {
+                perror("pthread_create");
+                hilo_Scanning(escaneo);
+            }
+            else
+            {
+                pthread_detach(hilo);
+            }
         }
 
         if (!strcmp(comando, "obtener_telemetria"))
         {
-            printf("Enviando orden OBTENER TELEMETRIA\n");
-            n = obtener_Telemetria(socket, ip, port);
+            /* obtener_telemetria [campo,campo...|mascara]: sin campos, todos */
+            char campos[TAM];
+            uint32_t mascara;
+            if (fgets(campos, sizeof(campos), stdin) == NULL || tlm_campos_leer(campos, &mascara) < 0)
+            {
+                printf("Uso: obtener_telemetria [id,firmware,uptime,arranque,hostname,memoria,cpu|mascara]\n");
+            }
+            else
+            {
+                printf("Enviando orden OBTENER TELEMETRIA\n");
+                if ((flujo = abrir_Flujo(comando, MUX_TELEMETRIA, 1)) >= 0)
+                {
+                    n = obtener_Telemetria(flujo, ip, port, mascara);
+                    close(flujo);
+                }
+            }
+        }
+
+        if (!strcmp(comando, "transmitir_telemetria"))
+        {
+            /* transmitir_telemetria <muestras> <periodo ms> [campos|mascara] */
+            char campos[TAM];
+            unsigned int muestras, periodo;
+            uint32_t mascara;
+            if (scanf("%u %u", &muestras, &periodo) != 2 || fgets(campos, sizeof(campos), stdin) == NULL ||
+                tlm_campos_leer(campos, &mascara) < 0 || muestras == 0)
+            {
+                printf("Uso: transmitir_telemetria <muestras> <periodo ms> [campos|mascara]\n");
+            }
+            else
+            {
+                printf("Enviando orden TRANSMITIR TELEMETRIA\n");
+                if ((flujo = abrir_Flujo(comando, MUX_TELEMETRIA, 1)) >= 0)
+                {
+                    n = transmitir_Telemetria(flujo, port, muestras, periodo, mascara);
+                    close(flujo);
+                }
+            }
+        }
+
+        if (!strcmp(comando, "ping"))
+        {
+            /* ping <tramas> <intervalo ms> */
+            unsigned int cantidad, intervalo;
+            if (scanf("%u %u", &cantidad, &intervalo) != 2 || cantidad == 0)
+            {
+                printf("Uso: ping <tramas> <intervalo ms>\n");
+            }
+            else
+            {
+                if ((flujo = abrir_Flujo(comando, MUX_CONTROL, 1)) >= 0)
+                {
+                    n = ping_Satelite(flujo, cantidad, intervalo);
+                    close(flujo);
+                }
+            }
+        }
+
+        if (!strcmp(comando, "bandwidth_test"))
+        {
+            /* bandwidth_test <MB> <bajada|subida|ambos> */
+            unsigned int mb;
+            char sentido[TAM];
+            if (scanf("%u %79s", &mb, sentido) != 2 || mb == 0 ||
+                (strcmp(sentido, "bajada") && strcmp(sentido, "subida") && strcmp(sentido, "ambos")))
+            {
+                printf("Uso: bandwidth_test <MB> <bajada|subida|ambos>\n");
+            }
+            else
+            {
+                uint64_t bytes = (uint64_t)mb * ANC_MB;
+                if ((flujo = abrir_Flujo(comando, MUX_MASIVO, PESO_ESCANEO)) >= 0)
+                {
+                    n = prueba_Ancho(flujo, strcmp(sentido, "subida") ? bytes : 0, strcmp(sentido, "bajada") ? bytes : 0);
+                    close(flujo);
+                }
+            }
+        }
+
+        if (!strcmp(comando, "agregado"))
+        {
+            /* agregado [grupos|reiniciar]: toda la flota, o cada grupo */
+            char opcion[TAM];
+            if (fgets(opcion, sizeof(opcion), stdin) == NULL)
+                opcion[0] = '\0';
+            opcion[strcspn(opcion, "\r\n")] = '\0';
+            if (strstr(opcion, "reiniciar") != NULL)
+            {
+                agr_reiniciar();
+                printf("Vista agregada reiniciada\n");
+            }
+            else if (strstr(opcion, "grupos") != NULL)
+            {
+                for (int g = 0; g < agr_grupos(); g++)
+                    mostrar_Agregado(g);
+            }
+            else
+            {
+                mostrar_Agregado(AGR_FLOTA);
+            }
+        }
+
+        if (!strcmp(comando, "perfil"))
+        {
+            memset(comando, '\0', 50);
+            scanf("%49s", comando);
+            n = cambiar_Perfil(comando);
+        }
+        if (!strcmp(comando, "recepcion"))
+        {
+            memset(comando, '\0', 50);
+            scanf("%49s", comando);
+            if (!strcmp(comando, "mmap"))
+                modo_recepcion = TRF_MMAP;
+            else if (!strcmp(comando, "splice"))
+                modo_recepcion = TRF_SPLICE;
+            else if (!strcmp(comando, "escritor"))
+                modo_recepcion = TRF_ESCRITOR;
+            printf("Recepcion de imagen: %s\n", modo_recepcion == TRF_MMAP ? "mmap" : modo_recepcion == TRF_SPLICE ? "splice" : "escritor");
+        }
+        if (!strcmp(comando, "canal"))
+        {
+            /* canal <tcp|udp> [kbit/s] [paridad %] [puerto] */
+            char opcion[TAM];
+            if (fgets(opcion, sizeof(opcion), stdin) == NULL || elegir_Canal(opcion) < 0)
+                printf("Uso: canal <tcp|udp> [kbit/s] [paridad %%] [puerto]\n");
+        }
+        if (!strcmp(comando, "flota"))
+        {
+            /* flota <concurrencia> <satelites por ola> <fallas por ola> */
+            struct flota_mensaje plan;
+            unsigned int concurrencia, ola, fallas;
+            if (scanf("%u %u %u", &concurrencia, &ola, &fallas) != 3)
+            {
+                printf("Uso: flota <concurrencia> <satelites por ola> <fallas por ola>\n");
+            }
+            else
+            {
+                memset(&plan, 0, sizeof(plan));
+                plan.tipo = FLOTA_PLAN;
+                plan.concurrencia = concurrencia;
+                plan.ola = ola;
+                plan.fallas = fallas;
+                plan.ramas = ramas_relevo;
+                if (flota_enviar(canal_flota, &plan, -1) < 0)
+                    printf("Coordinador de flota no disponible\n");
+            }
+        }
+        if (!strcmp(comando, "relevo"))
+        {
+            /* relevo <pares por satelite actualizado> */
+            unsigned int ramas;
+            if (scanf("%u", &ramas) != 1)
+            {
+                printf("Uso: relevo <pares>\n");
+                scanf("%*[^\n]"); /* el resto de la linea no es otro comando */
+            }
+            else
+            {
+                ramas_relevo = ramas;
+                printf("Relevo entre satelites: %u pares por satelite actualizado\n", ramas_relevo);
+            }
+        }
+        if (!strcmp(comando, "abortar"))
+        {
+            printf("Escaneos abortados: %d\n", abortar_Escaneos());
         }
         if (!strcmp(comando, "opciones"))
         {
             printf(ANSI_COLOR_RESET "\n%-20sOPCIONES\n", " ");
             printf(" 1)update_firmware\n"
                    " 2)start_scanning \n"
-                   " 3)obtener_telemetria \n"
-                   " 4)opciones \n"
-                   " 5)sat_logoff \n\n");
+                   " 3)obtener_telemetria [id,firmware,uptime,arranque,hostname,memoria,cpu|mascara] \n"
+                   " 4)transmitir_telemetria <muestras> <periodo ms> [campos|mascara] \n"
+                   " 5)agregado [grupos|reiniciar] \n"
+                   " 6)ping <tramas> <intervalo ms> \n"
+                   " 7)bandwidth_test <MB> <bajada|subida|ambos> \n"
+                   " 8)perfil <nombre> \n"
+                   " 9)recepcion <mmap|splice|escritor> \n"
+                   "10)canal <tcp|udp> [kbit/s] [paridad %%] [puerto] \n"
+                   "11)abortar \n"
+                   "12)flota <concurrencia> <ola> <fallas> \n"
+                   "13)relevo <pares> \n"
+                   "14)opciones \n"
+                   "15)sat_logoff \n\n");
         }
         if (!strcmp(comando, "sat_logoff"))
         {
@@ -344,215 +998,1026 @@ void sesion(int socket, char *usuario, char *ip, char *port)
             printf("Esperando por conexión entrante\n");
             printf(ANSI_COLOR_RESET);
 
-            int n = write(socket, "sat_logoff", 12);
-            if (n < 0)
-            {
-                perror("escritura en socket");
-                exit(1);
-            }
-            close(socket);
-            exit(0);
+            cerrar_Sesion();
         }
     } //Fin while sesion activa
 }
 
 /**
- * @brief Procedimiento de actualizacion del binario del satelite.
- * 
- * @param sock 
- * @return int 
+ * @brief Avisa al satelite que la sesion termina, cierra la conexion y
+ *        termina el proceso de la sesion.
  */
-int update_Firmware(int sock)
+void cerrar_Sesion(void)
 {
-    printf("=====================================\n\n");
-    printf("UPDATE FIRMWARE\n\n");
-
-    char buffer[TAM];
-    int new_exe;
-    struct stat buf;
-    int count;
-
-    memset(buffer, '\0', sizeof(buffer));
-    strcpy(buffer, "update_firmware");
-    write(sock, buffer, sizeof(buffer));
-
-    if ((new_exe = open("cliente2", O_RDONLY)) < 0)
-    {
-        printf("No existe el update de firmware solicitado\n");
-        return 0;
-    }
-
-    fstat(new_exe, &buf);
-    off_t fileSize = buf.st_size;
-    printf("Tamaño del binario: %li\n", fileSize);
-    int packages = fileSize / sizeof(buffer);
-    printf("N° de paquetes a enviar: %d\n", packages);
-
-    memset(buffer, 0, sizeof(buffer));
-    read(sock, buffer, 4);
-    sprintf(buffer, "%d", packages);
+    int flujo = abrir_Flujo("sat_logoff", MUX_CONTROL, 1);
 
-    if (write(sock, buffer, sizeof(buffer)) < 0)
-    {
-        perror("ERROR enviando");
-    }
-
-    while ((count = (int)read(new_exe, buffer, sizeof(buffer))) > 0)
-    {
-        usleep(1000);
-        if (write(sock, buffer, (size_t)count) < 0)
-        {
-            perror("ERROR enviando");
-        }
-        memset(buffer, '\0', sizeof(buffer));
-    }
-    close(new_exe);
-    printf("=====================================\n\n");
-    return 1;
+    if (flujo >= 0)
+        close(flujo);
+    mux_cerrar(conexion);
+    cap_cerrar(captura);
+    exit(0);
 }
 
 /**
- * @brief Procedimiento que recepta la imagen geoterrestre que envia
- *        el satelite.
+ * @brief Hilo que atiende las ordenes del coordinador de flota: envia el
+ *        firmware adjunto (el memfd que comparten todas las sesiones) o pide
+ *        al satelite que lo reciba de otro satelite, e informa el avance y
+ *        el resultado. Con el firmware verificado la sesion termina como en
+ *        update_firmware, para que el satelite se reinicie con la version
+ *        nueva. Un satelite ya actualizado puede recibir la orden de servir
+ *        el firmware a otros: la sesion devuelve la direccion de su relevo.
  * 
- * @param socket 
- * @return int 
+ * @param arg no usado
+ * @return void* 
  */
-int start_Scanning(int socket)
+void *hilo_Flota(void *arg)
 {
-    printf("=====================================\n\n");
-    printf("START SCANNING\n\n");
-
-    int n = write(socket, "start_scanning", 14); //Envia el comando ingresado al cliente
-    if (n < 0)
-    { //para que sepa que funcion ejecutar.
-        perror("escritura en socket");
-        exit(1);
-    }
+    struct flota_mensaje msg;
+    int imagen, flujo;
 
-    int new_img = 0;
-    remove("c1.jpg");
-    if ((new_img = open("c1.jpg", O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
-    {
-        printf("Error creando el file\n");
-        return 0;
-    }
-    char recvBuffer[FILE_BUFFER_SIZE];
-    long byteRead = 0;
-    int npackages = 0;
-    memset(&npackages, '\0', sizeof(npackages));
-    memset(recvBuffer, '\0', sizeof(recvBuffer));
+    (void)arg;
 
-    if ((byteRead = read(socket, &npackages, sizeof(int))) != 0)
+    while (flota_recibir(canal_flota, &msg, &imagen) == 0)
     {
-        if (byteRead <= 0)
+        if (msg.tipo == FLOTA_SERVIR)
         {
-            perror("ERROR leyendo del socket");
+            servir_Firmware(msg.cantidad, &msg);
+            flota_enviar(canal_flota, &msg, -1);
+            continue;
         }
-    }
-
-    float porcentaje;
-    printf("N° de paquetes a recibir: %i\n", npackages);
-    for (int i = 0; i <= npackages; i++)
-    {
-        porcentaje = ((float)i / (float)npackages) * 100;
-        printf("\r[%i - %i] [%.0f%%]", i, npackages, porcentaje);
-        usleep(100);
-        memset(recvBuffer, '\0', sizeof(recvBuffer));
-        if ((byteRead = read(socket, recvBuffer, sizeof(recvBuffer))) != 0)
+        if (msg.tipo == FLOTA_RELEVO)
         {
-            if (byteRead <= 0)
-            {
-                perror("ERROR leyendo del socket");
-                continue;
-            }
+            printf("Despliegue de flota: recibiendo firmware de otro satelite\n");
+            msg.resultado = relevo_Firmware(msg.ip, msg.puerto, msg.digesto) ? 1 : -1;
+            msg.tipo = FLOTA_RESULTADO;
+            flota_enviar(canal_flota, &msg, -1);
+            if (msg.resultado > 0)
+                cerrar_Sesion();
+            continue;
         }
-        if ((write(new_img, recvBuffer, (size_t)byteRead) < 0))
+        if (msg.tipo != FLOTA_ACTUALIZAR || imagen < 0)
         {
-            perror("ERROR escribiendo en el file");
-            exit(EXIT_FAILURE);
+            if (imagen >= 0)
+                close(imagen);
+            continue;
+        }
+        printf("Despliegue de flota: enviando firmware\n");
+        struct raf_ajuste canal = canal_masivo;
+        flujo = abrir_Flujo(canal.tasa ? "update_firmware_udp" : "update_firmware", MUX_MASIVO, PESO_FIRMWARE);
+        memset(&msg, 0, sizeof(msg));
+        msg.tipo = FLOTA_RESULTADO;
+        msg.resultado = flujo >= 0 ? update_Firmware(flujo, imagen, &canal) : -1;
+        if (flujo >= 0)
+            close(flujo);
+        close(imagen);
+        if (msg.resultado == 0)
+            msg.resultado = -1; /* la imagen existe: no verificar es una falla */
+        flota_enviar(canal_flota, &msg, -1);
+        if (msg.resultado > 0)
+        {
+            cerrar_Sesion();
         }
     }
-    close(new_img);
-    printf(" Finalizada la recepcion de Imagen\n");
-    printf("=====================================\n\n");
-    return 1;
+    return NULL;
+}
+
+/**
+ * @brief Pide al satelite que sirva su firmware a otros satelites. El
+ *        satelite escucha en la direccion con la que llega a la estacion y
+ *        responde "ip:puerto".
+ * 
+ * @param cantidad pares que atendera
+ * @param msg recibe la respuesta FLOTA_PUERTO (puerto 0 si no pudo)
+ * @return int 1 si el satelite abrio el relevo
+ */
+int servir_Firmware(uint32_t cantidad, struct flota_mensaje *msg)
+{
+    char buffer[TAM];
+    struct in_addr ip;
+    unsigned int puerto = 0;
+    int flujo = abrir_Flujo("servir_firmware", MUX_CONTROL, 1);
+    ssize_t n, total = 0;
+
+    memset(msg, 0, sizeof(*msg));
+    msg->tipo = FLOTA_PUERTO;
+    if (flujo < 0)
+        return 0;
+    memset(buffer, 0, sizeof(buffer));
+    snprintf(buffer, sizeof(buffer), "%u", cantidad);
+    write(flujo, buffer, strlen(buffer) + 1);
+
+    memset(buffer, 0, sizeof(buffer));
+    while (total < (ssize_t)sizeof(buffer) - 1 && (n = read(flujo, buffer + total, sizeof(buffer) - 1 - total)) > 0)
+        total += n;
+    close(flujo);
+
+    char *separador = strchr(buffer, ':');
+    if (separador == NULL)
+        return 0;
+    *separador = '\0';
+    if (inet_pton(AF_INET, buffer, &ip) != 1 || sscanf(separador + 1, "%u", &puerto) != 1)
+        return 0;
+    msg->ip = ip.s_addr;
+    msg->puerto = puerto;
+    return puerto != 0;
+}
+
+/**
+ * @brief Ordena al satelite recibir el firmware del relevo de otro
+ *        satelite. El flujo solo lleva la direccion, el SHA-256 de la imagen
+ *        del despliegue y el resultado: la imagen viaja entre los satelites
+ *        sin pasar por la estacion, y el satelite descarta lo que no
+ *        coincida con el resumen.
+ * 
+ * @param ip del relevo, en orden de red
+ * @param puerto 
+ * @param digesto SHA-256 de la imagen, calculado por el coordinador
+ * @return int 1 si el satelite verifico el firmware
+ */
+int relevo_Firmware(uint32_t ip, uint32_t puerto, const unsigned char *digesto)
+{
+    char buffer[TAM + 2 * SHA256_LEN];
+    struct in_addr direccion;
+    int flujo = abrir_Flujo("relevo_firmware", MUX_CONTROL, 1);
+    size_t n;
+
+    if (flujo < 0)
+        return 0;
+    direccion.s_addr = ip;
+    memset(buffer, 0, sizeof(buffer));
+    n = (size_t)snprintf(buffer, sizeof(buffer), "%s:%u ", inet_ntoa(direccion), puerto);
+    for (int i = 0; i < SHA256_LEN; i++, n += 2)
+        snprintf(buffer + n, sizeof(buffer) - n, "%02x", digesto[i]);
+    write(flujo, buffer, strlen(buffer) + 1);
+
+    memset(buffer, 0, sizeof(buffer));
+    if (read(flujo, buffer, 1) != 1)
+        buffer[0] = '0';
+    close(flujo);
+    if (buffer[0] != '1')
+        printf("El satelite no pudo verificar el firmware del relevo\n");
+    return buffer[0] == '1';
+}
+
+/**
+ * @brief Informa al coordinador el avance del envio del firmware, cada
+ *        FLOTA_PASO puntos porcentuales.
+ * 
+ * @param hecho 
+ * @param total 
+ * @param arg ultimo porcentaje informado (int)
+ */
+void informar_Avance(uint64_t hecho, uint64_t total, void *arg)
+{
+    int *ultimo = arg;
+    int porcentaje = (int)(hecho * 100 / total);
+    struct flota_mensaje msg;
+
+    if (porcentaje / FLOTA_PASO == *ultimo / FLOTA_PASO)
+        return;
+    *ultimo = porcentaje;
+    memset(&msg, 0, sizeof(msg));
+    msg.tipo = FLOTA_AVANCE;
+    msg.hecho = hecho;
+    msg.total = total;
+    flota_enviar(canal_flota, &msg, -1);
+}
+
+/**
+ * @brief Selecciona el perfil de ajuste de sockets de la sesion, lo aplica
+ *        en la estacion y se lo comunica al satelite para que haga lo mismo.
+ *        Si el nombre no existe, lista los perfiles disponibles.
+ * 
+ * @param nombre 
+ * @return int 1 si se cambio el perfil
+ */
+int cambiar_Perfil(char *nombre)
+{
+    const struct perfil *p = perfil_buscar(nombre);
+    int flujo;
+
+    if (p == NULL)
+    {
+        printf("Perfil desconocido. Perfiles disponibles:\n");
+        for (int i = 0; perfiles[i].nombre != NULL; i++)
+        {
+            printf(" %c %-12s %s\n", &perfiles[i] == perfil_activo ? '*' : ' ',
+                   perfiles[i].nombre, perfiles[i].descripcion);
+        }
+        return 0;
+    }
+
+    if ((flujo = abrir_Flujo("perfil", MUX_CONTROL, 1)) < 0)
+        return 0;
+    if (write(flujo, p->nombre, strlen(p->nombre)) < 0)
+    {
+        perror("escritura en socket");
+    }
+    close(flujo);
+    perfil_activo = p;
+    mux_ajustar(conexion, &perfil_activo->canal[CANAL_MASIVO]);
+    printf("Perfil activo: %s (%s)\n", p->nombre, p->descripcion);
+    return 1;
+}
+
+/**
+ * @brief Elige el canal de los escaneos y del firmware que se pidan desde
+ *        ahora: el flujo TCP de la orden, o una rafaga UDP a tasa fija con
+ *        el porcentaje de paridad indicado, para enlaces largos con
+ *        perdidas. El puerto fijo permite que la rafaga atraviese el
+ *        emulador de enlace (enlace -u).
+ * 
+ * @param opcion "tcp" o "udp [kbit/s] [paridad %] [puerto]"
+ * @return int 0, o -1 si la opcion no es valida
+ */
+int elegir_Canal(char *opcion)
+{
+    char tipo[TAM];
+    unsigned int tasa = RAF_TASA, paridad = RAF_PARIDAD, puerto = 0;
+    int n = sscanf(opcion, "%79s %u %u %u", tipo, &tasa, &paridad, &puerto);
+
+    if (n >= 1 && !strcmp(tipo, "tcp"))
+        canal_masivo.tasa = 0;
+    else if (n >= 1 && !strcmp(tipo, "udp") && tasa > 0 && paridad <= 100 && puerto <= 65535)
+    {
+        canal_masivo.tasa = tasa;
+        canal_masivo.paridad = paridad;
+        canal_masivo.puerto = (uint16_t)puerto;
+    }
+    else
+        return -1;
+
+    if (canal_masivo.tasa == 0)
+        printf("Canal masivo: flujo TCP\n");
+    else
+        printf("Canal masivo: rafaga UDP a %u kbit/s, %u%% de paridad, puerto %u\n", canal_masivo.tasa,
+               canal_masivo.paridad, canal_masivo.puerto);
+    return 0;
+}
+
+/**
+ * @brief Abre el flujo de un comando hacia el satelite. Si la conexion se
+ *        perdio, la sesion termina; si no hay flujos libres, se descarta
+ *        solo esta orden.
+ * 
+ * @param servicio nombre del comando
+ * @param clase prioridad del flujo
+ * @param peso parte del flujo dentro de su clase
+ * @return int socket del flujo, o -1 si no hay flujos libres
+ */
+int abrir_Flujo(const char *servicio, enum mux_clase clase, uint8_t peso)
+{
+    int flujo = mux_abrir(conexion, servicio, clase, peso);
+    if (flujo < 0 && errno == EPIPE)
+    {
+        printf("Conexion con el satelite perdida.\n");
+        exit(0);
+    }
+    if (flujo < 0)
+        printf("No hay flujos libres con el satelite: se descarta la orden %s\n", servicio);
+    return flujo;
+}
+
+/**
+ * @brief Milisegundos transcurridos desde el instante indicado.
+ * 
+ * @param desde 
+ * @return double 
+ */
+double milisegundos(struct timespec *desde)
+{
+    struct timespec ahora;
+    clock_gettime(CLOCK_MONOTONIC, &ahora);
+    return (ahora.tv_sec - desde->tv_sec) * 1e3 + (ahora.tv_nsec - desde->tv_nsec) / 1e6;
+}
+
+/**
+ * @brief Procedimiento de actualizacion del binario del satelite. El binario
+ *        viaja con trf_enviar: el satelite verifica cada bloque y el archivo
+ *        completo y pide de nuevo solo los bloques danados.
+ * 
+ * @param sock 
+ * @param imagen firmware ya abierto por el coordinador de flota, o -1 para
+ *        leer FIRMWARE
+ * @param canal con tasa, el binario viaja en rafaga UDP (ver rafaga.h)
+ * @return int 
+ */
+int update_Firmware(int sock, int imagen, const struct raf_ajuste *canal)
+{
+    printf("=====================================\n\n");
+    printf("UPDATE FIRMWARE\n\n");
+
+    char buffer[TAM];
+    int r, udp, fd, ultimo = -1;
+
+    perfil_aplicar(sock, &perfil_activo->canal[CANAL_MASIVO]);
+
+    /* El satelite confirma que libero el nombre del binario */
+    memset(buffer, 0, sizeof(buffer));
+    read(sock, buffer, 4);
+
+    if (canal->tasa > 0)
+    {
+        r = -1;
+        if ((udp = raf_abrir(socket_sesion, sock, canal)) >= 0)
+        {
+            fd = imagen < 0 ? open(FIRMWARE, O_RDONLY | O_CLOEXEC) : imagen;
+            r = raf_enviar_fd(sock, udp, fd, canal);
+            if (imagen < 0 && fd >= 0)
+                close(fd);
+            close(udp);
+        }
+    }
+    else if (imagen < 0)
+        r = trf_enviar(sock, FIRMWARE, &perfil_activo->canal[CANAL_MASIVO]);
+    else
+        r = trf_enviar_fd(sock, imagen, &perfil_activo->canal[CANAL_MASIVO], informar_Avance, &ultimo);
+    if (r == 0)
+        printf("No existe el update de firmware solicitado\n");
+    else if (r < 0)
+        printf("El satelite no pudo verificar el firmware\n");
+    printf("=====================================\n\n");
+    return r > 0;
+}
+
+/**
+ * @brief Procedimiento que recepta la imagen geoterrestre que envia
+ *        el satelite. El tamano llega en la cabecera de la transferencia y
+ *        la imagen se guarda en el archivo de escaneos con un nombre propio
+ *        (ver ruta_Escaneo); si no se pudo verificar, se descarta.
+ * 
+ * @param socket 
+ * @param canal con tasa, la imagen llega en rafaga UDP (ver rafaga.h)
+ * @return int 
+ */
+int start_Scanning(int socket, const struct raf_ajuste *canal)
+{
+    printf("=====================================\n\n");
+    printf("START SCANNING\n\n");
+
+    struct timespec inicio, captura;
+    struct buf_estadisticas pool;
+    char ruta[TAM2];
+    long total;
+
+    perfil_aplicar(socket, &perfil_activo->canal[CANAL_MASIVO]);
+    clock_gettime(CLOCK_MONOTONIC, &inicio);
+
+    if (ruta_Escaneo(ruta, sizeof(ruta), &captura) < 0)
+    {
+        return 0;
+    }
+    if (canal->tasa > 0)
+    {
+        int udp = raf_abrir(socket_sesion, socket, canal);
+        total = udp < 0 ? -1 : raf_recibir(socket, udp, ruta, POLITICA_FSYNC);
+        if (udp >= 0)
+            close(udp);
+    }
+    else
+        total = trf_recibir(socket, ruta, modo_recepcion, POLITICA_FSYNC);
+    if (total < 0)
+    {
+        remove(ruta);
+        return 0;
+    }
+    indexar_Escaneo(ruta, total, &captura);
+    printf(" Finalizada la recepcion de Imagen: %s\n", ruta);
+    double ms = milisegundos(&inicio);
+    printf("%ld bytes en %.1f ms (%.2f MB/s) - perfil %s\n", total, ms,
+           ms > 0 ? total / ms / 1e3 : 0.0, perfil_activo->nombre);
+    buf_estadisticas(&pool);
+    printf("Pool de buffers: %lu slabs, %lu MB (%s), %lu pedidos\n", pool.slabs,
+           pool.bytes >> 20, buf_implementacion(), pool.pedidos);
+    printf("=====================================\n\n");
+    return 1;
+}
+
+/**
+ * @brief Prueba de ancho de banda con el satelite, sin disco de por medio
+ *        (ver ancho.h): sirve para saber si un start_scanning lento se debe
+ *        al enlace o a lo que hay a cada lado. El goodput de cada sentido lo
+ *        mide su receptor; las retransmisiones, su emisor.
+ * 
+ * @param flujo 
+ * @param bajada bytes de la estacion al satelite
+ * @param subida bytes del satelite a la estacion
+ * @return int 1 si la prueba se completo
+ */
+int prueba_Ancho(int flujo, uint64_t bajada, uint64_t subida)
+{
+    struct anc_medida estacion, satelite;
+    char pedido[ANC_MENSAJE];
+
+    printf("=====================================\n\n");
+    printf("BANDWIDTH TEST: %.0f MB de bajada, %.0f MB de subida\n\n", (double)bajada / ANC_MB,
+           (double)subida / ANC_MB);
+    memset(pedido, '\0', sizeof(pedido));
+    snprintf(pedido, sizeof(pedido), "%llu %llu", (unsigned long long)bajada, (unsigned long long)subida);
+    if (send(flujo, pedido, sizeof(pedido), MSG_NOSIGNAL) != sizeof(pedido) ||
+        anc_mover(flujo, socket_sesion, bajada, subida, &estacion) < 0 ||
+        anc_recibir_medida(flujo, &satelite) < 0)
+    {
+        printf("Prueba interrumpida\n");
+        return 0;
+    }
+
+    printf("%-8s %9s %9s %10s %8s %9s\n", "", "MB", "s", "Mbit/s", "retrans", "rtt (ms)");
+    if (bajada > 0)
+        informar_Sentido("bajada", &estacion, &satelite);
+    if (subida > 0)
+        informar_Sentido("subida", &satelite, &estacion);
+    printf("\n%-8s %9s %9s %9s\n", "CPU", "usuario", "sistema", "uso");
+    printf("%-8s %8.2fs %8.2fs %8.0f%%\n", "estacion", estacion.usuario, estacion.sistema,
+           100 * (estacion.usuario + estacion.sistema) / estacion.total);
+    printf("%-8s %8.2fs %8.2fs %8.0f%%\n", "satelite", satelite.usuario, satelite.sistema,
+           100 * (satelite.usuario + satelite.sistema) / satelite.total);
+    printf("\n=====================================\n\n");
+    return 1;
+}
+
+/**
+ * @brief Linea del informe de un sentido de la prueba.
+ * 
+ * @param nombre 
+ * @param emisor medida del extremo que genero los datos
+ * @param receptor medida del extremo que los recibio
+ */
+void informar_Sentido(const char *nombre, const struct anc_medida *emisor, const struct anc_medida *receptor)
+{
+    double mb = (double)receptor->recibidos / ANC_MB;
+
+    printf("%-8s %9.1f %9.2f %10.1f %8u %9.3f\n", nombre, mb, receptor->segundos,
+           receptor->segundos > 0 ? receptor->recibidos * 8 / receptor->segundos / 1e6 : 0.0,
+           emisor->retransmisiones, emisor->rtt / 1e3);
+}
+
+/**
+ * @brief Reserva el nombre de un escaneo nuevo:
+ *        escaneos/sat<ID>/<fecha UTC de captura>-<n>.jpg. El archivo se crea
+ *        con O_EXCL, de modo que ni dos escaneos del mismo satelite en el
+ *        mismo milisegundo ni dos sesiones hijas pueden pisarse.
+ * 
+ * @param ruta 
+ * @param largo 
+ * @param captura recibe la hora de captura
+ * @return int 0, o -1 si no se pudo crear
+ */
+int ruta_Escaneo(char *ruta, size_t largo, struct timespec *captura)
+{
+    static int secuencia = 0;
+    char directorio[TAM], fecha[TAM];
+    struct tm tm;
+    int fd;
+
+    clock_gettime(CLOCK_REALTIME, captura);
+    gmtime_r(&captura->tv_sec, &tm);
+    strftime(fecha, sizeof(fecha), "%Y%m%dT%H%M%S", &tm);
+
+    snprintf(directorio, sizeof(directorio), DIRECTORIO_ESCANEOS "/sat%u", satelite_id);
+    if ((mkdir(DIRECTORIO_ESCANEOS, 0775) < 0 && errno != EEXIST) ||
+        (mkdir(directorio, 0775) < 0 && errno != EEXIST))
+    {
+        perror("archivo de escaneos");
+        return -1;
+    }
+    do
+    {
+        snprintf(ruta, largo, "%s/%s.%03ldZ-%d.jpg", directorio, fecha,
+                 captura->tv_nsec / 1000000, __sync_fetch_and_add(&secuencia, 1));
+        fd = open(ruta, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    } while (fd < 0 && errno == EEXIST);
+    if (fd < 0)
+    {
+        perror("archivo de escaneos");
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+/**
+ * @brief Agrega el escaneo al indice del archivo: una linea con la hora de
+ *        captura, el satelite, los bytes y la ruta. Se escribe en una sola
+ *        llamada con O_APPEND para que las sesiones de varios satelites no
+ *        mezclen sus lineas.
+ * 
+ * @param ruta 
+ * @param total 
+ * @param captura 
+ */
+void indexar_Escaneo(const char *ruta, long total, struct timespec *captura)
+{
+    char linea[2 * TAM2], fecha[TAM];
+    struct tm tm;
+    int fd, n;
+
+    gmtime_r(&captura->tv_sec, &tm);
+    strftime(fecha, sizeof(fecha), "%Y-%m-%dT%H:%M:%S", &tm);
+    n = snprintf(linea, sizeof(linea), "%s.%03ldZ %u %ld %s\n", fecha,
+                 captura->tv_nsec / 1000000, satelite_id, total, ruta);
+
+    if ((fd = open(INDICE_ESCANEOS, O_WRONLY | O_CREAT | O_APPEND, 0664)) < 0 ||
+        write(fd, linea, n) != n)
+    {
+        perror("indice de escaneos");
+    }
+    if (fd >= 0)
+        close(fd);
+}
+
+/**
+ * @brief Hilo que recibe un escaneo sobre su flujo y lo cierra al terminar.
+ * 
+ * @param arg struct escaneo
+ * @return void* 
+ */
+void *hilo_Scanning(void *arg)
+{
+    struct escaneo *escaneo = arg;
+    int flujo = escaneo->flujo;
+    start_Scanning(flujo, &escaneo->canal);
+    free(escaneo);
+
+    pthread_mutex_lock(&escaneos_mutex);
+    for (int i = 0; i < n_escaneos; i++)
+    {
+        if (escaneos[i] == flujo)
+        {
+            escaneos[i] = escaneos[--n_escaneos];
+            break;
+        }
+    }
+    close(flujo);
+    pthread_mutex_unlock(&escaneos_mutex);
+    return NULL;
+}
+
+/**
+ * @brief Corta los escaneos en curso. El multiplexor ve los flujos cerrados
+ *        y envia el aviso al satelite como trama de control, sin esperar
+ *        detras de la imagen que ya estaba en camino.
+ * 
+ * @return int cantidad de escaneos abortados
+ */
+int abortar_Escaneos(void)
+{
+    int n;
+
+    pthread_mutex_lock(&escaneos_mutex);
+    for (int i = 0; i < n_escaneos; i++)
+    {
+        shutdown(escaneos[i], SHUT_RDWR);
+    }
+    n = n_escaneos;
+    pthread_mutex_unlock(&escaneos_mutex);
+    return n;
 }
 
 /**
  * @brief Procedimiento que obtiene datos de estado del satelite.
  *        La comunicacion se realiza a traves de socket UDP, no orientado
  *        a la conexión. El puerto a emplear es el mismo que el puerto de
- *        la conexion TCP.
+ *        la conexion TCP; el socket lo mantiene abierto el proceso padre y
+ *        los datagramas de este satelite llegan por canal_telemetria.
+ *        Se piden solo los campos de la mascara. El satelite informa por el
+ *        flujo la secuencia del primer datagrama y cuantos envia; los que
+ *        no llegan se piden de nuevo cada TLM_NACK_ESPERA ms, y pasado
+ *        TLM_PLAZO la consulta termina con los campos que haya.
  * 
  * @param socketfd 
  * @param ip 
  * @param port 
- * @return int 
+ * @param mascara campos pedidos (bit 1 << campo)
+ * @return int 0 si llegaron todos los campos, -1 si no
  */
-int obtener_Telemetria(int socketfd, char *ip, char *port)
+int obtener_Telemetria(int socketfd, char *ip, char *port, uint32_t mascara)
 {
-    int n = write(socketfd, "obtener_telemetria", 18); //Envio el comando ingresado al cliente
+    char buffer[TAM2], carga[TLM_CARGA_MAX + 1];
+    struct tlm_cabecera cab;
+    struct tlm_ventana ventana;
+    struct pollfd fd;
+    struct timespec inicio;
+    uint32_t rango[2], recibidos = 0, llegados = 0;
+    int campos = 0, espera, r;
+
+    clock_gettime(CLOCK_MONOTONIC, &inicio);
+    for (int i = 0; i < TLM_CAMPOS; i++)
+        campos += (mascara >> i) & 1;
+
+    //Envio al cliente el numero de puerto UDP y los campos pedidos
+    memset(buffer, '\0', sizeof(buffer));
+    sprintf(buffer, "%d %x", atoi(port), mascara);
+
+    int n = write(socketfd, buffer, sizeof(buffer));
     if (n < 0)
-    { //para que sepa que funcion ejecutar
+    {
         perror("escritura en socket");
         exit(1);
     }
 
-    int sockfd_udp, puerto;
-    socklen_t tamano_direccion;
-    char buffer[TAM2];
-    struct sockaddr_in serv_addr;
+    printf("Usando socket: %s:%s\n", ip, port);
+
+    printf("=====================================\n\n");
+    printf("OBTENER TELEMETRIA\n\n");
 
-    sockfd_udp = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sockfd_udp < 0)
+    /* Los datagramas que se adelanten al rango esperan en el canal */
+    fd = (struct pollfd){socketfd, POLLIN, 0};
+    if (poll(&fd, 1, TLM_PLAZO) <= 0 || recv(socketfd, rango, sizeof(rango), MSG_WAITALL) != sizeof(rango))
     {
-        perror("ERROR en apertura de socket");
-        exit(1);
+        printf("El satelite no respondio la consulta\n");
+        return -1;
     }
+    tlm_ventana_iniciar(&ventana, ntohl(rango[0]));
+    tlm_ventana_fin(&ventana, ntohl(rango[0]) + ntohl(rango[1]));
 
-    memset(&serv_addr, 0, sizeof(serv_addr));
-    puerto = atoi(port);
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_addr.s_addr = inet_addr(ip);
-    serv_addr.sin_port = htons(puerto);
-    memset(&(serv_addr.sin_zero), '\0', 8);
-
-    if (bind(sockfd_udp, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
+    fd = (struct pollfd){canal_telemetria, POLLIN, 0};
+    while (!tlm_ventana_completa(&ventana) && (espera = TLM_PLAZO - (int)milisegundos(&inicio)) > 0)
     {
-        perror("ERROR en binding");
-        exit(1);
+        if ((r = poll(&fd, 1, espera < TLM_NACK_ESPERA ? espera : TLM_NACK_ESPERA)) <= 0)
+        {
+            /* Nada en TLM_NACK_ESPERA ms: se piden los que faltan */
+            if (r == 0 && tlm_ventana_pedir(&ventana, socketfd) < 0)
+                break;
+            continue;
+        }
+        if (tlm_canal_recibir(canal_telemetria, &cab, carga, sizeof(carga)) < 0)
+        {
+            perror("recepción de telemetria");
+            return -1;
+        }
+        /* Respuestas tardias de otra consulta, o de la telemetria continua */
+        if (cab.campo >= TLM_CAMPOS || !tlm_ventana_marcar(&ventana, cab.secuencia))
+            continue;
+        printf("[%d-%d] %s\n", cab.campo + 1, TLM_CAMPOS, carga);
+        llegados |= 1u << cab.campo;
+        recibidos++;
     }
-    //Envio al cliente el numero de puerto UDP
-    memset(buffer, '\0', sizeof(buffer));
-    sprintf(buffer, "%d", ntohs(serv_addr.sin_port));
+    for (int i = 0; i < TLM_CAMPOS; i++)
+        if ((mascara & (1u << i)) && !(llegados & (1u << i)))
+            printf("[%d-%d] sin respuesta\n", i + 1, TLM_CAMPOS);
+    printf("\nTelemetria %s en %.1f ms - %u de %d campos (%lu pedidos de nuevo, %lu recuperados) - perfil %s\n",
+           tlm_ventana_completa(&ventana) ? "completa" : "incompleta", milisegundos(&inicio), recibidos, campos,
+           ventana.pedidos, ventana.recuperados, perfil_activo->nombre);
+    printf("\n=====================================\n\n");
+    return tlm_ventana_completa(&ventana) ? 0 : -1;
+}
 
-    n = write(socketfd, buffer, sizeof(buffer));
-    if (n < 0)
+/**
+ * @brief Telemetria continua en formato compacto (ver compacta.h). El
+ *        satelite envia una trama por muestra; la estacion las decodifica
+ *        contra su historia y acusa cada TLM_ACUSE_CADA muestras y cada
+ *        clave, para que las delta se calculen contra algo que ya tiene. Al
+ *        final compara los bytes recibidos con los que habria ocupado la
+ *        consulta de texto de los mismos campos. Cada muestra se suma a la
+ *        vista agregada de la flota. Los huecos en la secuencia de los
+ *        datagramas se piden de nuevo por el flujo cada TLM_NACK_ESPERA ms;
+ *        al final el satelite informa cuantos envio y se esperan los que
+ *        falten hasta TLM_PLAZO.
+ * 
+ * @param socketfd 
+ * @param port puerto UDP
+ * @param muestras 
+ * @param periodo ms entre muestras
+ * @param mascara campos pedidos (bit 1 << campo)
+ * @return int 0, o -1 si no se pudo pedir o recibir la telemetria
+ */
+int transmitir_Telemetria(int socketfd, char *port, unsigned int muestras, unsigned int periodo, uint32_t mascara)
+{
+    struct tlm_historia historia;
+    struct tlm_muestra m, ultima;
+    struct tlm_cabecera cab;
+    struct tlm_ventana ventana;
+    struct pollfd fds[2];
+    struct timespec inicio, actividad, pedido, final;
+    char buffer[TAM2], texto[TAM2];
+    char carga[TLM_CARGA_MAX + 1]; /* un datagrama lleno y el '\0' */
+    unsigned long bytes = 0, claves = 0, sin_referencia = 0, invalidas = 0;
+    unsigned long texto_bytes = 0, texto_datagramas = 0, bytes_sat = 0, claves_sat = 0, datagramas = 0;
+    unsigned int decodificadas = 0, enviadas = 0, datagramas_sat = 0;
+    uint32_t acuse;
+    ssize_t n;
+    int tipo, r, fin = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &inicio);
+    actividad = pedido = inicio;
+    tlm_historia_iniciar(&historia);
+    tlm_ventana_iniciar(&ventana, 0);
+    memset(buffer, '\0', sizeof(buffer));
+    snprintf(buffer, sizeof(buffer), "%d %u %u %x", atoi(port), muestras, periodo, mascara);
+    if (write(socketfd, buffer, sizeof(buffer)) < 0)
     {
         perror("escritura en socket");
-        exit(1);
+        return -1;
+    }
+    printf("=====================================\n\n");
+    printf("TRANSMITIR TELEMETRIA: %u muestras cada %u ms\n\n", muestras, periodo);
+
+    fds[0].fd = canal_telemetria;
+    fds[0].events = POLLIN;
+    fds[1].fd = socketfd;
+    fds[1].events = POLLIN;
+    for (;;)
+    {
+        /* Terminada la transmision se esperan los datagramas que falten */
+        if (fin && (tlm_ventana_completa(&ventana) || milisegundos(&final) > TLM_PLAZO))
+            break;
+        if (!fin && milisegundos(&actividad) > periodo * 4.0 + 2000)
+            break;
+        if ((r = poll(fds, fin ? 1 : 2, TLM_NACK_ESPERA)) < 0 && errno != EINTR)
+            break;
+        if (milisegundos(&pedido) >= TLM_NACK_ESPERA)
+        {
+            tlm_ventana_pedir(&ventana, socketfd);
+            clock_gettime(CLOCK_MONOTONIC, &pedido);
+        }
+        if (r <= 0)
+            continue;
+        if (!fin && (fds[1].revents & (POLLIN | POLLHUP)))
+        {
+            memset(buffer, '\0', sizeof(buffer));
+            clock_gettime(CLOCK_MONOTONIC, &actividad);
+            if ((n = read(socketfd, buffer, sizeof(buffer) - 1)) <= 0 ||
+                sscanf(buffer, "%u %lu %lu %u", &enviadas, &bytes_sat, &claves_sat, &datagramas_sat) == 4)
+            {
+                fin = 1;
+                final = actividad;
+                tlm_ventana_fin(&ventana, datagramas_sat);
+            }
+        }
+        if (!(fds[0].revents & POLLIN))
+            continue;
+        if ((n = tlm_canal_recibir(canal_telemetria, &cab, carga, sizeof(carga))) < 0)
+        {
+            perror("recepción de telemetria");
+            return -1;
+        }
+        if (cab.campo != TLM_TRAMA)
+            continue; /* respuesta tardia de una consulta de texto */
+        clock_gettime(CLOCK_MONOTONIC, &actividad);
+        if (!tlm_ventana_marcar(&ventana, cab.secuencia))
+            continue; /* reenvio de uno que ya habia llegado */
+        bytes += TLM_CABECERA_LEN + n;
+        datagramas++;
+        /* Cada trama del datagrama va precedida por su largo */
+        for (ssize_t p = 0; p < n; p += 1 + (unsigned char)carga[p])
+        {
+            tipo = (unsigned char)carga[p] > n - p - 1
+                       ? -1
+                       : tlm_trama_decodificar((unsigned char *)carga + p + 1, (unsigned char)carga[p], &historia, &m);
+            if (tipo == TLM_SIN_REFERENCIA)
+            {
+                sin_referencia++;
+                continue;
+            }
+            if (tipo < 0)
+            {
+                invalidas++;
+                break;
+            }
+            /* Una muestra recuperada no pisa a una mas nueva en la historia */
+            if (decodificadas == 0 || m.numero + TLM_HISTORIA > ultima.numero)
+                tlm_historia_guardar(&historia, &m);
+            agr_muestra(grupo_sesion, &m);
+            claves += tipo == TLM_CLAVE;
+            if (decodificadas++ == 0 || m.numero > ultima.numero)
+                ultima = m;
+            for (int i = 0; i < TLM_CAMPOS; i++)
+            {
+                if ((mascara & (1u << i)) && tlm_muestra_texto(&m, i, texto, sizeof(texto)) > 0)
+                {
+                    texto_bytes += TLM_CABECERA_LEN + strlen(texto);
+                    texto_datagramas++;
+                }
+            }
+            if (tipo == TLM_CLAVE || m.numero % TLM_ACUSE_CADA == 0)
+            {
+                acuse = htonl(m.numero);
+                send(socketfd, &acuse, sizeof(acuse), MSG_NOSIGNAL);
+            }
+        }
     }
 
-    printf("Usando socket: %s:%d\n", ip, ntohs(serv_addr.sin_port));
+    if (decodificadas > 0)
+    {
+        printf("Ultima muestra (%u):\n", ultima.numero);
+        for (int i = 0; i < TLM_CAMPOS; i++)
+            if ((mascara & (1u << i)) && tlm_muestra_texto(&ultima, i, texto, sizeof(texto)) > 0)
+                printf("[%d-%d] %s\n", i + 1, TLM_CAMPOS, texto);
+    }
+    printf("\n%u de %u muestras en %.1f ms: %lu claves, %lu delta sin referencia, %lu invalidas\n",
+           decodificadas, enviadas, milisegundos(&inicio), claves, sin_referencia, invalidas);
+    printf("Reparacion: %lu datagramas pedidos de nuevo, %lu recuperados, %lu perdidos\n", ventana.pedidos,
+           ventana.recuperados, tlm_ventana_faltan(&ventana));
+    if (decodificadas > 0)
+    {
+        printf("Compacta: %lu bytes en %lu datagramas (%.1f por muestra) - texto: %lu bytes en %lu datagramas\n",
+               bytes, datagramas, (double)bytes / decodificadas, texto_bytes, texto_datagramas);
+        printf("Reduccion: %.1fx, %.1fx contando cabeceras IPv4/UDP\n", (double)texto_bytes / bytes,
+               (double)(texto_bytes + texto_datagramas * IP_UDP_CABECERAS) / (bytes + datagramas * IP_UDP_CABECERAS));
+    }
+    printf("\n=====================================\n\n");
+    return 0;
+}
 
-    tamano_direccion = sizeof(struct sockaddr);
+/**
+ * @brief Muestra la vista agregada de un grupo o de toda la flota, con lo
+ *        que tardo cada consulta.
+ * 
+ * @param grupo indice, o AGR_FLOTA
+ */
+void mostrar_Agregado(int grupo)
+{
+    struct agr_resumen r;
+    struct timespec inicio;
+    double ms;
 
-    printf("=====================================\n\n");
-    printf("OBTENER TELEMETRIA\n\n");
-    for (int i = 0; i < 7; i++)
+    printf("\n%s\n", grupo == AGR_FLOTA ? "Toda la flota" : agr_grupo_nombre(grupo));
+    printf("%-20s %10s %12s %12s %12s %12s %12s %8s\n", "metrica", "muestras", "min", "max", "media", "p50", "p99", "ms");
+    for (int i = 0; i < TLM_MAGNITUDES; i++)
+    {
+        if (!(AGR_METRICAS & (1u << i)))
+            continue;
+        clock_gettime(CLOCK_MONOTONIC, &inicio);
+        if (agr_consultar(grupo, i, &r) < 0)
+            continue;
+        ms = milisegundos(&inicio);
+        printf("%-20s %10llu %12.2f %12.2f %12.2f %12.2f %12.2f %8.3f\n", agr_metrica_nombre(i),
+               (unsigned long long)r.n, r.min, r.max, r.media, r.p50, r.p99, ms);
+    }
+}
+
+/**
+ * @brief Nanosegundos del reloj monotonico.
+ * 
+ * @return uint64_t 
+ */
+static uint64_t ahora_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ULL + (uint64_t)t.tv_nsec;
+}
+
+static int comparar_ms(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Muestra el RTT de un camino: minimo, media, p50, p99, maximo y
+ *        jitter (media de la diferencia entre tramas consecutivas que
+ *        volvieron).
+ * 
+ * @param c 
+ * @param cantidad tramas enviadas
+ */
+static void informar_Camino(struct ping_camino *c, unsigned int cantidad)
+{
+    double *orden, suma = 0, variacion = 0, anterior = -1;
+    unsigned int n = 0, pares = 0;
+
+    if (c->recibidas == 0 || (orden = malloc(c->recibidas * sizeof(double))) == NULL)
+    {
+        printf("%-18s %5u/%-5u sin ecos\n", c->nombre, c->recibidas, cantidad);
+        return;
+    }
+    for (unsigned int i = 0; i < cantidad; i++)
     {
-        n = recvfrom(sockfd_udp, (void *)buffer, TAM, 0, (struct sockaddr *)&serv_addr, &tamano_direccion);
-        if (n < 0)
+        if (c->rtt[i] < 0)
+            continue;
+        orden[n++] = c->rtt[i];
+        suma += c->rtt[i];
+        if (anterior >= 0)
         {
-            perror("recepción");
-            exit(1);
+            variacion += c->rtt[i] > anterior ? c->rtt[i] - anterior : anterior - c->rtt[i];
+            pares++;
         }
-        printf("[%d-7] %s\n", i + 1, buffer);
-        memset(buffer, '\0', sizeof(buffer));
+        anterior = c->rtt[i];
     }
-    printf("\n=====================================\n\n");
-    close(sockfd_udp);
+    qsort(orden, n, sizeof(double), comparar_ms);
+    printf("%-18s %5u/%-5u %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f\n", c->nombre, n, cantidad, orden[0], suma / n,
+           orden[(n - 1) / 2], orden[n - 1 - n / 100], orden[n - 1], pares > 0 ? variacion / pares : 0.0);
+    free(orden);
+}
+
+/**
+ * @brief Mide el RTT con el satelite por dos caminos a la vez: el flujo de
+ *        la orden, que va por la conexion multiplexada en la clase de
+ *        control como los comandos, y UDP directo contra un eco que abre el
+ *        satelite. En cada intervalo sale una trama por cada camino, con
+ *        la hora de envio; el satelite las devuelve tal cual.
+ * 
+ * @param flujo 
+ * @param cantidad tramas por camino
+ * @param intervalo ms entre tramas
+ * @return int 0, o -1 si no se pudo empezar
+ */
+int ping_Satelite(int flujo, unsigned int cantidad, unsigned int intervalo)
+{
+    struct ping_camino caminos[2] = {{"flujo de control", flujo, NULL, 0}, {"UDP", -1, NULL, 0}};
+    struct sockaddr_storage satelite;
+    socklen_t largo = sizeof(satelite);
+    struct ping_trama trama;
+    struct pollfd fds[2];
+    char buffer[TAM];
+    uint64_t proxima, limite, t;
+    unsigned int enviadas = 0, puerto = 0;
+    int espera;
+
     memset(buffer, '\0', sizeof(buffer));
+    if (recv(flujo, buffer, sizeof(buffer), MSG_WAITALL) != sizeof(buffer) || sscanf(buffer, "%u", &puerto) != 1)
+    {
+        printf("El satelite no atiende ping\n");
+        return -1;
+    }
+    if (puerto != 0 && getpeername(socket_sesion, (struct sockaddr *)&satelite, &largo) == 0 &&
+        (caminos[1].fd = socket(satelite.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0)) >= 0)
+    {
+        if (satelite.ss_family == AF_INET6)
+            ((struct sockaddr_in6 *)&satelite)->sin6_port = htons(puerto);
+        else
+            ((struct sockaddr_in *)&satelite)->sin_port = htons(puerto);
+        if (connect(caminos[1].fd, (struct sockaddr *)&satelite, largo) < 0)
+        {
+            perror("ping UDP");
+            close(caminos[1].fd);
+            caminos[1].fd = -1;
+        }
+    }
+    for (int c = 0; c < 2; c++)
+    {
+        if ((caminos[c].rtt = malloc(cantidad * sizeof(double))) == NULL)
+        {
+            perror("malloc");
+            exit(1);
+        }
+        for (unsigned int i = 0; i < cantidad; i++)
+            caminos[c].rtt[i] = -1;
+        fds[c].fd = caminos[c].fd;
+        fds[c].events = POLLIN;
+    }
+
+    printf("PING: %u tramas cada %u ms por el flujo de control%s\n", cantidad, intervalo,
+           caminos[1].fd >= 0 ? " y por UDP" : "");
+    proxima = ahora_ns();
+    limite = 0;
+    for (;;)
+    {
+        t = ahora_ns();
+        if (enviadas < cantidad && t >= proxima)
+        {
+            for (int c = 0; c < 2; c++)
+            {
+                if (caminos[c].fd < 0)
+                    continue;
+                trama.numero = enviadas;
+                trama.camino = c;
+                trama.enviada = ahora_ns();
+                if (send(caminos[c].fd, &trama, sizeof(trama), MSG_NOSIGNAL) < 0 && c == 0)
+                    cantidad = enviadas; /* el satelite cerro el flujo */
+            }
+            enviadas++;
+            proxima += (uint64_t)intervalo * 1000000;
+            if (enviadas == cantidad)
+                limite = t + (uint64_t)PING_ESPERA * 1000000;
+        }
+        if (enviadas == cantidad &&
+            (t >= limite || (caminos[0].recibidas == cantidad && (caminos[1].fd < 0 || caminos[1].recibidas == cantidad))))
+            break;
+        t = ahora_ns();
+        espera = enviadas < cantidad ? (proxima > t ? (int)((proxima - t) / 1000000) : 0)
+                                     : (limite > t ? (int)((limite - t) / 1000000) + 1 : 0);
+        if (poll(fds, 2, espera) <= 0)
+            continue;
+        for (int c = 0; c < 2; c++)
+        {
+            if (caminos[c].fd < 0 || !(fds[c].revents & (POLLIN | POLLHUP)))
+                continue;
+            if (recv(caminos[c].fd, &trama, sizeof(trama), c == 0 ? MSG_WAITALL : 0) != sizeof(trama))
+            {
+                if (c == 0)
+                    limite = 0, cantidad = enviadas; /* flujo cerrado */
+                continue;
+            }
+            if (trama.numero < enviadas && trama.camino == (uint32_t)c && caminos[c].rtt[trama.numero] < 0)
+            {
+                caminos[c].rtt[trama.numero] = (ahora_ns() - trama.enviada) / 1e6;
+                caminos[c].recibidas++;
+            }
+        }
+    }
+
+    printf("\n%-18s %11s %9s %9s %9s %9s %9s %9s\n", "RTT (ms)", "ecos", "min", "media", "p50", "p99", "max", "jitter");
+    for (int c = 0; c < 2; c++)
+    {
+        if (caminos[c].fd >= 0 || c == 0)
+            informar_Camino(&caminos[c], enviadas);
+        free(caminos[c].rtt);
+    }
+    if (caminos[1].fd >= 0)
+        close(caminos[1].fd);
+    printf("\n");
     return 0;
 }
@@ -0,0 +1,981 @@
+/**
+ * @file telemetria.c
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Receptor de telemetria de la estacion terrestre. El proceso padre
+ *        (el que acepta conexiones) mantiene un unico socket UDP durante toda
+ *        su vida y un hilo despachador que lo drena con recvmmsg en lotes.
+ *        Cada datagrama se entrega a la sesion (proceso hijo) del satelite
+ *        indicado en su cabecera a traves de un canal SOCK_SEQPACKET, que
+ *        conserva los limites de cada datagrama.
+ *        Del lado del satelite, el emisor agrupa los registros y los envia
+ *        por lotes para que el costo no sea una llamada al sistema por dato,
+ *        y retiene los ultimos para reenviar los que la estacion pida.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+
+#include "telemetria.h"
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103 /* linux/udp.h, kernels >= 4.18 */
+#endif
+
+/* Entrada de la tabla de despacho: satelite -> canal hacia su sesion */
+struct tlm_destino
+{
+    uint32_t satelite;
+    int fd;
+};
+
+static int socks_tlm[DIR_MAX_ESCUCHAS];  /* uno por direccion de escucha */
+static int n_socks_tlm = 0;
+static struct tlm_destino tabla[TLM_MAX_SATELITES];
+static pthread_mutex_t tabla_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long recibidos = 0;
+static unsigned long descartados = 0;
+
+/* Ultimo valor de cada campo en el satelite, para los colectores con
+   vigencia */
+struct tlm_valor
+{
+    char texto[TLM_CARGA_MAX];
+    struct timespec tomado;
+    int valido;
+};
+
+static struct tlm_valor valores[TLM_CAMPOS];
+static pthread_mutex_t valores_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void *tlm_despachador(void *);
+
+/* Nombres de los campos en la consola de la estacion */
+static const char *const tlm_nombres[TLM_CAMPOS] = {
+    [TLM_CAMPO_ID] = "id",
+    [TLM_CAMPO_FIRMWARE] = "firmware",
+    [TLM_CAMPO_UPTIME] = "uptime",
+    [TLM_CAMPO_ARRANQUE] = "arranque",
+    [TLM_CAMPO_HOSTNAME] = "hostname",
+    [TLM_CAMPO_MEMORIA] = "memoria",
+    [TLM_CAMPO_CPU] = "cpu",
+};
+
+/**
+ * @brief Nombre de un campo de telemetria.
+ *
+ * @param campo
+ * @return const char* "?" si no existe
+ */
+const char *tlm_campo_nombre(unsigned int campo)
+{
+    return campo < TLM_CAMPOS ? tlm_nombres[campo] : "?";
+}
+
+/**
+ * @brief Lee una seleccion de campos: nombres separados por comas
+ *        ("memoria,cpu"), una mascara numerica ("0x60") o "todos". Sin
+ *        texto se piden todos.
+ *
+ * @param texto
+ * @param mascara recibe la mascara de campos
+ * @return int 0, o -1 si algun nombre no existe o la mascara queda vacia
+ */
+int tlm_campos_leer(const char *texto, uint32_t *mascara)
+{
+    char copia[TLM_CARGA_MAX], *nombre, *resto, *fin;
+    unsigned long numero;
+    unsigned int i;
+
+    while (*texto == ' ' || *texto == '\t')
+        texto++;
+    snprintf(copia, sizeof(copia), "%s", texto);
+    copia[strcspn(copia, " \t\r\n")] = '\0';
+    if (copia[0] == '\0' || !strcmp(copia, "todos"))
+    {
+        *mascara = TLM_TODOS;
+        return 0;
+    }
+    numero = strtoul(copia, &fin, 0);
+    if (*fin == '\0')
+    {
+        *mascara = (uint32_t)numero & TLM_TODOS;
+        return *mascara != 0 ? 0 : -1;
+    }
+    *mascara = 0;
+    for (nombre = strtok_r(copia, ",", &resto); nombre != NULL; nombre = strtok_r(NULL, ",", &resto))
+    {
+        for (i = 0; i < TLM_CAMPOS && strcmp(nombre, tlm_nombres[i]); i++)
+            ;
+        if (i == TLM_CAMPOS)
+            return -1;
+        *mascara |= 1u << i;
+    }
+    return *mascara != 0 ? 0 : -1;
+}
+
+/**
+ * @brief Serializa la cabecera en orden de red.
+ *
+ * @param dst al menos TLM_CABECERA_LEN bytes
+ * @param cab
+ */
+void tlm_cabecera_escribir(void *dst, const struct tlm_cabecera *cab)
+{
+    unsigned char *p = dst;
+    uint32_t u32;
+    uint16_t u16;
+
+    u32 = htonl(cab->magia);
+    memcpy(p, &u32, 4);
+    u32 = htonl(cab->satelite);
+    memcpy(p + 4, &u32, 4);
+    u32 = htonl(cab->secuencia);
+    memcpy(p + 8, &u32, 4);
+    u16 = htons(cab->campo);
+    memcpy(p + 12, &u16, 2);
+    u16 = htons(cab->longitud);
+    memcpy(p + 14, &u16, 2);
+}
+
+/**
+ * @brief Interpreta la cabecera de un datagrama recibido.
+ *
+ * @param src datagrama
+ * @param len bytes recibidos
+ * @param cab
+ * @return int 0 si el datagrama es valido, -1 en caso contrario
+ */
+int tlm_cabecera_leer(const void *src, size_t len, struct tlm_cabecera *cab)
+{
+    const unsigned char *p = src;
+    uint32_t u32;
+    uint16_t u16;
+
+    if (len < TLM_CABECERA_LEN)
+        return -1;
+
+    memcpy(&u32, p, 4);
+    cab->magia = ntohl(u32);
+    memcpy(&u32, p + 4, 4);
+    cab->satelite = ntohl(u32);
+    memcpy(&u32, p + 8, 4);
+    cab->secuencia = ntohl(u32);
+    memcpy(&u16, p + 12, 2);
+    cab->campo = ntohs(u16);
+    memcpy(&u16, p + 14, 2);
+    cab->longitud = ntohs(u16);
+
+    if (cab->magia != TLM_MAGIA || cab->longitud > len - TLM_CABECERA_LEN)
+        return -1;
+    return 0;
+}
+
+/**
+ * @brief Toma la tabla antes de fork(), para que el hijo no vea un
+ *        descriptor ya cerrado que el padre acaba de reusar.
+ */
+static void tlm_fork_tomar(void)
+{
+    pthread_mutex_lock(&tabla_mutex);
+}
+
+/**
+ * @brief Suelta la tabla despues de fork(), en el padre y en el hijo.
+ */
+static void tlm_fork_soltar(void)
+{
+    pthread_mutex_unlock(&tabla_mutex);
+}
+
+/**
+ * @brief Crea un socket UDP persistente de la estacion en una de sus
+ *        direcciones de escucha y lanza el hilo que lo drena. Se llama una
+ *        vez por direccion, antes de aceptar satelites; todos los hilos
+ *        despachan a la misma tabla.
+ *
+ * @param d direccion local, con el mismo puerto que el socket TCP
+ * @return int 0 si el receptor quedo activo, -1 en caso de error
+ */
+int tlm_receptor_iniciar(const struct dir_escucha *d)
+{
+    int rcvbuf = TLM_RCVBUF;
+    pthread_t hilo;
+    int sock;
+
+    if (n_socks_tlm == 0)
+    {
+        for (int i = 0; i < TLM_MAX_SATELITES; i++)
+            tabla[i].fd = -1;
+        /* Las sesiones nacen con fork() mientras el despachador y otros
+           hilos de escucha cambian la tabla: el hijo la hereda entre dos
+           cambios, nunca a mitad de uno */
+        pthread_atfork(tlm_fork_tomar, tlm_fork_soltar, tlm_fork_soltar);
+    }
+    if (n_socks_tlm == DIR_MAX_ESCUCHAS)
+        return -1;
+
+    if ((sock = dir_abrir(d, SOCK_DGRAM)) < 0)
+        return -1;
+    /* Sin privilegios el kernel lo recorta a rmem_max, no es un error */
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    if (pthread_create(&hilo, NULL, tlm_despachador, (void *)(long)sock) != 0)
+    {
+        perror("hilo de telemetria");
+        close(sock);
+        return -1;
+    }
+    pthread_detach(hilo);
+    socks_tlm[n_socks_tlm++] = sock;
+    return 0;
+}
+
+/**
+ * @brief Crea el canal por el que el despachador entrega los datagramas a
+ *        una sesion. canal[0] queda en el padre, canal[1] en el hijo.
+ *
+ * @param canal
+ * @return int 0 o -1 si no pudo crearse
+ */
+int tlm_canal_crear(int canal[2])
+{
+    int sndbuf = TLM_RCVBUF / 8;
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, canal) < 0)
+        return -1;
+    /* Margen para rafagas mientras la sesion no esta leyendo */
+    setsockopt(canal[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    return 0;
+}
+
+/**
+ * @brief Busca la posicion de un satelite en la tabla (direccionamiento
+ *        abierto). Debe llamarse con tabla_mutex tomado.
+ *
+ * @param satelite
+ * @param libre si no es NULL, devuelve la primera posicion libre del recorrido
+ * @return int posicion o -1 si no esta registrado
+ */
+static int tlm_buscar(uint32_t satelite, int *libre)
+{
+    unsigned int h = (satelite * 2654435761u) % TLM_MAX_SATELITES;
+
+    if (libre != NULL)
+        *libre = -1;
+    for (int i = 0; i < TLM_MAX_SATELITES; i++)
+    {
+        unsigned int p = (h + i) % TLM_MAX_SATELITES;
+        if (tabla[p].fd < 0)
+        {
+            if (libre != NULL && *libre < 0)
+                *libre = p;
+            if (tabla[p].satelite == 0)
+                return -1; /* nunca usada: fin del recorrido */
+            continue;
+        }
+        if (tabla[p].satelite == satelite)
+            return p;
+    }
+    return -1;
+}
+
+/**
+ * @brief Asocia un satelite con el extremo del padre de su canal. Si el
+ *        satelite ya estaba registrado (reconexion) se reemplaza el canal.
+ *
+ * @param satelite ID informado por el satelite al conectarse
+ * @param fd canal[0] devuelto por tlm_canal_crear
+ * @return int 0 si se registro, -1 si la tabla esta llena
+ */
+int tlm_receptor_registrar(uint32_t satelite, int fd)
+{
+    int p, libre;
+
+    pthread_mutex_lock(&tabla_mutex);
+    if ((p = tlm_buscar(satelite, &libre)) >= 0)
+    {
+        close(tabla[p].fd);
+        tabla[p].fd = fd;
+    }
+    else if (libre >= 0)
+    {
+        tabla[libre].satelite = satelite;
+        tabla[libre].fd = fd;
+    }
+    pthread_mutex_unlock(&tabla_mutex);
+    return (p >= 0 || libre >= 0) ? 0 : -1;
+}
+
+/**
+ * @brief Da de baja un satelite cuya sesion termino. Debe llamarse con
+ *        tabla_mutex tomado. La posicion conserva el ID para no cortar los
+ *        recorridos de otros satelites.
+ *
+ * @param p posicion en la tabla
+ */
+static void tlm_baja(int p)
+{
+    close(tabla[p].fd);
+    tabla[p].fd = -1;
+}
+
+/**
+ * @brief Libera en un proceso hijo los recursos heredados del receptor, que
+ *        solo usa el padre. No toma el mutex: tras fork() el hilo despachador
+ *        no existe en el hijo, y la tabla que hereda esta completa porque el
+ *        fork se hizo con tabla_mutex tomado (ver tlm_fork_tomar).
+ */
+void tlm_receptor_hijo(void)
+{
+    for (int i = 0; i < n_socks_tlm; i++)
+        close(socks_tlm[i]);
+    n_socks_tlm = 0;
+    for (int i = 0; i < TLM_MAX_SATELITES; i++)
+    {
+        if (tabla[i].fd >= 0)
+            close(tabla[i].fd);
+        tabla[i].fd = -1;
+    }
+}
+
+/**
+ * @brief Hilo del padre que drena un socket de telemetria. Cada lote de
+ *        recvmmsg se agrupa por satelite y se reenvia con un sendmmsg por
+ *        canal, asi el costo en llamadas al sistema es por lote y no por
+ *        datagrama. Hay un hilo por direccion de escucha.
+ *
+ * @param arg socket UDP
+ * @return void*
+ */
+void *tlm_despachador(void *arg)
+{
+    int sock = (int)(long)arg;
+    char datos[TLM_LOTE][TLM_DATAGRAMA_MAX];
+    struct mmsghdr msgs[TLM_LOTE], salida[TLM_LOTE];
+    struct iovec iov[TLM_LOTE];
+    struct tlm_cabecera cab[TLM_LOTE];
+    int destino[TLM_LOTE];
+    char enviado[TLM_LOTE];
+    int n;
+
+    for (int i = 0; i < TLM_LOTE; i++)
+    {
+        iov[i].iov_base = datos[i];
+        iov[i].iov_len = TLM_DATAGRAMA_MAX;
+    }
+
+    while (1)
+    {
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < TLM_LOTE; i++)
+        {
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        /* Bloquea hasta el primer datagrama y se lleva lo que ya este en cola */
+        n = recvmmsg(sock, msgs, TLM_LOTE, MSG_WAITFORONE, NULL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("recvmmsg");
+            return NULL;
+        }
+
+        pthread_mutex_lock(&tabla_mutex);
+        recibidos += n;
+        for (int i = 0; i < n; i++)
+        {
+            enviado[i] = 0;
+            destino[i] = -1;
+            if (tlm_cabecera_leer(datos[i], msgs[i].msg_len, &cab[i]) == 0)
+                destino[i] = tlm_buscar(cab[i].satelite, NULL);
+            if (destino[i] < 0)
+            {
+                descartados++;
+                enviado[i] = 1;
+            }
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            int m = 0, p = destino[i], r;
+            if (enviado[i])
+                continue;
+
+            /* Junta todos los datagramas del lote que van al mismo canal */
+            memset(salida, 0, sizeof(salida));
+            for (int j = i; j < n; j++)
+            {
+                if (enviado[j] || destino[j] != p)
+                    continue;
+                iov[j].iov_len = msgs[j].msg_len;
+                salida[m].msg_hdr.msg_iov = &iov[j];
+                salida[m].msg_hdr.msg_iovlen = 1;
+                enviado[j] = 1;
+                m++;
+            }
+
+            r = sendmmsg(tabla[p].fd, salida, m, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (r < 0 && (errno == EPIPE || errno == ECONNREFUSED || errno == ECONNRESET))
+                tlm_baja(p); /* la sesion termino */
+            else if (r < m)
+                descartados += m - (r < 0 ? 0 : r); /* sesion saturada */
+        }
+        pthread_mutex_unlock(&tabla_mutex);
+
+        for (int i = 0; i < TLM_LOTE; i++)
+            iov[i].iov_len = TLM_DATAGRAMA_MAX;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Contadores del despachador desde que se inicio el receptor.
+ *
+ * @param rx datagramas leidos del socket
+ * @param desc datagramas descartados (invalidos, de satelites sin sesion o
+ *             con la sesion saturada)
+ */
+void tlm_receptor_estadisticas(unsigned long *rx, unsigned long *desc)
+{
+    pthread_mutex_lock(&tabla_mutex);
+    *rx = recibidos;
+    *desc = descartados;
+    pthread_mutex_unlock(&tabla_mutex);
+}
+
+/**
+ * @brief Recibe en la sesion el siguiente datagrama entregado por el
+ *        despachador.
+ *
+ * @param canal canal[1] devuelto por tlm_canal_crear
+ * @param cab cabecera del datagrama
+ * @param carga destino de la carga util, se termina en '\0'
+ * @param max tamano de carga; TLM_CARGA_MAX + 1 guarda un datagrama lleno
+ * @return ssize_t bytes de carga util, -1 en caso de error
+ */
+ssize_t tlm_canal_recibir(int canal, struct tlm_cabecera *cab, char *carga, size_t max)
+{
+    char datagrama[TLM_DATAGRAMA_MAX];
+    ssize_t n;
+    size_t len;
+
+    do
+    {
+        n = recv(canal, datagrama, sizeof(datagrama), 0);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0)
+        return -1;
+
+    if (tlm_cabecera_leer(datagrama, (size_t)n, cab) < 0)
+        return -1;
+
+    len = cab->longitud < max - 1 ? cab->longitud : max - 1;
+    memcpy(carga, datagrama + TLM_CABECERA_LEN, len);
+    carga[len] = '\0';
+    return (ssize_t)len;
+}
+
+#define TLM_BIT(v, s) ((v)->recibido[((s) % TLM_RETENCION) / 64] & (1ULL << ((s) % 64)))
+
+/**
+ * @brief Empieza a seguir las secuencias de una consulta o transmision.
+ *
+ * @param v
+ * @param desde primera secuencia esperada
+ */
+void tlm_ventana_iniciar(struct tlm_ventana *v, uint32_t desde)
+{
+    memset(v, 0, sizeof(*v));
+    v->base = v->hasta = desde;
+}
+
+/**
+ * @brief Saca de la ventana la secuencia base, recibida o no; siempre
+ *        es menor que hasta.
+ *
+ * @param v
+ */
+static void tlm_ventana_avanzar(struct tlm_ventana *v)
+{
+    uint32_t s = v->base++;
+
+    if (!TLM_BIT(v, s))
+        v->perdidos++;
+    v->recibido[(s % TLM_RETENCION) / 64] &= ~(1ULL << (s % 64));
+    v->intentos[s % TLM_RETENCION] = 0;
+}
+
+/**
+ * @brief Informa hasta que secuencia envio el emisor: los datagramas del
+ *        final que se perdieron pasan a ser huecos.
+ *
+ * @param v
+ * @param hasta una mas que la ultima secuencia enviada
+ */
+void tlm_ventana_fin(struct tlm_ventana *v, uint32_t hasta)
+{
+    if ((int32_t)(hasta - v->hasta) > 0)
+        v->hasta = hasta;
+    while ((int32_t)(v->hasta - v->base) > TLM_RETENCION)
+        tlm_ventana_avanzar(v);
+}
+
+/**
+ * @brief Registra una secuencia recibida.
+ *
+ * @param v
+ * @param secuencia
+ * @return int 1 si es nueva, 0 si es repetida o ya se dio por perdida
+ */
+int tlm_ventana_marcar(struct tlm_ventana *v, uint32_t secuencia)
+{
+    if ((int32_t)(secuencia - v->base) < 0)
+        return 0;
+    if ((int32_t)(secuencia - v->hasta) >= 0)
+        v->hasta = secuencia + 1;
+    while ((int32_t)(secuencia - v->base) >= TLM_RETENCION)
+        tlm_ventana_avanzar(v);
+    if (TLM_BIT(v, secuencia))
+        return 0;
+    v->recibido[(secuencia % TLM_RETENCION) / 64] |= 1ULL << (secuencia % 64);
+    if (v->intentos[secuencia % TLM_RETENCION] > 0)
+        v->recuperados++;
+    while (v->base != v->hasta && TLM_BIT(v, v->base))
+        tlm_ventana_avanzar(v);
+    return 1;
+}
+
+/**
+ * @brief Pide por el flujo de la orden los huecos de la ventana que no
+ *        agotaron sus intentos, cada uno como TLM_NACK y su secuencia.
+ *
+ * @param v
+ * @param flujo
+ * @return int secuencias pedidas, o -1 si fallo el flujo
+ */
+int tlm_ventana_pedir(struct tlm_ventana *v, int flujo)
+{
+    uint32_t pedido[2 * TLM_RETENCION];
+    int n = 0;
+
+    for (uint32_t s = v->base; s != v->hasta; s++)
+    {
+        if (TLM_BIT(v, s) || v->intentos[s % TLM_RETENCION] >= TLM_NACK_INTENTOS)
+            continue;
+        v->intentos[s % TLM_RETENCION]++;
+        pedido[2 * n] = htonl(TLM_NACK);
+        pedido[2 * n + 1] = htonl(s);
+        n++;
+    }
+    if (n == 0)
+        return 0;
+    v->pedidos += (unsigned long)n;
+    return send(flujo, pedido, (size_t)n * 2 * sizeof(uint32_t), MSG_NOSIGNAL) < 0 ? -1 : n;
+}
+
+/**
+ * @brief Indica si llego todo lo conocido.
+ *
+ * @param v
+ * @return int
+ */
+int tlm_ventana_completa(const struct tlm_ventana *v)
+{
+    return v->base == v->hasta;
+}
+
+/**
+ * @brief Datagramas que no llegaron: los que quedaron fuera de la ventana y
+ *        los huecos que siguen en ella.
+ *
+ * @param v
+ * @return unsigned long
+ */
+unsigned long tlm_ventana_faltan(const struct tlm_ventana *v)
+{
+    unsigned long n = v->perdidos;
+
+    for (uint32_t s = v->base; s != v->hasta; s++)
+        n += !TLM_BIT(v, s);
+    return n;
+}
+
+/**
+ * @brief Escribe en buffer el valor del campo del colector: el guardado si
+ *        sigue vigente, o uno nuevo que se guarda. El colector corre sin el
+ *        candado tomado, asi uno lento no frena a los demas campos.
+ *
+ * @param c
+ * @param buffer al menos TLM_CARGA_MAX bytes, en cero
+ * @return int 1 si el valor salio de la cache, 0 si se muestreo
+ */
+int tlm_muestrear(const struct tlm_colector *c, char *buffer)
+{
+    struct tlm_valor *v = &valores[c->campo];
+    struct timespec ahora;
+    long ms;
+
+    clock_gettime(CLOCK_MONOTONIC, &ahora);
+    if (c->vigencia != TLM_SIN_CACHE)
+    {
+        pthread_mutex_lock(&valores_mutex);
+        ms = (ahora.tv_sec - v->tomado.tv_sec) * 1000 + (ahora.tv_nsec - v->tomado.tv_nsec) / 1000000;
+        if (v->valido && (c->vigencia == TLM_SIEMPRE || ms < c->vigencia))
+        {
+            memcpy(buffer, v->texto, TLM_CARGA_MAX);
+            pthread_mutex_unlock(&valores_mutex);
+            return 1;
+        }
+        pthread_mutex_unlock(&valores_mutex);
+    }
+
+    c->muestrear(buffer);
+    if (c->vigencia != TLM_SIN_CACHE)
+    {
+        pthread_mutex_lock(&valores_mutex);
+        memcpy(v->texto, buffer, TLM_CARGA_MAX);
+        v->tomado = ahora;
+        v->valido = 1;
+        pthread_mutex_unlock(&valores_mutex);
+    }
+    return 0;
+}
+
+/**
+ * @brief Descarta los valores guardados de los campos de la mascara; la
+ *        proxima consulta los vuelve a muestrear.
+ *
+ * @param mascara
+ */
+void tlm_invalidar(uint32_t mascara)
+{
+    pthread_mutex_lock(&valores_mutex);
+    for (int i = 0; i < TLM_CAMPOS; i++)
+        if (mascara & (1u << i))
+            valores[i].valido = 0;
+    pthread_mutex_unlock(&valores_mutex);
+}
+
+/**
+ * @brief Prepara el emisor de telemetria del satelite.
+ *
+ * @param em
+ * @param host direccion de la estacion terrestre, IPv4 o IPv6 sin corchetes
+ * @param puerto puerto UDP informado por la estacion
+ * @param max_registros umbral de cantidad (1..TLM_EMISOR_MAX)
+ * @param max_latencia umbral de espera en microsegundos
+ * @return int 0 o -1 en caso de error
+ */
+int tlm_emisor_iniciar(struct tlm_emisor *em, const char *host, int puerto,
+                       int max_registros, long max_latencia)
+{
+    struct addrinfo pistas, *res;
+    char servicio[8];
+
+    memset(&pistas, 0, sizeof(pistas));
+    pistas.ai_family = AF_UNSPEC;
+    pistas.ai_socktype = SOCK_DGRAM;
+    snprintf(servicio, sizeof(servicio), "%d", puerto);
+    if (getaddrinfo(host, servicio, &pistas, &res) != 0)
+    {
+        fprintf(stderr, "ERROR, no existe el host\n");
+        return -1;
+    }
+
+    if ((em->sock = socket(res->ai_family, SOCK_DGRAM, 0)) < 0)
+    {
+        perror("apertura de socket");
+        freeaddrinfo(res);
+        return -1;
+    }
+
+    memset(&em->destino, 0, sizeof(em->destino));
+    memcpy(&em->destino, res->ai_addr, res->ai_addrlen);
+    em->destino_largo = res->ai_addrlen;
+    freeaddrinfo(res);
+
+    em->satelite = (uint32_t)getpid();
+    em->secuencia = 0;
+    if (max_registros < 1 || max_registros > TLM_EMISOR_MAX)
+        max_registros = TLM_EMISOR_MAX;
+    em->max_registros = max_registros;
+    em->max_latencia = max_latencia;
+    em->gso = 1;
+    em->pendientes = 0;
+    memset(em->retenido_largo, 0, sizeof(em->retenido_largo));
+    return 0;
+}
+
+/**
+ * @brief Microsegundos transcurridos desde t.
+ *
+ * @param t
+ * @return long
+ */
+static long tlm_transcurrido(const struct timespec *t)
+{
+    struct timespec ahora;
+
+    clock_gettime(CLOCK_MONOTONIC, &ahora);
+    return (ahora.tv_sec - t->tv_sec) * 1000000L + (ahora.tv_nsec - t->tv_nsec) / 1000;
+}
+
+/**
+ * @brief Agrega a la cola un registro con la secuencia dada y lo retiene
+ *        para reenviarlo.
+ *
+ * @param em
+ * @param secuencia
+ * @param campo
+ * @param datos
+ * @param len se trunca a TLM_CARGA_MAX bytes
+ * @return int 0 o -1 si fallo el envio
+ */
+static int tlm_emisor_poner(struct tlm_emisor *em, uint32_t secuencia, uint16_t campo, const void *datos, size_t len)
+{
+    struct tlm_cabecera cab;
+
+    if (len > TLM_CARGA_MAX)
+        len = TLM_CARGA_MAX;
+
+    cab.magia = TLM_MAGIA;
+    cab.satelite = em->satelite;
+    cab.secuencia = secuencia;
+    cab.campo = campo;
+    cab.longitud = (uint16_t)len;
+    tlm_cabecera_escribir(em->datos[em->pendientes], &cab);
+    memcpy(em->datos[em->pendientes] + TLM_CABECERA_LEN, datos, len);
+    em->largo[em->pendientes] = (uint16_t)(TLM_CABECERA_LEN + len);
+    memcpy(em->retenido[cab.secuencia % TLM_RETENCION], em->datos[em->pendientes], TLM_CABECERA_LEN + len);
+    em->retenido_largo[cab.secuencia % TLM_RETENCION] = (uint16_t)(TLM_CABECERA_LEN + len);
+    em->retenido_secuencia[cab.secuencia % TLM_RETENCION] = cab.secuencia;
+
+    if (em->pendientes++ == 0)
+        clock_gettime(CLOCK_MONOTONIC, &em->primero);
+
+    if (em->pendientes >= em->max_registros || tlm_transcurrido(&em->primero) >= em->max_latencia)
+        return tlm_emisor_vaciar(em);
+    return 0;
+}
+
+/**
+ * @brief Agrega un registro a la cola. Si se alcanza el umbral de cantidad o
+ *        el registro mas antiguo supero el de latencia, vacia la cola.
+ *
+ * @param em
+ * @param campo indice del dato de telemetria
+ * @param texto valor, se trunca a TLM_CARGA_MAX bytes
+ * @return int 0 o -1 si fallo el envio
+ */
+int tlm_emisor_encolar(struct tlm_emisor *em, uint16_t campo, const char *texto)
+{
+    return tlm_emisor_encolar_datos(em, campo, texto, strlen(texto));
+}
+
+/**
+ * @brief Como tlm_emisor_encolar, con una carga binaria.
+ *
+ * @param em
+ * @param campo
+ * @param datos
+ * @param len se trunca a TLM_CARGA_MAX bytes
+ * @return int 0 o -1 si fallo el envio
+ */
+int tlm_emisor_encolar_datos(struct tlm_emisor *em, uint16_t campo, const void *datos, size_t len)
+{
+    return tlm_emisor_poner(em, em->secuencia++, campo, datos, len);
+}
+
+/**
+ * @brief Aparta n secuencias consecutivas para encolarlas despues, en
+ *        cualquier orden, con tlm_emisor_encolar_en: una consulta informa su
+ *        rango antes de tener todos los valores.
+ *
+ * @param em
+ * @param n
+ * @return uint32_t la primera secuencia apartada
+ */
+uint32_t tlm_emisor_reservar(struct tlm_emisor *em, uint32_t n)
+{
+    uint32_t primera = em->secuencia;
+
+    em->secuencia += n;
+    return primera;
+}
+
+/**
+ * @brief Como tlm_emisor_encolar, con una secuencia apartada con
+ *        tlm_emisor_reservar.
+ *
+ * @param em
+ * @param secuencia
+ * @param campo
+ * @param texto
+ * @return int 0 o -1 si fallo el envio
+ */
+int tlm_emisor_encolar_en(struct tlm_emisor *em, uint32_t secuencia, uint16_t campo, const char *texto)
+{
+    return tlm_emisor_poner(em, secuencia, campo, texto, strlen(texto));
+}
+
+/**
+ * @brief Envia la cola como un unico datagrama GSO. Todos los segmentos
+ *        deben medir lo mismo (salvo el ultimo), asi que los registros se
+ *        rellenan hasta el mas largo; el receptor usa el campo longitud de
+ *        la cabecera y descarta el relleno.
+ *
+ * @param em
+ * @return int 0, o -1 si el kernel no acepta UDP_SEGMENT
+ */
+static int tlm_emisor_gso(struct tlm_emisor *em)
+{
+    static char contiguo[TLM_EMISOR_MAX * TLM_DATAGRAMA_MAX];
+    char control[CMSG_SPACE(sizeof(uint16_t))];
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cm;
+    uint16_t segmento = 0;
+    size_t total = 0;
+
+    for (int i = 0; i < em->pendientes; i++)
+        if (em->largo[i] > segmento)
+            segmento = em->largo[i];
+
+    for (int i = 0; i < em->pendientes; i++)
+    {
+        memcpy(contiguo + total, em->datos[i], em->largo[i]);
+        memset(contiguo + total + em->largo[i], 0, segmento - em->largo[i]);
+        total += (i == em->pendientes - 1) ? em->largo[i] : segmento;
+    }
+
+    iov.iov_base = contiguo;
+    iov.iov_len = total;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &em->destino;
+    msg.msg_namelen = em->destino_largo;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_UDP;
+    cm->cmsg_type = UDP_SEGMENT;
+    cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    memcpy(CMSG_DATA(cm), &segmento, sizeof(segmento));
+
+    return sendmsg(em->sock, &msg, 0) < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Despacha todos los registros pendientes.
+ *
+ * @param em
+ * @return int 0 o -1 si fallo el envio
+ */
+int tlm_emisor_vaciar(struct tlm_emisor *em)
+{
+    struct mmsghdr msgs[TLM_EMISOR_MAX];
+    struct iovec iov[TLM_EMISOR_MAX];
+    int enviados = 0, n;
+
+    if (em->pendientes == 0)
+        return 0;
+
+    if (em->pendientes > 1 && em->gso)
+    {
+        if (tlm_emisor_gso(em) == 0)
+        {
+            em->pendientes = 0;
+            return 0;
+        }
+        /* Kernel sin GSO o interfaz sin offload de checksum: no reintentar */
+        if (errno != EINVAL && errno != ENOPROTOOPT && errno != EIO && errno != EOPNOTSUPP)
+        {
+            perror("sendmsg");
+            return -1;
+        }
+        em->gso = 0;
+    }
+
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < em->pendientes; i++)
+    {
+        iov[i].iov_base = em->datos[i];
+        iov[i].iov_len = em->largo[i];
+        msgs[i].msg_hdr.msg_name = &em->destino;
+        msgs[i].msg_hdr.msg_namelen = em->destino_largo;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    while (enviados < em->pendientes)
+    {
+        n = sendmmsg(em->sock, msgs + enviados, em->pendientes - enviados, 0);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("sendmmsg");
+            em->pendientes = 0;
+            return -1;
+        }
+        enviados += n;
+    }
+    em->pendientes = 0;
+    return 0;
+}
+
+/**
+ * @brief Reenvia un datagrama que la estacion pidio, si todavia se retiene
+ *        y ya salio de la cola.
+ *
+ * @param em
+ * @param secuencia
+ * @return int 1 si se reenvio, 0 si no se retiene, -1 si fallo el envio
+ */
+int tlm_emisor_reenviar(struct tlm_emisor *em, uint32_t secuencia)
+{
+    int i = secuencia % TLM_RETENCION;
+
+    if (em->retenido_largo[i] == 0 || em->retenido_secuencia[i] != secuencia ||
+        em->secuencia - secuencia <= (uint32_t)em->pendientes)
+        return 0;
+    if (sendto(em->sock, em->retenido[i], em->retenido_largo[i], 0, (struct sockaddr *)&em->destino,
+               em->destino_largo) < 0)
+    {
+        perror("sendto");
+        return -1;
+    }
+    return 1;
+}
+
+/**
+ * @brief Vacia la cola y cierra el socket del emisor.
+ *
+ * @param em
+ */
+void tlm_emisor_cerrar(struct tlm_emisor *em)
+{
+    tlm_emisor_vaciar(em);
+    close(em->sock);
+    em->sock = -1;
+}
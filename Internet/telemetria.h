@@ -0,0 +1,180 @@
+/**
+ * @file telemetria.h
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Formato de los datagramas de telemetria compartido por satelite y
+ *        estacion terrestre, y receptor persistente de la estacion.
+ *        Cada datagrama lleva una cabecera fija (en orden de red) que identifica
+ *        al satelite emisor, de modo que un unico socket UDP por estacion puede
+ *        atender a toda la flota y repartir los datos a cada sesion.
+ *        La secuencia de la cabecera permite reparar perdidas: el emisor
+ *        retiene sus ultimos TLM_RETENCION datagramas y la estacion, que
+ *        sigue los huecos con una ventana (struct tlm_ventana), pide por el
+ *        flujo de la orden los que faltan, hasta TLM_NACK_INTENTOS veces
+ *        cada uno y dentro del plazo de la consulta.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef TELEMETRIA_H
+#define TELEMETRIA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#include "direcciones.h"
+
+#define TLM_MAGIA 0x544C4D31 /* "TLM1" */
+#define TLM_CABECERA_LEN 16
+#define TLM_CARGA_MAX 150 /* igual a TAM2, un campo por datagrama */
+#define TLM_DATAGRAMA_MAX (TLM_CABECERA_LEN + TLM_CARGA_MAX)
+#define TLM_LOTE 64                   /* datagramas por llamada a recvmmsg */
+#define TLM_RCVBUF (8 * 1024 * 1024)  /* buffer de recepcion del socket UDP */
+#define TLM_MAX_SATELITES 4096        /* capacidad de la tabla de despacho */
+#define TLM_EMISOR_MAX 64             /* registros por envio, limite de UDP_SEGMENT */
+#define TLM_EMISOR_LATENCIA 5000      /* espera maxima de un registro en cola (us) */
+#define TLM_RETENCION 128             /* datagramas que el emisor guarda para reenviar */
+#define TLM_NACK 0xFFFFFFFFu          /* en el flujo, precede a la secuencia de un datagrama perdido */
+#define TLM_NACK_ESPERA 100           /* ms entre pedidos de datagramas perdidos */
+#define TLM_NACK_INTENTOS 3           /* pedidos por datagrama antes de darlo por perdido */
+#define TLM_PLAZO 2000                /* ms para completar una consulta, o el final de una transmision */
+
+/* Campos de telemetria. Una consulta pide los campos con una mascara: el
+   bit (1 << campo) pide el campo */
+enum tlm_campo
+{
+    TLM_CAMPO_ID,
+    TLM_CAMPO_FIRMWARE,
+    TLM_CAMPO_UPTIME,
+    TLM_CAMPO_ARRANQUE,
+    TLM_CAMPO_HOSTNAME,
+    TLM_CAMPO_MEMORIA,
+    TLM_CAMPO_CPU,
+    TLM_CAMPOS
+};
+#define TLM_TODOS ((1u << TLM_CAMPOS) - 1)
+
+/* Tipo del valor de un campo */
+enum tlm_tipo
+{
+    TLM_TIPO_TEXTO,
+    TLM_TIPO_DURACION,
+    TLM_TIPO_FECHA,
+    TLM_TIPO_MEMORIA,
+    TLM_TIPO_PORCENTAJE
+};
+
+/* Costo de muestrear un campo; en una consulta los campos se envian de
+   menor a mayor costo */
+enum tlm_costo
+{
+    TLM_COSTO_BAJO,  /* datos del proceso o una llamada al sistema */
+    TLM_COSTO_MEDIO, /* lectura de /proc */
+    TLM_COSTO_ALTO,  /* lanza otro proceso */
+    TLM_COSTOS
+};
+
+/* Vigencia de un valor muestreado, en ms */
+#define TLM_SIN_CACHE 0 /* se muestrea en cada consulta */
+#define TLM_SIEMPRE -1  /* hasta que se invalide */
+
+/* Colector del satelite: escribe en el buffer el texto de su campo. El
+   registro de colectores es una tabla constante indexada por campo */
+struct tlm_colector
+{
+    enum tlm_campo campo;
+    enum tlm_tipo tipo;
+    enum tlm_costo costo;
+    void (*muestrear)(char *);
+    int vigencia; /* ms que se reusa el ultimo valor, o TLM_SIN_CACHE / TLM_SIEMPRE */
+};
+
+/**
+ * @brief Cabecera de cada datagrama de telemetria. En el cable ocupa
+ *        TLM_CABECERA_LEN bytes, todos los campos en orden de red.
+ */
+struct tlm_cabecera
+{
+    uint32_t magia;
+    uint32_t satelite;  /* ID del satelite (PID del proceso satelite) */
+    uint32_t secuencia; /* contador por satelite */
+    uint16_t campo;     /* indice del dato de telemetria */
+    uint16_t longitud;  /* bytes de carga util que siguen a la cabecera */
+};
+
+/**
+ * @brief Cola de envio de telemetria del satelite. Los registros se acumulan
+ *        y se despachan juntos, con un unico sendmsg segmentado por el kernel
+ *        (UDP_SEGMENT) o con sendmmsg si el kernel no soporta GSO.
+ */
+struct tlm_emisor
+{
+    int sock;
+    struct sockaddr_storage destino;  /* estacion, IPv4 o IPv6 */
+    socklen_t destino_largo;
+    uint32_t satelite;
+    uint32_t secuencia;
+    int max_registros;     /* se vacia al juntar esta cantidad */
+    long max_latencia;     /* o cuando el registro mas antiguo espera esto (us) */
+    int gso;               /* 1 mientras UDP_SEGMENT funcione */
+    int pendientes;
+    struct timespec primero;
+    uint16_t largo[TLM_EMISOR_MAX];
+    char datos[TLM_EMISOR_MAX][TLM_DATAGRAMA_MAX];
+    /* Ultimos datagramas, por secuencia % TLM_RETENCION; largo 0 libre */
+    uint32_t retenido_secuencia[TLM_RETENCION];
+    uint16_t retenido_largo[TLM_RETENCION];
+    char retenido[TLM_RETENCION][TLM_DATAGRAMA_MAX];
+};
+
+/**
+ * @brief Secuencias recibidas por la estacion en una consulta o una
+ *        transmision. Cubre TLM_RETENCION secuencias desde la mas antigua
+ *        que falta; una secuencia que queda fuera cuenta como perdida, ya
+ *        que el emisor tampoco la retiene.
+ */
+struct tlm_ventana
+{
+    uint32_t base;                  /* secuencia mas antigua sin recibir */
+    uint32_t hasta;                 /* una mas que la mayor secuencia conocida */
+    uint64_t recibido[TLM_RETENCION / 64];
+    uint8_t intentos[TLM_RETENCION];
+    unsigned long pedidos, recuperados, perdidos;
+};
+
+void tlm_cabecera_escribir(void *, const struct tlm_cabecera *);
+const char *tlm_campo_nombre(unsigned int);
+int tlm_campos_leer(const char *, uint32_t *);
+int tlm_cabecera_leer(const void *, size_t, struct tlm_cabecera *);
+
+/* Estacion terrestre */
+int tlm_receptor_iniciar(const struct dir_escucha *);
+int tlm_canal_crear(int[2]);
+int tlm_receptor_registrar(uint32_t, int);
+void tlm_receptor_hijo(void);
+void tlm_receptor_estadisticas(unsigned long *, unsigned long *);
+ssize_t tlm_canal_recibir(int, struct tlm_cabecera *, char *, size_t);
+void tlm_ventana_iniciar(struct tlm_ventana *, uint32_t);
+void tlm_ventana_fin(struct tlm_ventana *, uint32_t);
+int tlm_ventana_marcar(struct tlm_ventana *, uint32_t);
+int tlm_ventana_pedir(struct tlm_ventana *, int);
+int tlm_ventana_completa(const struct tlm_ventana *);
+unsigned long tlm_ventana_faltan(const struct tlm_ventana *);
+
+/* Satelite */
+int tlm_muestrear(const struct tlm_colector *, char *);
+void tlm_invalidar(uint32_t);
+int tlm_emisor_iniciar(struct tlm_emisor *, const char *, int, int, long);
+int tlm_emisor_encolar(struct tlm_emisor *, uint16_t, const char *);
+int tlm_emisor_encolar_datos(struct tlm_emisor *, uint16_t, const void *, size_t);
+uint32_t tlm_emisor_reservar(struct tlm_emisor *, uint32_t);
+int tlm_emisor_encolar_en(struct tlm_emisor *, uint32_t, uint16_t, const char *);
+int tlm_emisor_vaciar(struct tlm_emisor *);
+int tlm_emisor_reenviar(struct tlm_emisor *, uint32_t);
+void tlm_emisor_cerrar(struct tlm_emisor *);
+
+#endif
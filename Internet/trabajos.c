@@ -0,0 +1,310 @@
+/**
+ * @file trabajos.c
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Pool de calculo con una cola doble por hilo. El duenio encola y
+ *        desencola por el final (lo mas reciente sigue en su cache) y los
+ *        demas roban por el principio; cada cola tiene su candado, asi que
+ *        solo compiten el duenio y un ladron a la vez. Los trabajos que
+ *        llegan de hilos ajenos al pool se reparten en ronda entre las
+ *        colas. El pool arranca con el primer trabajo del proceso, con un
+ *        hilo por nucleo; un hijo creado con fork arranca el suyo.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "trabajos.h"
+
+struct trabajos_cola
+{
+    pthread_mutex_t mutex;
+    struct trabajo *anillo;
+    size_t inicio, n, capacidad;  /* capacidad potencia de dos */
+};
+
+static struct trabajos_cola colas[TRABAJOS_MAX_HILOS];
+static int n_hilos = 0;
+static pid_t pid_pool = 0;        /* proceso que arranco el pool */
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hay_trabajo = PTHREAD_COND_INITIALIZER;
+static unsigned long encolados = 0;   /* trabajos en alguna cola, con pool_mutex */
+static int dormidos = 0;
+static unsigned int ronda = 0;
+static unsigned long ejecutados = 0, robados = 0;
+
+static __thread int propio = -1;  /* cola del hilo del pool, -1 fuera del pool */
+
+/**
+ * @brief Agrega un trabajo al final de la cola.
+ *
+ * @param c
+ * @param t
+ * @return int 0, o -1 si no hay memoria
+ */
+static int trabajos_poner(struct trabajos_cola *c, const struct trabajo *t)
+{
+    pthread_mutex_lock(&c->mutex);
+    if (c->n == c->capacidad)
+    {
+        size_t capacidad = c->capacidad ? 2 * c->capacidad : TRABAJOS_COLA_INICIAL;
+        struct trabajo *anillo = malloc(capacidad * sizeof(*anillo));
+        if (anillo == NULL)
+        {
+            pthread_mutex_unlock(&c->mutex);
+            return -1;
+        }
+        for (size_t i = 0; i < c->n; i++)
+            anillo[i] = c->anillo[(c->inicio + i) & (c->capacidad - 1)];
+        free(c->anillo);
+        c->anillo = anillo;
+        c->inicio = 0;
+        c->capacidad = capacidad;
+    }
+    c->anillo[(c->inicio + c->n) & (c->capacidad - 1)] = *t;
+    c->n++;
+    pthread_mutex_unlock(&c->mutex);
+    return 0;
+}
+
+/**
+ * @brief Saca un trabajo de la cola: del final si es el duenio, del
+ *        principio si es un ladron.
+ *
+ * @param c
+ * @param t recibe el trabajo
+ * @param final
+ * @return int 1 si habia, 0 si la cola estaba vacia
+ */
+static int trabajos_sacar(struct trabajos_cola *c, struct trabajo *t, int final)
+{
+    int hay = 0;
+
+    pthread_mutex_lock(&c->mutex);
+    if (c->n > 0)
+    {
+        c->n--;
+        if (final)
+            *t = c->anillo[(c->inicio + c->n) & (c->capacidad - 1)];
+        else
+        {
+            *t = c->anillo[c->inicio];
+            c->inicio = (c->inicio + 1) & (c->capacidad - 1);
+        }
+        hay = 1;
+    }
+    pthread_mutex_unlock(&c->mutex);
+    return hay;
+}
+
+/**
+ * @brief Hilo del pool: atiende su cola, roba de las demas y duerme cuando
+ *        no queda trabajo en ninguna.
+ *
+ * @param arg indice de su cola
+ * @return void*
+ */
+static void *trabajos_hilo(void *arg)
+{
+    struct trabajo t;
+    int robado;
+
+    propio = (int)(long)arg;
+    for (;;)
+    {
+        robado = 0;
+        if (!trabajos_sacar(&colas[propio], &t, 1))
+        {
+            for (int k = 1; k < n_hilos && !robado; k++)
+                robado = trabajos_sacar(&colas[(propio + k) % n_hilos], &t, 0);
+            if (!robado)
+            {
+                pthread_mutex_lock(&pool_mutex);
+                if (encolados == 0)
+                {
+                    dormidos++;
+                    pthread_cond_wait(&hay_trabajo, &pool_mutex);
+                    dormidos--;
+                }
+                pthread_mutex_unlock(&pool_mutex);
+                continue;
+            }
+        }
+        pthread_mutex_lock(&pool_mutex);
+        encolados--;
+        ejecutados++;
+        robados += robado;
+        pthread_mutex_unlock(&pool_mutex);
+
+        t.funcion(t.arg);
+        if (t.listo != NULL)
+            t.listo(t.arg_listo);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Arranca los hilos si este proceso todavia no tiene pool. Con
+ *        pool_mutex.
+ *
+ * @return int 0, o -1 si no se pudo crear ningun hilo
+ */
+static int trabajos_arrancar(void)
+{
+    pthread_attr_t attr;
+    pthread_t hilo;
+    long nucleos;
+    int n;
+
+    if (n_hilos > 0 && pid_pool == getpid())
+        return 0;
+    /* Despues de fork las colas heredadas no tienen quien las atienda */
+    for (int i = 0; i < n_hilos; i++)
+    {
+        free(colas[i].anillo);
+        memset(&colas[i], 0, sizeof(colas[i]));
+    }
+    n_hilos = 0;
+    encolados = 0;
+    dormidos = 0;
+    pthread_cond_init(&hay_trabajo, NULL);
+
+    nucleos = sysconf(_SC_NPROCESSORS_ONLN);
+    n = nucleos < 1 ? 1 : nucleos > TRABAJOS_MAX_HILOS ? TRABAJOS_MAX_HILOS : (int)nucleos;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (int i = 0; i < n; i++)
+    {
+        pthread_mutex_init(&colas[i].mutex, NULL);
+        if (pthread_create(&hilo, &attr, trabajos_hilo, (void *)(long)i) != 0)
+        {
+            perror("pthread_create");
+            break;
+        }
+        n_hilos++;
+    }
+    pthread_attr_destroy(&attr);
+    pid_pool = getpid();
+    return n_hilos > 0 ? 0 : -1;
+}
+
+/**
+ * @brief Encola un trabajo. Desde un hilo del pool va a su propia cola;
+ *        desde cualquier otro, a la siguiente en ronda. Si el pool no se
+ *        puede arrancar el trabajo corre en el llamador.
+ *
+ * @param t se copia
+ */
+void trabajos_enviar(const struct trabajo *t)
+{
+    int cola;
+
+    pthread_mutex_lock(&pool_mutex);
+    if (trabajos_arrancar() < 0)
+    {
+        pthread_mutex_unlock(&pool_mutex);
+        t->funcion(t->arg);
+        if (t->listo != NULL)
+            t->listo(t->arg_listo);
+        return;
+    }
+    cola = propio >= 0 ? propio : (int)(ronda++ % (unsigned int)n_hilos);
+    /* Se cuenta antes de encolar: un hilo que lo tome ya lo ve contado */
+    encolados++;
+    pthread_mutex_unlock(&pool_mutex);
+
+    if (trabajos_poner(&colas[cola], t) < 0)
+    {
+        pthread_mutex_lock(&pool_mutex);
+        encolados--;
+        pthread_mutex_unlock(&pool_mutex);
+        t->funcion(t->arg);
+        if (t->listo != NULL)
+            t->listo(t->arg_listo);
+        return;
+    }
+    pthread_mutex_lock(&pool_mutex);
+    if (dormidos > 0)
+        pthread_cond_signal(&hay_trabajo);
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+void trabajos_grupo_iniciar(struct trabajos_grupo *g)
+{
+    pthread_mutex_init(&g->mutex, NULL);
+    pthread_cond_init(&g->vacio, NULL);
+    g->pendientes = 0;
+}
+
+/**
+ * @brief Aviso de fin de cada trabajo de un grupo.
+ *
+ * @param arg struct trabajos_grupo
+ */
+static void trabajos_grupo_listo(void *arg)
+{
+    struct trabajos_grupo *g = arg;
+
+    pthread_mutex_lock(&g->mutex);
+    if (--g->pendientes == 0)
+        pthread_cond_broadcast(&g->vacio);
+    pthread_mutex_unlock(&g->mutex);
+}
+
+/**
+ * @brief Encola un trabajo que cuenta en el grupo.
+ *
+ * @param g
+ * @param funcion
+ * @param arg
+ */
+void trabajos_grupo_enviar(struct trabajos_grupo *g, trabajo_funcion funcion, void *arg)
+{
+    struct trabajo t = {funcion, arg, trabajos_grupo_listo, g};
+
+    pthread_mutex_lock(&g->mutex);
+    g->pendientes++;
+    pthread_mutex_unlock(&g->mutex);
+    trabajos_enviar(&t);
+}
+
+/**
+ * @brief Espera a que terminen todos los trabajos enviados al grupo. No se
+ *        debe llamar desde un hilo del pool.
+ *
+ * @param g
+ */
+void trabajos_grupo_esperar(struct trabajos_grupo *g)
+{
+    pthread_mutex_lock(&g->mutex);
+    while (g->pendientes > 0)
+        pthread_cond_wait(&g->vacio, &g->mutex);
+    pthread_mutex_unlock(&g->mutex);
+}
+
+void trabajos_grupo_destruir(struct trabajos_grupo *g)
+{
+    pthread_mutex_destroy(&g->mutex);
+    pthread_cond_destroy(&g->vacio);
+}
+
+/**
+ * @brief Copia los contadores del pool del proceso.
+ *
+ * @param e
+ */
+void trabajos_estadisticas(struct trabajos_estadisticas *e)
+{
+    pthread_mutex_lock(&pool_mutex);
+    e->hilos = pid_pool == getpid() ? n_hilos : 0;
+    e->ejecutados = ejecutados;
+    e->robados = robados;
+    pthread_mutex_unlock(&pool_mutex);
+}
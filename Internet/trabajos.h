@@ -0,0 +1,56 @@
+/**
+ * @file trabajos.h
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Pool de hilos de calculo con robo de trabajo. Los hilos de E/S
+ *        (los que reciben o envian por el socket) no calculan sumas de
+ *        verificacion: las parten en trabajos por tramo y los envian al
+ *        pool, que los reparte entre un hilo por nucleo. Cada hilo tiene su
+ *        propia cola doble: toma lo ultimo que encolo y, si se queda sin
+ *        trabajo, roba lo mas antiguo de la cola de otro hilo.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef TRABAJOS_H
+#define TRABAJOS_H
+
+#include <pthread.h>
+
+#define TRABAJOS_MAX_HILOS 64
+#define TRABAJOS_COLA_INICIAL 256 /* capacidad inicial de la cola de cada hilo */
+
+typedef void (*trabajo_funcion)(void *);
+
+struct trabajo
+{
+    trabajo_funcion funcion;
+    void *arg;
+    trabajo_funcion listo;  /* se llama al terminar, en el hilo del pool; puede ser NULL */
+    void *arg_listo;
+};
+
+/* Trabajos que el llamador espera juntos */
+struct trabajos_grupo
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t vacio;
+    int pendientes;
+};
+
+struct trabajos_estadisticas
+{
+    int hilos;
+    unsigned long ejecutados;
+    unsigned long robados;    /* tomados de la cola de otro hilo */
+};
+
+void trabajos_enviar(const struct trabajo *);
+void trabajos_grupo_iniciar(struct trabajos_grupo *);
+void trabajos_grupo_enviar(struct trabajos_grupo *, trabajo_funcion, void *);
+void trabajos_grupo_esperar(struct trabajos_grupo *);
+void trabajos_grupo_destruir(struct trabajos_grupo *);
+void trabajos_estadisticas(struct trabajos_estadisticas *);
+
+#endif
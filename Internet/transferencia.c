@@ -0,0 +1,857 @@
+/**
+ * @file transferencia.c
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Envio y recepcion de archivos completos (imagen satelital). El
+ *        receptor conoce el tamano por la cabecera, reserva el archivo con
+ *        fallocate y recibe con recv sobre un mapeo compartido del archivo,
+ *        con splice desde el socket o sobre un doble buffer que un hilo
+ *        escritor vuelca al archivo mientras llega la otra mitad, de modo que
+ *        la recepcion no espera al sistema de archivos. Cada
+ *        bloque se verifica con CRC32C y el archivo completo con SHA-256; los
+ *        bloques danados se reciben de nuevo sobre el mismo mapeo. Las sumas
+ *        no se calculan en el hilo que usa el socket: a medida que los datos
+ *        quedan en el archivo se envian al pool de trabajos, los CRC por
+ *        tramos en paralelo y el SHA-256 en orden.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <arpa/inet.h>
+
+#include "transferencia.h"
+#include "buffers.h"
+#include "trabajos.h"
+
+/* Bytes de cada trabajo de CRC32C enviado al pool */
+#define TRF_TRABAJO (16 * TRF_BLOQUE)
+
+/* Sumas de un archivo calculadas en el pool mientras se transfiere */
+struct trf_resumen
+{
+    const char *datos;          /* archivo completo, mapeado */
+    uint64_t tamano;
+    uint32_t *crc;              /* CRC de cada bloque */
+    int orden_red;              /* guardar los CRC en orden de red (cola del emisor) */
+    struct sha256 *sha;
+    struct trabajos_grupo grupo;
+    uint64_t encolado;          /* hasta donde hay trabajos de CRC; solo el productor */
+    struct buffer *b_tramos;    /* un trf_tramo por cada TRF_TRABAJO del archivo */
+    struct trf_tramo *tramos;
+    pthread_mutex_t mutex;
+    uint64_t listo;             /* bytes de datos ya finales */
+    uint64_t resumido;          /* hasta donde llego el SHA-256 */
+    int sha_activo;             /* hay un trabajo de SHA-256 en el pool */
+};
+
+/* Trabajo de CRC de un tramo, alineado a TRF_TRABAJO */
+struct trf_tramo
+{
+    struct trf_resumen *r;
+    uint64_t desde, hasta;
+};
+
+/**
+ * @brief Lee exactamente len bytes del socket.
+ *
+ * @param sock
+ * @param buf
+ * @param len
+ * @return int 0, o -1 si la conexion se cerro o fallo
+ */
+static int trf_leer(int sock, void *buf, size_t len)
+{
+    char *p = buf;
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = recv(sock, p, len, MSG_WAITALL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Cantidad de bloques de TRF_BLOQUE de un archivo.
+ *
+ * @param tamano
+ * @return uint32_t
+ */
+static uint32_t trf_bloques(uint64_t tamano)
+{
+    return (uint32_t)((tamano + TRF_BLOQUE - 1) / TRF_BLOQUE);
+}
+
+/**
+ * @brief Largo del bloque i (el ultimo puede ser incompleto).
+ *
+ * @param tamano
+ * @param i
+ * @return size_t
+ */
+static size_t trf_largo(uint64_t tamano, uint32_t i)
+{
+    uint64_t desde = (uint64_t)i * TRF_BLOQUE;
+    return tamano - desde < TRF_BLOQUE ? (size_t)(tamano - desde) : TRF_BLOQUE;
+}
+
+/**
+ * @brief CRC32C de los bloques entre desde y hasta.
+ *
+ * @param r
+ * @param desde inicio de un bloque
+ * @param hasta
+ */
+static void trf_crc_bloques(struct trf_resumen *r, uint64_t desde, uint64_t hasta)
+{
+    for (uint32_t i = (uint32_t)(desde / TRF_BLOQUE); (uint64_t)i * TRF_BLOQUE < hasta; i++)
+    {
+        uint32_t crc = crc32c(0, r->datos + (uint64_t)i * TRF_BLOQUE, trf_largo(r->tamano, i));
+        r->crc[i] = r->orden_red ? htonl(crc) : crc;
+    }
+}
+
+/**
+ * @brief Trabajo del pool: CRC32C de un tramo.
+ *
+ * @param arg struct trf_tramo
+ */
+static void trf_crc_tramo(void *arg)
+{
+    struct trf_tramo *t = arg;
+
+    trf_crc_bloques(t->r, t->desde, t->hasta);
+}
+
+/**
+ * @brief Trabajo del pool: agrega al SHA-256, en orden, todo lo que ya esta
+ *        listo. Hay uno solo a la vez; termina cuando alcanza lo recibido.
+ *
+ * @param arg struct trf_resumen
+ */
+static void trf_sha_avanzar(void *arg)
+{
+    struct trf_resumen *r = arg;
+    uint64_t desde, hasta;
+
+    pthread_mutex_lock(&r->mutex);
+    while (r->resumido < r->listo)
+    {
+        desde = r->resumido;
+        hasta = r->listo;
+        pthread_mutex_unlock(&r->mutex);
+        sha256_agregar(r->sha, r->datos + desde, hasta - desde);
+        pthread_mutex_lock(&r->mutex);
+        r->resumido = hasta;
+    }
+    r->sha_activo = 0;
+    pthread_mutex_unlock(&r->mutex);
+}
+
+/**
+ * @brief Prepara el calculo de las sumas de un archivo en el pool. Los
+ *        trabajos de CRC se toman de una tabla pedida aqui, uno por tramo.
+ *
+ * @param r
+ * @param datos archivo mapeado; debe seguir mapeado hasta trf_resumen_esperar
+ * @param tamano
+ * @param crc tabla de CRC por bloque
+ * @param orden_red guardar los CRC en orden de red
+ * @param sha ya iniciado
+ * @return int 0, o -1 si no hay memoria para la tabla de tramos
+ */
+static int trf_resumen_iniciar(struct trf_resumen *r, const char *datos, uint64_t tamano,
+                               uint32_t *crc, int orden_red, struct sha256 *sha)
+{
+    memset(r, 0, sizeof(*r));
+    r->b_tramos = buf_obtener((size_t)(tamano / TRF_TRABAJO + 1) * sizeof(struct trf_tramo));
+    if (r->b_tramos == NULL)
+    {
+        perror("tramos");
+        return -1;
+    }
+    r->tramos = (struct trf_tramo *)r->b_tramos->datos;
+    r->datos = datos;
+    r->tamano = tamano;
+    r->crc = crc;
+    r->orden_red = orden_red;
+    r->sha = sha;
+    trabajos_grupo_iniciar(&r->grupo);
+    pthread_mutex_init(&r->mutex, NULL);
+    return 0;
+}
+
+/**
+ * @brief Informa que los datos hasta "hasta" ya son finales: envia al pool
+ *        los CRC de los tramos completos y despierta al SHA-256. Lo llama
+ *        siempre el mismo hilo, con "hasta" creciente.
+ *
+ * @param r
+ * @param hasta
+ */
+static void trf_resumen_agregar(struct trf_resumen *r, uint64_t hasta)
+{
+    uint64_t completo = hasta == r->tamano ? hasta : hasta / TRF_TRABAJO * TRF_TRABAJO;
+    struct trf_tramo *t;
+    int lanzar;
+
+    while (r->encolado < completo)
+    {
+        uint64_t fin = completo - r->encolado < TRF_TRABAJO ? completo : r->encolado + TRF_TRABAJO;
+        t = &r->tramos[r->encolado / TRF_TRABAJO];
+        t->r = r;
+        t->desde = r->encolado;
+        t->hasta = fin;
+        trabajos_grupo_enviar(&r->grupo, trf_crc_tramo, t);
+        r->encolado = fin;
+    }
+
+    pthread_mutex_lock(&r->mutex);
+    r->listo = hasta;
+    lanzar = !r->sha_activo && r->resumido < r->listo;
+    if (lanzar)
+        r->sha_activo = 1;
+    pthread_mutex_unlock(&r->mutex);
+    if (lanzar)
+        trabajos_grupo_enviar(&r->grupo, trf_sha_avanzar, r);
+}
+
+/**
+ * @brief Espera los trabajos pendientes y devuelve la tabla de tramos. Si
+ *        la transferencia se corto, el ultimo tramo incompleto queda sin CRC:
+ *        no se verifica.
+ *
+ * @param r
+ */
+static void trf_resumen_esperar(struct trf_resumen *r)
+{
+    trabajos_grupo_esperar(&r->grupo);
+    trabajos_grupo_destruir(&r->grupo);
+    pthread_mutex_destroy(&r->mutex);
+    buf_soltar(r->b_tramos);
+}
+
+/**
+ * @brief Muestra el avance de la recepcion cuando cambia el porcentaje.
+ *
+ * @param hecho
+ * @param total
+ * @param ultimo ultimo porcentaje mostrado
+ */
+static void trf_progreso(uint64_t hecho, uint64_t total, int *ultimo)
+{
+    int porcentaje = total > 0 ? (int)(hecho * 100 / total) : 100;
+
+    if (porcentaje == *ultimo)
+        return;
+    *ultimo = porcentaje;
+    printf("\r[%lu - %lu] [%d%%]", (unsigned long)hecho, (unsigned long)total, porcentaje);
+    fflush(stdout);
+}
+
+/**
+ * @brief Atiende los pedidos de reenvio del receptor hasta que confirma o
+ *        cancela la transferencia.
+ *
+ * @param sock
+ * @param mapa
+ * @param tamano
+ * @param masivo
+ * @param pendientes
+ * @return int 1 si el receptor confirmo, -1 si cancelo o fallo el socket
+ */
+static int trf_atender_pedidos(int sock, const char *mapa, uint64_t tamano,
+                               const struct ajuste_socket *masivo, int *pendientes)
+{
+    uint32_t cantidad, indice, n_bloques = trf_bloques(tamano);
+    unsigned long reenviados = 0;
+
+    for (;;)
+    {
+        perfil_empujar(sock);
+        if (trf_leer(sock, &cantidad, sizeof(cantidad)) < 0)
+            return -1;
+        cantidad = ntohl(cantidad);
+        if (cantidad == 0)
+            break;
+        if (cantidad == TRF_ABORTAR || cantidad > n_bloques)
+        {
+            printf("El receptor cancelo la transferencia\n");
+            return -1;
+        }
+        for (uint32_t k = 0; k < cantidad; k++)
+        {
+            if (trf_leer(sock, &indice, sizeof(indice)) < 0)
+                return -1;
+            indice = ntohl(indice);
+            if (indice >= n_bloques ||
+                perfil_enviar(sock, mapa + (uint64_t)indice * TRF_BLOQUE, trf_largo(tamano, indice), masivo, pendientes) < 0)
+                return -1;
+        }
+        reenviados += cantidad;
+    }
+    if (reenviados > 0)
+        printf("Bloques reenviados: %lu\n", reenviados);
+    return 1;
+}
+
+/**
+ * @brief Envia un archivo precedido por su cabecera. El archivo se mapea y
+ *        se envia en tramos de TRF_BLOQUE desde el mapeo, de modo que con el
+ *        ajuste masivo adecuado se usa MSG_ZEROCOPY. El CRC32C de cada bloque
+ *        y el SHA-256 se calculan al enviar y viajan en la cola; despues se
+ *        reenvian los bloques que pida el receptor.
+ *
+ * @param sock
+ * @param ruta
+ * @param masivo ajuste del canal masivo del perfil activo
+ * @return int 1 si se envio, 0 si no existe el archivo, -1 si fallo el socket
+ *         o el receptor no pudo verificarlo
+ */
+int trf_enviar(int sock, const char *ruta, const struct ajuste_socket *masivo)
+{
+    int fd = open(ruta, O_RDONLY), r;
+
+    r = trf_enviar_fd(sock, fd, masivo, NULL, NULL);
+    if (fd >= 0)
+        close(fd);
+    return r;
+}
+
+/**
+ * @brief Como trf_enviar, sobre un archivo ya abierto (puede ser un memfd
+ *        compartido por varios envios: solo se mapea para lectura).
+ *
+ * @param sock
+ * @param fd archivo a enviar, o -1 para avisar que no existe
+ * @param masivo ajuste del canal masivo del perfil activo
+ * @param avance si no es NULL, se llama tras cada bloque con lo enviado
+ * @param arg argumento de avance
+ * @return int 1 si se envio, 0 si no hay archivo, -1 si fallo el socket o el
+ *         receptor no pudo verificarlo
+ */
+int trf_enviar_fd(int sock, int fd, const struct ajuste_socket *masivo, trf_avance avance, void *arg)
+{
+    unsigned char cab[TRF_CABECERA_LEN];
+    unsigned char *cola = NULL;
+    struct buffer *b_cola;
+    uint32_t n_bloques, u32;
+    uint64_t u64;
+    struct stat st;
+    struct sha256 sha;
+    struct trf_resumen resumen;
+    char *mapa = NULL;
+    int pendientes = 0, r = 1;
+
+    u32 = htonl(TRF_MAGIA);
+    memcpy(cab, &u32, 4);
+    u32 = htonl(TRF_BLOQUE);
+    memcpy(cab + 4, &u32, 4);
+
+    if (fd >= 0)
+    {
+        fstat(fd, &st);
+        if (st.st_size > 0 && (mapa = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+            perror("mmap");
+    }
+    n_bloques = fd < 0 ? 0 : trf_bloques(st.st_size);
+    if ((b_cola = buf_obtener((size_t)n_bloques * 4 + SHA256_LEN)) != NULL)
+        cola = (unsigned char *)b_cola->datos;
+    /* Las sumas se calculan en el pool mientras este hilo envia */
+    sha256_iniciar(&sha);
+    if (fd < 0 || mapa == MAP_FAILED || cola == NULL ||
+        trf_resumen_iniciar(&resumen, mapa, st.st_size, (uint32_t *)cola, 1, &sha) < 0)
+    {
+        /* Avisa al receptor para que no quede esperando */
+        u64 = htobe64(TRF_SIN_ARCHIVO);
+        memcpy(cab + 8, &u64, 8);
+        perfil_enviar(sock, cab, sizeof(cab), masivo, &pendientes);
+        if (mapa != NULL && mapa != MAP_FAILED)
+            munmap(mapa, st.st_size);
+        buf_soltar(b_cola);
+        return 0;
+    }
+    printf("Tamaño: %li\n", (long)st.st_size);
+
+    u64 = htobe64((uint64_t)st.st_size);
+    memcpy(cab + 8, &u64, 8);
+
+    if (perfil_enviar(sock, cab, sizeof(cab), masivo, &pendientes) < 0)
+        r = -1;
+
+    trf_resumen_agregar(&resumen, st.st_size);
+    for (uint32_t i = 0; r > 0 && i < n_bloques; i++)
+    {
+        const char *bloque = mapa + (uint64_t)i * TRF_BLOQUE;
+        size_t tramo = trf_largo(st.st_size, i);
+
+        if (perfil_enviar(sock, bloque, tramo, masivo, &pendientes) < 0)
+            r = -1;
+        else if (avance != NULL)
+            avance((uint64_t)i * TRF_BLOQUE + tramo, st.st_size, arg);
+    }
+    trf_resumen_esperar(&resumen);
+    sha256_finalizar(&sha, cola + 4 * (size_t)n_bloques);
+    if (r > 0 && perfil_enviar(sock, cola, (size_t)n_bloques * 4 + SHA256_LEN, masivo, &pendientes) < 0)
+        r = -1;
+    if (r < 0)
+        perror("ERROR enviando");
+    else
+        r = trf_atender_pedidos(sock, mapa, st.st_size, masivo, &pendientes);
+
+    /* Las paginas deben seguir mapeadas hasta que el kernel termine de usarlas */
+    perfil_esperar_zerocopy(sock, pendientes);
+    if (mapa != NULL)
+        munmap(mapa, st.st_size);
+    buf_soltar(b_cola);
+    return r;
+}
+
+/**
+ * @brief Recibe directamente sobre el mapeo compartido del archivo. Cada
+ *        tramo pasa al pool para resumirlo mientras sigue en la cache.
+ *
+ * @param sock
+ * @param mapa archivo ya reservado y mapeado con el tamano final
+ * @param tamano
+ * @param resumen sumas de lo recibido
+ * @return int 0 o -1
+ */
+static int trf_recibir_mmap(int sock, char *mapa, uint64_t tamano, struct trf_resumen *resumen)
+{
+    uint64_t recibido = 0;
+    int ultimo = -1;
+
+    /* Se escribe de principio a fin: que el kernel adelante las paginas */
+    madvise(mapa, tamano, MADV_SEQUENTIAL);
+
+    while (recibido < tamano)
+    {
+        uint64_t tramo = tamano - recibido < 16 * TRF_BLOQUE ? tamano - recibido : 16 * TRF_BLOQUE;
+        if (trf_leer(sock, mapa + recibido, tramo) < 0)
+            return -1;
+        recibido += tramo;
+        trf_resumen_agregar(resumen, recibido);
+        trf_progreso(recibido, tamano, &ultimo);
+    }
+    return 0;
+}
+
+/**
+ * @brief Recibe moviendo los datos socket -> tuberia -> archivo con splice.
+ *        Lo escrito se resume en el pool a traves del mapeo.
+ *
+ * @param sock
+ * @param fd
+ * @param tamano
+ * @param resumen sumas de lo recibido
+ * @return int 0 o -1
+ */
+static int trf_recibir_splice(int sock, int fd, uint64_t tamano, struct trf_resumen *resumen)
+{
+    int tuberia[2], ultimo = -1, r = 0;
+    loff_t desplazamiento = 0;
+    ssize_t n, m;
+
+    if (pipe(tuberia) < 0)
+    {
+        perror("pipe");
+        return -1;
+    }
+    fcntl(tuberia[1], F_SETPIPE_SZ, TRF_TUBERIA);
+
+    while ((uint64_t)desplazamiento < tamano && r == 0)
+    {
+        size_t tramo = tamano - desplazamiento < TRF_TUBERIA ? tamano - desplazamiento : TRF_TUBERIA;
+        n = splice(sock, NULL, tuberia[1], NULL, tramo, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            r = -1;
+            break;
+        }
+        while (n > 0)
+        {
+            m = splice(tuberia[0], NULL, fd, &desplazamiento, n, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (m < 0 && errno == EINTR)
+                continue;
+            if (m <= 0)
+            {
+                r = -1;
+                break;
+            }
+            n -= m;
+        }
+        trf_resumen_agregar(resumen, desplazamiento);
+        trf_progreso(desplazamiento, tamano, &ultimo);
+    }
+    close(tuberia[0]);
+    close(tuberia[1]);
+    return r;
+}
+
+/* Doble buffer entre el hilo que recibe y el que escribe el archivo */
+struct trf_escritor
+{
+    int fd;
+    struct buffer *mitad[2];
+    size_t largo[2];
+    uint64_t desde[2];   /* posicion en el archivo de cada mitad */
+    int llena[2];        /* 1: recibida, pendiente de escribir */
+    int terminar, error;
+    struct trf_resumen *resumen; /* lo escrito se resume en el pool */
+    pthread_mutex_t mutex;
+    pthread_cond_t cambio;
+};
+
+/**
+ * @brief Hilo escritor: vuelca cada mitad llena en el archivo, alternando,
+ *        y la devuelve vacia al receptor. Lo escrito ya se puede resumir
+ *        desde el mapeo del archivo.
+ *
+ * @param arg struct trf_escritor
+ * @return void*
+ */
+static void *trf_escribir(void *arg)
+{
+    struct trf_escritor *e = arg;
+    int actual = 0;
+    ssize_t n;
+
+    pthread_mutex_lock(&e->mutex);
+    for (;;)
+    {
+        while (!e->llena[actual] && !e->terminar)
+            pthread_cond_wait(&e->cambio, &e->mutex);
+        if (!e->llena[actual])
+            break;
+        pthread_mutex_unlock(&e->mutex);
+
+        size_t hecho = 0;
+        while (hecho < e->largo[actual])
+        {
+            n = pwrite(e->fd, e->mitad[actual]->datos + hecho, e->largo[actual] - hecho, e->desde[actual] + hecho);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+            {
+                perror("escritor");
+                break;
+            }
+            hecho += (size_t)n;
+        }
+
+        /* La referencia que paso el receptor con la mitad */
+        buf_soltar(e->mitad[actual]);
+        if (hecho == e->largo[actual])
+            trf_resumen_agregar(e->resumen, e->desde[actual] + hecho);
+        pthread_mutex_lock(&e->mutex);
+        if (hecho < e->largo[actual])
+            e->error = 1;
+        e->llena[actual] = 0;
+        pthread_cond_signal(&e->cambio);
+        actual = !actual;
+    }
+    pthread_mutex_unlock(&e->mutex);
+    return NULL;
+}
+
+/**
+ * @brief Recibe sobre un doble buffer de TRF_MITAD: mientras el hilo
+ *        escritor vuelca una mitad en el archivo, el socket llena la otra.
+ *
+ * @param sock
+ * @param fd archivo ya reservado con el tamano final
+ * @param tamano
+ * @param resumen sumas de lo recibido, que el escritor alimenta
+ * @return int 0 o -1
+ */
+static int trf_recibir_escritor(int sock, int fd, uint64_t tamano, struct trf_resumen *resumen)
+{
+    struct trf_escritor e;
+    pthread_t hilo;
+    uint64_t recibido = 0;
+    int actual = 0, ultimo = -1, r = 0;
+
+    memset(&e, 0, sizeof(e));
+    e.fd = fd;
+    e.resumen = resumen;
+    e.mitad[0] = buf_obtener(TRF_MITAD);
+    e.mitad[1] = buf_obtener(TRF_MITAD);
+    pthread_mutex_init(&e.mutex, NULL);
+    pthread_cond_init(&e.cambio, NULL);
+    if (e.mitad[0] == NULL || e.mitad[1] == NULL || pthread_create(&hilo, NULL, trf_escribir, &e) != 0)
+    {
+        perror("escritor");
+        buf_soltar(e.mitad[0]);
+        buf_soltar(e.mitad[1]);
+        return -1;
+    }
+
+    while (recibido < tamano && r == 0)
+    {
+        size_t largo = tamano - recibido < TRF_MITAD ? tamano - recibido : TRF_MITAD;
+
+        /* Espera a que el escritor termine con esta mitad */
+        pthread_mutex_lock(&e.mutex);
+        while (e.llena[actual] && !e.error)
+            pthread_cond_wait(&e.cambio, &e.mutex);
+        r = e.error ? -1 : 0;
+        pthread_mutex_unlock(&e.mutex);
+
+        for (size_t hecho = 0; hecho < largo && r == 0;)
+        {
+            size_t tramo = largo - hecho < 16 * TRF_BLOQUE ? largo - hecho : 16 * TRF_BLOQUE;
+            if (trf_leer(sock, e.mitad[actual]->datos + hecho, tramo) < 0)
+            {
+                r = -1;
+                break;
+            }
+            hecho += tramo;
+            trf_progreso(recibido + hecho, tamano, &ultimo);
+        }
+        if (r < 0)
+            break;
+
+        pthread_mutex_lock(&e.mutex);
+        e.largo[actual] = largo;
+        e.desde[actual] = recibido;
+        e.llena[actual] = 1;
+        buf_retener(e.mitad[actual]);
+        pthread_cond_signal(&e.cambio);
+        pthread_mutex_unlock(&e.mutex);
+        recibido += largo;
+        actual = !actual;
+    }
+
+    pthread_mutex_lock(&e.mutex);
+    e.terminar = 1;
+    pthread_cond_signal(&e.cambio);
+    pthread_mutex_unlock(&e.mutex);
+    pthread_join(hilo, NULL);
+    if (e.error)
+        r = -1;
+    pthread_mutex_destroy(&e.mutex);
+    pthread_cond_destroy(&e.cambio);
+    buf_soltar(e.mitad[0]);
+    buf_soltar(e.mitad[1]);
+    return r;
+}
+
+/**
+ * @brief Compara lo recibido con la cola del emisor y pide de nuevo los
+ *        bloques que no coinciden, hasta TRF_REINTENTOS rondas.
+ *
+ * @param sock
+ * @param mapa
+ * @param tamano
+ * @param cola CRC esperados (orden de red) seguidos del SHA-256 esperado
+ * @param crc CRC calculados
+ * @param sha resumen de lo recibido en orden, sin reenvios
+ * @return int 0 si el archivo quedo verificado, -1 si no
+ */
+static int trf_verificar(int sock, char *mapa, uint64_t tamano, const unsigned char *cola,
+                         uint32_t *crc, struct sha256 *sha)
+{
+    uint32_t n_bloques = trf_bloques(tamano), k, u32, *pedido;
+    struct buffer *b_pedido = buf_obtener(((size_t)n_bloques + 1) * 4);
+    unsigned char resumen[SHA256_LEN];
+    int ronda = 0, completo = 0, r = -1;
+
+    if (b_pedido == NULL)
+    {
+        u32 = htonl(TRF_ABORTAR);
+        send(sock, &u32, sizeof(u32), MSG_NOSIGNAL);
+        perfil_empujar(sock);
+        return -1;
+    }
+    pedido = (uint32_t *)b_pedido->datos;
+
+    for (;;)
+    {
+        k = 0;
+        for (uint32_t i = 0; i < n_bloques; i++)
+        {
+            memcpy(&u32, cola + 4 * (size_t)i, 4);
+            if (ntohl(u32) != crc[i])
+                pedido[1 + k++] = htonl(i);
+        }
+        if (k == 0)
+        {
+            if (ronda > 0)
+            {
+                /* Hubo reenvios: el resumen se rehace sobre el archivo final */
+                sha256_iniciar(sha);
+                sha256_agregar(sha, mapa, tamano);
+            }
+            sha256_finalizar(sha, resumen);
+            if (!memcmp(resumen, cola + 4 * (size_t)n_bloques, SHA256_LEN))
+            {
+                r = 0;
+                break;
+            }
+            printf("El SHA-256 del archivo no coincide\n");
+            if (completo || n_bloques == 0)
+                break;
+            /* Un error que el CRC no detecto: se pide todo una sola vez */
+            completo = 1;
+            for (uint32_t i = 0; i < n_bloques; i++)
+                pedido[1 + k++] = htonl(i);
+        }
+        if (++ronda > TRF_REINTENTOS)
+            break;
+        printf("Bloques con error: %u de %u, reintento %d\n", k, n_bloques, ronda);
+        pedido[0] = htonl(k);
+        if (send(sock, pedido, ((size_t)k + 1) * 4, MSG_NOSIGNAL) < 0)
+            goto fin;
+        perfil_empujar(sock);
+        for (uint32_t j = 0; j < k; j++)
+        {
+            uint32_t i = ntohl(pedido[1 + j]);
+            if (trf_leer(sock, mapa + (uint64_t)i * TRF_BLOQUE, trf_largo(tamano, i)) < 0)
+                goto fin;
+            crc[i] = crc32c(0, mapa + (uint64_t)i * TRF_BLOQUE, trf_largo(tamano, i));
+        }
+    }
+
+    u32 = htonl(r == 0 ? 0 : TRF_ABORTAR);
+    send(sock, &u32, sizeof(u32), MSG_NOSIGNAL);
+    perfil_empujar(sock);
+    if (r == 0)
+    {
+        struct trabajos_estadisticas pool;
+        trabajos_estadisticas(&pool);
+        printf("Integridad verificada (crc32c %s, sha256 %s, %d hilos de calculo)\n",
+               crc32c_implementacion(), sha256_implementacion(), pool.hilos);
+    }
+fin:
+    buf_soltar(b_pedido);
+    return r;
+}
+
+/**
+ * @brief Recibe un archivo enviado con trf_enviar y lo guarda en ruta. El
+ *        archivo queda mapeado en ambos modos para verificarlo y recibir los
+ *        bloques reenviados en su lugar.
+ *
+ * @param sock
+ * @param ruta
+ * @param modo TRF_MMAP, TRF_SPLICE o TRF_ESCRITOR
+ * @param politica TRF_FSYNC_NUNCA o TRF_FSYNC_AL_FINAL
+ * @return long bytes recibidos, o -1 en caso de error o si no se pudo verificar
+ */
+long trf_recibir(int sock, const char *ruta, enum trf_modo modo, enum trf_fsync politica)
+{
+    unsigned char cab[TRF_CABECERA_LEN];
+    unsigned char *cola = NULL;
+    struct trf_cabecera c;
+    struct sha256 sha;
+    struct trf_resumen resumen;
+    uint32_t u32, n_bloques, *crc = NULL;
+    struct buffer *b_crc, *b_cola;
+    uint64_t u64;
+    char *mapa = NULL;
+    int fd, r = -1;
+
+    if (trf_leer(sock, cab, sizeof(cab)) < 0)
+    {
+        perror("ERROR leyendo del socket");
+        return -1;
+    }
+    memcpy(&u32, cab, 4);
+    c.magia = ntohl(u32);
+    memcpy(&u32, cab + 4, 4);
+    c.bloque = ntohl(u32);
+    memcpy(&u64, cab + 8, 8);
+    c.tamano = be64toh(u64);
+    if (c.magia != TRF_MAGIA || (c.tamano != TRF_SIN_ARCHIVO && c.bloque != TRF_BLOQUE))
+    {
+        printf("Cabecera de transferencia invalida\n");
+        return -1;
+    }
+    if (c.tamano == TRF_SIN_ARCHIVO)
+    {
+        printf("El archivo no existe en el emisor\n");
+        return -1;
+    }
+    printf("Tamaño a recibir: %lu\n", (unsigned long)c.tamano);
+
+    if ((fd = open(ruta, O_RDWR | O_CREAT | O_TRUNC, 0666)) < 0)
+    {
+        printf("Error creando el file\n");
+        return -1;
+    }
+    /* Reserva los bloques de una vez; sin soporte del sistema de archivos
+       alcanza con fijar el tamano */
+    if (c.tamano > 0 && fallocate(fd, 0, 0, c.tamano) < 0)
+    {
+        if (errno != EOPNOTSUPP || ftruncate(fd, c.tamano) < 0)
+        {
+            perror("fallocate");
+            close(fd);
+            return -1;
+        }
+    }
+
+    n_bloques = trf_bloques(c.tamano);
+    /* Tablas de verificacion del pool: sin pedir memoria en cada escaneo */
+    if ((b_crc = buf_obtener((size_t)n_bloques * 4 + 1)) != NULL)
+        crc = (uint32_t *)b_crc->datos;
+    if ((b_cola = buf_obtener((size_t)n_bloques * 4 + SHA256_LEN)) != NULL)
+        cola = (unsigned char *)b_cola->datos;
+    sha256_iniciar(&sha);
+    if (c.tamano > 0 && (mapa = mmap(NULL, c.tamano, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+    {
+        perror("mmap");
+        mapa = NULL;
+    }
+    else if (crc != NULL && cola != NULL && trf_resumen_iniciar(&resumen, mapa, c.tamano, crc, 0, &sha) == 0)
+    {
+        if (c.tamano == 0)
+            r = 0;
+        else if (modo == TRF_SPLICE)
+            r = trf_recibir_splice(sock, fd, c.tamano, &resumen);
+        else if (modo == TRF_ESCRITOR)
+            r = trf_recibir_escritor(sock, fd, c.tamano, &resumen);
+        else
+            r = trf_recibir_mmap(sock, mapa, c.tamano, &resumen);
+        /* El mapeo y las tablas siguen en uso hasta que el pool termine */
+        trf_resumen_esperar(&resumen);
+
+        if (r == 0 && trf_leer(sock, cola, (size_t)n_bloques * 4 + SHA256_LEN) < 0)
+            r = -1;
+        printf("\n");
+        if (r == 0)
+            r = trf_verificar(sock, mapa, c.tamano, cola, crc, &sha);
+    }
+
+    if (mapa != NULL)
+        munmap(mapa, c.tamano);
+    if (r == 0 && politica == TRF_FSYNC_AL_FINAL && fsync(fd) < 0)
+        perror("fsync");
+    close(fd);
+    buf_soltar(b_crc);
+    buf_soltar(b_cola);
+    return r < 0 ? -1 : (long)c.tamano;
+}
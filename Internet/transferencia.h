@@ -0,0 +1,73 @@
+/**
+ * @file transferencia.h
+ * @author Ezequiel Zimmel (ezequielzimmel@gmail.com)
+ * @brief Transferencia de archivos sobre el socket de la sesion. El emisor
+ *        anuncia el tamano exacto en una cabecera y el receptor reserva el
+ *        archivo completo antes de recibir, directamente sobre un mapeo del
+ *        archivo, moviendo las paginas con splice o a traves de un hilo
+ *        escritor con doble buffer. Al final de los datos
+ *        viaja la cola de integridad y el receptor pide de nuevo solo los
+ *        bloques que no la verifican.
+ * @version 0.1
+ * @date 2020-01-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef TRANSFERENCIA_H
+#define TRANSFERENCIA_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "perfiles.h"
+#include "integridad.h"
+
+#define TRF_MAGIA 0x54524632         /* "TRF2" */
+#define TRF_CABECERA_LEN 16
+#define TRF_BLOQUE (64 * 1024)       /* envios del emisor y unidad de verificacion */
+#define TRF_TUBERIA (1024 * 1024)    /* capacidad pedida para la tuberia de splice */
+#define TRF_MITAD (4 * 1024 * 1024)  /* cada mitad del doble buffer del escritor */
+#define TRF_SIN_ARCHIVO UINT64_MAX   /* tamano anunciado cuando no existe el archivo */
+#define TRF_REINTENTOS 3             /* rondas de reenvio antes de abandonar */
+#define TRF_ABORTAR UINT32_MAX       /* respuesta del receptor que cancela la transferencia */
+
+/*
+ * Secuencia de una transferencia:
+ *   emisor   -> cabecera | datos | cola: CRC32C de cada bloque (u32) + SHA-256
+ *   receptor -> cantidad de bloques a reenviar (u32) | indices (u32)
+ *   emisor   -> bloques pedidos, en el orden pedido
+ * y se repite hasta que el receptor responde 0 o TRF_ABORTAR. Si todos los
+ * bloques verifican pero el SHA-256 del archivo no, se piden todos una vez.
+ */
+
+/* Forma de volcar lo recibido en el archivo */
+enum trf_modo
+{
+    TRF_MMAP,     /* recv directo sobre el mapeo del archivo */
+    TRF_SPLICE,   /* socket -> tuberia -> archivo, sin pasar por espacio de usuario */
+    TRF_ESCRITOR /* doble buffer: un hilo escribe una mitad mientras se recibe la otra */
+};
+
+/* Cuando se fuerza el archivo a disco */
+enum trf_fsync
+{
+    TRF_FSYNC_NUNCA,    /* queda en la cache de paginas */
+    TRF_FSYNC_AL_FINAL  /* un unico fsync al completar la transferencia */
+};
+
+struct trf_cabecera
+{
+    uint32_t magia;
+    uint32_t bloque;  /* tamano de envio usado por el emisor */
+    uint64_t tamano;  /* bytes exactos del archivo */
+};
+
+/* Avance del envio: bytes enviados, total y argumento del llamador */
+typedef void (*trf_avance)(uint64_t, uint64_t, void *);
+
+int trf_enviar(int, const char *, const struct ajuste_socket *);
+int trf_enviar_fd(int, int, const struct ajuste_socket *, trf_avance, void *);
+long trf_recibir(int, const char *, enum trf_modo, enum trf_fsync);
+
+#endif